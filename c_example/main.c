@@ -114,6 +114,15 @@ int main() {
 
     // create a search context
     LG_ContextOptions ctxOpts;
+    memset(&ctxOpts, 0, sizeof(ctxOpts));
+    ctxOpts.TraceBegin = 0;
+    ctxOpts.TraceEnd = 0;
+    ctxOpts.NoSkipScan = 0;
+    ctxOpts.NoPrefilter = 0;
+    ctxOpts.LazyDfa = 0;
+    ctxOpts.NoTable = 0;
+    ctxOpts.NoBitParallel = 0;
+    ctxOpts.Compact = 0;
     LG_HCONTEXT searcher = lg_create_context(prog, &ctxOpts);
 
     char filesigText[] = "lambs love mary.";
@@ -0,0 +1,126 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "mappablevector.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// An Aho-Corasick automaton over byte strings, each with the label of the
+// pattern it came from, stored as a double array: state s goes to
+// t = Base[s] + b on byte b iff Check[t] == s. The initial state is 0.
+//
+// Each state's outputs are a list running through Outputs, with the labels
+// matched there longest first, continuing into those of shorter suffixes.
+//
+// Keywords and input are both read through Fold, so bytes folded together
+// are matched alike; a keyword is only ever built from its folded bytes.
+//
+// When it's small enough, the automaton is also expanded into Dense, a full
+// transition table over byte classes, so a step is one load and no failure
+// links are followed. Its entries are row offsets, state * NumClasses, with
+// HAS_OUTPUT set for states with outputs. Dense is derived from the double
+// array, so it's not serialized; call densify() after filling in the arrays
+// by hand.
+struct AhoCorasick {
+  static const uint32_t NONE;
+  static const uint32_t HAS_OUTPUT = 0x80000000;
+
+  struct Output {
+    uint32_t Label,
+             Length,
+             Next;   // next output, or NONE
+  };
+
+  AhoCorasick(): NumLabels(0), NumClasses(0) {
+    for (uint32_t b = 0; b < 256; ++b) {
+      Fold[b] = b;
+    }
+  }
+
+  // b, with an uppercase ASCII letter made lowercase
+  static byte lower(byte b) {
+    return 'A' <= b && b <= 'Z' ? b + ('a' - 'A') : b;
+  }
+
+  // Builds the automaton for keywords, a list of (string, label) pairs,
+  // matching ASCII letters in either case if foldCase is set
+  void build(std::vector<std::pair<std::string, uint32_t>> keywords, bool foldCase = false);
+
+  // Builds Dense, if it would have no more than maxEntries entries
+  void densify(size_t maxEntries = 1 << 22);
+
+  bool empty() const { return Base.empty(); }
+
+  // whether some byte is matched as another
+  bool folds() const {
+    for (uint32_t b = 0; b < 256; ++b) {
+      if (Fold[b] != b) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // the state after s on b, without following failure links
+  uint32_t child(uint32_t s, byte b) const {
+    const uint32_t t = Base[s] + Fold[b];
+    return Check[t] == s ? t : NONE;
+  }
+
+  // the state after s on b
+  uint32_t next(uint32_t s, byte b) const {
+    uint32_t t;
+    while ((t = child(s, b)) == NONE && s != 0) {
+      s = Fail[s];
+    }
+    return t == NONE ? 0 : t;
+  }
+
+  // next(), from the dense table if there is one
+  uint32_t step(uint32_t s, byte b) const {
+    return Dense.empty() ? next(s, b) :
+      (Dense[s * NumClasses + Classes[b]] & ~HAS_OUTPUT) / NumClasses;
+  }
+
+  // these can be borrowed from a mapped program file
+  MappableVector<uint32_t> Base,
+                           Check,
+                           Fail,
+                           Depth,
+                           Out;     // first output, or NONE
+
+  MappableVector<Output> Outputs;
+
+  // one more than the greatest label
+  uint32_t NumLabels;
+
+  // each byte's stand-in, itself unless it's folded into another
+  byte Fold[256];
+
+  // bytes appearing in no keyword share a class
+  byte Classes[256];
+  uint32_t NumClasses;
+  std::vector<uint32_t> Dense;
+
+  bool operator==(const AhoCorasick& other) const;
+};
@@ -24,6 +24,7 @@
 #include <memory>
 #include <limits>
 #include <cinttypes>
+#include <vector>
 
 typedef unsigned char byte;
 
@@ -35,6 +36,12 @@ typedef unsigned char byte;
 // typedef unsigned long long uint64_t;
 // typedef long long int64_t;
 
+// the bytes held by a vector
+template <class T>
+size_t vectorBytes(const std::vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
 #define THROW_WITH_OUTPUT(exceptType, expression) \
   std::ostringstream buf; \
   buf << __FILE__ << ":" << __LINE__ << ": " << expression; \
@@ -0,0 +1,104 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "prefilter.h"
+#include "skipscan.h"
+#include "vm.h"
+
+// Runs searches on programs with at most 64 states by simulating all of
+// the states at once, one bit per state (Glushkov's position automaton,
+// bit-parallel as in Navarro & Raffinot). Bits say only which states are
+// reachable, not which threads are in them, so where a match is possible
+// the wrapped Vm is rewound to the last byte at which no state was
+// reachable, and runs until its threads die out. The Vm's threads are
+// always a subset of the reachable states, so no match is missed, and the
+// Vm alone decides which are reported.
+class BitVm: public VmInterface {
+public:
+  BitVm();
+
+  // the most states a program may have, counting the initial state, which
+  // doesn't need a bit
+  static const uint32_t MAX_STATES = 65;
+
+  // whether prog is small enough, and has a table to build from
+  static bool fits(const Program& prog);
+
+  virtual void init(ProgramPtr prog);
+
+  virtual void startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual void closeOut(HitCallback hitFn, void* userData);
+  virtual void reset();
+
+  virtual std::shared_ptr<VmInterface> clone() const;
+
+  virtual void setSkipScan(bool enabled);
+
+  virtual void setPrefilter(bool enabled);
+
+  virtual void setCompact(bool enabled) { Fallback.setCompact(enabled); }
+
+  virtual size_t memoryUsage() const;
+
+  virtual void snapshot(std::ostream& out) const;
+  virtual void restore(std::istream& in);
+
+  // match states which only the label's threads reach no longer hand off
+  // to the Vm
+  virtual void retire(uint32_t label);
+
+  // whether the Vm has threads carried over from the last search
+  bool inVm() const { return InVm; }
+
+private:
+  uint64_t _follow(const uint64_t d) const;
+
+  Vm Fallback;
+  ProgramPtr Prog;
+
+  bool SkipScan;
+  SkipScanner Skipper;
+
+  bool UsePrefilter;
+  Prefilter Filter;
+  std::vector<const byte*> Lits;
+
+  // Reach[b] has the states entered on byte b, and Follow[256 * k + x]
+  // the children of the states whose bits are x in the kth byte of a
+  // state set
+  uint64_t Reach[256];
+  std::vector<uint64_t> Follow;
+  uint32_t NumChunks;
+
+  uint64_t Initial, // children of the initial state
+           Accept,  // match states, less those of retired labels
+           AllAccept;
+
+  // the labels threads may have in each match state, by bit, and the
+  // labels retired since the last reset
+  std::vector<std::vector<uint32_t>> AcceptLabels;
+  std::vector<bool> Retired;
+
+  bool InVm;
+};
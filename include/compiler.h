@@ -25,7 +25,10 @@
 class Compiler {
 public:
 
-  static ProgramPtr createProgram(const NFA& graph);
+  // With determinized, the graph was built as a DFA, and gets a transition
+  // table if it has no forks and the table isn't too big. Otherwise, only
+  // graphs small enough for BitVm get one.
+  static ProgramPtr createProgram(const NFA& graph, bool determinized = false);
 
 
 };
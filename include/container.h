@@ -0,0 +1,115 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "basic.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Serialized programs are containers: a header, a directory of sections,
+// then the sections, each beginning on a SECTION_ALIGNMENT boundary so
+// that arrays in them can be used in place from a mapped file.
+//
+//   header     magic "LGPR", format version, byte order mark, required
+//              feature flags, number of sections, total size, and a
+//              checksum of everything after the header
+//   directory  for each section: its id, flags, offset, and size
+//
+// Everything is in the byte order of the machine which wrote it, and a
+// container from a machine of the other order is refused. A reader skips
+// sections it doesn't know unless they're flagged SECTION_REQUIRED, and
+// refuses containers with feature flags it doesn't know, so either can be
+// used to keep old readers away from what they'd misread.
+
+enum ContainerSection : uint32_t {
+  INFO_SECTION = 1,     // NumChecked, the keywords' NumLabels, and First
+  CODE_SECTION,
+  KEYWORD_BASE_SECTION,
+  KEYWORD_CHECK_SECTION,
+  KEYWORD_FAIL_SECTION,
+  KEYWORD_DEPTH_SECTION,
+  KEYWORD_OUT_SECTION,
+  KEYWORD_OUTPUTS_SECTION,
+  LENGTHS_SECTION,      // per-label match lengths
+  TABLE_INFO_SECTION,   // byte classes of the transition table
+  TABLE_NEXT_SECTION,
+  TABLE_STATES_SECTION,
+  TABLE_LISTS_SECTION,
+  LITERALS_SECTION,     // for the prefilter
+  PATTERNS_SECTION,     // the pattern map, if it was written with one
+  KEYWORD_FOLD_SECTION  // the keywords' byte stand-ins, if any are folded
+};
+
+static const uint32_t SECTION_REQUIRED = 1;
+
+static const uint16_t CONTAINER_VERSION = 1;
+static const uint32_t CONTAINER_FEATURES = 0;
+static const size_t SECTION_ALIGNMENT = 64;
+
+// a fast 64-bit checksum; this is XXH64
+uint64_t checksum(const void* data, size_t len, uint64_t seed = 0);
+
+// Gathers sections, pointing at their data rather than copying it, and
+// lays them out.
+class ContainerWriter {
+public:
+  void add(ContainerSection id, const void* data, size_t len, uint32_t flags = SECTION_REQUIRED);
+
+  // for sections made just for writing; the writer keeps the data
+  void add(ContainerSection id, std::string data, uint32_t flags = SECTION_REQUIRED);
+
+  template <class V>
+  void addVector(ContainerSection id, const V& v, uint32_t flags = SECTION_REQUIRED) {
+    add(id, v.data(), v.size() * sizeof(typename V::value_type), flags);
+  }
+
+  size_t size() const;
+
+  // buf must be at least size() bytes
+  void write(void* buf) const;
+
+private:
+  struct Section {
+    ContainerSection Id;
+    uint32_t Flags;
+    const void* Data;
+    size_t Size;
+  };
+
+  std::vector<Section> Sections;
+
+  // held by pointer, so that adding more doesn't move what Sections
+  // point to
+  std::vector<std::unique_ptr<std::string>> Owned;
+};
+
+// Checks a container's header, directory, and checksum, throwing if any of
+// them is wrong, and then finds sections in it.
+class ContainerReader {
+public:
+  ContainerReader(const void* buf, size_t len);
+
+  // the section's data and size; (nullptr, 0) if there isn't one
+  std::pair<const byte*, size_t> find(ContainerSection id) const;
+
+private:
+  std::vector<std::pair<const byte*, size_t>> Sections;
+};
@@ -0,0 +1,60 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "mappablevector.h"
+
+#include <vector>
+
+// A dense transition table, mirroring a program's code. Bytes which no
+// edge tells apart share a class, and rows are indexed by class. Most
+// entries are a single target state, but where the code forks on a byte
+// the entry is a list of targets, in the order the code takes them.
+struct DfaTable {
+  static const uint32_t DEAD;    // no transition
+  static const uint32_t NOCHECK; // flag: target's CHECK_HALT is jumped over
+  static const uint32_t LIST;    // flag: the rest is an index into Lists
+
+  struct StateInfo {
+    uint32_t Label, // NOLABEL unless the state labels threads
+             Check; // NONE unless the state has a CHECK_HALT
+    bool     Match,
+             Terminal,
+             Fork;  // whether the code forks to the children, rather
+                    // than having a jump table
+  };
+
+  DfaTable(): Classes(), NumClasses(0) {}
+
+  bool empty() const { return Next.empty(); }
+
+  // the entry for state s on byte class c
+  uint32_t next(uint32_t s, uint32_t c) const { return Next[s * NumClasses + c]; }
+
+  byte Classes[256];
+  uint32_t NumClasses;
+
+  // these can be borrowed from a mapped program file
+  MappableVector<uint32_t> Next;
+  MappableVector<StateInfo> States;
+
+  // each list is its length, then the targets
+  MappableVector<uint32_t> Lists;
+};
@@ -1,11 +1,16 @@
 #pragma once
 
 #include "basic.h"
+#include "literals.h"
+#include "matchlengths.h"
 #include "nfabuilder.h"
 #include "nfaoptimizer.h"
 #include "encoders/encoderfactory.h"
 
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 class FSMThingy {
 public:
@@ -16,7 +21,27 @@ public:
   NFAOptimizer Comp;
   NFAPtr Fsm;
 
-  void addPattern(const ParseTree& tree, const char* chain, uint32_t label);
+  // literals required by the patterns so far, empty once one has none
+  RequiredLiterals Literals;
+  bool LiteralsUsable;
+
+  // (encoded string, label) for fixed-string patterns which are just a few
+  // strings of the same length, kept out of the graph for Aho-Corasick
+  std::vector<std::pair<std::string, uint32_t>> Keywords;
+
+  // whether the automaton has to match the Keywords' ASCII letters in
+  // either case, or has to match them exactly; once one is set, patterns
+  // needing the other go to the graph
+  bool KeywordsFoldCase,
+       KeywordsKeepCase;
+
+  // the lengths of each label's matches, filled in by finalizeGraph()
+  std::vector<MatchLengths> Lengths;
+
+  void addPattern(const ParseTree& tree, const char* chain, uint32_t label, bool fixed = false);
 
   void finalizeGraph(bool determinize);
+
+private:
+  bool addKeywords(const ParseTree& tree, const Encoder& enc, uint32_t label);
 };
@@ -20,6 +20,8 @@
 
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "lightgrep/api.h"
 
@@ -27,6 +29,7 @@
 #include "fsmthingy.h"
 #include "fwd_pointers.h"
 #include "parsetree.h"
+#include "patternmap.h"
 #include "vm_interface.h"
 #include "pattern.h"
 
@@ -36,28 +39,7 @@ struct PatternHandle {
 };
 
 struct PatternMapHandle {
-  std::vector<LG_PatternInfo> Patterns;
-
-  PatternMapHandle(unsigned int sizeHint): Patterns() { Patterns.reserve(sizeHint); }
-
-  ~PatternMapHandle() {
-    for (LG_PatternInfo& pi : Patterns) {
-      delete[] pi.Pattern;
-      delete[] pi.EncodingChain;
-    }
-  }
-
-  void addPattern(const char* pattern, const char* chain) {
-    std::unique_ptr<char[]> patcopy(new char[std::strlen(pattern)+1]);
-    std::strcpy(patcopy.get(), pattern);
-
-    std::unique_ptr<char[]> chcopy(new char[std::strlen(chain)+1]);
-    std::strcpy(chcopy.get(), chain);
-
-    Patterns.push_back({patcopy.get(), chcopy.get(), nullptr});
-    patcopy.release();
-    chcopy.release();
-  }
+  std::unique_ptr<PatternMap> Impl;
 };
 
 struct FSMHandle {
@@ -70,4 +52,24 @@ struct ProgramHandle {
 
 struct ContextHandle {
   std::shared_ptr<VmInterface> Impl;
+
+  // for tying snapshots to the program
+  ProgramPtr Prog;
+
+  // hits from lg_search_hits() which didn't fit in the caller's array;
+  // those before HeldPos have since been handed out
+  std::vector<LG_SearchHit> Held;
+  size_t HeldPos;
+
+  bool ClosedOut;
+
+  ContextHandle(): HeldPos(0), ClosedOut(false) {}
+};
+
+struct ContextPoolHandle {
+  // what the contexts handed out are cloned from
+  std::unique_ptr<ContextHandle> Proto;
+
+  std::mutex Lock;
+  std::vector<std::unique_ptr<ContextHandle>> Free;
 };
@@ -91,6 +91,13 @@ struct Instruction {
 
   byte byteSize() const { return sizeof(Instruction) * wordSize(); }
 
+  // the words up to the next instruction: wordSize(), but counting the
+  // addresses after a jump table, so code can be walked with it
+  uint32_t length() const {
+    return OpCode == JUMP_TABLE_RANGE_OP ?
+      2 + Op.T2.Last - Op.T2.First : wordSize();
+  }
+
   std::string toString() const;
 
   bool operator==(const Instruction& x) const { return *((uint32_t*)this) == *((uint32_t*)&x); } // total hack
@@ -0,0 +1,105 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "ahocorasick.h"
+#include "labelvalues.h"
+#include "prefilter.h"
+#include "skipscan.h"
+#include "vm_interface.h"
+
+// Searches for a program's keywords with its Aho-Corasick automaton, and
+// hands the rest of the program, if there is any, to another engine. Hits
+// are reported as the Vm would: for each label, its leftmost occurrence
+// and then the leftmost after that one ends, and so on. Between labels,
+// the order differs: each call reports the keywords' hits before the
+// other engine's.
+class KeywordVm: public VmInterface {
+public:
+  // rest may be null if the program has no code
+  KeywordVm(std::shared_ptr<VmInterface> rest);
+
+  virtual void init(ProgramPtr prog);
+
+  virtual void startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual void closeOut(HitCallback hitFn, void* userData);
+  virtual void reset();
+
+  virtual std::shared_ptr<VmInterface> clone() const;
+
+  virtual void setSkipScan(bool enabled);
+
+  virtual void setPrefilter(bool enabled);
+
+  virtual void setCompact(bool enabled);
+
+  virtual size_t memoryUsage() const;
+
+  virtual void snapshot(std::ostream& out) const;
+  virtual void restore(std::istream& in);
+
+  virtual void retire(uint32_t label);
+
+  #ifdef LBT_TRACE_ENABLED
+  void setDebugRange(uint64_t beg, uint64_t end) {
+    if (Rest) {
+      Rest->setDebugRange(beg, end);
+    }
+  }
+  #endif
+
+private:
+  void _report(const uint32_t state, const uint64_t offset, const uint64_t before, HitCallback hitFn, void* userData);
+
+  template <bool jump>
+  uint32_t _scanDense(const byte* const beg, const byte* const end, const uint64_t startOffset, uint32_t state, HitCallback hitFn, void* userData);
+
+  template <bool jump>
+  uint32_t _scan(const byte* const beg, const byte* const end, const uint64_t startOffset, uint32_t state, HitCallback hitFn, void* userData);
+
+  const byte* _jump(const byte* const cur, const byte* const end) const;
+
+  uint64_t _firstLive(const uint64_t offset) const;
+
+  std::shared_ptr<VmInterface> Rest;
+
+  ProgramPtr Prog;
+  const AhoCorasick* Trie;
+
+  bool SkipScan;
+  SkipScanner Skipper;
+
+  bool UsePrefilter;
+  Prefilter Filter;
+
+  // for the search under way: whether to prefilter, and where the bytes
+  // which must be walked begin
+  bool Filtering;
+  const byte* Tail;
+
+  bool Compact;
+
+  uint32_t State;
+  LabelValues<uint64_t> MatchEnds;
+};
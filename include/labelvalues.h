@@ -0,0 +1,289 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "snapshot.h"
+#include "sparseset.h"
+
+#include <vector>
+
+// Programs with more labels than this keep their per-label search state
+// hashed, as do contexts which ask to be compact. Below it, arrays indexed
+// by label are small enough and faster.
+static const uint32_t HASHED_LABELS = 1 << 16;
+
+inline bool hashLabels(uint32_t numLabels, bool compact) {
+  return compact || numLabels > HASHED_LABELS;
+}
+
+// An open-addressed hash from labels (or PCs) to values, linearly probed.
+// It grows with the labels put in it, not with the labels there are, and
+// clearing it costs only as much as what's in it.
+template <class T>
+class LabelMap {
+public:
+  LabelMap(): Shift(32) {}
+
+  size_t size() const { return Used.size(); }
+
+  const T* find(uint32_t label) const {
+    if (Keys.empty()) {
+      return nullptr;
+    }
+
+    for (uint32_t i = _slot(label); ; i = (i + 1) & (Keys.size() - 1)) {
+      if (Keys[i] == label) {
+        return &Vals[i];
+      }
+      else if (Keys[i] == EMPTY) {
+        return nullptr;
+      }
+    }
+  }
+
+  // the value for label, added as T() if it wasn't there
+  T& insert(uint32_t label) {
+    if (2 * (Used.size() + 1) > Keys.size()) {
+      _grow();
+    }
+
+    uint32_t i = _slot(label);
+    for ( ; Keys[i] != label; i = (i + 1) & (Keys.size() - 1)) {
+      if (Keys[i] == EMPTY) {
+        Keys[i] = label;
+        Used.push_back(i);
+        break;
+      }
+    }
+    return Vals[i];
+  }
+
+  void clear() {
+    for (const uint32_t i : Used) {
+      Keys[i] = EMPTY;
+      Vals[i] = T();
+    }
+    Used.clear();
+  }
+
+  size_t memoryUsage() const {
+    return vectorBytes(Keys) + vectorBytes(Vals) + vectorBytes(Used);
+  }
+
+  // calls f(label, value) for each label in the map
+  template <class F>
+  void forEach(F f) const {
+    for (const uint32_t i : Used) {
+      f(Keys[i], Vals[i]);
+    }
+  }
+
+private:
+  static const uint32_t EMPTY = 0xFFFFFFFF;
+
+  // Fibonacci hashing, so runs of labels spread out
+  uint32_t _slot(uint32_t label) const {
+    return Shift < 32 ? (label * 0x9E3779B9u) >> Shift : 0;
+  }
+
+  void _grow() {
+    std::vector<uint32_t> keys(Keys.empty() ? 16 : 2 * Keys.size(), EMPTY);
+    std::vector<T> vals(keys.size());
+    keys.swap(Keys);
+    vals.swap(Vals);
+    for (Shift = 32; (1u << (32 - Shift)) < Keys.size(); --Shift) ;
+
+    std::vector<uint32_t> used;
+    used.swap(Used);
+    Used.reserve(used.size());
+    for (const uint32_t j : used) {
+      insert(keys[j]) = vals[j];
+    }
+  }
+
+  uint32_t Shift;
+  std::vector<uint32_t> Keys;
+  std::vector<T> Vals;
+  std::vector<uint32_t> Used;
+};
+
+template <class T>
+const uint32_t LabelMap<T>::EMPTY;
+
+// A set of labels, in a SparseSet or, if hashed, a LabelMap.
+class LabelSet {
+public:
+  LabelSet(): Hashed(false) {}
+
+  void resize(uint32_t maxSize, bool hashed) {
+    Hashed = hashed;
+    Dense.resize(hashed ? 0 : maxSize);
+    Hash = LabelMap<byte>();
+  }
+
+  uint32_t size() const {
+    return Hashed ? Hash.size() : Dense.size();
+  }
+
+  bool find(uint32_t label) const {
+    return Hashed ? Hash.find(label) != nullptr : Dense.find(label);
+  }
+
+  // label had better not be in the set already
+  void insert(uint32_t label) {
+    if (Hashed) {
+      Hash.insert(label);
+    }
+    else {
+      Dense.insert(label);
+    }
+  }
+
+  void clear() {
+    if (Hashed) {
+      Hash.clear();
+    }
+    else {
+      Dense.clear();
+    }
+  }
+
+  size_t memoryUsage() const {
+    return Hashed ? Hash.memoryUsage() : Dense.memoryUsage();
+  }
+
+private:
+  bool Hashed;
+  SparseSet Dense;
+  LabelMap<byte> Hash;
+};
+
+// A value for each label, almost all of which stay zero between resets.
+// Values are changed through set(), which notes each label it takes from
+// zero, so that clear() costs only as much as the labels touched since the
+// last one, rather than as much as there are labels. If hashed, only the
+// values which aren't zero are kept at all.
+template <class T>
+class LabelValues {
+public:
+  LabelValues(): Hashed(false), Size(0) {}
+
+  size_t size() const { return Size; }
+
+  // all zero
+  void resize(size_t n, bool hashed = false) {
+    Hashed = hashed;
+    Size = n;
+    Values.assign(hashed ? 0 : n, T());
+    Touched.clear();
+    Hash = LabelMap<T>();
+  }
+
+  const T& operator[](uint32_t label) const {
+    if (Hashed) {
+      const T* val = Hash.find(label);
+      return val ? *val : Zero;
+    }
+    return Values[label];
+  }
+
+  void set(uint32_t label, const T& val) {
+    if (Hashed) {
+      Hash.insert(label) = val;
+    }
+    else {
+      if (Values[label] == T()) {
+        Touched.push_back(label);
+      }
+      Values[label] = val;
+    }
+  }
+
+  void clear() {
+    if (Hashed) {
+      Hash.clear();
+    }
+    else {
+      for (const uint32_t label : Touched) {
+        Values[label] = T();
+      }
+      Touched.clear();
+    }
+  }
+
+  size_t memoryUsage() const {
+    return vectorBytes(Values) + vectorBytes(Touched) + Hash.memoryUsage();
+  }
+
+  // the labels whose values aren't zero, and their values
+  void snapshot(std::ostream& out) const {
+    std::vector<uint32_t> labels;
+    std::vector<T> vals;
+    const auto add = [&](uint32_t label, const T& val) {
+      if (!(val == T())) {
+        labels.push_back(label);
+        vals.push_back(val);
+      }
+    };
+
+    if (Hashed) {
+      Hash.forEach(add);
+    }
+    else {
+      for (const uint32_t label : Touched) {
+        add(label, Values[label]);
+      }
+    }
+
+    writeSnapshotVector(out, labels);
+    writeSnapshotVector(out, vals);
+  }
+
+  void restore(std::istream& in) {
+    std::vector<uint32_t> labels;
+    std::vector<T> vals;
+    readSnapshotVector(in, labels);
+    readSnapshotVector(in, vals);
+
+    if (labels.size() != vals.size()) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot is corrupt");
+    }
+
+    clear();
+    for (size_t i = 0; i < labels.size(); ++i) {
+      if (labels[i] >= Size) {
+        THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot has a bad label");
+      }
+      set(labels[i], vals[i]);
+    }
+  }
+
+private:
+  static const T Zero;
+
+  bool Hashed;
+  size_t Size;
+  std::vector<T> Values;
+  std::vector<uint32_t> Touched;
+  LabelMap<T> Hash;
+};
+
+template <class T>
+const T LabelValues<T>::Zero = T();
@@ -0,0 +1,160 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "sparseset.h"
+#include "labelvalues.h"
+#include "vm.h"
+
+// Runs searches on DFA states built lazily from the Vm's threads.
+//
+// A state is the ordered list of (PC, label) pairs of the live threads,
+// which is all that determines what the threads do on the next byte so long
+// as none of them reaches a match and none of them overlaps a reported
+// match. Transitions are worked out the first time they are taken, and
+// remember which thread each new one descended from, so thread start
+// offsets can be carried along without running any instructions. Frames
+// where a thread matches are handed to the wrapped Vm, as is everything
+// while the threads can't be reduced to a state. The cache of states is
+// bounded; when it fills it is flushed, and if that happens too often to
+// pay off the Vm is used for the rest of the stream.
+class LazyDfa: public VmInterface {
+public:
+  LazyDfa(size_t cacheSize = 8 << 20);
+
+  virtual void init(ProgramPtr prog);
+
+  virtual void startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual void closeOut(HitCallback hitFn, void* userData);
+  virtual void reset();
+
+  virtual std::shared_ptr<VmInterface> clone() const;
+
+  virtual void setSkipScan(bool enabled);
+
+  virtual void setPrefilter(bool enabled);
+
+  virtual void setCompact(bool enabled);
+
+  virtual size_t memoryUsage() const;
+
+  virtual void snapshot(std::ostream& out) const;
+  virtual void restore(std::istream& in);
+
+  // threads with the label die on stepping, so the cache is flushed of
+  // states which have them
+  virtual void retire(uint32_t label);
+
+  #ifdef LBT_TRACE_ENABLED
+  void setDebugRange(uint64_t beg, uint64_t end) {
+    Fallback.setDebugRange(beg, end);
+  }
+  #endif
+
+  uint32_t numStates() const { return States.size(); }
+
+  uint32_t numFlushes() const { return Flushes; }
+
+  // whether the cache thrashed, leaving the rest of the stream to the Vm
+  bool gaveUp() const { return GaveUp; }
+
+private:
+  // (PC index << 32 | label) for each thread, in priority order
+  typedef std::vector<uint64_t> Key;
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const;
+  };
+
+  struct State {
+    Key Threads;
+
+    // transition index, by (spawning << 8 | byte)
+    std::vector<uint32_t> Next;
+  };
+
+  struct Transition {
+    uint32_t Target;
+    bool Identity;
+
+    // index of the thread each thread of Target came from, or NEW
+    std::vector<uint32_t> Src;
+  };
+
+  static const uint32_t UNKNOWN, FAILED, NEW;
+
+  bool fromVm();
+  void toVm();
+
+  uint32_t intern(const Key& key);
+  uint32_t build(uint32_t& state, const byte b, const bool spawn);
+  void flush();
+
+  bool step(const Key& threads, const byte b, const bool spawn);
+  bool stepSequence(Thread& t);
+  bool stepEpsilon(Thread& t);
+
+  Vm Fallback;
+  ProgramPtr Prog;
+  const Instruction* Base;
+  const Instruction* ProgEnd;
+
+  bool SkipScan;
+  SkipScanner Skipper;
+
+  bool UsePrefilter;
+  Prefilter Filter;
+
+  size_t CacheSize,
+         CacheUsed;
+
+  std::vector<State> States;
+  std::vector<Transition> Transitions;
+  std::unordered_map<Key, uint32_t, KeyHash> Index;
+
+  uint32_t Cur;
+  std::vector<uint64_t> Starts,
+                        NextStarts;
+
+  // for judging whether the cache pays for itself
+  uint64_t BytesSinceFlush;
+  uint32_t Flushes;
+  bool GaveUp;
+
+  // labels retired since the last reset, which the cached states reflect
+  uint32_t NumPatterns;
+  LabelSet Retired;
+  bool AnyRetired;
+
+  // scratch space for stepping threads
+  std::vector<Thread> Stepping,
+                      Stepped;
+  Key Scratch;
+  bool Failed;
+  bool LiveNoLabel;
+  LabelSet Live;
+  LabelSet CheckLabels;
+
+  bool Compact;
+};
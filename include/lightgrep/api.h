@@ -19,6 +19,8 @@
 #ifndef LIGHTGREP_C_API_H_
 #define LIGHTGREP_C_API_H_
 
+#include <stddef.h>  // for size_t
+
 #include "search_hit.h"
 
 #ifdef __cplusplus
@@ -37,8 +39,15 @@ extern "C" {
   typedef struct FSMHandle*        LG_HFSM;
   typedef struct ProgramHandle*    LG_HPROGRAM;
   typedef struct ContextHandle*    LG_HCONTEXT;
-
-  // Options for pattern parsing
+  typedef struct ContextPoolHandle* LG_HCONTEXTPOOL;
+
+  // Options for pattern parsing. Fixed strings are searched for apart from
+  // the other patterns where they can be, with an automaton which either
+  // folds ASCII case or matches it exactly. A case-insensitive fixed string
+  // with too many letters to list in each case needs folding, and a
+  // case-sensitive one with letters needs matching; whichever is added
+  // first decides, and fixed strings needing the other are searched for
+  // with the other patterns, finding the same hits more slowly.
   typedef struct {
     char FixedString;     // 0 => grep, non-zero => fixed-string
     char CaseInsensitive; // 0 => case sensitive, non-zero => case-insensitive
@@ -56,12 +65,35 @@ extern "C" {
     char Determinize;     // 0 => build NFA, non-zero => build (pseudo)DFA
   } LG_ProgramOptions;
 
-// TODO: nix these, don't expose trace in the lib
+  // Options for search contexts
   typedef struct {
+// TODO: nix these, don't expose trace in the lib
     uint64_t TraceBegin,    // starting offset of trace output
            TraceEnd;      // ending offset of trace output
+    char NoSkipScan;      // 0 => skip bytes which cannot start a match, non-zero => examine every byte
+    char NoPrefilter;     // 0 => skip input too far from a required literal, non-zero => don't
+    char LazyDfa;         // 0 => run threads one at a time, non-zero => cache them as DFA states
+    char NoTable;         // 0 => use the program's transition table if it has one, non-zero => don't
+    char NoBitParallel;   // 0 => search programs of up to 64 states bit-parallel when not prefiltering, non-zero => don't
+    char Compact;         // 0 => hash per-pattern state only for programs with very many patterns, non-zero => always hash it
   } LG_ContextOptions;
 
+  // Options for what search contexts do with the hits they find
+  typedef struct {
+    char Exists;                // 0 => search everything, non-zero => stop at the first hit
+    char CountOnly;             // 0 => report hits, non-zero => only count them, see lg_hit_count(); finding them costs the same
+    uint32_t MaxHitsPerPattern; // 0 => no limit, otherwise stop looking for a pattern after this many hits
+  } LG_SearchOptions;
+
+  // The lengths of a program's hits, in bytes
+  typedef struct {
+    uint32_t NumPatterns; // one past the greatest index of a pattern in the program
+    uint64_t MinLength;   // of the shortest hit of any pattern
+    uint64_t MaxLength;   // of the longest hit of any pattern, LG_UNBOUNDED if a pattern repeats without limit
+  } LG_ProgramInfo;
+
+  static const uint64_t LG_UNBOUNDED = 0xFFFFFFFFFFFFFFFFull;
+
   // Error handling
   typedef struct LG_Error {
     char* Message;
@@ -125,6 +157,18 @@ extern "C" {
   LG_HPROGRAM lg_create_program(LG_HFSM hFsm,
                                 const LG_ProgramOptions* options);
 
+  // How long the hits of the program can be. The lengths survive
+  // serialization, so no recompiling is needed to get them. A program which
+  // can never hit has MinLength greater than MaxLength.
+  void lg_program_info(const LG_HPROGRAM hProg, LG_ProgramInfo* info);
+
+  // How long the hits of one pattern in the program can be. For a pattern
+  // not in the program, *minLength is greater than *maxLength.
+  void lg_pattern_lengths(const LG_HPROGRAM hProg,
+                          unsigned int patternIndex,
+                          uint64_t* minLength,
+                          uint64_t* maxLength);
+
   // The size, in bytes, of the search program. Used for serialization.
   int lg_program_size(const LG_HPROGRAM hProg);
 
@@ -132,10 +176,82 @@ extern "C" {
   // at least as large as lg_program_size() in bytes.
   void lg_write_program(LG_HPROGRAM hProg, void* buffer);
 
-  // Read in a serialized program, given the binary buffer and size. No
-  // versioning check is done so don't keep these around too long.
+  // Read in a serialized program, given the binary buffer and size.
+  // Serialized programs carry a format version and a checksum, and are
+  // refused, with null returned, if they're corrupt, cut short, from a
+  // newer version of the library, or from a machine of the other byte
+  // order.
   LG_HPROGRAM lg_read_program(void* buffer, int size);
 
+  // Read in a serialized program from a file, mapping it rather than
+  // reading it, so its code is run from the file's pages and processes
+  // mapping the same file share them. Returns null if the file can't be
+  // mapped or doesn't hold a whole program.
+  LG_HPROGRAM lg_read_program_mapped(const char* path);
+
+  // Read in a serialized program, running its code from the buffer rather
+  // than from a copy. The buffer must not change or be freed until the
+  // program and every context made from it have been destroyed.
+  LG_HPROGRAM lg_program_from_buffer_nocopy(const void* buffer, int size);
+
+  // The size, in bytes, of the program serialized with a pattern map, so
+  // that a cached program doesn't need the patterns kept separately.
+  int lg_program_size_with_pattern_map(const LG_HPROGRAM hProg,
+                                       const LG_HPATTERNMAP hPatternMap);
+
+  // Serialize the program with a pattern map. The program reads back as
+  // any other; lg_read_pattern_map() reads back the pattern map. The
+  // patterns' UserData is kept as a number, so it means something read
+  // back only if it is one, like the line numbers lg_add_pattern_list()
+  // puts there.
+  void lg_write_program_with_pattern_map(LG_HPROGRAM hProg,
+                                         const LG_HPATTERNMAP hPatternMap,
+                                         void* buffer);
+
+  // Read the pattern map from a serialized program. Returns null if the
+  // program was written without one, or isn't a valid serialized program.
+  LG_HPATTERNMAP lg_read_pattern_map(const void* buffer, int size);
+
+  // Read the pattern map from a serialized program in a file, mapping it
+  // so that the patterns' strings are used where they lie rather than
+  // copied. Returns null as for lg_read_pattern_map(), or if the file
+  // can't be mapped. The strings aren't copied, but each pattern's offsets
+  // are still checked and an LG_PatternInfo made for it, so loading takes
+  // time, and memory, in proportion to the number of patterns.
+  LG_HPATTERNMAP lg_read_pattern_map_mapped(const char* path);
+
+  // Compile a pattern list, as lg_add_pattern_list() takes it, keeping
+  // compiled programs in the directory cacheDir. They're named for a
+  // fingerprint of the patterns, the encodings and options, and the
+  // library version. A program found there is mapped, as by
+  // lg_read_program_mapped(), rather than compiled; one not found is
+  // compiled and stored with its pattern map, atomically, so that jobs
+  // can share a directory. Patterns with errors are reported in err, as
+  // by lg_add_pattern_list(), and the program isn't stored.
+  //
+  // Returns 1 if the program came from the cache, 0 if it was compiled,
+  // and -1 on failure, setting *hProg and *hMap to the program and its
+  // pattern map, which the caller destroys.
+  int lg_cached_program(const char* cacheDir,
+                        const char* patterns,
+                        const char** defaultEncodings,
+                        unsigned int defaultEncodingsNum,
+                        const LG_KeyOptions* defaultOptions,
+                        const LG_ProgramOptions* progOpts,
+                        LG_HPROGRAM* hProg,
+                        LG_HPATTERNMAP* hMap,
+                        LG_Error** err);
+
+  // The name of the file lg_cached_program() keeps the program in, within
+  // the cache directory: the fingerprint, 32 hex digits, and ".lgp". name
+  // must have room for 37 bytes, with the NUL.
+  void lg_program_cache_file(const char* patterns,
+                             const char** defaultEncodings,
+                             unsigned int defaultEncodingsNum,
+                             const LG_KeyOptions* defaultOptions,
+                             const LG_ProgramOptions* progOpts,
+                             char* name);
+
   // A Program must live as long as any associated contexts,
   // so only call this at the end.
   void lg_destroy_program(LG_HPROGRAM hProg);
@@ -147,8 +263,71 @@ extern "C" {
   LG_HCONTEXT lg_create_context(LG_HPROGRAM hProg,
                                 const LG_ContextOptions* options);
 
+  // As lg_create_context(), but searches with the context do only as much
+  // as searchOptions ask. A context stopped by the first hit or by every
+  // pattern reaching its limit ignores further input until it's reset.
+  LG_HCONTEXT lg_create_search_context(LG_HPROGRAM hProg,
+                                       const LG_ContextOptions* options,
+                                       const LG_SearchOptions* searchOptions);
+
   void lg_destroy_context(LG_HCONTEXT hCtx);
 
+  // Creates a context like hCtx, with the same program and options, in the
+  // state of a newly reset one. Much cheaper than lg_create_context() for
+  // big programs, as what that works out from the program is copied or
+  // shared.
+  LG_HCONTEXT lg_clone_context(LG_HCONTEXT hCtx);
+
+  // The bytes of memory hCtx holds, not counting its program. A context
+  // keeps some state for each pattern; with LG_ContextOptions::Compact, or
+  // for programs with very many patterns, it grows with the patterns in
+  // play rather than with those in the program, and so does this.
+  uint64_t lg_context_memory_usage(LG_HCONTEXT hCtx);
+
+  // A snapshot is everything a context carries from one search call to
+  // the next: live threads, the patterns which have matched and where,
+  // hits not yet handed out, and hit counts under search options. Its size
+  // goes with the threads live and the patterns matched so far, not with
+  // the program. Taken between calls, it lets a long search be resumed
+  // after a restart, with exactly the hits it would otherwise have had.
+  //
+  // Returns the size of a snapshot of hCtx as it stands, or -1 on error.
+  int lg_context_snapshot_size(LG_HCONTEXT hCtx);
+
+  // Writes a snapshot of hCtx to buffer, which must have room for
+  // lg_context_snapshot_size() bytes.
+  void lg_write_context_snapshot(LG_HCONTEXT hCtx, void* buffer);
+
+  // Puts hCtx in the state of a snapshot. hCtx must have been created with
+  // the same options for the same program; the snapshot carries a
+  // fingerprint of the program to check that. Returns 1 on success; on
+  // failure, returns 0 and resets hCtx.
+  int lg_read_context_snapshot(LG_HCONTEXT hCtx,
+                               const void* buffer,
+                               int size,
+                               LG_Error** err);
+
+  // A pool of contexts, all alike, made once as lg_create_search_context()
+  // would and cloned from then on. Contexts are handed out ready to search
+  // and are reset when given back, so a worker taking one per file pays
+  // nothing for setting up. Acquiring and releasing are thread-safe.
+  LG_HCONTEXTPOOL lg_create_context_pool(LG_HPROGRAM hProg,
+                                         const LG_ContextOptions* options,
+                                         const LG_SearchOptions* searchOptions);
+
+  void lg_destroy_context_pool(LG_HCONTEXTPOOL hPool);
+
+  // A reset context from the pool, or a new clone if none is free. Give it
+  // back with lg_release_context() rather than destroying it.
+  LG_HCONTEXT lg_acquire_context(LG_HCONTEXTPOOL hPool);
+
+  void lg_release_context(LG_HCONTEXTPOOL hPool, LG_HCONTEXT hCtx);
+
+  // The number of hits found for the pattern since the context was last
+  // reset. Only contexts created by lg_create_search_context() count hits;
+  // for others this is always 0.
+  uint64_t lg_hit_count(LG_HCONTEXT hCtx, unsigned int patternIndex);
+
   // Finds matches beginning at the first byte. It works like lg_search(), but
   // neither lg_closeout_search() nor lg_reset() need to be called (these are
   // done automatically). Consequently, this function cannot be called in
@@ -175,7 +354,9 @@ extern "C" {
   // it after this function returns, so do whatever you'd like with your
   // buffers after lg_search() returns. Search hits will be generated in
   // increasing byte offset order BY KEYWORD INDEX. Search hits pertaining to
-  // different keywords may be out of order. In particular, it may not be
+  // different keywords may be out of order; for one, hits for fixed strings
+  // searched for apart from the other patterns come before the other
+  // patterns' hits from the same buffer. In particular, it may not be
   // possible to determine the full length of a hit until the entire byte
   // stream has been searched...
   uint64_t lg_search(LG_HCONTEXT hCtx,
@@ -191,6 +372,57 @@ extern "C" {
                           void* userData,
                           LG_HITCALLBACK_FN callbackFn);
 
+  // Search a buffer as lg_search() does, but rather than calling back for
+  // each hit, write hits into the caller's array, which has room for
+  // maxHits of them. Returns as soon as the array is full or the buffer is
+  // exhausted, with *numHits set to the number of hits written. The return
+  // value is the offset of the first byte not yet searched; to resume, call
+  // again with the rest of the buffer, starting at that offset. Hits found
+  // past the end of the array are held by the context and come first in
+  // the next call, so none are lost.
+  uint64_t lg_search_hits(LG_HCONTEXT hCtx,
+                          const char* bufStart,
+                          const char* bufEnd,
+                          const uint64_t startOffset,
+                          LG_SearchHit* hits,
+                          size_t maxHits,
+                          size_t* numHits);
+
+  // The lg_closeout_search() for lg_search_hits(). Returns the number of
+  // hits written to the array; if that's maxHits, there may be more, so
+  // call it again until it isn't.
+  size_t lg_closeout_search_hits(LG_HCONTEXT hCtx,
+                                 LG_SearchHit* hits,
+                                 size_t maxHits);
+
+  // Searches a whole buffer, splitting it into chunks which are searched on
+  // numThreads threads, each with a context of its own made as
+  // lg_create_context() would. The hits reported are exactly those which
+  // lg_search() over the buffer and then lg_closeout_search() would report,
+  // but in a different order: lg_search() reports a hit once it's sure of
+  // it, so a long hit can come after a shorter one which began later, while
+  // these are sorted by start offset, then end offset, then pattern. All are
+  // reported on the calling thread once the search is done. Returns the
+  // number of hits.
+  uint64_t lg_search_parallel(LG_HPROGRAM hProg,
+                              const LG_ContextOptions* options,
+                              const char* bufStart,
+                              const char* bufEnd,
+                              const uint64_t startOffset,
+                              unsigned int numThreads,
+                              void* userData,
+                              LG_HITCALLBACK_FN callbackFn);
+
+  // As lg_search_parallel(), over the whole of the file at path, which is
+  // mapped rather than read; hits' offsets are from the start of the file.
+  // Returns 0, reporting no hits, if the file can't be mapped.
+  uint64_t lg_search_parallel_file(LG_HPROGRAM hProg,
+                                   const LG_ContextOptions* options,
+                                   const char* path,
+                                   unsigned int numThreads,
+                                   void* userData,
+                                   LG_HITCALLBACK_FN callbackFn);
+
   uint64_t lg_search_resolve(LG_HCONTEXT hCtx,
                          const char* bufStart,
                          const char* bufEnd,
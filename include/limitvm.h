@@ -0,0 +1,99 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "labelvalues.h"
+#include "vm_interface.h"
+
+// Hands searches to another engine and passes on only the hits the search
+// options want: every hit, or just the first, and for each label no more
+// than a cap. Hits passed on are counted by label, and can be counted
+// without being reported at all, though the engine finds them all the same.
+// Once nothing more could be passed on, the search stops at that hit.
+class LimitVm: public VmInterface {
+public:
+  // maxHits of 0 means no cap
+  LimitVm(std::shared_ptr<VmInterface> inner, bool exists, bool countOnly, uint32_t maxHits);
+
+  virtual void init(ProgramPtr prog);
+
+  virtual void startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual void closeOut(HitCallback hitFn, void* userData);
+  virtual void reset();
+
+  virtual std::shared_ptr<VmInterface> clone() const;
+
+  virtual void setSkipScan(bool enabled) { Inner->setSkipScan(enabled); }
+
+  virtual void setPrefilter(bool enabled) { Inner->setPrefilter(enabled); }
+
+  virtual void setCompact(bool enabled) {
+    Compact = enabled;
+    Inner->setCompact(enabled);
+  }
+
+  virtual size_t memoryUsage() const {
+    return sizeof(*this) + Counts.memoryUsage() + Inner->memoryUsage();
+  }
+
+  virtual void snapshot(std::ostream& out) const;
+  virtual void restore(std::istream& in);
+
+  #ifdef LBT_TRACE_ENABLED
+  void setDebugRange(uint64_t beg, uint64_t end) {
+    Inner->setDebugRange(beg, end);
+  }
+  #endif
+
+  // the number of hits passed on for label since the last reset
+  uint64_t count(uint32_t label) const {
+    return label < Counts.size() ? Counts[label] : 0;
+  }
+
+  // whether nothing more will be passed on until the next reset
+  bool done() const { return Done; }
+
+private:
+  static void _hit(void* userData, const LG_SearchHit* const hit);
+
+  // runs f, which searches with the inner engine, unless done already;
+  // false if nothing more is to be passed on
+  template <class F> bool _run(F f);
+
+  std::shared_ptr<VmInterface> Inner;
+
+  const bool Exists,
+             CountOnly;
+  const uint32_t MaxHits;
+
+  bool Compact;
+
+  LabelValues<uint64_t> Counts;
+  uint32_t NumCapped;
+  bool Done;
+
+  // where the hits passed on go, for the call under way
+  HitCallback CurHitFn;
+  void* UserData;
+};
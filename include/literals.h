@@ -0,0 +1,55 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+
+#include <string>
+#include <vector>
+
+class Encoder;
+class ParseTree;
+
+// Encoded byte strings, one of which occurs in every match, beginning no
+// more than MaxLead bytes after the start of the match.
+struct RequiredLiterals {
+  std::vector<std::string> Strings;
+  uint32_t MaxLead;
+
+  RequiredLiterals(): MaxLead(0) {}
+
+  bool empty() const { return Strings.empty(); }
+
+  // adds the literals required by another pattern
+  void merge(const RequiredLiterals& other);
+
+  void clear() {
+    Strings.clear();
+    MaxLead = 0;
+  }
+
+  bool operator==(const RequiredLiterals& other) const {
+    return MaxLead == other.MaxLead && Strings == other.Strings;
+  }
+};
+
+// Finds the literals required by a reduced parse tree, as enc encodes them.
+// Returns false if the pattern has none, or if how far they may lie from
+// the start of a match is unbounded.
+bool requiredLiterals(const ParseTree& tree, const Encoder& enc, RequiredLiterals& lits);
@@ -0,0 +1,213 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// A vector whose elements can instead be borrowed from memory it doesn't
+// own, such as a mapped program file, which Keep holds onto if anything
+// must. Reads go through Ptr either way, so are as cheap as a vector's.
+//
+// Borrowed elements are never written through: they're copied into Owned
+// before anything changes the size, and element access must not be used
+// to change them in place.
+template <class T>
+class MappableVector {
+public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+
+  MappableVector(): Ptr(nullptr), Size(0), Borrowed(false) {}
+
+  MappableVector(size_t n, const T& val): Owned(n, val), Borrowed(false) {
+    sync();
+  }
+
+  MappableVector(std::initializer_list<T> init):
+    Owned(init), Borrowed(false)
+  {
+    sync();
+  }
+
+  MappableVector(const MappableVector& other) { *this = other; }
+
+  MappableVector(MappableVector&& other):
+    Owned(std::move(other.Owned)), Ptr(other.Ptr), Size(other.Size),
+    Keep(std::move(other.Keep)), Borrowed(other.Borrowed)
+  {
+    other.clear();
+  }
+
+  MappableVector& operator=(const MappableVector& other) {
+    if (this != &other) {
+      Owned = other.Owned;
+      Keep = other.Keep;
+      Borrowed = other.Borrowed;
+      if (Borrowed) {
+        Ptr = other.Ptr;
+        Size = other.Size;
+      }
+      else {
+        sync();
+      }
+    }
+    return *this;
+  }
+
+  MappableVector& operator=(MappableVector&& other) {
+    if (this != &other) {
+      Owned = std::move(other.Owned);
+      Ptr = other.Ptr;
+      Size = other.Size;
+      Keep = std::move(other.Keep);
+      Borrowed = other.Borrowed;
+      other.clear();
+    }
+    return *this;
+  }
+
+  MappableVector& operator=(const std::vector<T>& v) {
+    Owned = v;
+    Keep.reset();
+    Borrowed = false;
+    sync();
+    return *this;
+  }
+
+  // use n elements at data in place, for as long as keep is held
+  void borrow(const T* data, size_t n, std::shared_ptr<const void> keep) {
+    std::vector<T>().swap(Owned);
+    Ptr = const_cast<T*>(data);
+    Size = n;
+    Keep = std::move(keep);
+    Borrowed = true;
+  }
+
+  bool borrowed() const { return Borrowed; }
+
+  size_t size() const { return Size; }
+  bool empty() const { return Size == 0; }
+
+  T& operator[](size_t i) { return Ptr[i]; }
+  const T& operator[](size_t i) const { return Ptr[i]; }
+
+  T& front() { return Ptr[0]; }
+  const T& front() const { return Ptr[0]; }
+  T& back() { return Ptr[Size - 1]; }
+  const T& back() const { return Ptr[Size - 1]; }
+
+  T* data() { return Ptr; }
+  const T* data() const { return Ptr; }
+
+  iterator begin() { return Ptr; }
+  const_iterator begin() const { return Ptr; }
+  iterator end() { return Ptr + Size; }
+  const_iterator end() const { return Ptr + Size; }
+
+  // the bytes owned, which is none of those borrowed
+  size_t capacityBytes() const { return Owned.capacity() * sizeof(T); }
+
+  void push_back(const T& val) {
+    own();
+    Owned.push_back(val);
+    sync();
+  }
+
+  template <class... Args>
+  void emplace_back(Args&&... args) {
+    own();
+    Owned.emplace_back(std::forward<Args>(args)...);
+    sync();
+  }
+
+  void resize(size_t n) {
+    own();
+    Owned.resize(n);
+    sync();
+  }
+
+  void resize(size_t n, const T& val) {
+    own();
+    Owned.resize(n, val);
+    sync();
+  }
+
+  template <class It>
+  iterator insert(const_iterator pos, It first, It last) {
+    const size_t i = pos - begin();
+    own();
+    Owned.insert(Owned.begin() + i, first, last);
+    sync();
+    return begin() + i;
+  }
+
+  void assign(size_t n, const T& val) {
+    clear();
+    Owned.assign(n, val);
+    sync();
+  }
+
+  void reserve(size_t n) {
+    own();
+    Owned.reserve(n);
+    sync();
+  }
+
+  void clear() {
+    std::vector<T>().swap(Owned);
+    Keep.reset();
+    Borrowed = false;
+    sync();
+  }
+
+  bool operator==(const MappableVector& other) const {
+    return Size == other.Size && std::equal(begin(), end(), other.begin());
+  }
+
+  bool operator!=(const MappableVector& other) const {
+    return !(*this == other);
+  }
+
+private:
+  void own() {
+    if (Borrowed) {
+      Owned.assign(Ptr, Ptr + Size);
+      Keep.reset();
+      Borrowed = false;
+    }
+  }
+
+  void sync() {
+    Ptr = Owned.data();
+    Size = Owned.size();
+  }
+
+  std::vector<T> Owned;
+  T* Ptr;
+  size_t Size;
+  std::shared_ptr<const void> Keep;
+  bool Borrowed;
+};
@@ -0,0 +1,56 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "automata.h"
+#include "basic.h"
+
+#include <algorithm>
+#include <vector>
+
+// The shortest and longest matches of a label, in bytes. Max is UNBOUNDED
+// where a match can repeat without limit; Min > Max where there are none.
+struct MatchLengths {
+  static const uint64_t UNBOUNDED;
+
+  uint64_t Min, Max;
+
+  MatchLengths(): Min(UNBOUNDED), Max(0) {}
+
+  MatchLengths(uint64_t min, uint64_t max): Min(min), Max(max) {}
+
+  bool empty() const { return Min > Max; }
+
+  void merge(const MatchLengths& other) {
+    Min = std::min(Min, other.Min);
+    Max = std::max(Max, other.Max);
+  }
+
+  bool operator==(const MatchLengths& other) const {
+    return Min == other.Min && Max == other.Max;
+  }
+};
+
+// Merges into lengths, indexed by label, the lengths of the matches of
+// each label in a graph. Labelling guard states takes the labels off match
+// states, so this must come before it.
+void matchLengths(const NFA& g, std::vector<MatchLengths>& lengths);
+
+// Merges the lengths of one label's matches into lengths.
+void mergeLengths(std::vector<MatchLengths>& lengths, uint32_t label, const MatchLengths& len);
@@ -0,0 +1,36 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "basic.h"
+#include "vm_interface.h"
+
+// Makes a new engine, ready to search. Called from any of the threads.
+typedef std::function<std::shared_ptr<VmInterface>()> VmMaker;
+
+// Searches [beg, end) as chunks of chunkSize bytes, on numThreads threads,
+// each with engines of its own. Reports the hits which one engine searching
+// the whole buffer and then closing out would, sorted by start offset rather
+// than in the order that engine would report them, and returns how many
+// there were. Hits are reported on the calling thread,
+// after the chunks are all searched.
+uint64_t searchParallel(const VmMaker& makeVm, const byte* const beg, const byte* const end, const uint64_t startOffset, const uint32_t numThreads, const uint64_t chunkSize, HitCallback hitFn, void* userData);
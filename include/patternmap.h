@@ -0,0 +1,88 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "lightgrep/api.h"
+
+#include "basic.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The pattern and encoding chain of each label, with the user's data for
+// it. The strings are kept NUL-terminated in an arena of blocks which
+// never move, with each encoding chain kept once, so adding a pattern
+// allocates nothing of its own.
+//
+// Serialized, the map is a table of offsets into one block of strings,
+// with each pattern's UserData kept as a number. A map read back checks
+// every offset once and points its LG_PatternInfos at the strings where
+// they lie, in a mapped file if need be. After that nothing changes the
+// map but the caller, so searches on several threads can read it freely.
+class PatternMap {
+public:
+  PatternMap(uint32_t sizeHint);
+
+  uint32_t size() const { return Size; }
+
+  void addPattern(const char* pattern, const char* chain);
+
+  LG_PatternInfo& info(uint32_t i) { return Infos[i]; }
+
+  const char* pattern(uint32_t i) const { return Infos[i].Pattern; }
+  const char* chain(uint32_t i) const { return Infos[i].EncodingChain; }
+  uint64_t userData(uint32_t i) const { return reinterpret_cast<uintptr_t>(Infos[i].UserData); }
+
+  // the serialized map: its size, then the table, then the strings
+  std::string marshall() const;
+
+  // reads a serialized map, using it in place for as long as keep is held
+  static std::unique_ptr<PatternMap> unmarshallInPlace(const byte* buf, size_t len, std::shared_ptr<const void> keep);
+
+private:
+  // where a serialized pattern's strings are, and its UserData
+  struct Entry {
+    uint64_t Pattern,
+             Chain,
+             UserData;
+  };
+
+  struct Free {
+    void operator()(LG_PatternInfo* p) const { std::free(p); }
+  };
+
+  void reserve(uint32_t n);
+
+  const char* store(const char* str, size_t len);
+
+  std::unique_ptr<LG_PatternInfo[], Free> Infos;
+  uint32_t Size,
+           Capacity;
+
+  std::vector<std::unique_ptr<char[]>> Blocks;
+  char* BlockCur;
+  size_t BlockLeft;
+
+  std::unordered_map<std::string, const char*> Chains;
+
+  // for a map read back, what holds the strings
+  std::shared_ptr<const void> Keep;
+};
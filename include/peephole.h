@@ -0,0 +1,31 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+
+class Program;
+
+// Tidies the code Compiler::createProgram() emits. Jumps, forks, and jump
+// table entries landing on a jump are sent on to its target, jumps to the
+// next instruction kept are dropped, and code no thread can reach (e.g.,
+// the states the jump tables land past) is cut out. What's left is packed
+// and every address is moved to match. The halt and the finish stay last,
+// as the Vm expects.
+void optimizeCode(Program& prog);
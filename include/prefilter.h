@@ -0,0 +1,102 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "literals.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Finds occurrences of a set of literals, so that the Vm can jump to within
+// MaxLead bytes of the next place where a match could possibly be.
+//
+// Small sets use Teddy: the literals are spread over eight buckets, and for
+// each of the first few bytes of a literal a pair of nibble-indexed shuffle
+// tables gives the buckets that byte is consistent with. ANDing those over
+// 16 or 32 positions at a time (SSSE3 or AVX2, picked at runtime) leaves
+// few candidates to verify. Large sets saturate the buckets, so instead
+// candidates are found with a bitmap of leading byte pairs, then thinned
+// with a bitmap of hashed fingerprints. Either way, candidates are
+// confirmed by looking up their leading bytes in a hash table of literals
+// and comparing.
+class Prefilter {
+public:
+  enum Kernel {
+    NONE,   // no literals, nothing to filter
+    SCALAR,
+    SSSE3,
+    AVX2,
+    PAIRS
+  };
+
+  Prefilter();
+  Prefilter(const RequiredLiterals& lits, bool allowSimd = true);
+
+  void init(const RequiredLiterals& lits, bool allowSimd = true);
+
+  // returns the start of the first literal lying wholly in [beg, end), or end
+  const byte* next(const byte* beg, const byte* end) const;
+
+  Kernel kernel() const { return Which; }
+
+  bool empty() const { return Which == NONE; }
+
+  uint32_t maxLead() const { return MaxLead; }
+
+  uint32_t maxLength() const { return MaxLen; }
+
+  // the bytes allocated for the literals and their tables
+  size_t memoryUsage() const;
+
+private:
+  bool verify(const byte* cur, const byte* end) const;
+
+  const byte* scalar(const byte* beg, const byte* end) const;
+  const byte* ssse3(const byte* beg, const byte* end) const;
+  const byte* avx2(const byte* beg, const byte* end) const;
+  const byte* pairs(const byte* beg, const byte* end) const;
+
+  uint32_t fingerprint(const byte* cur) const;
+
+  Kernel Which;
+
+  uint32_t MaxLead,
+           MinLen,
+           MaxLen,
+           Width,   // number of leading bytes which are fingerprinted
+           Depth;   // number of leading bytes which Teddy looks at
+
+  std::vector<std::string> Literals;
+
+  // literal indices, by fingerprint
+  std::unordered_map<uint32_t, std::vector<uint32_t>> ByPrint;
+
+  // Teddy masks: bit k of Lo[i][b & 0xF] & Hi[i][b >> 4] is set iff b may
+  // be byte i of a literal in bucket k; Table[i][b] is the same, unsplit
+  byte Lo[3][16],
+       Hi[3][16],
+       Table[3][256];
+
+  // bit (b0 << 8 | b1) is set iff some literal begins with b0 b1
+  std::vector<uint64_t> Pairs;
+
+  // bit hash(fp) is set if some literal has fingerprint fp
+  std::vector<uint64_t> Prints;
+};
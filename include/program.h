@@ -22,28 +22,73 @@
 #include <ostream>
 #include <vector>
 
+#include "ahocorasick.h"
 #include "basic.h"
 #include "instructions.h"
 #include "fwd_pointers.h"
 #include "byteset.h"
+#include "dfatable.h"
+#include "literals.h"
+#include "mappablevector.h"
+#include "matchlengths.h"
 
-class Program: public std::vector<Instruction> {
+// The code is a MappableVector so that a program read from a mapped file
+// can run from the mapping, shared by every process mapping it.
+class ContainerReader;
+class ContainerWriter;
+
+class Program: public MappableVector<Instruction> {
 public:
   Program(size_t num, const Instruction& val):
-    std::vector<Instruction>(num, val), NumChecked(0), First() {}
+    MappableVector<Instruction>(num, val), NumChecked(0), First() {}
 
-  Program(): std::vector<Instruction>(), NumChecked(0), First() {}
+  Program(): MappableVector<Instruction>(), NumChecked(0), First() {}
 
   uint32_t  NumChecked;
 
   ByteSet First;
 
+  // empty unless every pattern has some
+  RequiredLiterals Literals;
+
+  // empty if the table would be too big, or wasn't built
+  DfaTable Table;
+
+  // the patterns which are just strings, kept out of the code; the code
+  // is empty if that's all of them
+  AhoCorasick Keywords;
+
+  // the lengths of each label's matches, indexed by label
+  MappableVector<MatchLengths> Lengths;
+
   int bufSize() const;
 
   bool operator==(const Program& rhs) const;
 
+  // a hash of what marshall() writes, so that state kept for a program
+  // can be matched up with it again, even once it's read back
+  uint64_t fingerprint() const;
+
+  // serializes the program into a container (see container.h); the
+  // buffer must be at least bufSize() bytes
+  void marshall(void* buf) const;
   std::string marshall() const;
+
+  // adds the program's sections to a container, for writing along with
+  // others; it must be written before the program changes
+  void addSections(ContainerWriter& out) const;
+
+  // reads a program from a container's sections, in place if inPlace, as
+  // for unmarshallInPlace()
+  static ProgramPtr read(const ContainerReader& in, bool inPlace, std::shared_ptr<const void> keep);
+
   static ProgramPtr unmarshall(const std::string& s);
+  static ProgramPtr unmarshall(const void* buf, size_t len);
+
+  // reads a program with its code and keyword automaton left where they
+  // are in buf, which must not change or go away while keep is held (or,
+  // if keep is empty, while the program is in use)
+  static ProgramPtr unmarshallInPlace(const void* buf, size_t len, std::shared_ptr<const void> keep);
 };
 
 std::ostream& operator<<(std::ostream& out, const Program& prog);
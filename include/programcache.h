@@ -0,0 +1,45 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "lightgrep/api.h"
+
+#include <string>
+
+class ContainerWriter;
+
+// Bump this when the same patterns and options would compile to a
+// different program, so that cached programs from before are not used.
+static const uint32_t PROGRAM_CACHE_VERSION = 2;
+
+// cached programs are in files named for their keys, with this suffix
+static const char PROGRAM_CACHE_SUFFIX[] = ".lgp";
+
+// A stable fingerprint of everything a compiled program depends on: the
+// pattern list, the default encodings and options, the program options,
+// and the library and format versions. It's 32 hex digits, for naming the
+// program's file in a cache.
+std::string programCacheKey(const char* patterns,
+                            const char** defaultEncodings,
+                            unsigned int defaultEncodingsNum,
+                            const LG_KeyOptions& defaultOptions,
+                            const LG_ProgramOptions& progOpts);
+
+// Writes out to path by way of a temporary file in the same directory
+// which is then renamed, so that readers see all of it or none of it.
+void writeFileAtomically(const std::string& path, const ContainerWriter& out);
@@ -0,0 +1,71 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "byteset.h"
+
+// Finds the next byte in a buffer which is a member of a ByteSet. The Vm
+// uses this to jump over input which cannot begin a match while it has
+// no live threads.
+//
+// Single-byte sets go through memchr(). Other sets are classified 16 or 32
+// bytes at a time with a pair of nibble-indexed shuffle tables (SSSE3 or
+// AVX2, picked at runtime), with a table-driven scalar loop as the fallback
+// on other CPUs and compilers.
+class SkipScanner {
+public:
+  enum Kernel {
+    NONE,   // set is empty, nothing can ever be found
+    ALL,    // set is full, skipping is pointless
+    MEMCHR,
+    SCALAR,
+    SSSE3,
+    AVX2
+  };
+
+  SkipScanner();
+  SkipScanner(const ByteSet& set, bool allowSimd = true);
+
+  void init(const ByteSet& set, bool allowSimd = true);
+
+  // returns a pointer to the first member of the set in [beg, end), or end
+  const byte* next(const byte* beg, const byte* end) const;
+
+  Kernel kernel() const { return Which; }
+
+  // ALL means every byte is a hit, so there is nothing to be gained
+  bool worthwhile() const { return Which != ALL; }
+
+private:
+  const byte* scalar(const byte* beg, const byte* end) const;
+  const byte* ssse3(const byte* beg, const byte* end) const;
+  const byte* avx2(const byte* beg, const byte* end) const;
+
+  Kernel Which;
+  byte   Single;
+
+  // Lookup[b] != 0 iff b is in the set
+  byte   Lookup[256];
+
+  // Bit (b >> 4) & 7 of HighClear[b & 0xF] (b < 0x80) or
+  // HighSet[b & 0xF] (b >= 0x80) is set iff b is in the set
+  byte   HighClear[16],
+         HighSet[16];
+};
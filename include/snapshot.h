@@ -0,0 +1,75 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// Snapshots of search contexts are written in native byte order, as
+// programs are, by each engine in turn from the outermost in. Each engine
+// begins with its tag, so that restoring into a context made differently
+// fails rather than misreading.
+enum SnapshotTag : byte {
+  VM_SNAPSHOT = 1,
+  TABLE_SNAPSHOT,
+  BIT_SNAPSHOT,
+  LAZY_DFA_SNAPSHOT,
+  KEYWORD_SNAPSHOT,
+  LIMIT_SNAPSHOT
+};
+
+template <class T>
+void writeSnapshotValue(std::ostream& out, const T& val) {
+  out.write(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+template <class T>
+T readSnapshotValue(std::istream& in) {
+  T val;
+  if (!in.read(reinterpret_cast<char*>(&val), sizeof(val))) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot is truncated");
+  }
+  return val;
+}
+
+template <class T>
+void writeSnapshotVector(std::ostream& out, const std::vector<T>& v) {
+  writeSnapshotValue(out, uint64_t(v.size()));
+  out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template <class T>
+void readSnapshotVector(std::istream& in, std::vector<T>& v) {
+  const uint64_t n = readSnapshotValue<uint64_t>(in);
+
+  // don't trust the count with an allocation before seeing the data
+  v.clear();
+  for (uint64_t i = 0; i < n; ++i) {
+    v.push_back(readSnapshotValue<T>(in));
+  }
+}
+
+inline void readSnapshotTag(std::istream& in, SnapshotTag tag) {
+  if (readSnapshotValue<byte>(in) != tag) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot is of a context made with different options");
+  }
+}
@@ -29,8 +29,24 @@ class SparseSet {
 public:
   SparseSet(uint32_t maxSize = 0) { resize(maxSize); }
 
+  SparseSet(const SparseSet& other): SparseSet(other.Max) {
+    *this = other;
+  }
+
+  SparseSet& operator=(const SparseSet& other) {
+    if (Max != other.Max) {
+      resize(other.Max);
+    }
+    // the sparse part, and only as much of the dense part as is in use
+    std::copy(other.Data.get(), other.Data.get() + other.End, Data.get());
+    End = other.End;
+    return *this;
+  }
+
   uint32_t size() const { return End - Max; }
 
+  size_t memoryUsage() const { return 2 * sizeof(uint32_t) * Max; }
+
   // e had damn well better be less than Max, because we don't check
   bool find(uint32_t e) const {
     const uint32_t i = Data[e] + Max;
@@ -0,0 +1,125 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "byteset.h"
+#include "dfatable.h"
+#include "labelvalues.h"
+#include "prefilter.h"
+#include "skipscan.h"
+#include "sparseset.h"
+#include "vm_interface.h"
+
+// Searches with a program's DfaTable instead of its code. Threads, their
+// priorities, and the rules for labels, CHECK_HALT and reporting matches
+// are exactly those of the Vm, but each thread takes one table lookup per
+// byte instead of running instructions, and bytes which can't begin a
+// match cost nothing while no threads are live.
+class TableVm: public VmInterface {
+public:
+  struct Thread {
+    uint32_t State,
+             Label;
+    uint64_t Start,
+             End;
+  };
+
+  typedef std::vector<Thread> ThreadList;
+
+  TableVm();
+  TableVm(ProgramPtr prog);
+
+  virtual void init(ProgramPtr prog);
+
+  virtual void startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual uint64_t searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData);
+  virtual void closeOut(HitCallback hitFn, void* userData);
+  virtual void reset();
+
+  virtual std::shared_ptr<VmInterface> clone() const;
+
+  virtual void setSkipScan(bool enabled) { SkipScan = enabled; }
+
+  virtual void setPrefilter(bool enabled) { UsePrefilter = enabled; }
+
+  virtual void setCompact(bool enabled) { Compact = enabled; }
+
+  virtual size_t memoryUsage() const;
+
+  virtual void snapshot(std::ostream& out) const;
+  virtual void restore(std::istream& in);
+
+  virtual void retire(uint32_t label);
+
+  #ifdef LBT_TRACE_ENABLED
+  // there are no instructions to trace
+  void setDebugRange(uint64_t, uint64_t) {}
+  #endif
+
+  const ThreadList& active() const { return Active; }
+
+private:
+  // pseudo-states for threads which aren't in the table
+  static const uint32_t FINISHED, // holding a match
+                        HALTED;   // killed by a match
+
+  void _markSeen(const uint32_t label);
+  void _markLive(const uint32_t label);
+  bool _liveCheck(const uint64_t start, const uint32_t label);
+
+  void _executeThread(Thread t, const size_t i, const uint32_t cls, const uint64_t offset);
+  bool _arrive(Thread& t, uint32_t target, const size_t i, const uint64_t offset);
+  void _take(const Thread& t, const uint32_t entry, const size_t i, const uint64_t offset);
+  void _finish(Thread& t, const size_t i, const uint64_t offset);
+  void _executeFrame(const bool spawn, const byte b, const uint64_t offset);
+  void _cleanup();
+
+  uint64_t _firstLive() const;
+
+  ProgramPtr Prog;
+  const DfaTable* Table;
+
+  bool SkipScan;
+  SkipScanner Skipper;
+
+  bool UsePrefilter;
+  Prefilter Filter;
+
+  bool Compact;
+
+  ThreadList Active,
+             Next;
+
+  bool SeenNoLabel;
+  LabelSet Seen;
+
+  bool LiveNoLabel;
+  LabelSet Live;
+
+  LabelValues<uint64_t> MatchEnds;
+  uint64_t MatchEndsMax;
+
+  LabelSet CheckLabels;
+
+  HitCallback CurHitFn;
+  void* UserData;
+};
@@ -0,0 +1,137 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "instructions.h"
+#include "thread.h"
+
+#include <vector>
+
+// The Vm's thread lists, split in two. A frame's first pass over the
+// threads tests them against the current byte, and needs only their PCs,
+// so those are packed together; only the survivors go on to touch the rest
+// of a thread, its label and offsets, which are kept together in Infos.
+// PCs are 32-bit indices into the program rather than pointers; they're
+// signed when read back out, so a PC just before the program survives the
+// trip.
+//
+// Offsets stay 64-bit: a thread can outlive any 32-bit window (think of
+// ".*"), so they can't be made relative to a per-buffer base.
+//
+// Threads are read out as Thread values, for everything outside the Vm's
+// inner loop.
+class ThreadList {
+public:
+  static const uint32_t NOPC; // dead, and to be dropped
+
+  // everything about a thread but its PC
+  struct Info {
+    uint64_t Start,
+             End;
+    uint32_t Label;
+    #ifdef LBT_TRACE_ENABLED
+    uint64_t Id;
+    #endif
+  };
+
+  class const_iterator {
+  public:
+    const_iterator(const ThreadList* list, size_t i): List(list), I(i) {}
+
+    Thread operator*() const { return (*List)[I]; }
+
+    const_iterator& operator++() {
+      ++I;
+      return *this;
+    }
+
+    bool operator==(const const_iterator& o) const { return I == o.I; }
+    bool operator!=(const const_iterator& o) const { return I != o.I; }
+
+  private:
+    const ThreadList* List;
+    size_t I;
+  };
+
+  ThreadList(): Base(0), Size(0) {}
+
+  // PCs are indices from base
+  void setBase(const Instruction* base) { Base = base; }
+
+  size_t size() const { return Size; }
+
+  bool empty() const { return Size == 0; }
+
+  void clear() { Size = 0; }
+
+  void swap(ThreadList& other);
+
+  size_t memoryUsage() const {
+    return vectorBytes(PC) + vectorBytes(Infos);
+  }
+
+  #ifdef LBT_TRACE_ENABLED
+  void push_back(uint32_t pc, uint32_t label, uint64_t id, uint64_t start, uint64_t end) {
+    const size_t i = _grow();
+    PC[i] = pc;
+    Infos[i] = Info{start, end, label, id};
+  }
+  #else
+  void push_back(uint32_t pc, uint32_t label, uint64_t start, uint64_t end) {
+    const size_t i = _grow();
+    PC[i] = pc;
+    Infos[i] = Info{start, end, label};
+  }
+  #endif
+
+  // copies the ith thread of another list
+  void push_back(const ThreadList& other, size_t i) {
+    const size_t j = _grow();
+    PC[j] = other.PC[i];
+    Infos[j] = other.Infos[i];
+  }
+
+  void push_back(const Thread& t);
+
+  Thread operator[](size_t i) const;
+
+  Thread front() const { return (*this)[0]; }
+  Thread back() const { return (*this)[Size - 1]; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, Size); }
+
+  std::vector<uint32_t> PC;
+  std::vector<Info> Infos;
+
+private:
+  // makes room for one more thread, returning its index
+  size_t _grow() {
+    if (Size == PC.size()) {
+      _reserve(Size ? 2 * Size : 16);
+    }
+    return Size++;
+  }
+
+  void _reserve(size_t n);
+
+  const Instruction* Base;
+  size_t Size;
+};
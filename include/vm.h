@@ -18,19 +18,29 @@
 
 #pragma once
 
+#include <memory>
 #include <set>
 #include <vector>
 
 #include "sparseset.h"
 #include "vm_interface.h"
 #include "byteset.h"
+#include "labelvalues.h"
+#include "prefilter.h"
+#include "skipscan.h"
 #include "thread.h"
+#include "threadlist.h"
+
+// Built with --enable-direct-threading, the Vm's inner loops dispatch with
+// computed gotos where the compiler has them. Tracing needs to see every
+// instruction, so it always gets the switch.
+#if defined(LBT_DIRECT_THREADING) && defined(__GNUC__) && !defined(LBT_TRACE_ENABLED)
+#define LBT_VM_DIRECT_THREADED
+#endif
 
 class Vm: public VmInterface {
 public:
 
-  typedef std::vector<Thread> ThreadList;
-
   Vm();
   Vm(ProgramPtr prog);
 
@@ -43,6 +53,26 @@ public:
   virtual void closeOut(HitCallback hitFn, void* userData);
   virtual void reset();
 
+  virtual std::shared_ptr<VmInterface> clone() const;
+
+  virtual void setSkipScan(bool enabled) { SkipScan = enabled; }
+
+  virtual void setPrefilter(bool enabled) { UsePrefilter = enabled; }
+
+  virtual void setCompact(bool enabled) { Compact = enabled; }
+
+  virtual size_t memoryUsage() const;
+
+  virtual void snapshot(std::ostream& out) const;
+  virtual void restore(std::istream& in);
+
+  // threads with the label then die as though overlapping a match
+  virtual void retire(uint32_t label) {
+    if (label < MatchEnds.size()) {
+      MatchEnds.set(label, Thread::NONE);
+    }
+  }
+
   #ifdef LBT_TRACE_ENABLED
   void setDebugRange(uint64_t beg, uint64_t end) {
     BeginDebug = beg;
@@ -50,24 +80,34 @@ public:
   }
   #endif
 
+  // these run the ith thread in the active list
   bool execute(Thread* t, const byte* const cur);
-  bool execute(ThreadList::iterator t, const byte* const cur);
+  bool execute(size_t i, const byte* const cur);
 
   bool executeEpsilon(Thread* t, uint64_t offset);
-  bool executeEpsilon(ThreadList::iterator t, uint64_t offset);
+  bool executeEpsilon(size_t i, uint64_t offset);
 
   void executeFrame(const byte* const cur, uint64_t offset, HitCallback hitFn, void* userData);
+  void executeFrame(const ByteSet& first, const byte* const cur, uint64_t offset, HitCallback hitFn, void* userData);
   void cleanup();
 
   const ThreadList& first() const { return First; }
   const ThreadList& active() const { return Active; }
   const ThreadList& next() const { return Next; }
 
-  Thread& add(const Thread& t) {
+  void add(const Thread& t) {
     Active.push_back(t);
-    return Active.back();
   }
 
+  void clearActive() { Active.clear(); }
+
+  // no match can be reported for a thread starting before this
+  uint64_t matchEndsMax() const { return MatchEndsMax; }
+
+  // a frame looks for threads duplicating others only if it begins with
+  // more threads than this; see _duplicate()
+  static const uint32_t MIN_DEDUP_THREADS = 16;
+
   uint32_t numActive() const { return Active.size(); }
   uint32_t numNext() const { return Next.size(); }
 
@@ -75,17 +115,24 @@ private:
   void _markSeen(const uint32_t label);
   void _markLive(const uint32_t label);
   bool _liveCheck(const uint64_t start, const uint32_t label);
+  bool _duplicate(const Instruction* const base, const uint32_t pc, const uint32_t label, const uint64_t start);
 
-  bool _execute(const Instruction* const base, ThreadList::iterator t, const byte* const cur);
+  bool _execute(const Instruction* const base, const size_t i, const byte* const cur);
 
   template <uint32_t X>
-  bool _executeEpsilon(const Instruction* const base, ThreadList::iterator t, const uint64_t offset);
+  bool _executeEpsilon(const Instruction* const base, const size_t i, const uint64_t offset);
 
   template <uint32_t X>
-  bool _executeEpSequence(const Instruction* const base, ThreadList::iterator t, const uint64_t offset);
+  bool _executeEpSequence(const Instruction* const base, const size_t i, const uint64_t offset);
+
+  void _continueThread(const Instruction* const base, const size_t i, const uint64_t offset);
 
-  void _executeThread(const Instruction* const base, ThreadList::iterator t, const byte* const cur, const uint64_t offset);
-  void _executeFrame(const ByteSet& first, ThreadList::iterator t, const Instruction* const base, const byte* const cur, const uint64_t offset);
+  // runs threads [i, n) of Active on *cur
+  void _executeThreads(const Instruction* const base, const size_t i, const size_t n, const byte* const cur, const uint64_t offset);
+  void _step(const Instruction* const base, size_t i, const size_t n, const byte* const cur);
+  void _close(const Instruction* const base, size_t i, const size_t n, const uint64_t offset);
+  void _executeFrame(const ByteSet& first, size_t i, const Instruction* const base, const byte* const cur, const uint64_t offset);
+  void _initStarts(const Instruction* const base);
   void _cleanup();
 
   #ifdef LBT_TRACE_ENABLED
@@ -112,22 +159,82 @@ private:
   uint64_t MaxMatches;
 
   ProgramPtr Prog;
-  const Instruction* ProgEnd;
+  uint32_t ProgEnd;
+
+  #ifdef LBT_VM_DIRECT_THREADED
+  // the program decoded into handler addresses, one per instruction, for
+  // each of _step() and _close(); filled by the first call to each
+  std::vector<const void*> StepTargets,
+                           CloseTargets;
+
+  // the parent threads of the forks being followed in _close()
+  struct Fork {
+    uint32_t PC, Label;
+    uint64_t End;
+  };
+
+  std::vector<Fork> Forks;
+  #endif
+
+  bool SkipScan;
+  SkipScanner Skipper;
+
+  bool UsePrefilter;
+  Prefilter Filter;
+
+  bool Compact;
 
   ThreadList First,
              Active,
              Next;
 
+  // For each byte b, PCs[End[b-1], End[b]) are the PCs of the First
+  // threads which survive b, already advanced past it and past any forks
+  // and jumps after it. It depends only on the program, so copies of the
+  // Vm share it; null if there would be too many.
+  struct StartTable {
+    std::vector<uint32_t> PCs,
+                          End;
+  };
+
+  std::shared_ptr<const StartTable> Starts;
+
   bool SeenNoLabel;
-  SparseSet Seen;
+  LabelSet Seen;
 
   bool LiveNoLabel;
-  SparseSet Live;
+  LabelSet Live;
 
-  std::vector<uint64_t> MatchEnds;
+  LabelValues<uint64_t> MatchEnds;
   uint64_t MatchEndsMax;
 
-  SparseSet CheckLabels;
+  LabelSet CheckLabels;
+
+  // The PCs of the threads in Next, and the label and start of the first
+  // thread at each; see _duplicate(). For big programs, or if compact,
+  // these are hashed instead.
+  SparseSet NextPCs;
+  std::vector<uint32_t> NextPCLabel;
+  std::vector<uint64_t> NextPCStart;
+
+  struct NextPC {
+    uint32_t Label;
+    uint64_t Start;
+
+    NextPC(): Label(0), Start(0) {}
+  };
+
+  bool HashedPCs;
+  LabelMap<NextPC> NextPCMap;
+
+  // whether this frame looks for duplicates at all, and how many it has
+  // dropped
+  bool Dedup;
+  uint32_t Dropped;
+
+  // the number of threads waiting at a finish in Active and in Next
+  uint32_t ActiveFinishes,
+           NextFinishes;
 
   HitCallback CurHitFn;
   void* UserData;
@@ -22,6 +22,9 @@
 #include "fwd_pointers.h"
 #include "searchhit.h"
 
+#include <istream>
+#include <ostream>
+
 class VmInterface {
 public:
   virtual ~VmInterface() {}
@@ -35,9 +38,50 @@ public:
   virtual void closeOut(HitCallback hitFn, void* userData) = 0;
   virtual void reset() = 0;
 
+  // When enabled, search() jumps over bytes which cannot begin a match
+  // while no threads are live. On by default.
+  virtual void setSkipScan(bool enabled) = 0;
+
+  // When enabled, search() also jumps over input which is too far from
+  // any occurrence of the literals the program requires. On by default.
+  // init() builds the prefilter only if enabled, so set this first.
+  virtual void setPrefilter(bool enabled) = 0;
+
+  // When enabled, init() keeps the state the engine has for each label in
+  // hash tables which grow with the labels in play, rather than in arrays
+  // as long as the program has labels. Programs with very many labels get
+  // that regardless. Off by default.
+  virtual void setCompact(bool enabled) = 0;
+
+  // The bytes the engine has allocated for itself, not counting the
+  // program, which is shared.
+  virtual size_t memoryUsage() const = 0;
+
+  // Tells the engine that no more hits are wanted for label until the
+  // next reset, so that it may stop looking for them. Engines which can't
+  // are free to carry on regardless.
+  virtual void retire(uint32_t) {}
+
+  // A new engine for the same program, as this one would be after a
+  // reset(), but without redoing the work of init(). Settings carry over.
+  virtual std::shared_ptr<VmInterface> clone() const = 0;
+
+  // Writes what the search under way depends on: the live threads, the
+  // labels which have matched and how far, and whatever else carries over
+  // from one call to the next. restore() on an engine made the same way,
+  // for the same program, then carries on exactly as this one would have.
+  // Only between calls, not from within a hit callback.
+  virtual void snapshot(std::ostream& out) const = 0;
+  virtual void restore(std::istream& in) = 0;
+
   #ifdef LBT_TRACE_ENABLED
   virtual void setDebugRange(uint64_t beg, uint64_t end) = 0;
   #endif
 
-  static std::shared_ptr<VmInterface> create();
+  // With lazyDfa, searches run on DFA states built as the input needs
+  // them, with the Vm handling whatever they can't. Otherwise, with bits,
+  // they run bit-parallel, which requires BitVm::fits() of the program,
+  // or with table, on the program's transition table, which must not be
+  // empty.
+  static std::shared_ptr<VmInterface> create(bool lazyDfa = false, bool table = false, bool bits = false);
 };
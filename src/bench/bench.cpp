@@ -0,0 +1,1328 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Throughput benchmarks for the search engine. Everything goes through the
+// public C API, so the numbers are what a client would see.
+// Corpora are synthetic and generated from a fixed seed, so runs are
+// comparable.
+//
+// usage: bench WORKLOAD [-s MB] [-r REPEAT]
+//
+
+#include "lightgrep/api.h"
+
+#include "basic.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LBT_BENCH_CYCLES
+#endif
+
+namespace {
+  struct Options {
+    uint64_t Size;   // corpus size, in bytes
+    uint32_t Repeat; // best of this many runs is reported
+  };
+
+  // small, fast, reproducible
+  class Lcg {
+  public:
+    Lcg(uint64_t seed): State(seed) {}
+
+    uint32_t operator()() {
+      State = State * 6364136223846793005ull + 1442695040888963407ull;
+      return State >> 33;
+    }
+
+  private:
+    uint64_t State;
+  };
+
+  struct Program {
+    LG_HPROGRAM Prog;
+    LG_HPATTERNMAP PMap;
+
+    Program(): Prog(nullptr), PMap(nullptr) {}
+
+    ~Program() {
+      lg_destroy_program(Prog);
+      lg_destroy_pattern_map(PMap);
+    }
+  };
+
+  void compile(Program& p, const std::vector<std::string>& pats, const char* enc = "ASCII", bool determinize = true, bool fixed = false) {
+    p.PMap = lg_create_pattern_map(pats.size());
+    LG_HFSM fsm = lg_create_fsm(0);
+    LG_HPATTERN pat = lg_create_pattern();
+
+    const LG_KeyOptions keyOpts{fixed, 0};
+
+    for (const std::string& s : pats) {
+      LG_Error* err = nullptr;
+      lg_parse_pattern(pat, s.c_str(), &keyOpts, &err);
+      if (!err) {
+        lg_add_pattern(fsm, p.PMap, pat, enc, &err);
+      }
+
+      if (err) {
+        const std::string msg(err->Message);
+        lg_free_error(err);
+        lg_destroy_pattern(pat);
+        lg_destroy_fsm(fsm);
+        throw std::runtime_error("bad pattern '" + s + "': " + msg);
+      }
+    }
+
+    const LG_ProgramOptions progOpts{determinize};
+    p.Prog = lg_create_program(fsm, &progOpts);
+
+    lg_destroy_pattern(pat);
+    lg_destroy_fsm(fsm);
+
+    if (!p.Prog) {
+      throw std::runtime_error("could not create program");
+    }
+  }
+
+  void countHit(void* userData, const LG_SearchHit* const) {
+    ++*static_cast<uint64_t*>(userData);
+  }
+
+  struct Result {
+    double MBps;
+    double CyclesPerByte; // 0 where there's no cycle counter
+    uint64_t Hits;
+  };
+
+  uint64_t cycles() {
+    #ifdef LBT_BENCH_CYCLES
+    return __rdtsc();
+    #else
+    return 0;
+    #endif
+  }
+
+  // Searches the corpus in 1 MB blocks, as a client streaming a file would.
+  Result search(const Program& p, const LG_ContextOptions& ctxOpts, const std::vector<byte>& corpus, const Options& opts, const LG_SearchOptions* searchOpts = nullptr) {
+    static const uint64_t BLOCK = 1 << 20;
+
+    LG_HCONTEXT ctx = searchOpts ?
+      lg_create_search_context(p.Prog, &ctxOpts, searchOpts) :
+      lg_create_context(p.Prog, &ctxOpts);
+
+    Result res{0.0, 0.0, 0};
+    for (uint32_t r = 0; r < opts.Repeat; ++r) {
+      uint64_t hits = 0;
+      lg_reset_context(ctx);
+
+      const auto start = std::chrono::steady_clock::now();
+      const uint64_t startCycles = cycles();
+
+      const char* beg = reinterpret_cast<const char*>(corpus.data());
+      for (uint64_t off = 0; off < corpus.size(); off += BLOCK) {
+        const uint64_t len = std::min(BLOCK, corpus.size() - off);
+        lg_search(ctx, beg + off, beg + off + len, off, &hits, countHit);
+      }
+      lg_closeout_search(ctx, &hits, countHit);
+
+      const double cpb = double(cycles() - startCycles) / corpus.size();
+      const std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+
+      res.MBps = std::max(res.MBps, corpus.size() / secs.count() / (1 << 20));
+      res.CyclesPerByte = r ? std::min(res.CyclesPerByte, cpb) : cpb;
+      res.Hits = hits;
+    }
+
+    lg_destroy_context(ctx);
+    return res;
+  }
+
+  LG_ContextOptions contextOptions() {
+    LG_ContextOptions opts;
+    std::memset(&opts, 0, sizeof(opts));
+    return opts;
+  }
+
+  // Fills the corpus with filler and then plants needles at random offsets,
+  // roughly one per rate bytes.
+  template <class Filler>
+  std::vector<byte> makeCorpus(uint64_t size, Filler fill, const std::vector<std::string>& needles, uint64_t rate) {
+    std::vector<byte> buf(size);
+    Lcg rng(0x5EED);
+    for (byte& b : buf) {
+      b = fill(rng);
+    }
+
+    if (!needles.empty()) {
+      for (uint64_t n = 0; n < size / rate; ++n) {
+        const std::string& needle = needles[rng() % needles.size()];
+        const uint64_t off = (uint64_t(rng()) << 16 ^ rng()) % (size - needle.size());
+        std::copy(needle.begin(), needle.end(), buf.begin() + off);
+      }
+    }
+
+    return buf;
+  }
+
+  void printHeader(const std::vector<std::string>& cols) {
+    for (const std::string& c : cols) {
+      std::cout << std::setw(14) << c;
+    }
+    std::cout << '\n';
+  }
+
+  //
+  // sparse: skip-scan on and off over corpora where almost no byte can
+  // begin a match
+  //
+  void benchSparse(const Options& opts) {
+    struct Set {
+      const char* Name;
+      std::vector<std::string> Patterns;
+      std::vector<std::string> Needles;
+    };
+
+    const std::vector<Set> sets{
+      { "zip", { "PK\\x03\\x04" }, { "PK\x03\x04" } },
+      { "keywords", { "mary", "lamb", "little", "fleece", "snow" },
+                    { "mary", "lamb", "snow" } },
+      { "email", { "[a-z0-9._]+@[a-z0-9.]+\\.(com|org|net)" },
+                 { "jon@lightbox.com", "someone@example.org" } },
+      { "hex-ids", { "0x[0-9a-f]{8}", "GUID\\{[0-9A-F-]{36}\\}" },
+                   { "0xdeadbeef" } }
+    };
+
+    const std::vector<std::pair<const char*, byte(*)(Lcg&)>> fillers{
+      { "zeros",  [](Lcg&) -> byte { return 0; } },
+      { "binary", [](Lcg& r) -> byte { return r() % 256; } }
+    };
+
+    printHeader({"patterns", "corpus", "noskip MB/s", "skip MB/s", "speedup", "hits"});
+
+    for (const Set& set : sets) {
+      Program p;
+      compile(p, set.Patterns);
+
+      for (const auto& filler : fillers) {
+        const std::vector<byte> corpus(
+          makeCorpus(opts.Size, filler.second, set.Needles, 1 << 20)
+        );
+
+        // keep the prefilter out of it, to measure skipping alone
+        LG_ContextOptions ctxOpts(contextOptions());
+        ctxOpts.NoPrefilter = 1;
+        ctxOpts.NoSkipScan = 1;
+        const Result off = search(p, ctxOpts, corpus, opts);
+
+        ctxOpts.NoSkipScan = 0;
+        const Result on = search(p, ctxOpts, corpus, opts);
+
+        if (on.Hits != off.Hits) {
+          throw std::runtime_error(std::string("hit counts differ on ") + set.Name);
+        }
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(14) << set.Name
+                  << std::setw(14) << filler.first
+                  << std::setw(14) << off.MBps
+                  << std::setw(14) << on.MBps
+                  << std::setw(13) << on.MBps / off.MBps << 'x'
+                  << std::setw(14) << on.Hits << '\n';
+      }
+    }
+  }
+
+  //
+  // prefilter: required-literal prefilter on and off, from a couple of
+  // patterns up to a large rule set
+  //
+  void benchPrefilter(const Options& opts) {
+    struct Set {
+      std::string Name;
+      std::vector<std::string> Patterns;
+      std::vector<std::string> Needles;
+    };
+
+    std::vector<Set> sets{
+      { "email", { "[a-z0-9._]{1,64}@[a-z0-9.]{1,64}\\.(com|org|net)" },
+                 { "jon@lightbox.com", "someone@example.org" } },
+      { "zip+pdf", { "PK\\x03\\x04", "%PDF-1\\.[0-9]" },
+                   { "PK\x03\x04", "%PDF-1.4" } }
+    };
+
+    // rule sets of made-up identifiers, each with some slop around it
+    Lcg rng(0xBADCAFE);
+    for (uint32_t num : {10u, 100u, 1000u, 10000u, 100000u}) {
+      Set set{"rules-" + std::to_string(num), {}, {}};
+      for (uint32_t i = 0; i < num; ++i) {
+        std::string id;
+        for (uint32_t j = 0; j < 8; ++j) {
+          id += 'a' + rng() % 26;
+        }
+        set.Patterns.push_back("[a-z]{0,4}" + id + "[0-9]{2}");
+        if (i % 10 == 0) {
+          set.Needles.push_back(id + "42");
+        }
+      }
+      sets.push_back(set);
+    }
+
+    printHeader({"patterns", "nofilter MB/s", "filter MB/s", "speedup", "hits"});
+
+    // English-ish text: letters and spaces, so First is no help
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    for (const Set& set : sets) {
+      Program p;
+      compile(p, set.Patterns, "ASCII", set.Patterns.size() < 1000);
+
+      const std::vector<byte> corpus(
+        makeCorpus(opts.Size, text, set.Needles, 1 << 16)
+      );
+
+      LG_ContextOptions ctxOpts(contextOptions());
+      ctxOpts.NoPrefilter = 1;
+      const Result off = search(p, ctxOpts, corpus, opts);
+
+      ctxOpts.NoPrefilter = 0;
+      const Result on = search(p, ctxOpts, corpus, opts);
+
+      if (on.Hits != off.Hits) {
+        throw std::runtime_error("hit counts differ on " + set.Name);
+      }
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << set.Name
+                << std::setw(14) << off.MBps
+                << std::setw(14) << on.MBps
+                << std::setw(13) << on.MBps / off.MBps << 'x'
+                << std::setw(14) << on.Hits << '\n';
+    }
+  }
+
+  //
+  // lazydfa: the lazy DFA against the Vm alone, on text where many threads
+  // are live at once
+  //
+  void benchLazyDfa(const Options& opts) {
+    struct Set {
+      std::string Name;
+      std::vector<std::string> Patterns;
+      std::vector<std::string> Needles;
+    };
+
+    std::vector<Set> sets{
+      { "email", { "[a-z0-9._]+@[a-z0-9.]+\\.(com|org|net)" },
+                 { "jon@lightbox.com", "someone@example.org" } },
+      { "keywords", { "mary", "lamb", "little", "fleece", "snow", "white" },
+                    { "mary", "lamb", "snow" } },
+      { "words", { "[a-z]{3,8}ing", "[a-z]{2,6}tion", "un[a-z]{3,6}" },
+                 { "running", "nation" } }
+    };
+
+    Lcg rng(0xBADCAFE);
+    Set rules{"rules-100", {}, {}};
+    for (uint32_t i = 0; i < 100; ++i) {
+      std::string id;
+      for (uint32_t j = 0; j < 8; ++j) {
+        id += 'a' + rng() % 26;
+      }
+      rules.Patterns.push_back("[a-z]{0,4}" + id + "[0-9]{2}");
+      if (i % 10 == 0) {
+        rules.Needles.push_back(id + "42");
+      }
+    }
+    sets.push_back(rules);
+
+    printHeader({"patterns", "vm MB/s", "dfa MB/s", "speedup", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    for (const Set& set : sets) {
+      Program p;
+      compile(p, set.Patterns);
+
+      const std::vector<byte> corpus(
+        makeCorpus(opts.Size, text, set.Needles, 1 << 16)
+      );
+
+      LG_ContextOptions ctxOpts(contextOptions());
+      ctxOpts.NoTable = 1;
+      ctxOpts.NoBitParallel = 1;
+      const Result off = search(p, ctxOpts, corpus, opts);
+
+      ctxOpts.LazyDfa = 1;
+      const Result on = search(p, ctxOpts, corpus, opts);
+
+      if (on.Hits != off.Hits) {
+        throw std::runtime_error("hit counts differ on " + set.Name);
+      }
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << set.Name
+                << std::setw(14) << off.MBps
+                << std::setw(14) << on.MBps
+                << std::setw(13) << on.MBps / off.MBps << 'x'
+                << std::setw(14) << on.Hits << '\n';
+    }
+  }
+
+  //
+  // table: the program's transition table against running its code
+  //
+  void benchTable(const Options& opts) {
+    struct Set {
+      std::string Name;
+      std::vector<std::string> Patterns;
+      std::vector<std::string> Needles;
+    };
+
+    std::vector<Set> sets{
+      { "email", { "[a-z0-9._]+@[a-z0-9.]+\\.(com|org|net)" },
+                 { "jon@lightbox.com", "someone@example.org" } },
+      { "keywords", { "mary", "lamb", "little", "fleece", "snow", "white" },
+                    { "mary", "lamb", "snow" } },
+      { "words", { "[a-z]{3,8}ing", "[a-z]{2,6}tion", "un[a-z]{3,6}" },
+                 { "running", "nation" } }
+    };
+
+    Lcg rng(0xBADCAFE);
+    Set rules{"rules-100", {}, {}};
+    for (uint32_t i = 0; i < 100; ++i) {
+      std::string id;
+      for (uint32_t j = 0; j < 8; ++j) {
+        id += 'a' + rng() % 26;
+      }
+      rules.Patterns.push_back("[a-z]{0,4}" + id + "[0-9]{2}");
+      if (i % 10 == 0) {
+        rules.Needles.push_back(id + "42");
+      }
+    }
+    sets.push_back(rules);
+
+    printHeader({"patterns", "vm MB/s", "table MB/s", "speedup", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    for (const Set& set : sets) {
+      Program p;
+      compile(p, set.Patterns);
+
+      const std::vector<byte> corpus(
+        makeCorpus(opts.Size, text, set.Needles, 1 << 16)
+      );
+
+      LG_ContextOptions ctxOpts(contextOptions());
+      ctxOpts.NoTable = 1;
+      ctxOpts.NoBitParallel = 1;
+      const Result off = search(p, ctxOpts, corpus, opts);
+
+      ctxOpts.NoTable = 0;
+      const Result on = search(p, ctxOpts, corpus, opts);
+
+      if (on.Hits != off.Hits) {
+        throw std::runtime_error("hit counts differ on " + set.Name);
+      }
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << set.Name
+                << std::setw(14) << off.MBps
+                << std::setw(14) << on.MBps
+                << std::setw(13) << on.MBps / off.MBps << 'x'
+                << std::setw(14) << on.Hits << '\n';
+    }
+  }
+
+  //
+  // bits: bit-parallel search against the Vm and the transition table,
+  // from 1 to 20 patterns of three ranges of letters, which have no
+  // literals for the prefilter to find
+  //
+  void benchBits(const Options& opts) {
+    printHeader({"patterns", "vm MB/s", "table MB/s", "bits MB/s", "speedup", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    Lcg rng(0xB175);
+    std::vector<std::string> pats, needles;
+    for (uint32_t i = 0; i < 20; ++i) {
+      std::string p, n;
+      for (uint32_t j = 0; j < 3; ++j) {
+        const char a = 'a' + rng() % 21;
+        p += std::string("[") + a + '-' + char(a + 5) + ']';
+        n += a;
+      }
+      pats.push_back(p);
+      needles.push_back(n);
+    }
+
+    const std::vector<byte> corpus(
+      makeCorpus(opts.Size, text, needles, 1 << 12)
+    );
+
+    for (uint32_t num : {1u, 2u, 5u, 10u, 20u}) {
+      Program p;
+      compile(p, std::vector<std::string>(pats.begin(), pats.begin() + num));
+
+      LG_ContextOptions ctxOpts(contextOptions());
+      ctxOpts.NoTable = 1;
+      ctxOpts.NoBitParallel = 1;
+      const Result vm = search(p, ctxOpts, corpus, opts);
+
+      ctxOpts.NoTable = 0;
+      const Result table = search(p, ctxOpts, corpus, opts);
+
+      ctxOpts.NoBitParallel = 0;
+      const Result bits = search(p, ctxOpts, corpus, opts);
+
+      if (bits.Hits != vm.Hits || table.Hits != vm.Hits) {
+        throw std::runtime_error("hit counts differ on " + std::to_string(num));
+      }
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << num
+                << std::setw(14) << vm.MBps
+                << std::setw(14) << table.MBps
+                << std::setw(14) << bits.MBps
+                << std::setw(13) << bits.MBps / vm.MBps << 'x'
+                << std::setw(14) << bits.Hits << '\n';
+    }
+  }
+
+  //
+  // keywords: fixed strings through the Aho-Corasick automaton against the
+  // same strings as regexes through the graph, for 10 to 100k keywords
+  //
+  void benchKeywords(const Options& opts) {
+    printHeader({"keywords", "vm build s", "ac build s", "vm MB/s", "ac MB/s", "speedup", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    Lcg rng(0xAC);
+    std::vector<std::string> pats;
+    for (uint32_t i = 0; i < 100000; ++i) {
+      std::string p;
+      for (uint32_t j = 6 + rng() % 10; j > 0; --j) {
+        p += 'a' + rng() % 26;
+      }
+      pats.push_back(p);
+    }
+
+    const std::vector<byte> corpus(
+      makeCorpus(opts.Size, text, pats, 1 << 12)
+    );
+
+    const auto timeCompile = [](Program& p, const std::vector<std::string>& pats, bool fixed) {
+      const auto start = std::chrono::steady_clock::now();
+      compile(p, pats, "ASCII", true, fixed);
+      const std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+      return secs.count();
+    };
+
+    for (uint32_t num : {10u, 100u, 1000u, 10000u, 100000u}) {
+      const std::vector<std::string> some(pats.begin(), pats.begin() + num);
+
+      Program vmProg, acProg;
+      const double vmBuild = timeCompile(vmProg, some, false);
+      const double acBuild = timeCompile(acProg, some, true);
+
+      const LG_ContextOptions ctxOpts(contextOptions());
+      const Result vm = search(vmProg, ctxOpts, corpus, opts);
+      const Result ac = search(acProg, ctxOpts, corpus, opts);
+
+      if (ac.Hits != vm.Hits) {
+        throw std::runtime_error("hit counts differ on " + std::to_string(num));
+      }
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << num
+                << std::setprecision(3)
+                << std::setw(14) << vmBuild
+                << std::setw(14) << acBuild
+                << std::setprecision(1)
+                << std::setw(14) << vm.MBps
+                << std::setw(14) << ac.MBps
+                << std::setw(13) << ac.MBps / vm.MBps << 'x'
+                << std::setw(14) << ac.Hits << '\n';
+    }
+  }
+
+  //
+  // starts: the Vm alone on NFAs with thousands of root branches, where
+  // most start threads die on the byte they're started on
+  //
+  void benchStarts(const Options& opts) {
+    printHeader({"patterns", "vm MB/s", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    for (uint32_t num : {100u, 300u, 1000u}) {
+      // a class of three letters and then a word, so that few patterns
+      // share their first transition
+      Lcg rng(num);
+      std::vector<std::string> pats, words;
+      for (uint32_t i = 0; i < num; ++i) {
+        std::string w(1, 'a' + rng() % 26);
+        for (uint32_t len = 5 + rng() % 4; w.size() < len; ) {
+          w += 'a' + rng() % 26;
+        }
+        words.push_back(w);
+
+        pats.push_back("[" + w.substr(0, 1) + char('a' + rng() % 26) +
+                       char('a' + rng() % 26) + "]" + w.substr(1));
+      }
+
+      const std::vector<byte> corpus(
+        makeCorpus(opts.Size, text, words, 1 << 12)
+      );
+
+      Program p;
+      compile(p, pats, "ASCII", false);
+
+      LG_ContextOptions ctxOpts(contextOptions());
+      ctxOpts.NoPrefilter = 1;
+      ctxOpts.NoTable = 1;
+      ctxOpts.NoBitParallel = 1;
+      const Result vm = search(p, ctxOpts, corpus, opts);
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << num
+                << std::setw(14) << vm.MBps
+                << std::setw(14) << vm.Hits << '\n';
+    }
+  }
+
+  //
+  // threads: the Vm alone, on patterns which keep a thread alive for each
+  // of the last span bytes, so hundreds are live at once
+  //
+  void benchThreads(const Options& opts) {
+    printHeader({"span", "vm MB/s", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    const std::vector<byte> corpus(
+      makeCorpus(opts.Size, text, {"qq"}, 1 << 16)
+    );
+
+    for (uint32_t span : {16u, 64u, 256u}) {
+      Program p;
+      compile(p, {"[a-z][a-z ]{0," + std::to_string(span) + "}qq"});
+
+      LG_ContextOptions ctxOpts(contextOptions());
+      ctxOpts.NoPrefilter = 1;
+      ctxOpts.NoTable = 1;
+      ctxOpts.NoBitParallel = 1;
+      const Result vm = search(p, ctxOpts, corpus, opts);
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << span
+                << std::setw(14) << vm.MBps
+                << std::setw(14) << vm.Hits << '\n';
+    }
+  }
+
+  // the Vm alone, without skipping or prefiltering
+  LG_ContextOptions vmOnlyOptions() {
+    LG_ContextOptions ctxOpts(contextOptions());
+    ctxOpts.NoSkipScan = 1;
+    ctxOpts.NoPrefilter = 1;
+    ctxOpts.NoTable = 1;
+    ctxOpts.NoBitParallel = 1;
+    return ctxOpts;
+  }
+
+  //
+  // dispatch: the Vm alone, on patterns each dominated by one kind of
+  // instruction, in cycles per byte; compare builds with and without
+  // --enable-direct-threading
+  //
+  void benchDispatch(const Options& opts) {
+    struct Mix {
+      const char* Name;
+      std::vector<std::string> Patterns;
+      bool Determinize;
+    };
+
+    const std::vector<Mix> mixes{
+      { "byte", { "the", "and", "ing", "ion" }, false },
+      { "either", { "[ae][nr][dt][se]" }, false },
+      { "range", { "[a-m][n-z][a-m][n-z]" }, false },
+      { "bitvector", { "[aeiou][^aeiou ][aeiou][^aeiou ]" }, false },
+      { "jumptable", { "(ab|cd|ef|gh|ij|kl|mn|op|qr|st|uv|wx)(ab|cd|ef|gh|ij|kl|mn|op|qr|st|uv|wx)" }, true },
+      { "fork", { "[a-z][a-z ]{0,16}qq" }, false }
+    };
+
+    printHeader({"mix", "vm MB/s", "cycles/byte", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    const std::vector<byte> corpus(makeCorpus(opts.Size, text, {}, 1));
+
+    for (const Mix& m : mixes) {
+      Program p;
+      compile(p, m.Patterns, "ASCII", m.Determinize);
+
+      const Result vm = search(p, vmOnlyOptions(), corpus, opts);
+
+      std::cout << std::setw(14) << m.Name
+                << std::fixed << std::setprecision(1)
+                << std::setw(14) << vm.MBps;
+      if (vm.CyclesPerByte > 0.0) {
+        std::cout << std::setw(14) << vm.CyclesPerByte;
+      }
+      else {
+        std::cout << std::setw(14) << '-';
+      }
+      std::cout << std::setw(14) << vm.Hits << '\n';
+    }
+  }
+
+  //
+  // adversarial: the Vm alone, on patterns whose NFAs reach the same
+  // instruction along many paths at once
+  //
+  void benchAdversarial(const Options& opts) {
+    printHeader({"set", "vm MB/s", "hits"});
+
+    // runs of a, each ended by some other letter
+    const auto runs = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 64;
+      return x ? 'a' : 'b' + r() % 4;
+    };
+
+    const auto text = [](Lcg& r) -> byte {
+      return 'a' + r() % 26;
+    };
+
+    const std::vector<byte> runCorpus(makeCorpus(opts.Size, runs, {}, 1)),
+                            textCorpus(makeCorpus(opts.Size, text, {}, 1));
+
+    const struct {
+      const char* Name;
+      std::vector<std::string> Patterns;
+      const std::vector<byte>& Corpus;
+    } sets[] = {
+      { "a|aa", { "(a|aa)*b" }, runCorpus },
+      { "a*a*", { "a*a*a*a*a*c" }, runCorpus },
+      // from re_gen/randpat 16 60 1, less those matching the empty string
+      { "randpat", {
+        "(f+?|c|ke|g)p?q", "b+(a?|(j+?)??|(c?\?)+?)|v", "((x|f*v)e|(j?\?)*?)s", "(k|o|e|((l*)*?h)+q)+?",
+        "(e|p+?)bb(d+?|(f+?)?)", "(zx|z*?(w+?)*?)qw", "(gq|xf)s(p|e)q", "u+|r?st|e|va",
+        "f*smd*?(e*)+|m", "t|r|gp|c|hj|b", "(s+?|l)*?(w|c)|u|a|x", "(n|((p*)+)+?)(jp|p|p)",
+        "(s|u*?|p)fi((q*?)*)?", "n|e|x|q|w|r|w|r", "uu*?pi((z?\?)?\?)*?y", "tx+?y(w+)+(q|f)",
+        "(t(x|(j+?)*)|(q*?)+)ey", "h((l+)+)?|c|x|q+|y", "htir(tb+|x)", "(p+?|n|b)(w??|r)(w+?)?",
+        "t+e|zc|s|b+?|m", "(d??i|l)s+|zc|y", "(u|c)d|((a|l)?|l)k", "(vw+?)+|(v|c)j(f+?)??",
+        "((w|i)??|j)(j|e|w)*u", "f+s(vm|n+?)", "(y+)+?a+(q+?)*?(h|w)", "i*e(ms|(gxn)?\?)",
+        "((s*?)*?(y*?)*|s?)f*h", "(lg?\?)+(q?|((g?)*)?)c", "(e|a)+?(l|p)|odt*", "nn+zp(i|l?)+?"
+      }, textCorpus }
+    };
+
+    for (const auto& set : sets) {
+      Program p;
+      compile(p, set.Patterns, "ASCII", false);
+
+      const Result vm = search(p, vmOnlyOptions(), set.Corpus, opts);
+
+      std::cout << std::setw(14) << set.Name
+                << std::fixed << std::setprecision(1)
+                << std::setw(14) << vm.MBps
+                << std::setw(14) << vm.Hits << '\n';
+    }
+  }
+
+  //
+  // batch: hits taken one callback at a time and in batches, on patterns
+  // which hit every few bytes
+  //
+  void benchBatch(const Options& opts) {
+    printHeader({"batch", "callback MB/s", "batch MB/s", "speedup", "hits"});
+
+    const auto digits = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 12;
+      return x < 10 ? '0' + x : ' ';
+    };
+
+    const std::vector<byte> corpus(makeCorpus(opts.Size, digits, {}, 1));
+
+    Program p;
+    compile(p, {"\\d{4}"});
+
+    const LG_ContextOptions ctxOpts(contextOptions());
+    const Result cb = search(p, ctxOpts, corpus, opts);
+
+    for (size_t batch : {16u, 256u, 4096u}) {
+      LG_HCONTEXT ctx = lg_create_context(p.Prog, &ctxOpts);
+      std::vector<LG_SearchHit> hits(batch);
+
+      Result res{0.0, 0.0, 0};
+      for (uint32_t r = 0; r < opts.Repeat; ++r) {
+        uint64_t total = 0;
+        size_t num;
+        lg_reset_context(ctx);
+
+        const auto start = std::chrono::steady_clock::now();
+
+        const char* const beg = reinterpret_cast<const char*>(corpus.data());
+        for (uint64_t off = 0; off < corpus.size(); total += num) {
+          off = lg_search_hits(ctx, beg + off, beg + corpus.size(), off, hits.data(), batch, &num);
+        }
+
+        do {
+          total += num = lg_closeout_search_hits(ctx, hits.data(), batch);
+        } while (num == batch);
+
+        const std::chrono::duration<double> secs =
+          std::chrono::steady_clock::now() - start;
+
+        res.MBps = std::max(res.MBps, corpus.size() / secs.count() / (1 << 20));
+        res.Hits = total;
+      }
+
+      lg_destroy_context(ctx);
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << batch
+                << std::setw(14) << cb.MBps
+                << std::setw(14) << res.MBps
+                << std::setprecision(2)
+                << std::setw(13) << res.MBps / cb.MBps << 'x'
+                << std::setw(14) << res.Hits << '\n';
+    }
+  }
+
+  //
+  // modes: every hit reported, only counted, capped per pattern, and only
+  // whether there is one, over text with a hit every few hundred bytes
+  //
+  void benchModes(const Options& opts) {
+    printHeader({"mode", "MB/s", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    const std::vector<byte> corpus(
+      makeCorpus(opts.Size, text, {"1999", "2024", "bob@example.com"}, 1 << 8)
+    );
+
+    Program p;
+    compile(p, {"[0-9]{4}", "[a-z]+@[a-z]+\\.com"});
+
+    const struct {
+      const char* Name;
+      LG_SearchOptions SearchOpts;
+    } modes[] = {
+      { "all", {0, 0, 0} },
+      { "count", {0, 1, 0} },
+      { "max-1000", {0, 0, 1000} },
+      { "exists", {1, 0, 0} }
+    };
+
+    for (const auto& m : modes) {
+      const Result res = search(p, contextOptions(), corpus, opts, &m.SearchOpts);
+
+      std::cout << std::setw(14) << m.Name
+                << std::fixed << std::setprecision(1)
+                << std::setw(14) << res.MBps
+                << std::setw(14) << res.Hits << '\n';
+    }
+  }
+
+  //
+  // parallel: one buffer searched whole by lg_search_parallel() on 1 to 8
+  // threads, against lg_search() in blocks; the speedup is bounded by the
+  // number of cores
+  //
+  void benchParallel(const Options& opts) {
+    printHeader({"threads", "serial MB/s", "parallel MB/s", "speedup", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 32;
+      return x < 26 ? 'a' + x : ' ';
+    };
+
+    const std::vector<byte> corpus(
+      makeCorpus(opts.Size, text, {"1999", "2024", "bob@example.com"}, 1 << 12)
+    );
+
+    Program p;
+    compile(p, {"[0-9]{4}", "[a-z]+@[a-z]+\\.com", "[a-z]{3}[aeiou]{3}"});
+
+    const LG_ContextOptions ctxOpts(contextOptions());
+    const Result serial = search(p, ctxOpts, corpus, opts);
+
+    for (uint32_t threads : {1u, 2u, 4u, 8u}) {
+      Result res{0.0, 0.0, 0};
+      for (uint32_t r = 0; r < opts.Repeat; ++r) {
+        uint64_t hits = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        const char* const beg = reinterpret_cast<const char*>(corpus.data());
+        lg_search_parallel(
+          p.Prog, &ctxOpts, beg, beg + corpus.size(), 0, threads, &hits, countHit
+        );
+
+        const std::chrono::duration<double> secs =
+          std::chrono::steady_clock::now() - start;
+
+        res.MBps = std::max(res.MBps, corpus.size() / secs.count() / (1 << 20));
+        res.Hits = hits;
+      }
+
+      if (res.Hits != serial.Hits) {
+        throw std::runtime_error("hit counts differ on " + std::to_string(threads) + " threads");
+      }
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << threads
+                << std::setw(14) << serial.MBps
+                << std::setw(14) << res.MBps
+                << std::setprecision(2)
+                << std::setw(13) << res.MBps / serial.MBps << 'x'
+                << std::setw(14) << res.Hits << '\n';
+    }
+  }
+
+  //
+  // contexts: setting up a context for each file, by creating, cloning
+  // and taking one from a pool, as the program grows
+  //
+  void benchContexts(const Options& opts) {
+    printHeader({"patterns", "create us", "clone us", "pool us"});
+
+    for (uint32_t num : {1000u, 10000u, 100000u}) {
+      Lcg rng(0xC0DE);
+      std::vector<std::string> pats;
+      for (uint32_t i = 0; i < num; ++i) {
+        std::string p;
+        for (uint32_t j = 0; j < 6; ++j) {
+          p += 'a' + rng() % 26;
+        }
+        pats.push_back(p + "[0-9]+");
+      }
+
+      Program p;
+      compile(p, pats, "ASCII", false);
+
+      const LG_ContextOptions ctxOpts(vmOnlyOptions());
+      const uint32_t n = std::max(uint64_t(10), opts.Size >> 20);
+
+      // microseconds for each of n contexts, best of the repeats
+      const auto time = [&](const std::function<void()>& f) {
+        double best = 0.0;
+        for (uint32_t r = 0; r < opts.Repeat; ++r) {
+          const auto start = std::chrono::steady_clock::now();
+          for (uint32_t i = 0; i < n; ++i) {
+            f();
+          }
+          const std::chrono::duration<double, std::micro> us =
+            std::chrono::steady_clock::now() - start;
+          best = r ? std::min(best, us.count() / n) : us.count() / n;
+        }
+        return best;
+      };
+
+      const double create = time([&]() {
+        lg_destroy_context(lg_create_context(p.Prog, &ctxOpts));
+      });
+
+      LG_HCONTEXT proto = lg_create_context(p.Prog, &ctxOpts);
+      const double clone = time([&]() {
+        lg_destroy_context(lg_clone_context(proto));
+      });
+      lg_destroy_context(proto);
+
+      LG_HCONTEXTPOOL pool = lg_create_context_pool(p.Prog, &ctxOpts, nullptr);
+      const double pooled = time([&]() {
+        lg_release_context(pool, lg_acquire_context(pool));
+      });
+      lg_destroy_context_pool(pool);
+
+      std::cout << std::fixed << std::setprecision(1)
+                << std::setw(14) << num
+                << std::setw(14) << create
+                << std::setw(14) << clone
+                << std::setw(14) << pooled << '\n';
+    }
+  }
+
+  //
+  // cache: compiling pattern lists of more and more patterns through the
+  // program cache, the first time, when the program is stored, and again,
+  // when it's mapped from the cache
+  //
+  void benchCache(const Options&) {
+    printHeader({"patterns", "how", "ms"});
+
+    const char* encs[] = {"ASCII"};
+    const LG_KeyOptions keyOpts{0, 0};
+    const LG_ProgramOptions progOpts{1};
+
+    for (uint32_t num : {10000u, 100000u, 1000000u}) {
+      Lcg rng(0xCAC4E);
+      std::string pats;
+      for (uint32_t i = 0; i < num; ++i) {
+        for (uint32_t j = 0; j < 6; ++j) {
+          pats += 'a' + rng() % 26;
+        }
+        pats += "[0-9]+\n";
+      }
+
+      char name[37];
+      lg_program_cache_file(pats.c_str(), encs, 1, &keyOpts, &progOpts, name);
+      std::remove(name);
+
+      for (const char* how : {"compiled", "cached"}) {
+        LG_HPROGRAM prog;
+        LG_HPATTERNMAP pmap;
+        LG_Error* err = nullptr;
+
+        const auto start = std::chrono::steady_clock::now();
+        const int ret = lg_cached_program(
+          ".", pats.c_str(), encs, 1, &keyOpts, &progOpts, &prog, &pmap, &err
+        );
+        const std::chrono::duration<double> secs =
+          std::chrono::steady_clock::now() - start;
+
+        if (ret < 0 || err) {
+          throw std::runtime_error("could not compile the patterns");
+        }
+        lg_destroy_program(prog);
+        lg_destroy_pattern_map(pmap);
+
+        std::cout << std::setw(14) << num
+                  << std::setw(14) << how
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << secs.count() * 1000 << '\n';
+      }
+
+      std::remove(name);
+    }
+  }
+
+  //
+  // load: reading back serialized programs with more and more patterns, by
+  // copying the buffer, by using it in place, and by mapping a file, and
+  // reading back the pattern maps written with them
+  //
+  void benchLoad(const Options& opts) {
+    printHeader({"patterns", "program MB", "how", "ms/load"});
+
+    const char path[] = "bench_program.tmp";
+
+    for (uint32_t num : {1000u, 100000u, 1000000u}) {
+      Lcg rng(0x10AD);
+      std::vector<std::string> pats;
+      for (uint32_t i = 0; i < num; ++i) {
+        std::string p;
+        for (uint32_t j = 0; j < 6; ++j) {
+          p += 'a' + rng() % 26;
+        }
+        pats.push_back(p + "[0-9]+");
+      }
+
+      Program p;
+      compile(p, pats, "ASCII", false);
+
+      std::vector<char> buf(lg_program_size_with_pattern_map(p.Prog, p.PMap));
+      lg_write_program_with_pattern_map(p.Prog, p.PMap, buf.data());
+
+      std::FILE* f = std::fopen(path, "wb");
+      if (!f || std::fwrite(buf.data(), 1, buf.size(), f) != buf.size()) {
+        throw std::runtime_error("could not write the program file");
+      }
+      std::fclose(f);
+
+      struct Loader {
+        const char* Name;
+        std::function<void*()> Load;
+        std::function<void(void*)> Destroy;
+      };
+
+      const auto destroyProgram = [](void* h){ lg_destroy_program(static_cast<LG_HPROGRAM>(h)); };
+      const auto destroyMap = [](void* h){ lg_destroy_pattern_map(static_cast<LG_HPATTERNMAP>(h)); };
+
+      const std::vector<Loader> loaders{
+        { "copy", [&](){ return lg_read_program(buf.data(), buf.size()); }, destroyProgram },
+        { "in place", [&](){ return lg_program_from_buffer_nocopy(buf.data(), buf.size()); }, destroyProgram },
+        { "mapped", [&](){ return lg_read_program_mapped(path); }, destroyProgram },
+        { "map copy", [&](){ return lg_read_pattern_map(buf.data(), buf.size()); }, destroyMap },
+        { "map mapped", [&](){ return lg_read_pattern_map_mapped(path); }, destroyMap }
+      };
+
+      for (const Loader& l : loaders) {
+        double best = 0.0;
+        for (uint32_t r = 0; r < opts.Repeat; ++r) {
+          const auto start = std::chrono::steady_clock::now();
+          void* h = l.Load();
+          const std::chrono::duration<double> secs =
+            std::chrono::steady_clock::now() - start;
+          if (!h) {
+            throw std::runtime_error("could not read the program");
+          }
+          l.Destroy(h);
+          best = r ? std::min(best, secs.count()) : secs.count();
+        }
+
+        std::cout << std::setw(14) << num
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << buf.size() / double(1 << 20)
+                  << std::setw(14) << l.Name
+                  << std::setprecision(3)
+                  << std::setw(14) << best * 1000 << '\n';
+      }
+    }
+
+    std::remove(path);
+  }
+
+  //
+  // memory: the bytes a context holds after a search, and search speed,
+  // with per-pattern state in arrays and hashed, as the program grows
+  //
+  void benchMemory(const Options& opts) {
+    printHeader({"patterns", "state", "context KB", "MB/s", "hits"});
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 40;
+      return x < 26 ? 'a' + x : x < 36 ? '0' + x - 26 : ' ';
+    };
+
+    const std::vector<byte> corpus(makeCorpus(opts.Size, text, {}, 1));
+
+    for (uint32_t num : {1000u, 50000u, 1000000u}) {
+      Lcg rng(0x3E3);
+      std::vector<std::string> pats;
+      for (uint32_t i = 0; i < num; ++i) {
+        std::string p;
+        for (uint32_t j = 0; j < 6; ++j) {
+          p += 'a' + rng() % 26;
+        }
+        pats.push_back(p + "[0-9]+");
+      }
+
+      Program p;
+      compile(p, pats, "ASCII", false);
+
+      for (bool compact : {false, true}) {
+        LG_ContextOptions ctxOpts(vmOnlyOptions());
+        ctxOpts.Compact = compact;
+
+        const Result res(search(p, ctxOpts, corpus, opts));
+
+        // hashed state grows as it's used, so measure it after a search
+        LG_HCONTEXT ctx = lg_create_context(p.Prog, &ctxOpts);
+        uint64_t hits = 0;
+        lg_search(ctx, reinterpret_cast<const char*>(corpus.data()),
+          reinterpret_cast<const char*>(corpus.data() + corpus.size()), 0, &hits, countHit);
+        const uint64_t bytes = lg_context_memory_usage(ctx);
+        lg_destroy_context(ctx);
+
+        std::cout << std::setw(14) << num
+                  << std::setw(14) << (compact ? "hashed" : "default")
+                  << std::setw(14) << bytes / 1024
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << res.MBps
+                  << std::setw(14) << res.Hits << '\n';
+      }
+    }
+  }
+
+  //
+  // reset: many small buffers, each in a fresh search, against programs
+  // with more and more patterns, so that resetting the context between
+  // buffers is a large share of the work
+  //
+  void benchReset(const Options& opts) {
+    printHeader({"patterns", "engine", "us/buffer", "MB/s", "hits"});
+
+    static const uint64_t BUFFER = 4 << 10;
+
+    const auto text = [](Lcg& r) -> byte {
+      const uint32_t x = r() % 40;
+      return x < 26 ? 'a' + x : x < 36 ? '0' + x - 26 : ' ';
+    };
+
+    const std::vector<byte> corpus(makeCorpus(opts.Size, text, {}, 1));
+    const char* const beg = reinterpret_cast<const char*>(corpus.data());
+    const uint64_t numBuffers = corpus.size() / BUFFER;
+
+    for (uint32_t num : {1000u, 100000u, 1000000u}) {
+      Lcg rng(0x4E5E);
+      std::vector<std::string> pats;
+      for (uint32_t i = 0; i < num; ++i) {
+        std::string p;
+        for (uint32_t j = 0; j < 6; ++j) {
+          p += 'a' + rng() % 26;
+        }
+        pats.push_back(p + "[0-9]+");
+      }
+
+      Program p;
+      compile(p, pats, "ASCII", false);
+
+      const struct {
+        const char* Name;
+        LG_ContextOptions CtxOpts;
+      } engines[] = {
+        { "auto", contextOptions() },
+        { "vm", vmOnlyOptions() }
+      };
+
+      for (const auto& e : engines) {
+        LG_HCONTEXT ctx = lg_create_context(p.Prog, &e.CtxOpts);
+
+        double best = 0.0;
+        uint64_t hits = 0;
+        for (uint32_t r = 0; r < opts.Repeat; ++r) {
+          hits = 0;
+          const auto start = std::chrono::steady_clock::now();
+
+          for (uint64_t i = 0; i < numBuffers; ++i) {
+            const char* const buf = beg + i * BUFFER;
+            lg_reset_context(ctx);
+            lg_search(ctx, buf, buf + BUFFER, 0, &hits, countHit);
+            lg_closeout_search(ctx, &hits, countHit);
+          }
+
+          const std::chrono::duration<double, std::micro> us =
+            std::chrono::steady_clock::now() - start;
+          best = r ? std::min(best, us.count()) : us.count();
+        }
+
+        lg_destroy_context(ctx);
+
+        std::cout << std::setw(14) << num
+                  << std::setw(14) << e.Name
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(14) << best / numBuffers
+                  << std::setprecision(1)
+                  << std::setw(14) << numBuffers * BUFFER / best * 1e6 / (1 << 20)
+                  << std::setw(14) << hits << '\n';
+      }
+    }
+  }
+
+  typedef void (*Workload)(const Options&);
+
+  const std::map<std::string, Workload>& workloads() {
+    static const std::map<std::string, Workload> w{
+      { "adversarial", benchAdversarial },
+      { "batch", benchBatch },
+      { "bits", benchBits },
+      { "cache", benchCache },
+      { "contexts", benchContexts },
+      { "dispatch", benchDispatch },
+      { "keywords", benchKeywords },
+      { "lazydfa", benchLazyDfa },
+      { "load", benchLoad },
+      { "memory", benchMemory },
+      { "modes", benchModes },
+      { "parallel", benchParallel },
+      { "prefilter", benchPrefilter },
+      { "reset", benchReset },
+      { "sparse", benchSparse },
+      { "starts", benchStarts },
+      { "table", benchTable },
+      { "threads", benchThreads }
+    };
+    return w;
+  }
+
+  int usage() {
+    std::cerr << "usage: bench WORKLOAD [-s MB] [-r REPEAT]\n"
+              << "workloads:";
+    for (const auto& w : workloads()) {
+      std::cerr << ' ' << w.first;
+    }
+    std::cerr << std::endl;
+    return 1;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || !workloads().count(argv[1])) {
+    return usage();
+  }
+
+  Options opts{64 << 20, 3};
+
+  for (int i = 2; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-s") && i + 1 < argc) {
+      opts.Size = std::strtoull(argv[++i], nullptr, 10) << 20;
+    }
+    else if (!std::strcmp(argv[i], "-r") && i + 1 < argc) {
+      opts.Repeat = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else {
+      return usage();
+    }
+  }
+
+  try {
+    workloads().find(argv[1])->second(opts);
+  }
+  catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
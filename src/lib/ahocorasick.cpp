@@ -0,0 +1,281 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ahocorasick.h"
+#include "byteset.h"
+
+#include <algorithm>
+#include <limits>
+
+const uint32_t AhoCorasick::NONE = std::numeric_limits<uint32_t>::max();
+
+namespace {
+  struct Node {
+    uint32_t State;
+    size_t Lo, Hi; // the keywords it's a prefix of
+  };
+
+  struct Child {
+    byte Byte;
+    size_t Lo, Hi;
+  };
+}
+
+void AhoCorasick::build(std::vector<std::pair<std::string, uint32_t>> keywords, bool foldCase) {
+  for (uint32_t b = 0; b < 256; ++b) {
+    Fold[b] = foldCase ? lower(b) : b;
+  }
+
+  // keywords which differ only in folded bytes are one and the same
+  for (auto& k : keywords) {
+    for (char& c : k.first) {
+      c = Fold[byte(c)];
+    }
+  }
+
+  std::sort(keywords.begin(), keywords.end());
+  keywords.erase(std::unique(keywords.begin(), keywords.end()), keywords.end());
+
+  NumLabels = 0;
+  for (const auto& k : keywords) {
+    NumLabels = std::max(NumLabels, k.second + 1);
+  }
+
+  Base.clear();
+  Check.clear();
+  Fail.clear();
+  Depth.clear();
+  Out.clear();
+  Outputs.clear();
+  Dense.clear();
+
+  if (keywords.empty() || keywords.back().first.empty()) {
+    // nothing to find; the empty string is no keyword
+    return;
+  }
+
+  Base.assign(1, 0);
+  Check.assign(1, NONE);
+  Fail.assign(1, 0);
+  Depth.assign(1, 0);
+  Out.assign(1, NONE);
+
+  std::vector<bool> used(1, true);
+
+  const auto grow = [&](size_t size) {
+    if (size > used.size()) {
+      size = std::max(size, 2 * used.size());
+      Base.resize(size, 0);
+      Check.resize(size, NONE);
+      Fail.resize(size, 0);
+      Depth.resize(size, 0);
+      Out.resize(size, NONE);
+      used.resize(size, false);
+    }
+  };
+
+  // States are given their children breadth-first, so failure links and
+  // the outputs of shorter suffixes are always there when needed.
+  std::vector<Node> queue;
+  size_t lo = 0;
+  while (lo < keywords.size() && keywords[lo].first.empty()) {
+    ++lo;
+  }
+  queue.push_back(Node{0, lo, keywords.size()});
+
+  std::vector<Child> kids;
+  std::vector<uint32_t> labels;
+  size_t firstFree = 1;
+
+  for (size_t qi = 0; qi < queue.size(); ++qi) {
+    const Node node = queue[qi];
+    const uint32_t d = Depth[node.State];
+
+    kids.clear();
+    for (size_t i = node.Lo; i < node.Hi; ) {
+      const byte b = keywords[i].first[d];
+      size_t j = i + 1;
+      while (j < node.Hi && byte(keywords[j].first[d]) == b) {
+        ++j;
+      }
+      kids.push_back(Child{b, i, j});
+      i = j;
+    }
+
+    if (kids.empty()) {
+      continue;
+    }
+
+    // find the first base putting every child in a free slot
+    const size_t start = firstFree;
+    size_t pos = start, occupied = 0, base = 0;
+    for ( ; ; ++pos) {
+      grow(pos + 1);
+      if (used[pos]) {
+        ++occupied;
+        continue;
+      }
+
+      if (pos <= kids.front().Byte) {
+        // the base has to be positive, so the root is no one's child
+        continue;
+      }
+
+      base = pos - kids.front().Byte;
+      grow(base + 256);
+
+      bool fits = true;
+      for (const Child& k : kids) {
+        if (used[base + k.Byte]) {
+          fits = false;
+          break;
+        }
+      }
+
+      if (fits) {
+        break;
+      }
+    }
+
+    // skip over stretches which are nearly full, rather than rescanning
+    // them for every state
+    if (occupied >= 0.95 * (pos - start + 1)) {
+      firstFree = pos;
+    }
+
+    Base[node.State] = base;
+
+    for (const Child& k : kids) {
+      const uint32_t t = base + k.Byte;
+      used[t] = true;
+      Check[t] = node.State;
+      Depth[t] = d + 1;
+      Fail[t] = node.State == 0 ? 0 : next(Fail[node.State], k.Byte);
+
+      // keywords ending here sort before those running on
+      labels.clear();
+      size_t i = k.Lo;
+      for ( ; i < k.Hi && keywords[i].first.size() == d + 1; ++i) {
+        labels.push_back(keywords[i].second);
+      }
+
+      uint32_t o = Out[Fail[t]];
+      for (auto l = labels.rbegin(); l != labels.rend(); ++l) {
+        Outputs.push_back(Output{*l, d + 1, o});
+        o = Outputs.size() - 1;
+      }
+      Out[t] = o;
+
+      queue.push_back(Node{t, i, k.Hi});
+    }
+  }
+
+  // trim the slack, but leave room for every base plus any byte, so
+  // child() needn't check bounds
+  size_t size = used.size();
+  while (size > 1 && !used[size - 1]) {
+    --size;
+  }
+
+  const size_t states = size;
+  for (size_t s = 0; s < states; ++s) {
+    size = std::max(size, size_t(Base[s]) + 256);
+  }
+
+  Base.resize(size, 0);
+  Check.resize(size, NONE);
+  Fail.resize(size, 0);
+  Depth.resize(size, 0);
+  Out.resize(size, NONE);
+
+  densify();
+}
+
+void AhoCorasick::densify(size_t maxEntries) {
+  Dense.clear();
+  if (empty()) {
+    return;
+  }
+
+  ByteSet used;
+  for (uint32_t t = 0; t < Check.size(); ++t) {
+    if (Check[t] != NONE) {
+      used.set(byte(t - Base[Check[t]]));
+    }
+  }
+
+  // Bytes which no state has a child on, even folded, always go back to
+  // the root, so they share a class, 0; if there are none, there's no such
+  // class. Folded bytes take the class of their stand-ins.
+  bool unused = false;
+  for (uint32_t b = 0; b < 256; ++b) {
+    unused |= !used[Fold[b]];
+  }
+
+  uint32_t rep[256];
+  NumClasses = unused ? 1 : 0;
+  for (uint32_t b = 0; b < 256; ++b) {
+    if (Fold[b] != b) {
+      continue;
+    }
+
+    if (used[b]) {
+      rep[NumClasses] = b;
+      Classes[b] = NumClasses++;
+    }
+    else {
+      rep[0] = b;
+      Classes[b] = 0;
+    }
+  }
+
+  for (uint32_t b = 0; b < 256; ++b) {
+    Classes[b] = Classes[Fold[b]];
+  }
+
+  if (Base.size() * NumClasses > std::min(maxEntries, size_t(HAS_OUTPUT))) {
+    return;
+  }
+
+  // leave the entries of unused slots pointing at the root
+  Dense.assign(Base.size() * NumClasses, 0);
+  for (uint32_t s = 0; s < Base.size(); ++s) {
+    if (s == 0 || Check[s] != NONE) {
+      for (uint32_t c = 0; c < NumClasses; ++c) {
+        const uint32_t t = next(s, rep[c]);
+        Dense[s * NumClasses + c] =
+          t * NumClasses | (Out[t] == NONE ? 0 : HAS_OUTPUT);
+      }
+    }
+  }
+}
+
+bool AhoCorasick::operator==(const AhoCorasick& other) const {
+  return NumLabels == other.NumLabels &&
+         std::equal(Fold, Fold + 256, other.Fold) &&
+         Base == other.Base &&
+         Check == other.Check &&
+         Fail == other.Fail &&
+         Depth == other.Depth &&
+         Out == other.Out &&
+         Outputs.size() == other.Outputs.size() &&
+         std::equal(Outputs.begin(), Outputs.end(), other.Outputs.begin(),
+           [](const Output& a, const Output& b) {
+             return a.Label == b.Label && a.Length == b.Length && a.Next == b.Next;
+           });
+}
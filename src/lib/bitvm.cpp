@@ -0,0 +1,349 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bitvm.h"
+#include "program.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+  const uint64_t NONE = std::numeric_limits<uint64_t>::max();
+}
+
+BitVm::BitVm():
+  SkipScan(true),
+  UsePrefilter(true),
+  NumChunks(0),
+  Initial(0),
+  Accept(0),
+  AllAccept(0),
+  InVm(false) {}
+
+bool BitVm::fits(const Program& prog) {
+  return !prog.Table.empty() && prog.Table.States.size() <= MAX_STATES;
+}
+
+void BitVm::init(ProgramPtr prog) {
+  Prog = prog;
+  Fallback.init(prog);
+
+  const DfaTable& tbl(Prog->Table);
+  const uint32_t numStates = tbl.States.size();
+  NumChunks = (numStates + 6) / 8;
+
+  std::vector<uint64_t> reach(tbl.NumClasses, 0);
+  Follow.assign(256 * NumChunks, 0);
+  Initial = Accept = 0;
+
+  // the children of each state, on any byte
+  std::vector<uint64_t> children(numStates, 0);
+
+  for (uint32_t s = 0; s < numStates; ++s) {
+    for (uint32_t c = 0; c < tbl.NumClasses; ++c) {
+      const uint32_t e = tbl.next(s, c);
+      if (e == DfaTable::DEAD) {
+        continue;
+      }
+
+      const uint32_t* l = &e;
+      uint32_t n = 1;
+      if (e & DfaTable::LIST) {
+        l = &tbl.Lists[e & ~DfaTable::LIST];
+        n = *l++;
+      }
+
+      for (uint32_t i = 0; i < n; ++i) {
+        const uint64_t bit = uint64_t(1) << ((l[i] & ~DfaTable::NOCHECK) - 1);
+        children[s] |= bit;
+        reach[c] |= bit;
+      }
+    }
+
+    if (s > 0 && tbl.States[s].Match) {
+      Accept |= uint64_t(1) << (s - 1);
+    }
+  }
+
+  Initial = children[0];
+
+  // A thread's label is the one given by the last labeling state it went
+  // through, so the labels possible in each state spread from those.
+  std::vector<std::vector<uint32_t>> labels(numStates);
+  labels[0].push_back(Thread::NOLABEL);
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (uint32_t s = 0; s < numStates; ++s) {
+      for (uint32_t c = 1; c < numStates; ++c) {
+        if (!(children[s] & (uint64_t(1) << (c - 1)))) {
+          continue;
+        }
+
+        const uint32_t label = tbl.States[c].Label;
+        for (const uint32_t l : label == Thread::NOLABEL ? labels[s] : std::vector<uint32_t>(1, label)) {
+          if (std::find(labels[c].begin(), labels[c].end(), l) == labels[c].end()) {
+            labels[c].push_back(l);
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  AcceptLabels.assign(numStates, std::vector<uint32_t>());
+  uint32_t numLabels = 0;
+  for (uint32_t s = 1; s < numStates; ++s) {
+    if (tbl.States[s].Match) {
+      AcceptLabels[s - 1] = labels[s];
+    }
+
+    if (tbl.States[s].Label != Thread::NOLABEL) {
+      numLabels = std::max(numLabels, tbl.States[s].Label + 1);
+    }
+  }
+
+  AllAccept = Accept;
+  Retired.assign(numLabels, false);
+
+  for (uint32_t b = 0; b < 256; ++b) {
+    Reach[b] = reach[tbl.Classes[b]];
+  }
+
+  for (uint32_t k = 0; k < NumChunks; ++k) {
+    for (uint32_t x = 0; x < 256; ++x) {
+      uint64_t f = 0;
+      for (uint32_t b = 0; b < 8; ++b) {
+        const uint32_t s = 8 * k + b + 1;
+        if ((x & (1 << b)) && s < numStates) {
+          f |= children[s];
+        }
+      }
+      Follow[256 * k + x] = f;
+    }
+  }
+
+  Skipper.init(Prog->First);
+  Filter.init(UsePrefilter ? Prog->Literals : RequiredLiterals());
+
+  InVm = false;
+}
+
+void BitVm::setSkipScan(bool enabled) {
+  SkipScan = enabled;
+  Fallback.setSkipScan(enabled);
+}
+
+void BitVm::setPrefilter(bool enabled) {
+  UsePrefilter = enabled;
+  Fallback.setPrefilter(enabled);
+}
+
+void BitVm::startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  Fallback.startsWith(beg, end, startOffset, hitFn, userData);
+}
+
+uint64_t BitVm::searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  const uint64_t ret = Fallback.searchResolve(beg, end, startOffset, hitFn, userData);
+  InVm = !Fallback.active().empty();
+  return ret;
+}
+
+void BitVm::closeOut(HitCallback hitFn, void* userData) {
+  Fallback.closeOut(hitFn, userData);
+}
+
+std::shared_ptr<VmInterface> BitVm::clone() const {
+  std::shared_ptr<BitVm> c(new BitVm(*this));
+  c->reset();
+  return c;
+}
+
+size_t BitVm::memoryUsage() const {
+  // the Fallback is counted in both
+  return sizeof(*this) - sizeof(Fallback) + Fallback.memoryUsage() +
+    Filter.memoryUsage() + vectorBytes(Lits) + vectorBytes(Follow);
+}
+
+void BitVm::snapshot(std::ostream& out) const {
+  writeSnapshotValue(out, BIT_SNAPSHOT);
+  writeSnapshotValue(out, byte(InVm));
+  Fallback.snapshot(out);
+}
+
+void BitVm::restore(std::istream& in) {
+  readSnapshotTag(in, BIT_SNAPSHOT);
+  InVm = readSnapshotValue<byte>(in);
+  Fallback.restore(in);
+}
+
+void BitVm::reset() {
+  Fallback.reset();
+  InVm = false;
+
+  Accept = AllAccept;
+  Retired.assign(Retired.size(), false);
+}
+
+void BitVm::retire(uint32_t label) {
+  Fallback.retire(label);
+
+  if (label >= Retired.size() || Retired[label]) {
+    return;
+  }
+  Retired[label] = true;
+
+  // the Vm reports nothing for retired labels, so there is no need to
+  // hand it a match which only they could have
+  for (uint32_t i = 0; i < AcceptLabels.size(); ++i) {
+    const std::vector<uint32_t>& l(AcceptLabels[i]);
+    if ((Accept & (uint64_t(1) << i)) && std::all_of(l.begin(), l.end(),
+      [this](uint32_t x) { return x != Thread::NOLABEL && x < Retired.size() && Retired[x]; }))
+    {
+      Accept &= ~(uint64_t(1) << i);
+    }
+  }
+}
+
+inline uint64_t BitVm::_follow(const uint64_t d) const {
+  uint64_t f = 0;
+  for (uint32_t k = 0; k < NumChunks; ++k) {
+    f |= Follow[256 * k + ((d >> (8 * k)) & 0xFF)];
+  }
+  return f;
+}
+
+uint64_t BitVm::search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  const ByteSet& first = Prog->First;
+  const byte* cur = beg;
+  uint64_t offset = startOffset;
+
+  // skipping and prefiltering are exactly as in Vm::search(), as which
+  // threads the Vm starts decides the order in which it reports hits
+  const bool skip = SkipScan && Skipper.worthwhile(),
+             filter = UsePrefilter && !Filter.empty();
+
+  const uint64_t lead = Filter.maxLead(),
+                 longest = Filter.maxLength();
+  const byte* const tail = !filter ? end :
+    uint64_t(end - beg) >= longest ? end - longest + 1 : beg;
+
+  // The next literal found from each place asked about since the start of
+  // the current run, so the Vm can be rewound without looking again. Each
+  // is the next one from anywhere since the one before.
+  Lits.clear();
+  size_t li = 0;
+
+  const auto window = [&](const byte* cur) {
+    while (li < Lits.size() && Lits[li] < cur) {
+      ++li;
+    }
+
+    if (li == Lits.size()) {
+      Lits.push_back(Filter.next(cur, end));
+    }
+
+    const byte* const n = std::min(Lits[li], tail);
+    return n > cur && uint64_t(n - cur) > lead ? n - lead : cur;
+  };
+
+  const ByteSet none;
+
+  // runs the Vm from cur, at least past until, and then until its threads
+  // die out
+  const auto runVm = [&](const uint64_t until) {
+    while (cur < end) {
+      Fallback.executeFrame(
+        filter && window(cur) != cur ? none : first, cur, offset, hitFn, userData
+      );
+      Fallback.cleanup();
+      ++cur;
+      ++offset;
+
+      if (offset > until && Fallback.active().empty()) {
+        break;
+      }
+    }
+
+    InVm = !Fallback.active().empty();
+  };
+
+  if (InVm) {
+    // the Vm has threads from the last buffer
+    runVm(offset);
+  }
+
+  // the states reachable, and the first byte of the run which reached them
+  uint64_t d = 0;
+  const byte* from = cur;
+
+  while (cur < end) {
+    if (!d) {
+      // nothing is reachable, so jump to the next byte which could begin
+      // a match, as the Vm would
+      const byte* const prev = cur;
+      if (skip || filter) {
+        for (const byte* p = nullptr; cur != p && cur < end; ) {
+          p = cur;
+          if (skip) {
+            cur = Skipper.next(cur, end);
+          }
+
+          if (filter && cur < end) {
+            cur = window(cur);
+          }
+        }
+      }
+      else {
+        while (cur < end && !(Initial & Reach[*cur])) {
+          ++cur;
+        }
+      }
+
+      offset += cur - prev;
+
+      if (cur == end) {
+        break;
+      }
+
+      from = cur;
+      Lits.erase(Lits.begin(), Lits.begin() + li);
+      li = 0;
+    }
+
+    d = (_follow(d) | (filter && window(cur) != cur ? 0 : Initial)) & Reach[*cur];
+
+    if ((d & Accept) || (d && cur + 1 == end)) {
+      // Something may match, or threads may be live at the end and have
+      // to be carried over; either way, the Vm takes it from here.
+      const uint64_t until = offset;
+      offset -= cur - from;
+      cur = from;
+      li = 0;
+      runVm(until);
+      d = 0;
+    }
+    else {
+      ++cur;
+      ++offset;
+    }
+  }
+
+  // with no bytes, this just finds the Vm's first live thread
+  return InVm ? Fallback.searchResolve(end, end, offset, hitFn, userData) : NONE;
+}
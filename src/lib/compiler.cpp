@@ -18,10 +18,13 @@
 
 #include "compiler.h"
 
+#include "bitvm.h"
 #include "codegen.h"
 #include "program.h"
 #include "utility.h"
 
+#include <algorithm>
+#include <set>
 #include <tuple>
 
 uint32_t figureOutLanding(const CodeGenHelper& cg, NFA::VertexDescriptor v, const NFA& graph) {
@@ -161,10 +164,122 @@ void encodeState(const NFA& graph, NFA::VertexDescriptor v, const CodeGenHelper&
   }
 }
 
+// past this many entries, the table would cost more memory than it's worth
+static const uint64_t MAX_TABLE_ENTRIES = 1 << 24;
+
+// Builds a transition table mirroring the code. A state's entry for a byte
+// is the edge it takes, or if several edges allow the byte, the list of
+// them in the order the code would take them. The code jumps from a jump
+// table straight to the child of a state having only that child and
+// nothing to do, so it skips any CHECK_HALT there; the table flags those
+// edges to do the same.
+//
+// The table is serialized with the program, so it's only built where an
+// engine will use it: for a determinized graph with no forks, which
+// TableVm runs, or for a graph small enough for BitVm, lists and all.
+void createTable(const NFA& graph, const CodeGenHelper& cg, DfaTable& tbl, bool determinized) {
+  const uint32_t numVs = graph.verticesSize();
+  const bool small = numVs <= BitVm::MAX_STATES;
+  if (!small && (!determinized || numVs >= DfaTable::LIST)) {
+    return;
+  }
+
+  std::set<ByteSet> sets;
+  std::vector<ByteSet> bytes(numVs);
+
+  for (NFA::VertexDescriptor v = 0; v < numVs; ++v) {
+    if (v > 0) {
+      graph[v].Trans->getBytes(bytes[v]);
+      sets.insert(bytes[v]);
+
+      if (graph.outDegree(v) == 0 && !graph[v].IsMatch) {
+        // the code would run off the end of the state
+        return;
+      }
+    }
+  }
+
+  // split the bytes into classes, by which sets they're in
+  std::fill(tbl.Classes, tbl.Classes + 256, 0);
+  tbl.NumClasses = 1;
+  for (const ByteSet& s : sets) {
+    std::vector<uint32_t> split(2 * tbl.NumClasses, NONE);
+    uint32_t num = 0;
+    for (uint32_t b = 0; b < 256; ++b) {
+      uint32_t& c = split[2 * tbl.Classes[b] + s[b]];
+      if (c == NONE) {
+        c = num++;
+      }
+      tbl.Classes[b] = c;
+    }
+    tbl.NumClasses = num;
+  }
+
+  if (uint64_t(numVs) * tbl.NumClasses > MAX_TABLE_ENTRIES) {
+    return;
+  }
+
+  // one representative byte per class
+  std::vector<byte> reps(tbl.NumClasses);
+  for (uint32_t b = 0; b < 256; ++b) {
+    reps[tbl.Classes[b]] = b;
+  }
+
+  tbl.Next.assign(numVs * tbl.NumClasses, DfaTable::DEAD);
+  tbl.States.resize(numVs);
+  tbl.Lists.clear();
+
+  std::vector<uint32_t> targets;
+
+  for (NFA::VertexDescriptor v = 0; v < numVs; ++v) {
+    const NFA::Vertex& state(graph[v]);
+    const bool jumpTable = cg.Snippets[v].Op == JUMP_TABLE_RANGE_OP;
+
+    tbl.States[v] = DfaTable::StateInfo{
+      state.Label, cg.Snippets[v].CheckIndex,
+      state.IsMatch, graph.outDegree(v) == 0, !jumpTable
+    };
+
+    for (uint32_t c = 0; c < tbl.NumClasses; ++c) {
+      targets.clear();
+      for (const NFA::VertexDescriptor t : graph.outVertices(v)) {
+        if (!bytes[t][reps[c]]) {
+          continue;
+        }
+
+        const uint32_t target = t | (
+          jumpTable && graph.outDegree(t) == 1 &&
+          graph[t].Label == NOLABEL && !graph[t].IsMatch ? DfaTable::NOCHECK : 0
+        );
+
+        // jump tables have each target once, forks have each edge
+        if (!jumpTable || std::find(targets.begin(), targets.end(), target) == targets.end()) {
+          targets.push_back(target);
+        }
+      }
+
+      if (targets.size() == 1) {
+        tbl.Next[v * tbl.NumClasses + c] = targets.front();
+      }
+      else if (targets.size() > 1) {
+        if (!small) {
+          // a fork, which only BitVm has any use for
+          tbl = DfaTable();
+          return;
+        }
+
+        tbl.Next[v * tbl.NumClasses + c] = DfaTable::LIST | tbl.Lists.size();
+        tbl.Lists.push_back(targets.size());
+        tbl.Lists.insert(tbl.Lists.end(), targets.begin(), targets.end());
+      }
+    }
+  }
+}
+
 // need a two-pass to get it to work with the bgl visitors
 //  discover_vertex: determine slot
 //  finish_vertex:
-ProgramPtr Compiler::createProgram(const NFA& graph) {
+ProgramPtr Compiler::createProgram(const NFA& graph, bool determinized) {
   // std::cerr << "Compiling to byte code" << std::endl;
   ProgramPtr ret(new Program);
 
@@ -189,5 +304,7 @@ ProgramPtr Compiler::createProgram(const NFA& graph) {
   // last instruction will always be Finish, for handling matches
   ret->push_back(Instruction::makeFinish());
 
+  createTable(graph, *cg, ret->Table, determinized);
+
   return ret;
 }
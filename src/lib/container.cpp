@@ -0,0 +1,241 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "container.h"
+
+#include <cstring>
+
+namespace {
+  const char MAGIC[4] = {'L', 'G', 'P', 'R'};
+  const uint16_t ORDER_MARK = 0x0102;
+
+  struct Header {
+    char     Magic[4];
+    uint16_t Version;
+    uint16_t ByteOrder;
+    uint32_t Features;
+    uint32_t NumSections;
+    uint64_t Size;
+    uint64_t Checksum;
+  };
+
+  struct DirEntry {
+    uint32_t Id;
+    uint32_t Flags;
+    uint64_t Offset;
+    uint64_t Size;
+  };
+
+  size_t align(size_t n) {
+    return (n + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+  }
+
+  const uint64_t P1 = 0x9E3779B185EBCA87ull,
+                 P2 = 0xC2B2AE3D27D4EB4Full,
+                 P3 = 0x165667B19E3779F9ull,
+                 P4 = 0x85EBCA77C2B2AE63ull,
+                 P5 = 0x27D4EB2F165667C5ull;
+
+  uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  uint64_t mix(uint64_t acc, uint64_t in) {
+    return rotl(acc + in * P2, 31) * P1;
+  }
+
+  uint64_t fold(uint64_t h, uint64_t v) {
+    return (h ^ mix(0, v)) * P1 + P4;
+  }
+
+  template <class T>
+  T load(const byte* p) {
+    T w;
+    std::memcpy(&w, p, sizeof(w));
+    return w;
+  }
+}
+
+uint64_t checksum(const void* data, size_t len, uint64_t seed) {
+  const byte* p = static_cast<const byte*>(data);
+  const byte* const end = p + len;
+
+  uint64_t h;
+  if (len >= 32) {
+    // four lanes, so the multiplies overlap
+    uint64_t v1 = seed + P1 + P2,
+             v2 = seed + P2,
+             v3 = seed,
+             v4 = seed - P1;
+
+    for ( ; end - p >= 32; p += 32) {
+      v1 = mix(v1, load<uint64_t>(p));
+      v2 = mix(v2, load<uint64_t>(p + 8));
+      v3 = mix(v3, load<uint64_t>(p + 16));
+      v4 = mix(v4, load<uint64_t>(p + 24));
+    }
+
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = fold(h, v1);
+    h = fold(h, v2);
+    h = fold(h, v3);
+    h = fold(h, v4);
+  }
+  else {
+    h = seed + P5;
+  }
+
+  h += len;
+
+  for ( ; end - p >= 8; p += 8) {
+    h ^= mix(0, load<uint64_t>(p));
+    h = rotl(h, 27) * P1 + P4;
+  }
+
+  if (end - p >= 4) {
+    h ^= load<uint32_t>(p) * P1;
+    h = rotl(h, 23) * P2 + P3;
+    p += 4;
+  }
+
+  for ( ; p < end; ++p) {
+    h ^= *p * P5;
+    h = rotl(h, 11) * P1;
+  }
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+void ContainerWriter::add(ContainerSection id, const void* data, size_t len, uint32_t flags) {
+  Sections.push_back({id, flags, data, len});
+}
+
+void ContainerWriter::add(ContainerSection id, std::string data, uint32_t flags) {
+  Owned.emplace_back(new std::string(std::move(data)));
+  add(id, Owned.back()->data(), Owned.back()->size(), flags);
+}
+
+size_t ContainerWriter::size() const {
+  size_t n = align(sizeof(Header) + Sections.size() * sizeof(DirEntry));
+  for (const Section& s : Sections) {
+    n = align(n + s.Size);
+  }
+  return n;
+}
+
+void ContainerWriter::write(void* buf) const {
+  byte* const out = static_cast<byte*>(buf);
+  const size_t total = size();
+
+  size_t off = align(sizeof(Header) + Sections.size() * sizeof(DirEntry));
+  std::memset(out + sizeof(Header), 0, off - sizeof(Header));
+
+  DirEntry* dir = reinterpret_cast<DirEntry*>(out + sizeof(Header));
+  for (const Section& s : Sections) {
+    const DirEntry e{s.Id, s.Flags, off, s.Size};
+    std::memcpy(dir++, &e, sizeof(e));
+
+    if (s.Size) {
+      std::memcpy(out + off, s.Data, s.Size);
+    }
+    // zero the padding, so equal programs make equal containers
+    const size_t next = align(off + s.Size);
+    std::memset(out + off + s.Size, 0, next - off - s.Size);
+    off = next;
+  }
+
+  Header h;
+  std::memcpy(h.Magic, MAGIC, sizeof(MAGIC));
+  h.Version = CONTAINER_VERSION;
+  h.ByteOrder = ORDER_MARK;
+  h.Features = CONTAINER_FEATURES;
+  h.NumSections = Sections.size();
+  h.Size = total;
+  h.Checksum = checksum(out + sizeof(Header), total - sizeof(Header));
+  std::memcpy(out, &h, sizeof(h));
+}
+
+ContainerReader::ContainerReader(const void* buf, size_t len):
+  Sections(KEYWORD_FOLD_SECTION + 1, std::make_pair(nullptr, 0))
+{
+  const byte* const in = static_cast<const byte*>(buf);
+
+  if (len < sizeof(Header)) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program is truncated");
+  }
+
+  Header h;
+  std::memcpy(&h, in, sizeof(h));
+
+  if (std::memcmp(h.Magic, MAGIC, sizeof(MAGIC))) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("not a serialized program");
+  }
+
+  if (h.ByteOrder != ORDER_MARK) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program was written with the other byte order");
+  }
+
+  if (h.Version > CONTAINER_VERSION) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program format version " << h.Version << " is newer than this library's, " << CONTAINER_VERSION);
+  }
+
+  if (h.Features & ~CONTAINER_FEATURES) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program uses features unknown to this library");
+  }
+
+  if (h.Size < sizeof(Header)) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program size " << h.Size << " is too small to hold its header");
+  }
+
+  if (h.Size > len || h.NumSections > (h.Size - sizeof(Header)) / sizeof(DirEntry)) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program is truncated");
+  }
+
+  if (checksum(in + sizeof(Header), h.Size - sizeof(Header)) != h.Checksum) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program is corrupt; its checksum doesn't match");
+  }
+
+  for (uint32_t i = 0; i < h.NumSections; ++i) {
+    const DirEntry e(load<DirEntry>(in + sizeof(Header) + i * sizeof(DirEntry)));
+
+    if (e.Offset > h.Size || e.Size > h.Size - e.Offset) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program section " << e.Id << " runs past the end");
+    }
+
+    if (e.Id == 0 || e.Id >= Sections.size()) {
+      if (e.Flags & SECTION_REQUIRED) {
+        THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program has section " << e.Id << ", unknown to this library");
+      }
+      continue;
+    }
+
+    if (Sections[e.Id].first) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program has section " << e.Id << " twice");
+    }
+
+    Sections[e.Id] = std::make_pair(in + e.Offset, size_t(e.Size));
+  }
+}
+
+std::pair<const byte*, size_t> ContainerReader::find(ContainerSection id) const {
+  return Sections[id];
+}
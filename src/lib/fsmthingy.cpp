@@ -17,38 +17,259 @@
 */
 
 #include "fsmthingy.h"
+#include "ahocorasick.h"
+#include "parsetree.h"
 #include "encoders/encoder.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 
-FSMThingy::FSMThingy(uint32_t sizeHint): Fsm(new NFA(1, sizeHint)) {
+namespace {
+  // past this many strings, a pattern is better off in the graph
+  const size_t MAX_KEYWORD_STRINGS = 64;
+
+  // the other case of an ASCII letter, or b itself
+  byte otherCase(byte b) {
+    const byte l = AhoCorasick::lower(b);
+    return 'a' <= l && l <= 'z' ? b ^ ('a' ^ 'A') : b;
+  }
+
+  // the strings in each case of a string, one byte at a time, or none if
+  // there are too many
+  bool caseVariants(const std::string& s, std::vector<std::string>& vars) {
+    vars.assign(1, std::string());
+    for (const char c : s) {
+      const byte b = c, o = otherCase(b);
+      const size_t n = vars.size();
+      if (o != b) {
+        if (2 * n > MAX_KEYWORD_STRINGS) {
+          return false;
+        }
+        vars.insert(vars.end(), vars.begin(), vars.end());
+      }
+
+      for (size_t i = 0; i < vars.size(); ++i) {
+        vars[i].push_back(i < n ? b : o);
+      }
+    }
+    return true;
+  }
+
+  // The byte strings an atom of a fixed string matches, as NFABuilder
+  // would encode it: literals through the encoder, raw bytes as they are,
+  // and case-insensitive letters as each code point of the class.
+  bool atomStrings(const ParseNode& n, const Encoder& enc, byte* buf, std::vector<std::string>& strs) {
+    strs.clear();
+
+    switch (n.Type) {
+    case ParseNode::LITERAL:
+      {
+        const uint32_t len = enc.write(n.Val, buf);
+        if (len == 0) {
+          // the NFABuilder has the error message for this
+          return false;
+        }
+        strs.emplace_back(buf, buf + len);
+      }
+      return true;
+
+    case ParseNode::BYTE:
+      strs.emplace_back(1, char(n.Val));
+      return true;
+
+    case ParseNode::CHAR_CLASS:
+      {
+        const UnicodeSet uset(n.Set.CodePoints & enc.validCodePoints());
+        if (n.Set.Breakout.Bytes.any() || uset.none() || uset.count() > MAX_KEYWORD_STRINGS) {
+          return false;
+        }
+
+        for (const UnicodeSet::range& r : uset) {
+          for (uint32_t cp = r.first; cp < r.second; ++cp) {
+            const uint32_t len = enc.write(cp, buf);
+            strs.emplace_back(buf, buf + len);
+          }
+        }
+      }
+      return true;
+
+    default:
+      return false;
+    }
+  }
+
+  // the atoms of a fixed string, in order
+  bool fixedAtoms(const ParseNode* n, std::vector<const ParseNode*>& atoms) {
+    switch (n->Type) {
+    case ParseNode::REGEXP:
+      return fixedAtoms(n->Child.Left, atoms);
+    case ParseNode::CONCATENATION:
+      return fixedAtoms(n->Child.Left, atoms) && fixedAtoms(n->Child.Right, atoms);
+    case ParseNode::LITERAL:
+    case ParseNode::BYTE:
+    case ParseNode::CHAR_CLASS:
+      atoms.push_back(n);
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Finds the byte strings a fixed string's parse tree matches, straight
+  // from the tree, as exact strings if they're few and all the same
+  // length, and folded if each atom matches the case variants of one
+  // string and nothing else. Matches of a label are then just its leftmost
+  // non-overlapping occurrences, which Aho-Corasick finds directly.
+  void keywordStrings(const ParseTree& tree, const Encoder& enc, bool& exactOk, std::vector<std::string>& exact, bool& foldedOk, std::vector<std::string>& folded) {
+    exactOk = foldedOk = false;
+
+    std::vector<const ParseNode*> nodes;
+    if (!tree.Root || !fixedAtoms(tree.Root, nodes) || nodes.empty()) {
+      return;
+    }
+
+    std::unique_ptr<byte[]> buf(new byte[enc.maxByteLength()]);
+    std::vector<std::string> strs, vars;
+    std::string f;
+
+    exactOk = foldedOk = true;
+    exact.assign(1, std::string());
+    folded.assign(1, std::string());
+
+    for (const ParseNode* n : nodes) {
+      if (!atomStrings(*n, enc, buf.get(), strs)) {
+        exactOk = foldedOk = false;
+        return;
+      }
+
+      const size_t len = strs.front().size();
+      for (const std::string& s : strs) {
+        if (s.size() != len) {
+          exactOk = foldedOk = false;
+          return;
+        }
+      }
+
+      if (exactOk) {
+        if (exact.size() * strs.size() > MAX_KEYWORD_STRINGS) {
+          exactOk = false;
+        }
+        else {
+          std::vector<std::string> next;
+          for (const std::string& e : exact) {
+            for (const std::string& s : strs) {
+              next.push_back(e + s);
+            }
+          }
+          exact.swap(next);
+        }
+      }
+
+      if (foldedOk) {
+        // the atom has to be every case variant of its lowercase, and no
+        // more, for the automaton to fold it
+        f = strs.front();
+        std::transform(f.begin(), f.end(), f.begin(), AhoCorasick::lower);
+        std::sort(strs.begin(), strs.end());
+        if (caseVariants(f, vars)) {
+          std::sort(vars.begin(), vars.end());
+          foldedOk = vars == strs;
+        }
+        else {
+          foldedOk = false;
+        }
+        folded.front() += f;
+      }
+    }
+  }
+}
+
+FSMThingy::FSMThingy(uint32_t sizeHint):
+  Fsm(new NFA(1, sizeHint)), LiteralsUsable(true),
+  KeywordsFoldCase(false), KeywordsKeepCase(false)
+{
   Fsm->TransFac = Nfab.getTransFac();
 }
 
-void FSMThingy::addPattern(const ParseTree& tree, const char* chain, uint32_t label) {
+void FSMThingy::addPattern(const ParseTree& tree, const char* chain, uint32_t label, bool fixed) {
+  // set the character encoding
+  const std::shared_ptr<Encoder> enc(EncFac.get(chain));
+
+  // fixed strings go to the Aho-Corasick automaton instead of the graph,
+  // without building an NFA for them
+  if (fixed && addKeywords(tree, *enc, label)) {
+    return;
+  }
+
   // prepare the NFA builder
   Nfab.reset();
   Nfab.setCurLabel(label);
-
-  // set the character encoding
-  Nfab.setEncoder(EncFac.get(chain));
+  Nfab.setEncoder(enc);
 
   // build the NFA for this pattern
   if (Nfab.build(tree)) {
-    // and merge it into the greater NFA
+    // merge it into the greater NFA
     Comp.pruneBranches(*Nfab.getFsm());
     Comp.mergeIntoFSM(*Fsm, *Nfab.getFsm());
+
+    // one pattern without a required literal makes the rest useless
+    if (LiteralsUsable) {
+      RequiredLiterals lits;
+      if (requiredLiterals(tree, *enc, lits)) {
+        Literals.merge(lits);
+      }
+      else {
+        LiteralsUsable = false;
+        Literals.clear();
+      }
+    }
   }
   else {
     THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("Empty matches");
   }
 }
 
+bool FSMThingy::addKeywords(const ParseTree& tree, const Encoder& enc, uint32_t label) {
+  std::vector<std::string> exact, folded;
+  bool exactOk, foldedOk;
+  keywordStrings(tree, enc, exactOk, exact, foldedOk, folded);
+
+  const std::vector<std::string>* strs;
+  if (exactOk && foldedOk && exact.size() == folded.size()) {
+    // no letters in either case, so no matter whether the automaton folds
+    strs = &exact;
+  }
+  else if (foldedOk && (KeywordsFoldCase || (!exactOk && !KeywordsKeepCase))) {
+    // letters in either case, too many of them to list
+    KeywordsFoldCase = true;
+    strs = &folded;
+  }
+  else if (exactOk && (foldedOk || !KeywordsFoldCase)) {
+    // a handful of letters in either case listed, or letters in one case
+    KeywordsKeepCase |= !foldedOk;
+    strs = &exact;
+  }
+  else {
+    // the automaton folds case and this can't, or the other way around
+    return false;
+  }
+
+  for (const std::string& s : *strs) {
+    Keywords.emplace_back(s, label);
+    mergeLengths(Lengths, label, MatchLengths(s.size(), s.size()));
+  }
+  return true;
+}
+
 void FSMThingy::finalizeGraph(bool determinize) {
   if (Fsm->verticesSize() < 2) {
-    throw std::runtime_error("No valid patterns were parsed");
+    if (Keywords.empty()) {
+      throw std::runtime_error("No valid patterns were parsed");
+    }
+    // all keywords, no graph
+    return;
   }
 
   if (determinize && !Fsm->Deterministic) {
@@ -58,5 +279,12 @@ void FSMThingy::finalizeGraph(bool determinize) {
     Fsm = dfa;
   }
 
+  // while the match states still have their labels
+  matchLengths(*Fsm, Lengths);
+
   Comp.labelGuardStates(*Fsm);
+
+  std::vector<std::string>& lits(Literals.Strings);
+  std::sort(lits.begin(), lits.end());
+  lits.erase(std::unique(lits.begin(), lits.end()), lits.end());
 }
@@ -0,0 +1,346 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "keywordvm.h"
+#include "program.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+  const uint64_t NONE = std::numeric_limits<uint64_t>::max();
+
+  // Past this many bytes beginning keywords, walking the automaton over
+  // ordinary text beats stopping and starting the skip scan.
+  const size_t MAX_SKIPPED_FIRST_BYTES = 8;
+
+  // Past this many keywords, the prefilter has to fall back on byte pairs
+  // and the dense automaton is as fast on its own.
+  const size_t MAX_FILTERED_KEYWORDS = 64;
+
+  // adds the strings which fold to folded, if there aren't too many
+  bool unfold(const AhoCorasick& ac, const std::string& folded, std::string& s, RequiredLiterals& lits) {
+    if (s.size() == folded.size()) {
+      if (lits.Strings.size() == MAX_FILTERED_KEYWORDS) {
+        return false;
+      }
+      lits.Strings.push_back(s);
+      return true;
+    }
+
+    for (uint32_t b = 0; b < 256; ++b) {
+      if (ac.Fold[b] == byte(folded[s.size()])) {
+        s.push_back(b);
+        if (!unfold(ac, folded, s, lits)) {
+          return false;
+        }
+        s.pop_back();
+      }
+    }
+    return true;
+  }
+
+  // the strings of the states where keywords end, if there aren't too many
+  bool keywordStrings(const AhoCorasick& ac, RequiredLiterals& lits) {
+    std::string buf;
+    for (uint32_t t = 1; t < ac.Check.size(); ++t) {
+      const uint32_t o = ac.Out[t];
+      if (ac.Check[t] == AhoCorasick::NONE || o == AhoCorasick::NONE ||
+          ac.Outputs[o].Length != ac.Depth[t])
+      {
+        continue;
+      }
+
+      std::string str(ac.Depth[t], '\0');
+      for (uint32_t s = t; s != 0; s = ac.Check[s]) {
+        str[ac.Depth[s] - 1] = s - ac.Base[ac.Check[s]];
+      }
+
+      // the prefilter knows nothing of folding
+      buf.clear();
+      if (!unfold(ac, str, buf, lits)) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+KeywordVm::KeywordVm(std::shared_ptr<VmInterface> rest):
+  Rest(rest),
+  Trie(0),
+  SkipScan(true),
+  UsePrefilter(true),
+  Filtering(false),
+  Tail(0),
+  Compact(false),
+  State(0) {}
+
+void KeywordVm::init(ProgramPtr prog) {
+  Prog = prog;
+  Trie = &Prog->Keywords;
+
+  if (Rest) {
+    Rest->init(prog);
+  }
+
+  // the bytes which begin keywords
+  ByteSet first;
+  for (uint32_t b = 0; b < 256; ++b) {
+    first[b] = Trie->child(0, b) != AhoCorasick::NONE;
+  }
+
+  if (first.count() > MAX_SKIPPED_FIRST_BYTES) {
+    first.set(0, 256, true);
+  }
+  Skipper.init(first);
+
+  // a handful of keywords are found faster by the prefilter
+  RequiredLiterals lits;
+  if (UsePrefilter && keywordStrings(*Trie, lits)) {
+    Filter.init(lits);
+  }
+  else {
+    Filter.init(RequiredLiterals());
+  }
+
+  MatchEnds.resize(Trie->NumLabels, hashLabels(Trie->NumLabels, Compact));
+  reset();
+}
+
+void KeywordVm::setSkipScan(bool enabled) {
+  SkipScan = enabled;
+  if (Rest) {
+    Rest->setSkipScan(enabled);
+  }
+}
+
+void KeywordVm::setPrefilter(bool enabled) {
+  UsePrefilter = enabled;
+  if (Rest) {
+    Rest->setPrefilter(enabled);
+  }
+}
+
+void KeywordVm::setCompact(bool enabled) {
+  Compact = enabled;
+  if (Rest) {
+    Rest->setCompact(enabled);
+  }
+}
+
+void KeywordVm::retire(uint32_t label) {
+  if (label < MatchEnds.size()) {
+    MatchEnds.set(label, NONE);
+  }
+
+  if (Rest) {
+    Rest->retire(label);
+  }
+}
+
+std::shared_ptr<VmInterface> KeywordVm::clone() const {
+  std::shared_ptr<KeywordVm> c(new KeywordVm(*this));
+  if (Rest) {
+    c->Rest = Rest->clone();
+  }
+  c->reset();
+  return c;
+}
+
+size_t KeywordVm::memoryUsage() const {
+  return sizeof(*this) + Filter.memoryUsage() + MatchEnds.memoryUsage() +
+    (Rest ? Rest->memoryUsage() : 0);
+}
+
+void KeywordVm::snapshot(std::ostream& out) const {
+  writeSnapshotValue(out, KEYWORD_SNAPSHOT);
+  writeSnapshotValue(out, State);
+  MatchEnds.snapshot(out);
+
+  if (Rest) {
+    Rest->snapshot(out);
+  }
+}
+
+void KeywordVm::restore(std::istream& in) {
+  readSnapshotTag(in, KEYWORD_SNAPSHOT);
+  State = readSnapshotValue<uint32_t>(in);
+  if (State >= Trie->Depth.size()) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot has a bad keyword state");
+  }
+  MatchEnds.restore(in);
+
+  if (Rest) {
+    Rest->restore(in);
+  }
+}
+
+void KeywordVm::reset() {
+  State = 0;
+  MatchEnds.clear();
+
+  if (Rest) {
+    Rest->reset();
+  }
+}
+
+// reports the keywords ending at offset in state, if they began before before
+inline void KeywordVm::_report(const uint32_t state, const uint64_t offset, const uint64_t before, HitCallback hitFn, void* userData) {
+  for (uint32_t o = Trie->Out[state]; o != AhoCorasick::NONE; o = Trie->Outputs[o].Next) {
+    const AhoCorasick::Output& out(Trie->Outputs[o]);
+    const uint64_t start = offset + 1 - out.Length;
+
+    if (start >= MatchEnds[out.Label] && start < before) {
+      MatchEnds.set(out.Label, offset + 1);
+
+      if (hitFn) {
+        SearchHit hit(start, offset + 1, out.Label);
+        (*hitFn)(userData, &hit);
+      }
+    }
+  }
+}
+
+uint64_t KeywordVm::_firstLive(const uint64_t offset) const {
+  return State == 0 ? NONE : offset - Trie->Depth[State];
+}
+
+void KeywordVm::startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  // only keywords ending in the state reached without failing started at beg
+  uint32_t s = 0;
+  uint64_t offset = startOffset;
+  for (const byte* cur = beg; cur < end; ++cur, ++offset) {
+    if ((s = Trie->child(s, *cur)) == AhoCorasick::NONE) {
+      break;
+    }
+
+    for (uint32_t o = Trie->Out[s]; o != AhoCorasick::NONE; o = Trie->Outputs[o].Next) {
+      const AhoCorasick::Output& out(Trie->Outputs[o]);
+      if (out.Length == Trie->Depth[s] && hitFn) {
+        SearchHit hit(startOffset, offset + 1, out.Label);
+        (*hitFn)(userData, &hit);
+      }
+    }
+  }
+
+  if (Rest) {
+    Rest->startsWith(beg, end, startOffset, hitFn, userData);
+  }
+
+  reset();
+}
+
+// Scanning with and without jumping ahead are separate loops, so the check
+// for being in the initial state costs nothing when not jumping.
+template <bool jump>
+uint32_t KeywordVm::_scanDense(const byte* const beg, const byte* const end, const uint64_t startOffset, uint32_t state, HitCallback hitFn, void* userData) {
+  // walk row offsets rather than states, saving a multiply per byte
+  const uint32_t* const dense = Trie->Dense.data();
+  const byte* const classes = Trie->Classes;
+  const uint32_t numClasses = Trie->NumClasses;
+
+  uint32_t row = state * numClasses;
+  for (const byte* cur = beg; cur < end; ++cur) {
+    if (jump && row == 0 && (cur = _jump(cur, end)) == end) {
+      // no keyword is under way, and none can begin in what's left
+      break;
+    }
+
+    row = dense[row + classes[*cur]];
+    if (row & AhoCorasick::HAS_OUTPUT) {
+      row &= ~AhoCorasick::HAS_OUTPUT;
+      _report(row / numClasses, startOffset + (cur - beg), NONE, hitFn, userData);
+    }
+  }
+  return row / numClasses;
+}
+
+template <bool jump>
+uint32_t KeywordVm::_scan(const byte* const beg, const byte* const end, const uint64_t startOffset, uint32_t state, HitCallback hitFn, void* userData) {
+  for (const byte* cur = beg; cur < end; ++cur) {
+    if (jump && state == 0 && (cur = _jump(cur, end)) == end) {
+      break;
+    }
+
+    state = Trie->next(state, *cur);
+    _report(state, startOffset + (cur - beg), NONE, hitFn, userData);
+  }
+  return state;
+}
+
+// the first place at or after cur where a keyword could begin
+const byte* KeywordVm::_jump(const byte* const cur, const byte* const end) const {
+  if (!Filtering) {
+    return Skipper.next(cur, end);
+  }
+
+  // Keywords running off the end of the buffer can't be seen by the
+  // prefilter, so the last few bytes are always walked.
+  const byte* const lit = Filter.next(cur, end);
+  return lit < Tail ? lit : std::max(cur, Tail);
+}
+
+uint64_t KeywordVm::search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  Filtering = UsePrefilter && !Filter.empty();
+  Tail = !Filtering ? end :
+    uint64_t(end - beg) >= Filter.maxLength() ? end - Filter.maxLength() + 1 : beg;
+
+  const bool jump = Filtering || (SkipScan && Skipper.worthwhile());
+
+  if (Trie->Dense.empty()) {
+    State = jump ?
+      _scan<true>(beg, end, startOffset, State, hitFn, userData) :
+      _scan<false>(beg, end, startOffset, State, hitFn, userData);
+  }
+  else {
+    State = jump ?
+      _scanDense<true>(beg, end, startOffset, State, hitFn, userData) :
+      _scanDense<false>(beg, end, startOffset, State, hitFn, userData);
+  }
+
+  const uint64_t live = _firstLive(startOffset + (end - beg));
+  return Rest ?
+    std::min(live, Rest->search(beg, end, startOffset, hitFn, userData)) : live;
+}
+
+uint64_t KeywordVm::searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  // finish only the keywords begun before startOffset
+  uint64_t offset = startOffset;
+  for (const byte* cur = beg; cur < end && State != 0; ++cur, ++offset) {
+    State = Trie->step(State, *cur);
+    _report(State, offset, startOffset, hitFn, userData);
+
+    if (offset + 1 - Trie->Depth[State] >= startOffset) {
+      // what's left began in the new data
+      State = 0;
+    }
+  }
+
+  const uint64_t live = _firstLive(offset);
+  return Rest ?
+    std::min(live, Rest->searchResolve(beg, end, startOffset, hitFn, userData)) : live;
+}
+
+void KeywordVm::closeOut(HitCallback hitFn, void* userData) {
+  // keywords are reported as soon as they end, so there's nothing pending
+  if (Rest) {
+    Rest->closeOut(hitFn, userData);
+  }
+}
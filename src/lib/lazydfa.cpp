@@ -0,0 +1,556 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lazydfa.h"
+#include "program.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <limits>
+
+const uint32_t LazyDfa::UNKNOWN = std::numeric_limits<uint32_t>::max();
+const uint32_t LazyDfa::FAILED = UNKNOWN - 1;
+const uint32_t LazyDfa::NEW = std::numeric_limits<uint32_t>::max();
+
+size_t LazyDfa::KeyHash::operator()(const Key& k) const {
+  // FNV-1a, a word at a time
+  uint64_t h = 14695981039346656037ull;
+  for (const uint64_t x : k) {
+    h ^= x ^ (x >> 29);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+LazyDfa::LazyDfa(size_t cacheSize):
+  Base(0),
+  ProgEnd(0),
+  SkipScan(true),
+  UsePrefilter(true),
+  CacheSize(cacheSize),
+  CacheUsed(0),
+  Cur(0),
+  BytesSinceFlush(0),
+  Flushes(0),
+  GaveUp(false),
+  NumPatterns(0),
+  AnyRetired(false),
+  Failed(false),
+  LiveNoLabel(false),
+  Compact(false) {}
+
+void LazyDfa::init(ProgramPtr prog) {
+  Prog = prog;
+  Fallback.init(prog);
+
+  const Program& p(*Prog);
+  Base = &p[0];
+  ProgEnd = &p.back() - 1;
+
+  uint32_t numPatterns = 0,
+           numCheckedStates = 0;
+  for (uint32_t i = 0; i < p.size(); ++i) {
+    switch (p[i].OpCode) {
+    case LABEL_OP:
+      numPatterns = std::max(numPatterns, p[i].Op.Offset);
+      break;
+    case CHECK_HALT_OP:
+      numCheckedStates = std::max(numCheckedStates, p[i].Op.Offset);
+      break;
+    }
+  }
+
+  NumPatterns = numPatterns + 1;
+  Live.resize(NumPatterns, hashLabels(NumPatterns, Compact));
+  Retired.resize(NumPatterns, hashLabels(NumPatterns, Compact));
+  AnyRetired = false;
+  CheckLabels.resize(numCheckedStates + 1, hashLabels(numCheckedStates + 1, Compact));
+
+  Skipper.init(p.First);
+  Filter.init(UsePrefilter ? p.Literals : RequiredLiterals());
+
+  flush();
+  Flushes = 0;
+  GaveUp = false;
+}
+
+void LazyDfa::setSkipScan(bool enabled) {
+  SkipScan = enabled;
+  Fallback.setSkipScan(enabled);
+}
+
+void LazyDfa::setPrefilter(bool enabled) {
+  UsePrefilter = enabled;
+  Fallback.setPrefilter(enabled);
+}
+
+void LazyDfa::setCompact(bool enabled) {
+  Compact = enabled;
+  Fallback.setCompact(enabled);
+}
+
+void LazyDfa::startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  Fallback.startsWith(beg, end, startOffset, hitFn, userData);
+}
+
+uint64_t LazyDfa::searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  return Fallback.searchResolve(beg, end, startOffset, hitFn, userData);
+}
+
+void LazyDfa::closeOut(HitCallback hitFn, void* userData) {
+  Fallback.closeOut(hitFn, userData);
+}
+
+std::shared_ptr<VmInterface> LazyDfa::clone() const {
+  std::shared_ptr<LazyDfa> c(new LazyDfa(*this));
+  c->reset();
+  return c;
+}
+
+size_t LazyDfa::memoryUsage() const {
+  // the Fallback is counted in both; the cache, as it's reckoned for flushing
+  return sizeof(*this) - sizeof(Fallback) + Fallback.memoryUsage() +
+    Filter.memoryUsage() + CacheUsed +
+    vectorBytes(Starts) + vectorBytes(NextStarts) +
+    vectorBytes(Stepping) + vectorBytes(Stepped) + vectorBytes(Scratch) +
+    Live.memoryUsage() + CheckLabels.memoryUsage();
+}
+
+void LazyDfa::snapshot(std::ostream& out) const {
+  // between calls, the threads are always back in the Vm
+  writeSnapshotValue(out, LAZY_DFA_SNAPSHOT);
+  writeSnapshotValue(out, byte(GaveUp));
+  Fallback.snapshot(out);
+}
+
+void LazyDfa::restore(std::istream& in) {
+  reset();
+  readSnapshotTag(in, LAZY_DFA_SNAPSHOT);
+  GaveUp = readSnapshotValue<byte>(in);
+  Fallback.restore(in);
+}
+
+void LazyDfa::reset() {
+  Fallback.reset();
+
+  // a new stream gets a fresh chance at using the cache
+  BytesSinceFlush = 0;
+  GaveUp = false;
+
+  // the cached states have no threads for the retired labels
+  if (AnyRetired) {
+    Retired.clear();
+    AnyRetired = false;
+    flush();
+  }
+}
+
+void LazyDfa::retire(uint32_t label) {
+  Fallback.retire(label);
+
+  // Hits come only from the Vm, after which the threads are turned back
+  // into a state by fromVm(), so the cache can go now.
+  if (label < NumPatterns && !Retired.find(label)) {
+    Retired.insert(label);
+    AnyRetired = true;
+    flush();
+  }
+}
+
+void LazyDfa::flush() {
+  States.clear();
+  Transitions.clear();
+  Index.clear();
+  CacheUsed = 0;
+  BytesSinceFlush = 0;
+}
+
+uint32_t LazyDfa::intern(const Key& key) {
+  const auto i(Index.find(key));
+  if (i != Index.end()) {
+    return i->second;
+  }
+
+  const uint32_t id = States.size();
+  States.push_back(State{key, std::vector<uint32_t>(512, UNKNOWN)});
+  Index.emplace(key, id);
+
+  // the key is stored twice, once in the state and once in the index
+  CacheUsed += sizeof(State) + 512 * sizeof(uint32_t) +
+               2 * key.size() * sizeof(uint64_t) + 64;
+  return id;
+}
+
+bool LazyDfa::fromVm() {
+  // Threads starting before the end of a reported match may yet be killed
+  // for overlapping it, and threads holding a match must report it; both
+  // need the start offsets, which states don't have.
+  const uint64_t minStart = Fallback.matchEndsMax();
+
+  Scratch.clear();
+  Starts.clear();
+  for (const Thread& t : Fallback.active()) {
+    if (t.End != Thread::NONE || t.Start < minStart || t.PC->OpCode == FINISH_OP) {
+      return false;
+    }
+
+    if (AnyRetired && t.Label != Thread::NOLABEL && Retired.find(t.Label)) {
+      // the Vm would kill it on the next byte
+      continue;
+    }
+
+    Scratch.push_back(uint64_t(t.PC - Base) << 32 | t.Label);
+    Starts.push_back(t.Start);
+  }
+
+  if (CacheUsed > CacheSize) {
+    flush();
+  }
+
+  Cur = intern(Scratch);
+  return true;
+}
+
+void LazyDfa::toVm() {
+  Fallback.clearActive();
+
+  const Key& threads(States[Cur].Threads);
+  for (uint32_t i = 0; i < threads.size(); ++i) {
+    Fallback.add(Thread(Base + (threads[i] >> 32), uint32_t(threads[i]), Starts[i], Thread::NONE));
+  }
+}
+
+uint32_t LazyDfa::build(uint32_t& state, const byte b, const bool spawn) {
+  const uint32_t idx = uint32_t(spawn) << 8 | b;
+
+  if (!step(States[state].Threads, b, spawn)) {
+    States[state].Next[idx] = FAILED;
+    return FAILED;
+  }
+
+  // Stepped threads carry the index of their source in Start
+  Transition tr{0, Stepped.size() == States[state].Threads.size(), {}};
+  Scratch.clear();
+  for (uint32_t i = 0; i < Stepped.size(); ++i) {
+    const Thread& t(Stepped[i]);
+    Scratch.push_back(uint64_t(t.PC - Base) << 32 | t.Label);
+    tr.Src.push_back(uint32_t(t.Start));
+    tr.Identity = tr.Identity && t.Start == i;
+  }
+
+  if (CacheUsed > CacheSize) {
+    // Too few bytes per state means we're spending our time building
+    // states rather than using them, and the Vm would do better.
+    ++Flushes;
+    if (BytesSinceFlush < 10 * States.size()) {
+      GaveUp = true;
+    }
+
+    const Key cur(States[state].Threads);
+    flush();
+    state = intern(cur);
+  }
+
+  tr.Target = intern(Scratch);
+  CacheUsed += sizeof(Transition) + tr.Src.size() * sizeof(uint32_t);
+
+  Transitions.push_back(std::move(tr));
+  return States[state].Next[idx] = Transitions.size() - 1;
+}
+
+//
+// Stepping mirrors Vm::_executeThread() and friends, for threads which
+// can't have any match to contend with: labels are always taken, nothing
+// is killed for overlapping a match, and stepping fails as soon as any
+// thread would match, since that needs the Vm.
+//
+
+bool LazyDfa::step(const Key& threads, const byte b, const bool spawn) {
+  Stepping.clear();
+  for (uint32_t i = 0; i < threads.size(); ++i) {
+    Stepping.emplace_back(Base + (threads[i] >> 32), uint32_t(threads[i]), i, Thread::NONE);
+  }
+
+  if (spawn) {
+    for (const Thread& t : Fallback.first()) {
+      Stepping.emplace_back(t.PC, Thread::NOLABEL, NEW, Thread::NONE);
+    }
+  }
+
+  Stepped.clear();
+  CheckLabels.clear();
+  LiveNoLabel = false;
+  Live.clear();
+  Failed = false;
+
+  for (Thread& t : Stepping) {
+    const Instruction& instr = *t.PC;
+
+    switch (instr.OpCode) {
+    case BYTE_OP:
+      if ((b == instr.Op.T1.Byte) ^ bool(instr.Op.T1.Flags & Instruction::NEGATE)) {
+        t.advance(InstructionSize<BYTE_OP>::VAL);
+        break;
+      }
+      // DIE, penultimate instruction is always a halt.
+      t.PC = ProgEnd;
+      break;
+    case EITHER_OP:
+      if ((b == instr.Op.T2.First || b == instr.Op.T2.Last) ^ bool(instr.Op.T2.Flags & Instruction::NEGATE)) {
+        t.advance(InstructionSize<EITHER_OP>::VAL);
+        break;
+      }
+      t.PC = ProgEnd;
+      break;
+    case RANGE_OP:
+      if ((instr.Op.T2.First <= b && b <= instr.Op.T2.Last) ^ bool(instr.Op.T2.Flags & Instruction::NEGATE)) {
+        t.advance(InstructionSize<RANGE_OP>::VAL);
+        break;
+      }
+      t.PC = ProgEnd;
+      break;
+    case ANY_OP:
+      t.advance(InstructionSize<ANY_OP>::VAL);
+      break;
+    case BIT_VECTOR_OP:
+      if ((*reinterpret_cast<const ByteSet*>(t.PC + 1))[b]) {
+        t.advance(InstructionSize<BIT_VECTOR_OP>::VAL);
+        break;
+      }
+      t.PC = ProgEnd;
+      break;
+    case JUMP_TABLE_RANGE_OP:
+      if (instr.Op.T2.First <= b && b <= instr.Op.T2.Last) {
+        const uint32_t addr = *reinterpret_cast<const uint32_t*>(t.PC + 1 + (b - instr.Op.T2.First));
+        if (addr != 0xffffffff) {
+          t.jump(Base, addr);
+          break;
+        }
+      }
+      t.PC = ProgEnd;
+      break;
+    case FINISH_OP:
+      return false;
+    default:
+      t.PC = ProgEnd;
+      break;
+    }
+
+    if (stepSequence(t)) {
+      if (t.Label == Thread::NOLABEL) {
+        LiveNoLabel = true;
+      }
+      else if (!Live.find(t.Label)) {
+        Live.insert(t.Label);
+      }
+      Stepped.push_back(t);
+    }
+
+    if (Failed) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool LazyDfa::stepSequence(Thread& t) {
+  while (stepEpsilon(t)) ;
+  return t.PC && !Failed;
+}
+
+bool LazyDfa::stepEpsilon(Thread& t) {
+  const Instruction& instr = *t.PC;
+
+  switch (instr.OpCode) {
+  case MATCH_OP:
+  case FINISH_OP:
+    Failed = true;
+    return false;
+
+  case FORK_OP:
+    {
+      Thread f = t;
+      t.advance(InstructionSize<FORK_OP>::VAL);
+
+      if (stepSequence(t)) {
+        if (t.Label == Thread::NOLABEL) {
+          LiveNoLabel = true;
+        }
+        else if (!Live.find(t.Label)) {
+          Live.insert(t.Label);
+        }
+        Stepped.push_back(t);
+      }
+
+      if (Failed) {
+        return false;
+      }
+
+      // the forked child takes the parent's place, as in the Vm
+      t = f;
+    }
+    // fallthrough - t is back on the fork, and goes where it points
+
+  case JUMP_OP:
+    t.jump(Base, *reinterpret_cast<const uint32_t*>(t.PC + 1));
+    return true;
+
+  case CHECK_HALT_OP:
+    if (CheckLabels.find(instr.Op.Offset)) {
+      t.PC = 0;
+      return false;
+    }
+    else if (t.Label == Thread::NOLABEL ? Stepped.empty() : !LiveNoLabel && !Live.find(t.Label)) {
+      CheckLabels.insert(instr.Op.Offset);
+    }
+
+    t.advance(InstructionSize<CHECK_HALT_OP>::VAL);
+    return true;
+
+  case LABEL_OP:
+    if (AnyRetired && Retired.find(instr.Op.Offset)) {
+      // as in the Vm, where it would overlap the retired label's match
+      t.PC = 0;
+      return false;
+    }
+
+    t.Label = instr.Op.Offset;
+    t.advance(InstructionSize<LABEL_OP>::VAL);
+    return true;
+
+  case HALT_OP:
+    t.PC = 0;
+    return false;
+  }
+
+  return false;
+}
+
+uint64_t LazyDfa::search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  #ifdef LBT_TRACE_ENABLED
+  // every thread must show up in the trace
+  return Fallback.search(beg, end, startOffset, hitFn, userData);
+  #else
+  if (GaveUp) {
+    return Fallback.search(beg, end, startOffset, hitFn, userData);
+  }
+
+  const ByteSet& first = Prog->First;
+  uint64_t offset = startOffset;
+
+  // skipping and prefiltering are exactly as in Vm::search()
+  const bool skip = SkipScan && Skipper.worthwhile(),
+             filter = UsePrefilter && !Filter.empty();
+
+  const uint64_t lead = Filter.maxLead(),
+                 longest = Filter.maxLength();
+  const byte* const tail = !filter ? end :
+    uint64_t(end - beg) >= longest ? end - longest + 1 : beg;
+  const byte* lit = nullptr;
+
+  const auto window = [&](const byte* cur) {
+    if (!lit || lit < cur) {
+      lit = Filter.next(cur, end);
+    }
+
+    const byte* const n = std::min(lit, tail);
+    return n > cur && uint64_t(n - cur) > lead ? n - lead : cur;
+  };
+
+  const ByteSet none;
+
+  bool dfa = fromVm();
+
+  for (const byte* cur = beg; cur < end; ++cur, ++offset) {
+    if (!dfa) {
+      Fallback.executeFrame(filter && window(cur) != cur ? none : first, cur, offset, hitFn, userData);
+      Fallback.cleanup();
+      dfa = fromVm();
+      continue;
+    }
+
+    if (States[Cur].Threads.empty() && (skip || filter)) {
+      const byte* const from = cur;
+      for (const byte* prev = nullptr; cur != prev && cur < end; ) {
+        prev = cur;
+        if (skip) {
+          cur = Skipper.next(cur, end);
+        }
+
+        if (filter && cur < end) {
+          cur = window(cur);
+        }
+      }
+
+      offset += cur - from;
+
+      if (cur == end) {
+        break;
+      }
+    }
+
+    const bool spawn = first[*cur] && !(filter && window(cur) != cur);
+
+    uint32_t next = States[Cur].Next[uint32_t(spawn) << 8 | *cur];
+    if (next == UNKNOWN) {
+      next = build(Cur, *cur, spawn);
+      if (GaveUp) {
+        toVm();
+        return Fallback.search(cur, end, offset, hitFn, userData);
+      }
+    }
+
+    if (next == FAILED) {
+      toVm();
+      Fallback.executeFrame(spawn ? first : none, cur, offset, hitFn, userData);
+      Fallback.cleanup();
+      dfa = fromVm();
+    }
+    else {
+      const Transition& tr(Transitions[next]);
+      if (!tr.Identity) {
+        NextStarts.resize(tr.Src.size());
+        for (uint32_t i = 0; i < tr.Src.size(); ++i) {
+          NextStarts[i] = tr.Src[i] == NEW ? offset : Starts[tr.Src[i]];
+        }
+        Starts.swap(NextStarts);
+      }
+      Cur = tr.Target;
+    }
+
+    ++BytesSinceFlush;
+  }
+
+  if (dfa) {
+    toVm();
+  }
+
+  // check for remaining live threads
+  for (const Thread& t : Fallback.active()) {
+    const unsigned char op = t.PC->OpCode;
+    if (op == HALT_OP || op == FINISH_OP) {
+      continue;
+    }
+    // this is a live thread
+    return t.Start;
+  }
+
+  return Thread::NONE;
+  #endif
+}
@@ -21,19 +21,30 @@
 #include "lightgrep/api.h"
 
 #include "automata.h"
+#include "bitvm.h"
 #include "c_api_util.h"
 #include "compiler.h"
+#include "container.h"
 #include "handles.h"
+#include "keywordvm.h"
+#include "limitvm.h"
+#include "mappedfile.h"
 #include "nfabuilder.h"
 #include "nfaoptimizer.h"
+#include "parallelsearch.h"
 #include "parser.h"
 #include "parsetree.h"
+#include "peephole.h"
 #include "program.h"
+#include "programcache.h"
+#include "snapshot.h"
 #include "utility.h"
 #include "vm_interface.h"
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -89,7 +100,12 @@ int lg_parse_pattern(LG_HPATTERN hPattern,
 }
 
 LG_HPATTERNMAP lg_create_pattern_map(unsigned int numTotalPatternsSizeHint) {
-  return new (std::nothrow) PatternMapHandle(numTotalPatternsSizeHint);
+  return trapWithRetval(
+    [numTotalPatternsSizeHint](){
+      return new PatternMapHandle{std::unique_ptr<PatternMap>(new PatternMap(numTotalPatternsSizeHint))};
+    },
+    nullptr
+  );
 }
 
 void lg_destroy_pattern_map(LG_HPATTERNMAP hPatternMap) {
@@ -97,7 +113,7 @@ void lg_destroy_pattern_map(LG_HPATTERNMAP hPatternMap) {
 }
 
 int lg_pattern_map_size(const LG_HPATTERNMAP hPatternMap) {
-  return hPatternMap->Patterns.size();
+  return hPatternMap->Impl->size();
 }
 
 LG_HFSM create_fsm(unsigned int numFsmStateSizeHint) {
@@ -123,9 +139,9 @@ void lg_destroy_fsm(LG_HFSM hFsm) {
 
 namespace {
   int addPattern(LG_HFSM hFsm, LG_HPATTERNMAP hMap, LG_HPATTERN hPattern, const char* encoding) {
-    const uint32_t label = hMap->Patterns.size();
-    hFsm->Impl->addPattern(hPattern->Tree, encoding, label);
-    hMap->addPattern(hPattern->Pat.Expression.c_str(), encoding);
+    const uint32_t label = hMap->Impl->size();
+    hFsm->Impl->addPattern(hPattern->Tree, encoding, label, hPattern->Pat.FixedString);
+    hMap->Impl->addPattern(hPattern->Pat.Expression.c_str(), encoding);
     return (int) label;
   }
 }
@@ -304,7 +320,7 @@ int lg_add_pattern_list(LG_HFSM hFsm,
 LG_PatternInfo* lg_pattern_info(LG_HPATTERNMAP hMap,
                                 unsigned int patternIndex)
 {
-  return &hMap->Patterns[patternIndex];
+  return &hMap->Impl->info(patternIndex);
 }
 
 LG_HPROGRAM create_program(LG_HFSM hFsm, const LG_ProgramOptions* opts) {
@@ -313,8 +329,16 @@ LG_HPROGRAM create_program(LG_HFSM hFsm, const LG_ProgramOptions* opts) {
     lg_destroy_program
   );
 
-  hFsm->Impl->finalizeGraph(opts->Determinize);
-  hProg->Impl = Compiler::createProgram(*hFsm->Impl->Fsm);
+  FSMThingy& fsm(*hFsm->Impl);
+  fsm.finalizeGraph(opts->Determinize);
+
+  // a program with nothing but keywords has no code
+  hProg->Impl = fsm.Fsm->verticesSize() > 1 ?
+    Compiler::createProgram(*fsm.Fsm, opts->Determinize) : ProgramPtr(new Program);
+  optimizeCode(*hProg->Impl);
+  hProg->Impl->Literals = fsm.Literals;
+  hProg->Impl->Keywords.build(fsm.Keywords, fsm.KeywordsFoldCase);
+  hProg->Impl->Lengths = fsm.Lengths;
 
   return hProg.release();
 }
@@ -329,22 +353,124 @@ LG_HPROGRAM lg_create_program(LG_HFSM hFsm,
 }
 
 namespace {
+  void check_program_size(int size) {
+    if (size < 0) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program size " << size << " is negative");
+    }
+  }
+
   void write_program(LG_HPROGRAM hProg, void* buffer) {
-    std::string buf = hProg->Impl->marshall();
-    std::memcpy(buffer, buf.data(), buf.size());
+    hProg->Impl->marshall(buffer);
+  }
+
+  void add_program_with_pattern_map(ContainerWriter& out, LG_HPROGRAM hProg, const LG_HPATTERNMAP hPatternMap) {
+    hProg->Impl->addSections(out);
+    out.add(PATTERNS_SECTION, hPatternMap->Impl->marshall(), 0);
+  }
+
+  int program_size_with_pattern_map(LG_HPROGRAM hProg, const LG_HPATTERNMAP hPatternMap) {
+    ContainerWriter out;
+    add_program_with_pattern_map(out, hProg, hPatternMap);
+    return out.size();
+  }
+
+  void write_program_with_pattern_map(LG_HPROGRAM hProg, const LG_HPATTERNMAP hPatternMap, void* buffer) {
+    ContainerWriter out;
+    add_program_with_pattern_map(out, hProg, hPatternMap);
+    out.write(buffer);
+  }
+
+  LG_HPATTERNMAP read_pattern_map_in_place(const ContainerReader& in, bool copy, std::shared_ptr<const void> keep) {
+    std::pair<const byte*, size_t> sec(in.find(PATTERNS_SECTION));
+    if (!sec.first) {
+      return nullptr;
+    }
+
+    if (copy) {
+      // in words, to keep the offset table aligned
+      std::shared_ptr<uint64_t> buf(
+        new uint64_t[sec.second / sizeof(uint64_t) + 1],
+        std::default_delete<uint64_t[]>()
+      );
+      std::memcpy(buf.get(), sec.first, sec.second);
+      sec.first = reinterpret_cast<const byte*>(buf.get());
+      keep = buf;
+    }
+
+    return new PatternMapHandle{
+      PatternMap::unmarshallInPlace(sec.first, sec.second, std::move(keep))
+    };
+  }
+
+  LG_HPATTERNMAP read_pattern_map(const void* buffer, int size) {
+    check_program_size(size);
+    return read_pattern_map_in_place(ContainerReader(buffer, size), true, nullptr);
   }
 
+  LG_HPATTERNMAP read_pattern_map_mapped(const char* path) {
+    size_t size;
+    std::shared_ptr<const void> mem(mapFile(path, size));
+    return read_pattern_map_in_place(ContainerReader(mem.get(), size), false, mem);
+  }
+
+
   LG_HPROGRAM read_program(void* buffer, int size) {
+    check_program_size(size);
+
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> hProg(
+      new (std::nothrow) ProgramHandle,
+      lg_destroy_program
+    );
+
+    hProg->Impl = Program::unmarshall(buffer, size);
+
+    return hProg.release();
+  }
+
+  LG_HPROGRAM read_program_in_place(const void* buffer, size_t size, std::shared_ptr<const void> keep) {
     std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> hProg(
       new (std::nothrow) ProgramHandle,
       lg_destroy_program
     );
 
-    std::string s(static_cast<char*>(buffer), size);
-    hProg->Impl = Program::unmarshall(s);
+    hProg->Impl = Program::unmarshallInPlace(buffer, size, std::move(keep));
 
     return hProg.release();
   }
+
+  LG_HPROGRAM read_program_mapped(const char* path) {
+    size_t size;
+    std::shared_ptr<const void> mem(mapFile(path, size));
+    return read_program_in_place(mem.get(), size, mem);
+  }
+}
+
+void lg_program_info(const LG_HPROGRAM hProg, LG_ProgramInfo* info) {
+  const MappableVector<MatchLengths>& lengths(hProg->Impl->Lengths);
+
+  MatchLengths all;
+  for (const MatchLengths& len : lengths) {
+    all.merge(len);
+  }
+
+  info->NumPatterns = lengths.size();
+  info->MinLength = all.Min;
+  info->MaxLength = all.Max;
+}
+
+void lg_pattern_lengths(const LG_HPROGRAM hProg,
+                        unsigned int patternIndex,
+                        uint64_t* minLength,
+                        uint64_t* maxLength)
+{
+  const MappableVector<MatchLengths>& lengths(hProg->Impl->Lengths);
+
+  const MatchLengths len(
+    patternIndex < lengths.size() ? lengths[patternIndex] : MatchLengths()
+  );
+
+  *minLength = len.Min;
+  *maxLength = len.Max;
 }
 
 int lg_program_size(const LG_HPROGRAM hProg) {
@@ -358,56 +484,437 @@ LG_HPROGRAM lg_read_program(void* buffer, int size) {
   );
 }
 
+LG_HPROGRAM lg_read_program_mapped(const char* path) {
+  return trapWithRetval(
+    [path](){ return read_program_mapped(path); },
+    nullptr
+  );
+}
+
+LG_HPROGRAM lg_program_from_buffer_nocopy(const void* buffer, int size) {
+  return trapWithRetval(
+    [buffer,size](){
+      check_program_size(size);
+      return read_program_in_place(buffer, size, nullptr);
+    },
+    nullptr
+  );
+}
+
 void lg_write_program(LG_HPROGRAM hProg, void* buffer) {
   exceptionTrap(std::bind(write_program, hProg, buffer));
 }
 
+int lg_program_size_with_pattern_map(const LG_HPROGRAM hProg, const LG_HPATTERNMAP hPatternMap) {
+  return trapWithRetval(
+    [hProg,hPatternMap](){ return program_size_with_pattern_map(hProg, hPatternMap); },
+    0
+  );
+}
+
+void lg_write_program_with_pattern_map(LG_HPROGRAM hProg, const LG_HPATTERNMAP hPatternMap, void* buffer) {
+  exceptionTrap(std::bind(write_program_with_pattern_map, hProg, hPatternMap, buffer));
+}
+
+LG_HPATTERNMAP lg_read_pattern_map(const void* buffer, int size) {
+  return trapWithRetval(
+    [buffer,size](){ return read_pattern_map(buffer, size); },
+    nullptr
+  );
+}
+
+LG_HPATTERNMAP lg_read_pattern_map_mapped(const char* path) {
+  return trapWithRetval(
+    [path](){ return read_pattern_map_mapped(path); },
+    nullptr
+  );
+}
+
 void lg_destroy_program(LG_HPROGRAM hProg) {
   delete hProg;
 }
 
 namespace {
-  LG_HCONTEXT create_context(LG_HPROGRAM hProg,
-    #ifdef LBT_TRACE_ENABLED
-                      uint64_t beginTrace, uint64_t endTrace
-    #else
-                      uint64_t, uint64_t
-    #endif
-    )
+  int cached_program(const char* cacheDir,
+                     const char* patterns,
+                     const char** defaultEncodings,
+                     unsigned int defaultEncodingsNum,
+                     const LG_KeyOptions* defaultOptions,
+                     const LG_ProgramOptions* progOpts,
+                     LG_HPROGRAM* hProg,
+                     LG_HPATTERNMAP* hMap,
+                     LG_Error** err)
   {
+    const std::string path(
+      std::string(cacheDir) + "/" +
+      programCacheKey(patterns, defaultEncodings, defaultEncodingsNum, *defaultOptions, *progOpts) +
+      PROGRAM_CACHE_SUFFIX
+    );
+
+    // a cached program which can't be read is compiled again
+    try {
+      size_t size;
+      std::shared_ptr<const void> mem(mapFile(path, size));
+      const ContainerReader in(mem.get(), size);
+
+      std::unique_ptr<ProgramHandle> prog(new ProgramHandle{Program::read(in, true, mem)});
+      std::unique_ptr<PatternMapHandle> pmap(read_pattern_map_in_place(in, false, mem));
+      if (pmap) {
+        *hProg = prog.release();
+        *hMap = pmap.release();
+        return 1;
+      }
+    }
+    catch (const std::exception&) {
+    }
+
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      create_fsm(0),
+      lg_destroy_fsm
+    );
+
+    std::unique_ptr<PatternMapHandle,void(*)(PatternMapHandle*)> pmap(
+      new PatternMapHandle{std::unique_ptr<PatternMap>(new PatternMap(0))},
+      lg_destroy_pattern_map
+    );
+
+    LG_Error* patErr = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), pmap.get(), patterns, defaultEncodings, defaultEncodingsNum,
+      defaultOptions, &patErr
+    );
+    std::unique_ptr<LG_Error,void(*)(LG_Error*)> patErrs(patErr, lg_free_error);
+
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      create_program(fsm.get(), progOpts),
+      lg_destroy_program
+    );
+
+    // only a clean compile is cached, so that errors are reported every time
+    if (!patErr) {
+      ContainerWriter out;
+      add_program_with_pattern_map(out, prog.get(), pmap.get());
+      try {
+        writeFileAtomically(path, out);
+      }
+      catch (const std::exception&) {
+        // the cache is only a cache
+      }
+    }
+
+    *hProg = prog.release();
+    *hMap = pmap.release();
+    if (err) {
+      *err = patErrs.release();
+    }
+    return 0;
+  }
+}
+
+void lg_program_cache_file(const char* patterns,
+                           const char** defaultEncodings,
+                           unsigned int defaultEncodingsNum,
+                           const LG_KeyOptions* defaultOptions,
+                           const LG_ProgramOptions* progOpts,
+                           char* name)
+{
+  const std::string file(
+    programCacheKey(patterns, defaultEncodings, defaultEncodingsNum, *defaultOptions, *progOpts) +
+    PROGRAM_CACHE_SUFFIX
+  );
+  std::memcpy(name, file.c_str(), file.size() + 1);
+}
+
+int lg_cached_program(const char* cacheDir,
+                      const char* patterns,
+                      const char** defaultEncodings,
+                      unsigned int defaultEncodingsNum,
+                      const LG_KeyOptions* defaultOptions,
+                      const LG_ProgramOptions* progOpts,
+                      LG_HPROGRAM* hProg,
+                      LG_HPATTERNMAP* hMap,
+                      LG_Error** err)
+{
+  *hProg = nullptr;
+  *hMap = nullptr;
+  return trapWithRetval(
+    [=](){
+      return cached_program(
+        cacheDir, patterns, defaultEncodings, defaultEncodingsNum,
+        defaultOptions, progOpts, hProg, hMap, err
+      );
+    },
+    -1,
+    err
+  );
+}
+
+namespace {
+  LG_HCONTEXT create_context(LG_HPROGRAM hProg, const LG_ContextOptions& opts, const LG_SearchOptions* searchOpts) {
     std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> hCtx(
       new ContextHandle,
       lg_destroy_context
     );
 
-    hCtx->Impl = VmInterface::create();
+    hCtx->Prog = hProg->Impl;
+
+    // where the prefilter can skip, it beats running bit-parallel
+    const Program& prog(*hProg->Impl);
+    if (!prog.empty()) {
+      hCtx->Impl = VmInterface::create(
+        opts.LazyDfa,
+        !opts.NoTable && !prog.Table.empty(),
+        !opts.NoBitParallel && BitVm::fits(prog) &&
+          (opts.NoPrefilter || prog.Literals.empty())
+      );
+    }
+
+    // keywords are searched for separately from the code
+    if (!prog.Keywords.empty()) {
+      hCtx->Impl.reset(new KeywordVm(hCtx->Impl));
+    }
+
+    if (searchOpts) {
+      hCtx->Impl.reset(new LimitVm(
+        hCtx->Impl,
+        searchOpts->Exists,
+        searchOpts->CountOnly,
+        searchOpts->MaxHitsPerPattern
+      ));
+    }
+
     #ifdef LBT_TRACE_ENABLED
-    hCtx->Impl->setDebugRange(beginTrace, endTrace);
+    hCtx->Impl->setDebugRange(opts.TraceBegin, opts.TraceEnd);
     #endif
+    hCtx->Impl->setSkipScan(!opts.NoSkipScan);
+    hCtx->Impl->setPrefilter(!opts.NoPrefilter);
+    hCtx->Impl->setCompact(opts.Compact);
     hCtx->Impl->init(hProg->Impl);
 
     return hCtx.release();
   }
 }
 
+namespace {
+  LG_ContextOptions contextOptions(const LG_ContextOptions* options) {
+    LG_ContextOptions opts;
+    if (options) {
+      opts = *options;
+    }
+    else {
+      std::memset(&opts, 0, sizeof(opts));
+      opts.TraceBegin = opts.TraceEnd = std::numeric_limits<uint64_t>::max();
+    }
+    return opts;
+  }
+}
+
 LG_HCONTEXT lg_create_context(LG_HPROGRAM hProg,
                               const LG_ContextOptions* options)
 {
-  const uint64_t
-    begin = options ? options->TraceBegin : std::numeric_limits<uint64_t>::max(),
-    end = options ? options->TraceEnd : std::numeric_limits<uint64_t>::max();
+  const LG_ContextOptions opts(contextOptions(options));
 
   return trapWithRetval(
-    [hProg,begin,end](){ return create_context(hProg, begin, end); },
+    [hProg,&opts](){ return create_context(hProg, opts, nullptr); },
     nullptr
   );
 }
 
+LG_HCONTEXT lg_create_search_context(LG_HPROGRAM hProg,
+                                     const LG_ContextOptions* options,
+                                     const LG_SearchOptions* searchOptions)
+{
+  const LG_ContextOptions opts(contextOptions(options));
+
+  return trapWithRetval(
+    [hProg,&opts,searchOptions](){ return create_context(hProg, opts, searchOptions); },
+    nullptr
+  );
+}
+
+uint64_t lg_hit_count(LG_HCONTEXT hCtx, unsigned int patternIndex) {
+  const LimitVm* limits = dynamic_cast<const LimitVm*>(hCtx->Impl.get());
+  return limits ? limits->count(patternIndex) : 0;
+}
+
 void lg_destroy_context(LG_HCONTEXT hCtx) {
   delete hCtx;
 }
 
+namespace {
+  LG_HCONTEXT clone_context(LG_HCONTEXT hCtx) {
+    std::unique_ptr<ContextHandle> clone(new ContextHandle);
+    clone->Impl = hCtx->Impl->clone();
+    clone->Prog = hCtx->Prog;
+    return clone.release();
+  }
+}
+
+LG_HCONTEXT lg_clone_context(LG_HCONTEXT hCtx) {
+  return trapWithRetval(
+    [hCtx](){ return clone_context(hCtx); },
+    nullptr
+  );
+}
+
+namespace {
+  const uint32_t SNAPSHOT_MAGIC = 0x5353474C; // "LGSS"
+  const uint32_t SNAPSHOT_VERSION = 1;
+
+  std::string snapshot_context(LG_HCONTEXT hCtx) {
+    std::ostringstream out;
+    writeSnapshotValue(out, SNAPSHOT_MAGIC);
+    writeSnapshotValue(out, SNAPSHOT_VERSION);
+    writeSnapshotValue(out, hCtx->Prog->fingerprint());
+
+    writeSnapshotValue(out, byte(hCtx->ClosedOut));
+
+    // the batched hits not yet handed out
+    writeSnapshotValue(out, uint64_t(hCtx->Held.size() - hCtx->HeldPos));
+    for (size_t i = hCtx->HeldPos; i < hCtx->Held.size(); ++i) {
+      writeSnapshotValue(out, hCtx->Held[i].Start);
+      writeSnapshotValue(out, hCtx->Held[i].End);
+      writeSnapshotValue(out, hCtx->Held[i].KeywordIndex);
+    }
+
+    if (hCtx->Impl) {
+      hCtx->Impl->snapshot(out);
+    }
+    return out.str();
+  }
+
+  void restore_context(LG_HCONTEXT hCtx, const void* buffer, int size) {
+    std::istringstream in(std::string(static_cast<const char*>(buffer), size));
+
+    if (readSnapshotValue<uint32_t>(in) != SNAPSHOT_MAGIC) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("not a context snapshot");
+    }
+
+    if (readSnapshotValue<uint32_t>(in) != SNAPSHOT_VERSION) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("unsupported context snapshot version");
+    }
+
+    if (readSnapshotValue<uint64_t>(in) != hCtx->Prog->fingerprint()) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot is of a context for a different program");
+    }
+
+    hCtx->ClosedOut = readSnapshotValue<byte>(in);
+
+    hCtx->Held.clear();
+    hCtx->HeldPos = 0;
+    const uint64_t numHeld = readSnapshotValue<uint64_t>(in);
+    for (uint64_t i = 0; i < numHeld; ++i) {
+      LG_SearchHit hit;
+      hit.Start = readSnapshotValue<uint64_t>(in);
+      hit.End = readSnapshotValue<uint64_t>(in);
+      hit.KeywordIndex = readSnapshotValue<uint32_t>(in);
+      hCtx->Held.push_back(hit);
+    }
+
+    if (hCtx->Impl) {
+      hCtx->Impl->restore(in);
+    }
+
+    if (in.peek() != std::char_traits<char>::eof()) {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot is of a context made with different options");
+    }
+  }
+}
+
+int lg_context_snapshot_size(LG_HCONTEXT hCtx) {
+  return trapWithRetval(
+    [hCtx](){ return int(snapshot_context(hCtx).size()); },
+    -1
+  );
+}
+
+void lg_write_context_snapshot(LG_HCONTEXT hCtx, void* buffer) {
+  exceptionTrap([hCtx,buffer]() {
+    const std::string s(snapshot_context(hCtx));
+    std::memcpy(buffer, s.data(), s.size());
+  });
+}
+
+int lg_read_context_snapshot(LG_HCONTEXT hCtx, const void* buffer, int size, LG_Error** err) {
+  const int ret = trapWithVals(
+    [hCtx,buffer,size](){ restore_context(hCtx, buffer, size); },
+    1, 0, err
+  );
+
+  if (!ret) {
+    // rather than leave it half restored
+    lg_reset_context(hCtx);
+  }
+  return ret;
+}
+
+uint64_t lg_context_memory_usage(LG_HCONTEXT hCtx) {
+  return sizeof(ContextHandle) + vectorBytes(hCtx->Held) +
+    (hCtx->Impl ? hCtx->Impl->memoryUsage() : 0);
+}
+
+namespace {
+  LG_HCONTEXTPOOL create_context_pool(LG_HPROGRAM hProg, const LG_ContextOptions& opts, const LG_SearchOptions* searchOpts) {
+    std::unique_ptr<ContextPoolHandle> hPool(new ContextPoolHandle);
+    hPool->Proto.reset(create_context(hProg, opts, searchOpts));
+    return hPool.release();
+  }
+
+  LG_HCONTEXT acquire_context(LG_HCONTEXTPOOL hPool) {
+    {
+      std::lock_guard<std::mutex> lock(hPool->Lock);
+      if (!hPool->Free.empty()) {
+        LG_HCONTEXT hCtx = hPool->Free.back().release();
+        hPool->Free.pop_back();
+        return hCtx;
+      }
+    }
+
+    // the prototype is never searched, so cloning it needs no lock
+    return clone_context(hPool->Proto.get());
+  }
+
+  void release_context(LG_HCONTEXTPOOL hPool, LG_HCONTEXT hCtx) {
+    std::unique_ptr<ContextHandle> ctx(hCtx);
+    lg_reset_context(hCtx);
+
+    std::lock_guard<std::mutex> lock(hPool->Lock);
+    hPool->Free.push_back(std::move(ctx));
+  }
+}
+
+LG_HCONTEXTPOOL lg_create_context_pool(LG_HPROGRAM hProg,
+                                       const LG_ContextOptions* options,
+                                       const LG_SearchOptions* searchOptions)
+{
+  const LG_ContextOptions opts(contextOptions(options));
+
+  return trapWithRetval(
+    [hProg,&opts,searchOptions](){ return create_context_pool(hProg, opts, searchOptions); },
+    nullptr
+  );
+}
+
+void lg_destroy_context_pool(LG_HCONTEXTPOOL hPool) {
+  delete hPool;
+}
+
+LG_HCONTEXT lg_acquire_context(LG_HCONTEXTPOOL hPool) {
+  return trapWithRetval(
+    [hPool](){ return acquire_context(hPool); },
+    nullptr
+  );
+}
+
+void lg_release_context(LG_HCONTEXTPOOL hPool, LG_HCONTEXT hCtx) {
+  exceptionTrap([hPool,hCtx](){ release_context(hPool, hCtx); });
+}
+
 void lg_reset_context(LG_HCONTEXT hCtx) {
+  hCtx->Held.clear();
+  hCtx->HeldPos = 0;
+  hCtx->ClosedOut = false;
+
   exceptionTrap(std::bind(&VmInterface::reset, hCtx->Impl));
 }
 
@@ -440,6 +947,174 @@ void lg_closeout_search(LG_HCONTEXT hCtx,
   exceptionTrap(std::bind(&VmInterface::closeOut, hCtx->Impl, callbackFn, userData));
 }
 
+namespace {
+  // the caller's array for lg_search_hits(), spilling into the context
+  struct HitArray {
+    LG_SearchHit* Hits;
+    size_t Max, Num;
+    ContextHandle* Ctx;
+
+    bool full() const { return Num == Max; }
+  };
+
+  void appendHit(void* userData, const LG_SearchHit* const hit) {
+    HitArray& arr(*static_cast<HitArray*>(userData));
+    if (arr.full()) {
+      arr.Ctx->Held.push_back(*hit);
+    }
+    else {
+      arr.Hits[arr.Num++] = *hit;
+    }
+  }
+
+  void takeHeld(HitArray& arr) {
+    ContextHandle& ctx(*arr.Ctx);
+
+    const size_t n = std::min(arr.Max - arr.Num, ctx.Held.size() - ctx.HeldPos);
+    std::copy(ctx.Held.begin() + ctx.HeldPos,
+              ctx.Held.begin() + ctx.HeldPos + n, arr.Hits + arr.Num);
+    arr.Num += n;
+    ctx.HeldPos += n;
+
+    if (ctx.HeldPos == ctx.Held.size()) {
+      ctx.Held.clear();
+      ctx.HeldPos = 0;
+    }
+  }
+
+  uint64_t search_hits(LG_HCONTEXT hCtx, const byte* const beg, const byte* const end, const uint64_t startOffset, LG_SearchHit* hits, size_t maxHits, size_t* numHits) {
+    // The buffer is searched a slice at a time so as to stop soon after
+    // the array fills. Slices are small enough that not many hits pile up
+    // in the context past that, and big enough that the cost of starting
+    // one is lost in the cost of searching it.
+    static const uint64_t SLICE = 1 << 12;
+
+    HitArray arr{hits, maxHits, 0, hCtx};
+    takeHeld(arr);
+
+    const byte* cur = beg;
+    while (cur < end && !arr.full()) {
+      const byte* const next = uint64_t(end - cur) > SLICE ? cur + SLICE : end;
+      hCtx->Impl->search(cur, next, startOffset + (cur - beg), appendHit, &arr);
+      cur = next;
+    }
+
+    *numHits = arr.Num;
+    return startOffset + (cur - beg);
+  }
+
+  size_t closeout_search_hits(LG_HCONTEXT hCtx, LG_SearchHit* hits, size_t maxHits) {
+    HitArray arr{hits, maxHits, 0, hCtx};
+    takeHeld(arr);
+
+    if (!hCtx->ClosedOut) {
+      hCtx->ClosedOut = true;
+      hCtx->Impl->closeOut(appendHit, &arr);
+    }
+
+    return arr.Num;
+  }
+}
+
+uint64_t lg_search_hits(LG_HCONTEXT hCtx,
+                        const char* bufStart,
+                        const char* bufEnd,
+                        const uint64_t startOffset,
+                        LG_SearchHit* hits,
+                        size_t maxHits,
+                        size_t* numHits)
+{
+  *numHits = 0;
+  return trapWithRetval(
+    [=](){ return search_hits(hCtx, (const byte*) bufStart, (const byte*) bufEnd, startOffset, hits, maxHits, numHits); },
+    std::numeric_limits<uint64_t>::max()
+  );
+}
+
+size_t lg_closeout_search_hits(LG_HCONTEXT hCtx,
+                               LG_SearchHit* hits,
+                               size_t maxHits)
+{
+  return trapWithRetval(
+    [=](){ return closeout_search_hits(hCtx, hits, maxHits); },
+    size_t(0)
+  );
+}
+
+namespace {
+  uint64_t search_parallel(LG_HPROGRAM hProg, const LG_ContextOptions& opts, const byte* bufStart, const byte* bufEnd, const uint64_t startOffset, const uint32_t numThreads, LG_HITCALLBACK_FN callbackFn, void* userData) {
+    // chunks big enough that the lookahead past each is small beside it,
+    // and enough of them to keep all the threads busy
+    const uint32_t threads = std::max(numThreads, 1u);
+    const uint64_t chunkSize = std::max(
+      uint64_t(1) << 20, uint64_t(bufEnd - bufStart) / (4 * threads) + 1
+    );
+
+    // each thread's engine is a clone of this one, sharing what it worked
+    // out from the program
+    const std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> hProto(
+      create_context(hProg, opts, nullptr),
+      lg_destroy_context
+    );
+    const VmInterface& proto(*hProto->Impl);
+
+    return searchParallel(
+      [&proto]() { return proto.clone(); },
+      bufStart, bufEnd, startOffset, threads, chunkSize, callbackFn, userData
+    );
+  }
+
+  uint64_t search_parallel_file(LG_HPROGRAM hProg, const LG_ContextOptions& opts, const char* path, const uint32_t numThreads, LG_HITCALLBACK_FN callbackFn, void* userData) {
+    size_t size;
+    const std::shared_ptr<const void> mem(mapFile(path, size));
+    const byte* beg = static_cast<const byte*>(mem.get());
+    return search_parallel(
+      hProg, opts, beg, beg + size, 0, numThreads, callbackFn, userData
+    );
+  }
+}
+
+uint64_t lg_search_parallel(LG_HPROGRAM hProg,
+                            const LG_ContextOptions* options,
+                            const char* bufStart,
+                            const char* bufEnd,
+                            const uint64_t startOffset,
+                            unsigned int numThreads,
+                            void* userData,
+                            LG_HITCALLBACK_FN callbackFn)
+{
+  const LG_ContextOptions opts(contextOptions(options));
+
+  return trapWithRetval(
+    [=,&opts](){
+      return search_parallel(
+        hProg, opts, (const byte*) bufStart, (const byte*) bufEnd,
+        startOffset, numThreads, callbackFn, userData
+      );
+    },
+    uint64_t(0)
+  );
+}
+
+uint64_t lg_search_parallel_file(LG_HPROGRAM hProg,
+                                 const LG_ContextOptions* options,
+                                 const char* path,
+                                 unsigned int numThreads,
+                                 void* userData,
+                                 LG_HITCALLBACK_FN callbackFn)
+{
+  const LG_ContextOptions opts(contextOptions(options));
+
+  return trapWithRetval(
+    [=,&opts](){
+      return search_parallel_file(
+        hProg, opts, path, numThreads, callbackFn, userData
+      );
+    },
+    uint64_t(0)
+  );
+}
+
 uint64_t lg_search_resolve(LG_HCONTEXT hCtx,
                        const char* bufStart,
                        const char* bufEnd,
@@ -0,0 +1,168 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "limitvm.h"
+#include "program.h"
+#include "snapshot.h"
+
+#include <limits>
+
+namespace {
+  // thrown from _hit() once nothing more will be passed on, so the engine
+  // stops at the hit which ended the search rather than at the end of the
+  // buffer; every engine retires labels, so this is the only way out
+  struct Stop {};
+}
+
+LimitVm::LimitVm(std::shared_ptr<VmInterface> inner, bool exists, bool countOnly, uint32_t maxHits):
+  Inner(inner),
+  Exists(exists),
+  CountOnly(countOnly),
+  MaxHits(maxHits),
+  Compact(false),
+  NumCapped(0),
+  Done(false),
+  CurHitFn(0),
+  UserData(0) {}
+
+void LimitVm::init(ProgramPtr prog) {
+  Inner->init(prog);
+
+  // labels come from the code and from the keywords; the code is walked
+  // instruction by instruction, as operands could pass for labels
+  const Program& p(*prog);
+  uint32_t numLabels = p.Keywords.NumLabels;
+  for (uint32_t pc = 0; pc < p.size(); pc += p[pc].length()) {
+    if (p[pc].OpCode == LABEL_OP && p[pc].Op.Offset >= numLabels) {
+      numLabels = p[pc].Op.Offset + 1;
+    }
+  }
+
+  Counts.resize(numLabels, hashLabels(numLabels, Compact));
+  reset();
+}
+
+std::shared_ptr<VmInterface> LimitVm::clone() const {
+  std::shared_ptr<LimitVm> c(new LimitVm(*this));
+  c->Inner = Inner->clone();
+  c->reset();
+  return c;
+}
+
+void LimitVm::snapshot(std::ostream& out) const {
+  writeSnapshotValue(out, LIMIT_SNAPSHOT);
+  writeSnapshotValue(out, NumCapped);
+  writeSnapshotValue(out, byte(Done));
+  Counts.snapshot(out);
+  Inner->snapshot(out);
+}
+
+void LimitVm::restore(std::istream& in) {
+  readSnapshotTag(in, LIMIT_SNAPSHOT);
+  NumCapped = readSnapshotValue<uint32_t>(in);
+  Done = readSnapshotValue<byte>(in);
+  if (NumCapped > Counts.size()) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot is corrupt");
+  }
+  Counts.restore(in);
+  Inner->restore(in);
+}
+
+void LimitVm::reset() {
+  Inner->reset();
+
+  Counts.clear();
+  NumCapped = 0;
+  Done = Counts.size() == 0;
+}
+
+void LimitVm::_hit(void* userData, const LG_SearchHit* const hit) {
+  LimitVm& vm(*static_cast<LimitVm*>(userData));
+  const uint32_t label = hit->KeywordIndex;
+  const uint64_t n = vm.Counts[label] + 1;
+  if (n > vm.MaxHits && vm.MaxHits) {
+    return;
+  }
+
+  vm.Counts.set(label, n);
+
+  if (!vm.CountOnly && vm.CurHitFn) {
+    (*vm.CurHitFn)(vm.UserData, hit);
+  }
+
+  if (vm.Exists) {
+    vm.Done = true;
+  }
+  else if (n == vm.MaxHits) {
+    vm.Inner->retire(label);
+    vm.Done = ++vm.NumCapped == vm.Counts.size();
+  }
+
+  if (vm.Done) {
+    throw Stop();
+  }
+}
+
+template <class F>
+bool LimitVm::_run(F f) {
+  if (Done) {
+    return false;
+  }
+
+  try {
+    f();
+    return true;
+  }
+  catch (const Stop&) {
+    // the engine was left mid-search, and nothing it has matters now
+    Inner->reset();
+    return false;
+  }
+}
+
+void LimitVm::startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+
+  _run([&](){ Inner->startsWith(beg, end, startOffset, _hit, this); });
+}
+
+uint64_t LimitVm::search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+
+  uint64_t live = std::numeric_limits<uint64_t>::max();
+  return _run([&](){ live = Inner->search(beg, end, startOffset, _hit, this); }) ?
+    live : std::numeric_limits<uint64_t>::max();
+}
+
+uint64_t LimitVm::searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+
+  uint64_t live = std::numeric_limits<uint64_t>::max();
+  return _run([&](){ live = Inner->searchResolve(beg, end, startOffset, _hit, this); }) ?
+    live : std::numeric_limits<uint64_t>::max();
+}
+
+void LimitVm::closeOut(HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+
+  _run([&](){ Inner->closeOut(_hit, this); });
+}
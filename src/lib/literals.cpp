@@ -0,0 +1,429 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "literals.h"
+
+#include "encoders/encoder.h"
+#include "parsetree.h"
+
+#include <algorithm>
+#include <set>
+
+//
+// Every node of the parse tree is summarized bottom-up by:
+//
+//  * the longest (encoded) match it can have;
+//  * every string it can match, if there are only a few short ones;
+//  * strings one of which every match begins with, and ends with;
+//  * the best factor seen so far: strings one of which every match
+//    contains, along with how far into the match they may begin.
+//
+// Keeping the sets small keeps this linear in the size of the tree; when a
+// set would grow too large we simply forget about it, which is safe since
+// every set is only ever a constraint on matches.
+//
+
+namespace {
+  typedef std::set<std::string> StringSet;
+
+  const size_t MAX_STRINGS = 16;
+  const size_t MAX_LENGTH = 16;
+
+  uint32_t addLen(uint32_t a, uint32_t b) {
+    return a == UNBOUNDED || b == UNBOUNDED || a + b < a ? UNBOUNDED : a + b;
+  }
+
+  uint32_t mulLen(uint32_t a, uint32_t b) {
+    if (a == 0 || b == 0) {
+      return 0;
+    }
+    else if (a == UNBOUNDED || b == UNBOUNDED) {
+      return UNBOUNDED;
+    }
+
+    const uint64_t p = uint64_t(a) * b;
+    return p >= UNBOUNDED ? UNBOUNDED : p;
+  }
+
+  size_t shortest(const StringSet& s) {
+    size_t len = std::numeric_limits<size_t>::max();
+    for (const std::string& str : s) {
+      len = std::min(len, str.size());
+    }
+    return len;
+  }
+
+  bool cross(const StringSet& a, const StringSet& b, StringSet& out) {
+    if (a.size() * b.size() > MAX_STRINGS) {
+      return false;
+    }
+
+    out.clear();
+    for (const std::string& x : a) {
+      for (const std::string& y : b) {
+        out.insert(x + y);
+      }
+    }
+    return true;
+  }
+
+  StringSet heads(const StringSet& s) {
+    StringSet r;
+    for (const std::string& str : s) {
+      r.insert(str.substr(0, MAX_LENGTH));
+    }
+    return r;
+  }
+
+  StringSet tails(const StringSet& s) {
+    StringSet r;
+    for (const std::string& str : s) {
+      r.insert(str.size() > MAX_LENGTH ? str.substr(str.size() - MAX_LENGTH) : str);
+    }
+    return r;
+  }
+
+  struct Factor {
+    StringSet Strs;
+    uint32_t Lead;
+
+    Factor(): Lead(UNBOUNDED) {}
+
+    Factor(const StringSet& s, uint32_t lead): Strs(s), Lead(lead) {
+      if (Strs.empty() || Strs.count("")) {
+        Strs.clear();
+      }
+    }
+
+    // whether this would make a better prefilter than o
+    bool operator>(const Factor& o) const {
+      if (Strs.empty() || o.Strs.empty()) {
+        return o.Strs.empty() && !Strs.empty();
+      }
+
+      if ((Lead == UNBOUNDED) != (o.Lead == UNBOUNDED)) {
+        return o.Lead == UNBOUNDED;
+      }
+
+      // beyond a few bytes, length hardly changes the false positive rate
+      const size_t len = std::min(shortest(Strs), size_t(4)),
+                   olen = std::min(shortest(o.Strs), size_t(4));
+      if (len != olen) {
+        return len > olen;
+      }
+
+      if (Strs.size() != o.Strs.size()) {
+        return Strs.size() < o.Strs.size();
+      }
+
+      if (Lead != o.Lead) {
+        return Lead < o.Lead;
+      }
+
+      return shortest(Strs) > shortest(o.Strs);
+    }
+  };
+
+  struct Info {
+    uint32_t MaxLen;
+
+    bool Exact; // Strs holds everything the node can match
+    StringSet Strs,
+              Prefix,
+              Suffix;
+
+    Factor Best;
+
+    Info(): MaxLen(0), Exact(false) {}
+
+    void consider(const Factor& f) {
+      if (f > Best) {
+        Best = f;
+      }
+    }
+
+    // fills in what can be derived from the rest
+    void finish() {
+      if (Exact) {
+        if (Strs.size() > MAX_STRINGS) {
+          Exact = false;
+          Strs.clear();
+        }
+        else {
+          Prefix = heads(Strs);
+          Suffix = tails(Strs);
+          if (shortest(Strs) > MAX_LENGTH) {
+            Exact = false;
+            Strs.clear();
+          }
+          else {
+            consider(Factor(Strs, 0));
+          }
+        }
+      }
+
+      if (Prefix.count("")) {
+        Prefix.clear();
+      }
+
+      if (Suffix.count("")) {
+        Suffix.clear();
+      }
+
+      if (!Prefix.empty()) {
+        consider(Factor(Prefix, 0));
+      }
+
+      if (!Suffix.empty()) {
+        consider(Factor(Suffix, MaxLen == UNBOUNDED ? UNBOUNDED : MaxLen - shortest(Suffix)));
+      }
+    }
+  };
+
+  class Extractor {
+  public:
+    Extractor(const Encoder& enc): Enc(enc), Buf(new byte[enc.maxByteLength()]) {}
+
+    // returns false if there is something here we do not understand
+    bool visit(const ParseNode& n, Info& info) {
+      switch (n.Type) {
+      case ParseNode::REGEXP:
+        return visit(*n.Child.Left, info);
+      case ParseNode::ALTERNATION:
+        return alternation(n, info);
+      case ParseNode::CONCATENATION:
+        return concatenation(n, info);
+      case ParseNode::REPETITION:
+      case ParseNode::REPETITION_NG:
+        return repetition(n, info);
+      case ParseNode::DOT:
+        info.MaxLen = Enc.maxByteLength();
+        break;
+      case ParseNode::CHAR_CLASS:
+        charClass(n, info);
+        break;
+      case ParseNode::LITERAL:
+        {
+          const uint32_t len = Enc.write(n.Val, Buf.get());
+          if (len == 0) {
+            return false;
+          }
+          info.MaxLen = len;
+          info.Exact = true;
+          info.Strs.insert(std::string(reinterpret_cast<char*>(Buf.get()), len));
+        }
+        break;
+      case ParseNode::BYTE:
+        info.MaxLen = 1;
+        info.Exact = true;
+        info.Strs.insert(std::string(1, char(n.Val)));
+        break;
+      default:
+        return false;
+      }
+
+      info.finish();
+      return true;
+    }
+
+  private:
+    void charClass(const ParseNode& n, Info& info) {
+      const UnicodeSet uset(n.Set.CodePoints & Enc.validCodePoints());
+      const ByteSet& bytes(n.Set.Breakout.Bytes);
+
+      info.MaxLen = uset.any() ? Enc.maxByteLength() : 1;
+
+      // subtracted breakout bytes remove whole encodings from the class
+      if (!n.Set.Breakout.Additive && bytes.any()) {
+        return;
+      }
+
+      if (uset.count() + bytes.count() > 4) {
+        return;
+      }
+
+      for (const UnicodeSet::range& r : uset) {
+        for (uint32_t cp = r.first; cp < r.second; ++cp) {
+          const uint32_t len = Enc.write(cp, Buf.get());
+          info.Strs.insert(std::string(reinterpret_cast<char*>(Buf.get()), len));
+        }
+      }
+
+      for (uint32_t b = 0; b < 256; ++b) {
+        if (bytes.test(b)) {
+          info.Strs.insert(std::string(1, char(b)));
+        }
+      }
+
+      info.Exact = !info.Strs.empty();
+    }
+
+    bool alternation(const ParseNode& n, Info& info) {
+      Info l, r;
+      if (!visit(*n.Child.Left, l) || !visit(*n.Child.Right, r)) {
+        return false;
+      }
+
+      info.MaxLen = std::max(l.MaxLen, r.MaxLen);
+
+      if (l.Exact && r.Exact) {
+        info.Exact = true;
+        info.Strs = l.Strs;
+        info.Strs.insert(r.Strs.begin(), r.Strs.end());
+      }
+
+      if (!l.Prefix.empty() && !r.Prefix.empty()) {
+        info.Prefix = l.Prefix;
+        info.Prefix.insert(r.Prefix.begin(), r.Prefix.end());
+        if (info.Prefix.size() > MAX_STRINGS) {
+          info.Prefix.clear();
+        }
+      }
+
+      if (!l.Suffix.empty() && !r.Suffix.empty()) {
+        info.Suffix = l.Suffix;
+        info.Suffix.insert(r.Suffix.begin(), r.Suffix.end());
+        if (info.Suffix.size() > MAX_STRINGS) {
+          info.Suffix.clear();
+        }
+      }
+
+      if (!l.Best.Strs.empty() && !r.Best.Strs.empty()) {
+        StringSet s(l.Best.Strs);
+        s.insert(r.Best.Strs.begin(), r.Best.Strs.end());
+        if (s.size() <= MAX_STRINGS) {
+          info.consider(Factor(s, std::max(l.Best.Lead, r.Best.Lead)));
+        }
+      }
+
+      info.finish();
+      return true;
+    }
+
+    bool concatenation(const ParseNode& n, Info& info) {
+      Info l, r;
+      if (!visit(*n.Child.Left, l) || !visit(*n.Child.Right, r)) {
+        return false;
+      }
+
+      info.MaxLen = addLen(l.MaxLen, r.MaxLen);
+
+      if (l.Exact && r.Exact) {
+        info.Exact = cross(l.Strs, r.Strs, info.Strs);
+      }
+
+      StringSet s;
+      if (l.Exact && !r.Prefix.empty() && cross(l.Strs, r.Prefix, s)) {
+        info.Prefix = heads(s);
+      }
+      else {
+        info.Prefix = l.Prefix;
+      }
+
+      if (r.Exact && !l.Suffix.empty() && cross(l.Suffix, r.Strs, s)) {
+        info.Suffix = tails(s);
+      }
+      else {
+        info.Suffix = r.Suffix;
+      }
+
+      info.consider(l.Best);
+      info.consider(Factor(r.Best.Strs, addLen(l.MaxLen, r.Best.Lead)));
+
+      // a literal spanning the boundary
+      if (!l.Suffix.empty() && !r.Prefix.empty() && cross(l.Suffix, r.Prefix, s)) {
+        info.consider(Factor(s, l.MaxLen == UNBOUNDED ? UNBOUNDED : l.MaxLen - shortest(l.Suffix)));
+      }
+
+      info.finish();
+      return true;
+    }
+
+    bool repetition(const ParseNode& n, Info& info) {
+      Info c;
+      if (!visit(*n.Child.Left, c)) {
+        return false;
+      }
+
+      const uint32_t min = n.Child.Rep.Min,
+                     max = n.Child.Rep.Max;
+
+      info.MaxLen = mulLen(c.MaxLen, max);
+
+      if (min == 0) {
+        if (max == 0) {
+          info.Exact = true;
+          info.Strs.insert("");
+        }
+        // otherwise nothing is required of an optional subpattern
+        info.finish();
+        return true;
+      }
+
+      // the first and last repetitions are required
+      info.Prefix = c.Prefix;
+      info.Suffix = c.Suffix;
+      info.consider(c.Best);
+
+      if (c.Exact && min <= MAX_LENGTH) {
+        // c{min} is both a prefix and a suffix of c{min,max}
+        StringSet pow(c.Strs), s;
+        bool ok = true;
+        for (uint32_t i = 1; i < min && ok; ++i) {
+          ok = cross(pow, c.Strs, s);
+          pow.swap(s);
+        }
+
+        if (ok) {
+          if (min == max) {
+            info.Exact = true;
+            info.Strs = pow;
+          }
+          else {
+            info.Prefix = heads(pow);
+            info.Suffix = tails(pow);
+          }
+        }
+      }
+
+      info.finish();
+      return true;
+    }
+
+    const Encoder& Enc;
+    std::unique_ptr<byte[]> Buf;
+  };
+}
+
+void RequiredLiterals::merge(const RequiredLiterals& other) {
+  Strings.insert(Strings.end(), other.Strings.begin(), other.Strings.end());
+  MaxLead = std::max(MaxLead, other.MaxLead);
+}
+
+bool requiredLiterals(const ParseTree& tree, const Encoder& enc, RequiredLiterals& lits) {
+  Info info;
+  if (!tree.Root || !Extractor(enc).visit(*tree.Root, info) ||
+      info.Best.Strs.empty() || info.Best.Lead == UNBOUNDED)
+  {
+    return false;
+  }
+
+  lits.Strings.assign(info.Best.Strs.begin(), info.Best.Strs.end());
+  lits.MaxLead = info.Best.Lead;
+  return true;
+}
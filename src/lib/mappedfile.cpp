@@ -0,0 +1,89 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "mappedfile.h"
+
+#include "basic.h"
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+std::shared_ptr<const void> mapFile(const std::string& path, size_t& len) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not open " << path);
+  }
+
+  len = in.tellg();
+  std::shared_ptr<char> buf(new char[len ? len : 1], std::default_delete<char[]>());
+  in.seekg(0);
+  if (!in.read(buf.get(), len)) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not read " << path);
+  }
+  return buf;
+}
+
+#else
+
+namespace {
+  struct Unmapper {
+    size_t Size;
+
+    void operator()(const void* p) const {
+      munmap(const_cast<void*>(p), Size);
+    }
+  };
+}
+
+std::shared_ptr<const void> mapFile(const std::string& path, size_t& len) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not open " << path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not stat " << path);
+  }
+
+  len = st.st_size;
+  if (len == 0) {
+    // there's nothing to map, but a null pointer would look like failure
+    close(fd);
+    return std::make_shared<byte>(0);
+  }
+
+  // private, so the pages are shared by all who map the file, but never
+  // written back to it
+  void* mem = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not map " << path);
+  }
+  return std::shared_ptr<const void>(mem, Unmapper{len});
+}
+
+#endif
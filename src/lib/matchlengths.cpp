@@ -0,0 +1,84 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "matchlengths.h"
+
+#include <algorithm>
+#include <limits>
+
+const uint64_t MatchLengths::UNBOUNDED = std::numeric_limits<uint64_t>::max();
+
+void mergeLengths(std::vector<MatchLengths>& lengths, uint32_t label, const MatchLengths& len) {
+  if (label >= lengths.size()) {
+    lengths.resize(label + 1);
+  }
+  lengths[label].merge(len);
+}
+
+void matchLengths(const NFA& g, std::vector<MatchLengths>& lengths) {
+  // Each state but the initial one consumes a byte on the way in, so a
+  // match is as long as the path to its state. Breadth-first order gives
+  // the shortest paths; the longest come from a topological order of the
+  // states reachable from the initial one, which leaves out exactly those
+  // on or after a cycle.
+  const uint32_t n = g.verticesSize();
+  const uint64_t NONE = std::numeric_limits<uint64_t>::max();
+
+  std::vector<uint64_t> shortest(n, NONE), longest(n, 0);
+  std::vector<uint32_t> inDegree(n, 0), queue;
+  queue.reserve(n);
+
+  shortest[0] = 0;
+  queue.push_back(0);
+  for (uint32_t i = 0; i < queue.size(); ++i) {
+    const NFA::VertexDescriptor v = queue[i];
+    for (const NFA::VertexDescriptor w : g.outVertices(v)) {
+      ++inDegree[w];
+      if (shortest[w] == NONE) {
+        shortest[w] = shortest[v] + 1;
+        queue.push_back(w);
+      }
+    }
+  }
+
+  queue.clear();
+  if (inDegree[0] == 0) {
+    queue.push_back(0);
+  }
+
+  for (uint32_t i = 0; i < queue.size(); ++i) {
+    const NFA::VertexDescriptor v = queue[i];
+    for (const NFA::VertexDescriptor w : g.outVertices(v)) {
+      longest[w] = std::max(longest[w], longest[v] + 1);
+
+      if (--inDegree[w] == 0) {
+        queue.push_back(w);
+      }
+    }
+  }
+
+  for (NFA::VertexDescriptor v = 1; v < n; ++v) {
+    if (g[v].IsMatch && g[v].Label != Glushkov::NOLABEL && shortest[v] != NONE) {
+      // states left with in-edges come after a cycle
+      mergeLengths(
+        lengths, g[v].Label,
+        MatchLengths(shortest[v], inDegree[v] ? MatchLengths::UNBOUNDED : longest[v])
+      );
+    }
+  }
+}
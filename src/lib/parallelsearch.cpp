@@ -0,0 +1,189 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "parallelsearch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <vector>
+
+//
+// Each chunk is searched from a fresh engine, as if the buffer began with
+// it, and then on past its end for as long as threads which began in the
+// chunk are live; its hits are those which begin in it. Searched alone, a
+// chunk can only differ from the serial search in what happens to each
+// label where a hit of the label from an earlier chunk runs into it: the
+// serial search finds the label's next hit at or after where that one
+// ends, while the chunk alone finds a chain of hits beginning at the start
+// of the chunk. The chain can simply be cut there unless one of its hits
+// straddles that point, in which case the label's hits in the chunk are
+// found again by searching from there.
+//
+// Labels meet only at the CHECK_HALT locks, which let one thread at a time
+// on through a state and kill the later ones arriving at it. Knowing less
+// of the hits before it, a chunk's engine hands out a lock more readily,
+// but the threads it then kills have the same future as the one holding
+// it and began after it, so their hits are overlapped by its hit of the
+// same label; unless an earlier chunk's hit kills that one, in which case
+// it straddles that hit's end and the label is searched again anyway.
+//
+
+namespace {
+  const uint64_t NONE = std::numeric_limits<uint64_t>::max();
+
+  void collect(void* userData, const LG_SearchHit* const hit) {
+    static_cast<std::vector<SearchHit>*>(userData)->push_back(
+      *static_cast<const SearchHit*>(hit)
+    );
+  }
+
+  // Searches [from, chunkEnd) and on until no thread begun before chunkEnd
+  // is live, and returns the hits which began in [from, chunkEnd).
+  std::vector<SearchHit> searchChunk(VmInterface& vm, const byte* const beg, const byte* const end, const uint64_t startOffset, const byte* const from, const byte* const chunkEnd) {
+    std::vector<SearchHit> hits;
+
+    vm.reset();
+
+    const uint64_t endOffset = startOffset + (chunkEnd - beg);
+    uint64_t live = vm.search(from, chunkEnd, startOffset + (from - beg), collect, &hits);
+
+    // most matches are short, so look a little way past the chunk first
+    uint64_t step = 1 << 12;
+    for (const byte* cur = chunkEnd; live < endOffset && cur < end; step *= 2) {
+      const byte* const next = uint64_t(end - cur) > step ? cur + step : end;
+      live = vm.search(cur, next, startOffset + (cur - beg), collect, &hits);
+      cur = next;
+    }
+
+    vm.closeOut(collect, &hits);
+
+    hits.erase(
+      std::remove_if(hits.begin(), hits.end(),
+        [endOffset](const SearchHit& h) { return h.Start >= endOffset; }),
+      hits.end()
+    );
+    return hits;
+  }
+
+  // the end of the last hit of each label so far, or 0 for none
+  uint64_t& lastEnd(std::vector<uint64_t>& ends, const uint32_t label) {
+    if (label >= ends.size()) {
+      ends.resize(label + 1, 0);
+    }
+    return ends[label];
+  }
+}
+
+uint64_t searchParallel(const VmMaker& makeVm, const byte* const beg, const byte* const end, const uint64_t startOffset, const uint32_t numThreads, const uint64_t chunkSize, HitCallback hitFn, void* userData) {
+  const uint64_t len = end - beg,
+                 size = std::max(chunkSize, uint64_t(1)),
+                 numChunks = (len + size - 1) / size;
+
+  const auto chunkBegin = [=](uint64_t i) { return beg + std::min(i * size, len); };
+
+  // the chunks are handed out in order, to whichever thread is free
+  std::vector<std::vector<SearchHit>> results(numChunks);
+  std::atomic<uint64_t> nextChunk(0);
+
+  const auto work = [&]() {
+    const std::shared_ptr<VmInterface> vm(makeVm());
+    for (uint64_t i; (i = nextChunk++) < numChunks; ) {
+      results[i] = searchChunk(
+        *vm, beg, end, startOffset, chunkBegin(i), chunkBegin(i + 1)
+      );
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < std::min(uint64_t(numThreads), numChunks); ++t) {
+    threads.emplace_back(work);
+  }
+  work();
+
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  // stitch the chunks together, in order
+  std::shared_ptr<VmInterface> vm;
+  std::vector<uint64_t> ends;
+  std::vector<bool> redo;
+  std::vector<SearchHit> out;
+
+  for (uint64_t i = 0; i < numChunks; ++i) {
+    std::vector<SearchHit>& hits(results[i]);
+
+    while (true) {
+      // find the labels whose chains straddle an earlier hit's end, and
+      // search again from the first such end
+      uint64_t from = NONE;
+      redo.assign(ends.size(), false);
+
+      for (const SearchHit& h : hits) {
+        const uint64_t e = lastEnd(ends, h.KeywordIndex);
+        if (h.Start < e && e < h.End) {
+          redo.resize(ends.size(), false);
+          redo[h.KeywordIndex] = true;
+          from = std::min(from, e);
+        }
+      }
+
+      if (from == NONE) {
+        break;
+      }
+
+      if (!vm) {
+        vm = makeVm();
+      }
+
+      std::vector<SearchHit> again(searchChunk(
+        *vm, beg, end, startOffset,
+        beg + (from - startOffset), chunkBegin(i + 1)
+      ));
+
+      const auto redone = [&redo](const SearchHit& h) {
+        return h.KeywordIndex < redo.size() && redo[h.KeywordIndex];
+      };
+
+      hits.erase(std::remove_if(hits.begin(), hits.end(), redone), hits.end());
+      std::copy_if(again.begin(), again.end(), std::back_inserter(hits), redone);
+    }
+
+    for (const SearchHit& h : hits) {
+      uint64_t& e(lastEnd(ends, h.KeywordIndex));
+      if (h.Start >= e) {
+        out.push_back(h);
+        e = std::max(e, h.End);
+      }
+    }
+
+    std::vector<SearchHit>().swap(hits);
+  }
+
+  std::sort(out.begin(), out.end());
+
+  if (hitFn) {
+    for (const SearchHit& h : out) {
+      (*hitFn)(userData, &h);
+    }
+  }
+
+  return out.size();
+}
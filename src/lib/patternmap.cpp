@@ -0,0 +1,181 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "patternmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace {
+  const size_t BLOCK_SIZE = 1 << 16;
+
+  // at the start of a serialized map
+  struct Head {
+    uint64_t NumPatterns,
+             StringsSize;
+  };
+
+  [[noreturn]] void malformed() {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("pattern map is malformed");
+  }
+}
+
+PatternMap::PatternMap(uint32_t sizeHint):
+  Size(0), Capacity(0), BlockCur(nullptr), BlockLeft(0)
+{
+  reserve(sizeHint);
+}
+
+void PatternMap::reserve(uint32_t n) {
+  if (n <= Capacity) {
+    return;
+  }
+
+  // the infos are C structs handed out to callers, so they're grown with
+  // realloc, and new room is zeroed
+  LG_PatternInfo* p = static_cast<LG_PatternInfo*>(
+    Capacity ? std::realloc(Infos.get(), n * sizeof(LG_PatternInfo)) :
+               std::calloc(n, sizeof(LG_PatternInfo))
+  );
+  if (!p) {
+    throw std::bad_alloc();
+  }
+
+  Infos.release();
+  Infos.reset(p);
+  std::memset(p + Capacity, 0, (n - Capacity) * sizeof(LG_PatternInfo));
+  Capacity = n;
+}
+
+const char* PatternMap::store(const char* str, size_t len) {
+  const size_t n = len + 1;
+
+  char* dst;
+  if (n > BLOCK_SIZE / 4) {
+    // big ones get their own block, so as not to waste the current one
+    Blocks.emplace_back(new char[n]);
+    dst = Blocks.back().get();
+  }
+  else {
+    if (n > BlockLeft) {
+      Blocks.emplace_back(new char[BLOCK_SIZE]);
+      BlockCur = Blocks.back().get();
+      BlockLeft = BLOCK_SIZE;
+    }
+    dst = BlockCur;
+    BlockCur += n;
+    BlockLeft -= n;
+  }
+
+  std::memcpy(dst, str, len);
+  dst[len] = '\0';
+  return dst;
+}
+
+void PatternMap::addPattern(const char* pat, const char* chainName) {
+  if (Size == Capacity) {
+    reserve(std::max(16u, Capacity * 2));
+  }
+
+  // the same pattern is often added in several encodings in a row
+  const char* p;
+  if (Size && !std::strcmp(pattern(Size - 1), pat)) {
+    p = pattern(Size - 1);
+  }
+  else {
+    p = store(pat, std::strlen(pat));
+  }
+
+  auto c = Chains.find(chainName);
+  if (c == Chains.end()) {
+    c = Chains.emplace(chainName, store(chainName, std::strlen(chainName))).first;
+  }
+
+  Infos[Size++] = LG_PatternInfo{p, c->second, nullptr};
+}
+
+std::string PatternMap::marshall() const {
+  // shared strings are written once
+  std::unordered_map<const char*, uint64_t> offsets;
+  std::string strings;
+  const auto offset = [&](const char* s) {
+    auto i = offsets.find(s);
+    if (i == offsets.end()) {
+      i = offsets.emplace(s, strings.size()).first;
+      strings.append(s, std::strlen(s) + 1);
+    }
+    return i->second;
+  };
+
+  std::vector<Entry> entries;
+  entries.reserve(Size);
+  for (uint32_t i = 0; i < Size; ++i) {
+    entries.push_back(Entry{offset(pattern(i)), offset(chain(i)), userData(i)});
+  }
+
+  const Head head{Size, strings.size()};
+
+  std::string buf(reinterpret_cast<const char*>(&head), sizeof(head));
+  buf.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+  buf.append(strings);
+  return buf;
+}
+
+std::unique_ptr<PatternMap> PatternMap::unmarshallInPlace(const byte* buf, size_t len, std::shared_ptr<const void> keep) {
+  if (len < sizeof(Head)) {
+    malformed();
+  }
+
+  Head head;
+  std::memcpy(&head, buf, sizeof(head));
+
+  const size_t maxEntries = (len - sizeof(Head)) / sizeof(Entry);
+  if (head.NumPatterns > std::min<size_t>(maxEntries, std::numeric_limits<uint32_t>::max())) {
+    malformed();
+  }
+
+  const size_t tableEnd = sizeof(Head) + head.NumPatterns * sizeof(Entry);
+  if (head.StringsSize != len - tableEnd ||
+      (head.StringsSize && buf[len - 1] != '\0') ||
+      reinterpret_cast<uintptr_t>(buf + sizeof(Head)) % alignof(Entry))
+  {
+    malformed();
+  }
+
+  const Entry* entries = reinterpret_cast<const Entry*>(buf + sizeof(Head));
+  const char* strings = reinterpret_cast<const char*>(buf + tableEnd);
+
+  std::unique_ptr<PatternMap> pmap(new PatternMap(head.NumPatterns));
+  for (uint32_t i = 0; i < head.NumPatterns; ++i) {
+    // the strings end with a NUL, so any offset within them is safe
+    const Entry& e(entries[i]);
+    if (e.Pattern >= head.StringsSize || e.Chain >= head.StringsSize) {
+      malformed();
+    }
+
+    pmap->Infos[i] = LG_PatternInfo{
+      strings + e.Pattern, strings + e.Chain,
+      reinterpret_cast<void*>(uintptr_t(e.UserData))
+    };
+  }
+
+  pmap->Size = head.NumPatterns;
+  pmap->Keep = std::move(keep);
+  return pmap;
+}
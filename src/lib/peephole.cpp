@@ -0,0 +1,159 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "peephole.h"
+
+#include "program.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+  static const uint32_t NO_TARGET = 0xffffffff;
+
+  bool fallsThrough(const Instruction& instr) {
+    switch (instr.OpCode) {
+    case JUMP_OP:
+    case JUMP_TABLE_RANGE_OP:
+    case FINISH_OP:
+    case HALT_OP:
+      return false;
+    default:
+      return true;
+    }
+  }
+
+  // the addresses an instruction holds: the one after a jump or a fork,
+  // or those after a jump table
+  uint32_t* targetsBegin(Instruction* instr) {
+    return reinterpret_cast<uint32_t*>(instr + 1);
+  }
+
+  uint32_t* targetsEnd(Instruction* instr) {
+    switch (instr->OpCode) {
+    case JUMP_OP:
+    case FORK_OP:
+      return targetsBegin(instr) + 1;
+    case JUMP_TABLE_RANGE_OP:
+      return targetsBegin(instr) + instr->length() - 1;
+    default:
+      return targetsBegin(instr);
+    }
+  }
+
+  // follows a chain of jumps to where it ends; a loop of jumps is left be,
+  // as a thread in one would never get anywhere either way
+  uint32_t landing(const std::vector<Instruction>& code, uint32_t pc) {
+    for (size_t hops = 0; hops < code.size() && code[pc].OpCode == JUMP_OP; ++hops) {
+      pc = *reinterpret_cast<const uint32_t*>(&code[pc] + 1);
+    }
+    return pc;
+  }
+}
+
+void optimizeCode(Program& prog) {
+  if (prog.size() < 2) {
+    return;
+  }
+
+  std::vector<Instruction> code(prog.begin(), prog.end());
+  const uint32_t size = code.size();
+
+  // find where the instructions start, as jump tables hold raw addresses
+  std::vector<uint32_t> starts;
+  for (uint32_t pc = 0; pc < size; pc += code[pc].length()) {
+    starts.push_back(pc);
+  }
+
+  // thread jumps: anything landing on a jump lands where it goes instead
+  for (const uint32_t pc : starts) {
+    for (uint32_t* t = targetsBegin(&code[pc]); t != targetsEnd(&code[pc]); ++t) {
+      if (*t != NO_TARGET) {
+        *t = landing(code, *t);
+      }
+    }
+  }
+
+  // mark what threads can reach from the start; the halt and the finish
+  // are where the Vm sends threads, so they're always kept
+  std::vector<bool> keep(size, false);
+  std::vector<uint32_t> todo{0, size - 2, size - 1};
+
+  while (!todo.empty()) {
+    const uint32_t pc = todo.back();
+    todo.pop_back();
+
+    if (pc >= size || keep[pc]) {
+      continue;
+    }
+    keep[pc] = true;
+
+    Instruction& instr(code[pc]);
+    for (uint32_t* t = targetsBegin(&instr); t != targetsEnd(&instr); ++t) {
+      if (*t != NO_TARGET) {
+        todo.push_back(*t);
+      }
+    }
+
+    if (fallsThrough(instr)) {
+      todo.push_back(pc + instr.length());
+    }
+  }
+
+  // drop jumps to the next instruction kept, working backwards so that
+  // runs of them go together
+  uint32_t next = size;
+  for (auto it = starts.rbegin(); it != starts.rend(); ++it) {
+    const uint32_t pc = *it;
+    if (!keep[pc]) {
+      continue;
+    }
+
+    if (code[pc].OpCode == JUMP_OP && *targetsBegin(&code[pc]) == next) {
+      keep[pc] = false;
+    }
+    else {
+      next = pc;
+    }
+  }
+
+  // assign the new addresses; a dropped instruction's is that of the
+  // next one kept, which is where a thread there would end up
+  std::vector<uint32_t> moved(size, NO_TARGET);
+  uint32_t guard = 0;
+  for (const uint32_t pc : starts) {
+    moved[pc] = guard;
+    if (keep[pc]) {
+      guard += code[pc].length();
+    }
+  }
+
+  prog.resize(guard);
+  for (const uint32_t pc : starts) {
+    if (keep[pc]) {
+      Instruction* instr = &prog[moved[pc]];
+      std::copy(&code[pc], &code[pc] + code[pc].length(), instr);
+
+      for (uint32_t* t = targetsBegin(instr); t != targetsEnd(instr); ++t) {
+        if (*t != NO_TARGET) {
+          *t = moved[*t];
+        }
+      }
+    }
+  }
+}
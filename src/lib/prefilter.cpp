@@ -0,0 +1,316 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prefilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LBT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+  bool haveSsse3() {
+    #ifdef LBT_X86_SIMD
+    return __builtin_cpu_supports("ssse3");
+    #else
+    return false;
+    #endif
+  }
+
+  bool haveAvx2() {
+    #ifdef LBT_X86_SIMD
+    return __builtin_cpu_supports("avx2");
+    #else
+    return false;
+    #endif
+  }
+
+  // past this many distinct fingerprints, every bucket holds so many that
+  // the Teddy masks let nearly everything through
+  const size_t MAX_TEDDY = 64;
+
+  uint32_t hashPrint(uint32_t fp) {
+    return (fp * 2654435761u) >> 16;
+  }
+
+  bool testBit(const std::vector<uint64_t>& bits, uint32_t i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+  }
+
+  void setBit(std::vector<uint64_t>& bits, uint32_t i) {
+    bits[i >> 6] |= uint64_t(1) << (i & 63);
+  }
+}
+
+Prefilter::Prefilter():
+  Which(NONE), MaxLead(0), MinLen(0), MaxLen(0), Width(0), Depth(0) {}
+
+Prefilter::Prefilter(const RequiredLiterals& lits, bool allowSimd) {
+  init(lits, allowSimd);
+}
+
+void Prefilter::init(const RequiredLiterals& lits, bool allowSimd) {
+  Which = NONE;
+  MaxLead = lits.MaxLead;
+  MinLen = MaxLen = Width = Depth = 0;
+  Literals.clear();
+  ByPrint.clear();
+  Pairs.clear();
+  Prints.clear();
+
+  for (const std::string& s : lits.Strings) {
+    if (!s.empty()) {
+      Literals.push_back(s);
+    }
+  }
+
+  if (Literals.empty()) {
+    return;
+  }
+
+  std::sort(Literals.begin(), Literals.end());
+  Literals.erase(std::unique(Literals.begin(), Literals.end()), Literals.end());
+
+  MinLen = std::numeric_limits<uint32_t>::max();
+  for (const std::string& s : Literals) {
+    MinLen = std::min(MinLen, uint32_t(s.size()));
+    MaxLen = std::max(MaxLen, uint32_t(s.size()));
+  }
+
+  Width = std::min(MinLen, 4u);
+  Depth = std::min(Width, 3u);
+
+  // literals are sorted, so those sharing a fingerprint are adjacent
+  std::vector<uint32_t> prints;
+  for (uint32_t i = 0; i < Literals.size(); ++i) {
+    const uint32_t fp = fingerprint(reinterpret_cast<const byte*>(Literals[i].data()));
+    std::vector<uint32_t>& idx(ByPrint[fp]);
+    if (idx.empty()) {
+      prints.push_back(i);
+    }
+    idx.push_back(i);
+  }
+
+  if (Width >= 2 && prints.size() > MAX_TEDDY) {
+    Pairs.assign(65536 / 64, 0);
+    Prints.assign(65536 / 64, 0);
+    for (const std::string& s : Literals) {
+      setBit(Pairs, byte(s[0]) << 8 | byte(s[1]));
+    }
+
+    for (const auto& p : ByPrint) {
+      setBit(Prints, hashPrint(p.first));
+    }
+
+    Which = PAIRS;
+    return;
+  }
+
+  // positions Teddy does not look at let everything through
+  std::memset(Lo, 0xFF, sizeof(Lo));
+  std::memset(Hi, 0xFF, sizeof(Hi));
+  std::memset(Table, 0xFF, sizeof(Table));
+  std::memset(Lo, 0, Depth * sizeof(Lo[0]));
+  std::memset(Hi, 0, Depth * sizeof(Hi[0]));
+  std::memset(Table, 0, Depth * sizeof(Table[0]));
+
+  // neighbouring fingerprints tend to be alike, so grouping them into
+  // buckets in order keeps the masks tight
+  for (uint32_t p = 0; p < prints.size(); ++p) {
+    const byte bit = 1 << (p * 8 / prints.size());
+    const std::string& s(Literals[prints[p]]);
+    for (uint32_t i = 0; i < Depth; ++i) {
+      const byte b = s[i];
+      Lo[i][b & 0x0F] |= bit;
+      Hi[i][b >> 4] |= bit;
+      Table[i][b] |= bit;
+    }
+  }
+
+  if (allowSimd && haveAvx2()) {
+    Which = AVX2;
+  }
+  else if (allowSimd && haveSsse3()) {
+    Which = SSSE3;
+  }
+  else {
+    Which = SCALAR;
+  }
+}
+
+size_t Prefilter::memoryUsage() const {
+  size_t bytes = vectorBytes(Literals) + vectorBytes(Pairs) + vectorBytes(Prints);
+  for (const std::string& s : Literals) {
+    bytes += s.capacity();
+  }
+
+  // a node per fingerprint, besides the buckets
+  bytes += ByPrint.bucket_count() * sizeof(void*);
+  for (const auto& p : ByPrint) {
+    bytes += sizeof(p) + sizeof(void*) + vectorBytes(p.second);
+  }
+  return bytes;
+}
+
+uint32_t Prefilter::fingerprint(const byte* cur) const {
+  uint32_t fp = 0;
+  for (uint32_t i = 0; i < Width; ++i) {
+    fp |= uint32_t(cur[i]) << (8 * i);
+  }
+  return fp;
+}
+
+bool Prefilter::verify(const byte* cur, const byte* end) const {
+  const auto i(ByPrint.find(fingerprint(cur)));
+  if (i != ByPrint.end()) {
+    for (const uint32_t idx : i->second) {
+      const std::string& s(Literals[idx]);
+      if (s.size() <= size_t(end - cur) && !std::memcmp(cur, s.data(), s.size())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+const byte* Prefilter::next(const byte* beg, const byte* end) const {
+  switch (Which) {
+  case NONE:
+    return end;
+  case SSSE3:
+    return ssse3(beg, end);
+  case AVX2:
+    return avx2(beg, end);
+  case PAIRS:
+    return pairs(beg, end);
+  default:
+    return scalar(beg, end);
+  }
+}
+
+const byte* Prefilter::scalar(const byte* beg, const byte* end) const {
+  for ( ; end - beg >= MinLen; ++beg) {
+    byte m = Table[0][beg[0]];
+    for (uint32_t i = 1; i < Depth && m; ++i) {
+      m &= Table[i][beg[i]];
+    }
+
+    if (m && verify(beg, end)) {
+      return beg;
+    }
+  }
+  return end;
+}
+
+const byte* Prefilter::pairs(const byte* beg, const byte* end) const {
+  for ( ; end - beg >= MinLen; ++beg) {
+    if (testBit(Pairs, beg[0] << 8 | beg[1]) &&
+        testBit(Prints, hashPrint(fingerprint(beg))) && verify(beg, end))
+    {
+      return beg;
+    }
+  }
+  return end;
+}
+
+#ifdef LBT_X86_SIMD
+
+__attribute__((target("ssse3")))
+const byte* Prefilter::ssse3(const byte* beg, const byte* end) const {
+  const __m128i nib  = _mm_set1_epi8(0x0F),
+                zero = _mm_setzero_si128();
+
+  __m128i lo[3], hi[3];
+  for (uint32_t i = 0; i < 3; ++i) {
+    lo[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Lo[i]));
+    hi[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Hi[i]));
+  }
+
+  // every block reads 18 bytes, for the three shifted loads
+  for ( ; end - beg >= 18; beg += 16) {
+    __m128i res = _mm_set1_epi8(-1);
+    for (uint32_t i = 0; i < 3; ++i) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(beg + i));
+      res = _mm_and_si128(res, _mm_and_si128(
+        _mm_shuffle_epi8(lo[i], _mm_and_si128(v, nib)),
+        _mm_shuffle_epi8(hi[i], _mm_and_si128(_mm_srli_epi16(v, 4), nib))
+      ));
+    }
+
+    uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xFFFF;
+    for ( ; mask; mask &= mask - 1) {
+      const byte* const cur = beg + __builtin_ctz(mask);
+      if (end - cur >= MinLen && verify(cur, end)) {
+        return cur;
+      }
+    }
+  }
+
+  return scalar(beg, end);
+}
+
+__attribute__((target("avx2")))
+const byte* Prefilter::avx2(const byte* beg, const byte* end) const {
+  const __m256i nib  = _mm256_set1_epi8(0x0F),
+                zero = _mm256_setzero_si256();
+
+  // VPSHUFB shuffles within each 128-bit lane, so both lanes get the masks
+  __m256i lo[3], hi[3];
+  for (uint32_t i = 0; i < 3; ++i) {
+    lo[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Lo[i])));
+    hi[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Hi[i])));
+  }
+
+  for ( ; end - beg >= 34; beg += 32) {
+    __m256i res = _mm256_set1_epi8(-1);
+    for (uint32_t i = 0; i < 3; ++i) {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(beg + i));
+      res = _mm256_and_si256(res, _mm256_and_si256(
+        _mm256_shuffle_epi8(lo[i], _mm256_and_si256(v, nib)),
+        _mm256_shuffle_epi8(hi[i], _mm256_and_si256(_mm256_srli_epi16(v, 4), nib))
+      ));
+    }
+
+    uint32_t mask = ~static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero))
+    );
+    for ( ; mask; mask &= mask - 1) {
+      const byte* const cur = beg + __builtin_ctz(mask);
+      if (end - cur >= MinLen && verify(cur, end)) {
+        return cur;
+      }
+    }
+  }
+
+  return ssse3(beg, end);
+}
+
+#else
+
+const byte* Prefilter::ssse3(const byte* beg, const byte* end) const {
+  return scalar(beg, end);
+}
+
+const byte* Prefilter::avx2(const byte* beg, const byte* end) const {
+  return scalar(beg, end);
+}
+
+#endif
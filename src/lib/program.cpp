@@ -18,42 +18,464 @@
 
 #include "program.h"
 
+#include "container.h"
+
+#include <cstring>
 #include <iomanip>
 #include <iostream>
-#include <sstream>
+
+namespace {
+  // what goes in INFO_SECTION
+  struct Info {
+    uint32_t NumChecked,
+             NumLabels;
+    ByteSet  First;
+  };
+
+  [[noreturn]] void badSection(ContainerSection id) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("program section " << id << " is malformed");
+  }
+
+  // reads a program's sections out of a container, with each array either
+  // copied in one go or, in place, borrowed from the container
+  class SectionReader {
+  public:
+    SectionReader(const ContainerReader& in, bool inPlace, std::shared_ptr<const void> keep):
+      In(in), InPlace(inPlace), Keep(std::move(keep)) {}
+
+    // a section which must be there, and be len bytes
+    const byte* fixed(ContainerSection id, size_t len) const {
+      const std::pair<const byte*, size_t> sec(In.find(id));
+      if (!sec.first || sec.second != len) {
+        badSection(id);
+      }
+      return sec.first;
+    }
+
+    std::pair<const byte*, size_t> find(ContainerSection id) const {
+      return In.find(id);
+    }
+
+    template <class T>
+    void readVector(ContainerSection id, MappableVector<T>& v) const {
+      const std::pair<const byte*, size_t> sec(In.find(id));
+      if (sec.second % sizeof(T)) {
+        badSection(id);
+      }
+
+      const size_t n = sec.second / sizeof(T);
+      if (InPlace && reinterpret_cast<uintptr_t>(sec.first) % alignof(T) == 0) {
+        v.borrow(reinterpret_cast<const T*>(sec.first), n, Keep);
+      }
+      else {
+        v.resize(n);
+        if (n) {
+          std::memcpy(v.data(), sec.first, sec.second);
+        }
+      }
+    }
+
+  private:
+    const ContainerReader& In;
+    const bool InPlace;
+    const std::shared_ptr<const void> Keep;
+  };
+
+  std::string tableInfo(const DfaTable& tbl) {
+    std::string buf(reinterpret_cast<const char*>(tbl.Classes), sizeof(tbl.Classes));
+    buf.append(reinterpret_cast<const char*>(&tbl.NumClasses), sizeof(tbl.NumClasses));
+    return buf;
+  }
+
+  std::string tableStates(const DfaTable& tbl) {
+    // field by field, so the padding is zeroed
+    std::string buf(tbl.States.size() * sizeof(DfaTable::StateInfo), '\0');
+    char* out = &buf[0];
+    for (const DfaTable::StateInfo& si : tbl.States) {
+      DfaTable::StateInfo* d = reinterpret_cast<DfaTable::StateInfo*>(out);
+      d->Label = si.Label;
+      d->Check = si.Check;
+      d->Match = si.Match;
+      d->Terminal = si.Terminal;
+      d->Fork = si.Fork;
+      out += sizeof(si);
+    }
+    return buf;
+  }
+
+  // the checksum only catches damage, so a table read back must be
+  // checked before an engine follows anything in it
+  bool validTarget(const DfaTable& tbl, uint32_t t) {
+    return (t & ~DfaTable::NOCHECK) < tbl.States.size();
+  }
+
+  void checkTable(const DfaTable& tbl) {
+    if (tbl.NumClasses == 0 || tbl.NumClasses > 256 ||
+        tbl.Next.size() != tbl.States.size() * tbl.NumClasses)
+    {
+      badSection(TABLE_NEXT_SECTION);
+    }
+
+    for (uint32_t b = 0; b < 256; ++b) {
+      if (tbl.Classes[b] >= tbl.NumClasses) {
+        badSection(TABLE_INFO_SECTION);
+      }
+    }
+
+    for (const uint32_t t : tbl.Next) {
+      if (t == DfaTable::DEAD) {
+        continue;
+      }
+      else if (t & DfaTable::LIST) {
+        const uint32_t l = t & ~DfaTable::LIST;
+        if (l >= tbl.Lists.size() || tbl.Lists[l] >= tbl.Lists.size() - l) {
+          badSection(TABLE_LISTS_SECTION);
+        }
+
+        for (uint32_t i = l + 1; i <= l + tbl.Lists[l]; ++i) {
+          if (!validTarget(tbl, tbl.Lists[i])) {
+            badSection(TABLE_LISTS_SECTION);
+          }
+        }
+      }
+      else if (!validTarget(tbl, t)) {
+        badSection(TABLE_NEXT_SECTION);
+      }
+    }
+  }
+
+  // the same goes for the code: every instruction has to fit, and every
+  // jump, fork and jump table entry land on one, with the halt and the
+  // finish last, where the engines expect them
+  void checkCode(const Program& p) {
+    const size_t size = p.size();
+    if (size == 0) {
+      // nothing but keywords
+      return;
+    }
+
+    if (size < 2 || p[size - 2].OpCode != HALT_OP || p[size - 1].OpCode != FINISH_OP) {
+      badSection(CODE_SECTION);
+    }
+
+    std::vector<bool> starts(size, false);
+    for (size_t i = 0; i < size; i += p[i].length()) {
+      if (p[i].OpCode == JUMP_TABLE_RANGE_OP && p[i].Op.T2.First > p[i].Op.T2.Last) {
+        badSection(CODE_SECTION);
+      }
+
+      if (p[i].length() > size - i) {
+        badSection(CODE_SECTION);
+      }
+      starts[i] = true;
+    }
+
+    const auto target = [&](size_t i) {
+      return *reinterpret_cast<const uint32_t*>(&p[i]);
+    };
+
+    for (size_t i = 0; i < size; i += p[i].length()) {
+      switch (p[i].OpCode) {
+      case JUMP_OP:
+      case FORK_OP:
+        if (target(i + 1) >= size || !starts[target(i + 1)]) {
+          badSection(CODE_SECTION);
+        }
+        break;
+      case JUMP_TABLE_RANGE_OP:
+        for (size_t j = i + 1; j < i + p[i].length(); ++j) {
+          if (target(j) != 0xffffffff && (target(j) >= size || !starts[target(j)])) {
+            badSection(CODE_SECTION);
+          }
+        }
+        break;
+      }
+    }
+  }
+
+  // and for the keywords, the double array's transitions, failure links
+  // and outputs must all stay within it
+  void checkKeywords(const AhoCorasick& ac) {
+    const size_t n = ac.Base.size();
+    if (ac.Check.size() != n || ac.Fail.size() != n ||
+        ac.Depth.size() != n || ac.Out.size() != n)
+    {
+      badSection(KEYWORD_BASE_SECTION);
+    }
+
+    if (n == 0) {
+      if (!ac.Outputs.empty()) {
+        badSection(KEYWORD_OUTPUTS_SECTION);
+      }
+      return;
+    }
+
+    if (ac.Check[0] != AhoCorasick::NONE || ac.Depth[0] != 0) {
+      badSection(KEYWORD_CHECK_SECTION);
+    }
+
+    // the root, or a slot which is some state's child
+    const auto isState = [&](uint32_t s) {
+      return s == 0 || (s < n && ac.Check[s] != AhoCorasick::NONE);
+    };
+
+    for (uint32_t t = 0; t < n; ++t) {
+      // so child() needn't check bounds
+      if (uint64_t(ac.Base[t]) + 255 >= n) {
+        badSection(KEYWORD_BASE_SECTION);
+      }
+
+      const uint32_t s = ac.Check[t];
+      if (s != AhoCorasick::NONE) {
+        // a child is one deeper than its parent, so walking up ends at
+        // the root; and its byte is its offset from the parent's base
+        if (s >= n || !isState(s) || ac.Depth[t] == 0 || ac.Depth[t] - 1 != ac.Depth[s] ||
+            t < ac.Base[s] || t - ac.Base[s] > 255)
+        {
+          badSection(KEYWORD_CHECK_SECTION);
+        }
+      }
+
+      // failure links go to shallower states, so following them ends at
+      // the root too
+      if (t != 0 && (!isState(ac.Fail[t]) ||
+          (s == AhoCorasick::NONE ? ac.Fail[t] != 0 : ac.Depth[ac.Fail[t]] >= ac.Depth[t])))
+      {
+        badSection(KEYWORD_FAIL_SECTION);
+      }
+
+      if (ac.Out[t] != AhoCorasick::NONE && ac.Out[t] >= ac.Outputs.size()) {
+        badSection(KEYWORD_OUT_SECTION);
+      }
+    }
+
+    // lists run back to earlier outputs, so they can't loop
+    for (uint32_t o = 0; o < ac.Outputs.size(); ++o) {
+      const AhoCorasick::Output& out(ac.Outputs[o]);
+      if (out.Label >= ac.NumLabels ||
+          (out.Next != AhoCorasick::NONE && out.Next >= o))
+      {
+        badSection(KEYWORD_OUTPUTS_SECTION);
+      }
+    }
+  }
+
+  // MaxLead, the number of strings, and then each's length and bytes
+  std::string literals(const RequiredLiterals& lits) {
+    std::string buf;
+    const uint32_t head[2] = {lits.MaxLead, uint32_t(lits.Strings.size())};
+    buf.append(reinterpret_cast<const char*>(head), sizeof(head));
+    for (const std::string& str : lits.Strings) {
+      const uint32_t len = str.size();
+      buf.append(reinterpret_cast<const char*>(&len), sizeof(len));
+      buf.append(str);
+    }
+    return buf;
+  }
+
+  void readLiterals(std::pair<const byte*, size_t> sec, RequiredLiterals& lits) {
+    const byte* cur = sec.first;
+    const byte* const end = cur + sec.second;
+
+    const auto take = [&](size_t len) {
+      if (len > size_t(end - cur)) {
+        badSection(LITERALS_SECTION);
+      }
+      const byte* ret = cur;
+      cur += len;
+      return ret;
+    };
+
+    uint32_t head[2];
+    std::memcpy(head, take(sizeof(head)), sizeof(head));
+    lits.MaxLead = head[0];
+    for (uint32_t i = 0; i < head[1]; ++i) {
+      uint32_t len;
+      std::memcpy(&len, take(sizeof(len)), sizeof(len));
+      lits.Strings.emplace_back(reinterpret_cast<const char*>(take(len)), len);
+    }
+  }
+
+  // FNV-1a, but a word at a time
+  class Hasher {
+  public:
+    Hasher(): Hash(0xCBF29CE484222325ull) {}
+
+    void add(const void* data, size_t len) {
+      const byte* p = static_cast<const byte*>(data);
+      for ( ; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        mix(w);
+      }
+      for ( ; len; ++p, --len) {
+        mix(*p);
+      }
+    }
+
+    template <class V>
+    void add(const V& v) {
+      mix(v.size());
+      add(v.data(), v.size() * sizeof(typename V::value_type));
+    }
+
+    uint64_t value() const { return Hash; }
+
+  private:
+    void mix(uint64_t w) {
+      Hash = (Hash ^ w) * 0x100000001B3ull;
+    }
+
+    uint64_t Hash;
+  };
+}
 
 int Program::bufSize() const {
-  return sizeof(ByteSet) + sizeof(uint32_t) + (size() * sizeof(value_type));
+  ContainerWriter out;
+  addSections(out);
+  return out.size();
 }
 
 bool Program::operator==(const Program& rhs) const {
   return NumChecked == rhs.NumChecked &&
          First == rhs.First &&
-         std::equal(begin(), end(), rhs.begin());
+         size() == rhs.size() &&
+         std::equal(begin(), end(), rhs.begin()) &&
+         Keywords == rhs.Keywords &&
+         Lengths == rhs.Lengths;
 }
 
-std::string Program::marshall() const {
-  std::ostringstream buf;
-  buf.write((char*)&NumChecked, sizeof(NumChecked));
-  buf.write((char*)&First, sizeof(First));
-  for (auto instruction: *this) {
-    buf.write((char*)&instruction, sizeof(instruction));
+uint64_t Program::fingerprint() const {
+  Hasher h;
+  h.add(&NumChecked, sizeof(NumChecked));
+  h.add(&First, sizeof(First));
+  h.add(*this);
+
+  h.add(Keywords.Base);
+  h.add(Keywords.Check);
+  h.add(Keywords.Fail);
+  h.add(Keywords.Depth);
+  h.add(Keywords.Out);
+  h.add(Keywords.Outputs);
+  h.add(&Keywords.NumLabels, sizeof(Keywords.NumLabels));
+  h.add(Keywords.Fold, sizeof(Keywords.Fold));
+
+  h.add(Lengths);
+  return h.value();
+}
+
+void Program::addSections(ContainerWriter& out) const {
+  const Info info{NumChecked, Keywords.NumLabels, First};
+  out.add(INFO_SECTION, std::string(reinterpret_cast<const char*>(&info), sizeof(info)));
+  out.addVector(CODE_SECTION, *this);
+
+  out.addVector(KEYWORD_BASE_SECTION, Keywords.Base);
+  out.addVector(KEYWORD_CHECK_SECTION, Keywords.Check);
+  out.addVector(KEYWORD_FAIL_SECTION, Keywords.Fail);
+  out.addVector(KEYWORD_DEPTH_SECTION, Keywords.Depth);
+  out.addVector(KEYWORD_OUT_SECTION, Keywords.Out);
+  out.addVector(KEYWORD_OUTPUTS_SECTION, Keywords.Outputs);
+  if (Keywords.folds()) {
+    out.add(KEYWORD_FOLD_SECTION, Keywords.Fold, sizeof(Keywords.Fold));
+  }
+
+  // the rest can be done without, if not as quickly or helpfully
+  out.addVector(LENGTHS_SECTION, Lengths, 0);
+
+  if (!Table.empty()) {
+    out.add(TABLE_INFO_SECTION, tableInfo(Table), 0);
+    out.addVector(TABLE_NEXT_SECTION, Table.Next, 0);
+    out.add(TABLE_STATES_SECTION, tableStates(Table), 0);
+    out.addVector(TABLE_LISTS_SECTION, Table.Lists, 0);
+  }
+
+  if (!Literals.empty()) {
+    out.add(LITERALS_SECTION, literals(Literals), 0);
   }
-  return buf.str();
 }
 
-ProgramPtr Program::unmarshall(const std::string& s) {
+ProgramPtr Program::read(const ContainerReader& container, bool inPlace, std::shared_ptr<const void> keep) {
+  const SectionReader in(container, inPlace, std::move(keep));
+
   ProgramPtr p(new Program);
-  std::stringstream buf(s);
-  buf.read((char*)&p->NumChecked, sizeof(uint32_t));
-  buf.read((char*)&p->First, sizeof(ByteSet));
-  Instruction i;
-  while (buf.read((char*)&i, sizeof(Instruction))) {
-    p->push_back(i);
+
+  Info info;
+  std::memcpy(&info, in.fixed(INFO_SECTION, sizeof(info)), sizeof(info));
+  p->NumChecked = info.NumChecked;
+  p->Keywords.NumLabels = info.NumLabels;
+  p->First = info.First;
+
+  in.readVector(CODE_SECTION, *p);
+  checkCode(*p);
+
+  in.readVector(KEYWORD_BASE_SECTION, p->Keywords.Base);
+  in.readVector(KEYWORD_CHECK_SECTION, p->Keywords.Check);
+  in.readVector(KEYWORD_FAIL_SECTION, p->Keywords.Fail);
+  in.readVector(KEYWORD_DEPTH_SECTION, p->Keywords.Depth);
+  in.readVector(KEYWORD_OUT_SECTION, p->Keywords.Out);
+  in.readVector(KEYWORD_OUTPUTS_SECTION, p->Keywords.Outputs);
+  if (in.find(KEYWORD_FOLD_SECTION).first) {
+    byte* fold = p->Keywords.Fold;
+    std::memcpy(fold, in.fixed(KEYWORD_FOLD_SECTION, sizeof(p->Keywords.Fold)), sizeof(p->Keywords.Fold));
+
+    // a stand-in has to stand for itself
+    for (uint32_t b = 0; b < 256; ++b) {
+      if (fold[fold[b]] != fold[b]) {
+        badSection(KEYWORD_FOLD_SECTION);
+      }
+    }
+  }
+  checkKeywords(p->Keywords);
+  p->Keywords.densify();
+
+  in.readVector(LENGTHS_SECTION, p->Lengths);
+
+  if (in.find(TABLE_INFO_SECTION).first) {
+    DfaTable& tbl(p->Table);
+    const byte* ti = in.fixed(TABLE_INFO_SECTION, sizeof(tbl.Classes) + sizeof(tbl.NumClasses));
+    std::memcpy(tbl.Classes, ti, sizeof(tbl.Classes));
+    std::memcpy(&tbl.NumClasses, ti + sizeof(tbl.Classes), sizeof(tbl.NumClasses));
+
+    in.readVector(TABLE_NEXT_SECTION, tbl.Next);
+    in.readVector(TABLE_STATES_SECTION, tbl.States);
+    in.readVector(TABLE_LISTS_SECTION, tbl.Lists);
+
+    checkTable(tbl);
+  }
+
+  if (in.find(LITERALS_SECTION).first) {
+    readLiterals(in.find(LITERALS_SECTION), p->Literals);
   }
+
   return p;
 }
 
+void Program::marshall(void* buf) const {
+  ContainerWriter out;
+  addSections(out);
+  out.write(buf);
+}
+
+std::string Program::marshall() const {
+  ContainerWriter out;
+  addSections(out);
+  std::string buf(out.size(), '\0');
+  out.write(&buf[0]);
+  return buf;
+}
+
+ProgramPtr Program::unmarshall(const std::string& s) {
+  return unmarshall(s.data(), s.size());
+}
+
+ProgramPtr Program::unmarshall(const void* buf, size_t len) {
+  return read(ContainerReader(buf, len), false, nullptr);
+}
+
+ProgramPtr Program::unmarshallInPlace(const void* buf, size_t len, std::shared_ptr<const void> keep) {
+  return read(ContainerReader(buf, len), true, std::move(keep));
+}
+
 std::ostream& printIndex(std::ostream& out, uint32_t i) {
   out << std::setfill('0') << std::hex << std::setw(8) << i << ' ';
   return out;
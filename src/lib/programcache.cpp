@@ -0,0 +1,110 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "programcache.h"
+
+#include "basic.h"
+#include "container.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "unknown"
+#endif
+
+namespace {
+  class KeyBuilder {
+  public:
+    template <class T>
+    void add(const T& val) {
+      Buf.append(reinterpret_cast<const char*>(&val), sizeof(val));
+    }
+
+    // with its length first, so that fields can't run together
+    void add(const char* str) {
+      const uint64_t len = std::strlen(str);
+      add(len);
+      Buf.append(str, len);
+    }
+
+    std::string key() const {
+      std::ostringstream out;
+      out << std::hex << std::setfill('0')
+          << std::setw(16) << checksum(Buf.data(), Buf.size(), 0)
+          << std::setw(16) << checksum(Buf.data(), Buf.size(), 1);
+      return out.str();
+    }
+
+  private:
+    std::string Buf;
+  };
+}
+
+std::string programCacheKey(const char* patterns,
+                            const char** defaultEncodings,
+                            unsigned int defaultEncodingsNum,
+                            const LG_KeyOptions& defaultOptions,
+                            const LG_ProgramOptions& progOpts)
+{
+  KeyBuilder k;
+  k.add("lightgrep program");
+  k.add(PACKAGE_VERSION);
+  k.add(CONTAINER_VERSION);
+  k.add(PROGRAM_CACHE_VERSION);
+
+  k.add(patterns);
+
+  k.add(uint64_t(defaultEncodingsNum));
+  for (unsigned int i = 0; i < defaultEncodingsNum; ++i) {
+    k.add(defaultEncodings[i]);
+  }
+
+  k.add(defaultOptions.FixedString != 0);
+  k.add(defaultOptions.CaseInsensitive != 0);
+  k.add(progOpts.Determinize != 0);
+  return k.key();
+}
+
+void writeFileAtomically(const std::string& path, const ContainerWriter& out) {
+  std::vector<char> buf(out.size());
+  out.write(buf.data());
+
+  // unique, so that writers racing for the same path don't collide
+  std::ostringstream tmpName;
+  tmpName << path << ".tmp" << std::hex << std::random_device()();
+  const std::string tmp(tmpName.str());
+
+  std::FILE* f = std::fopen(tmp.c_str(), "wb");
+  if (!f) {
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not create " << tmp);
+  }
+
+  const bool wrote = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+  if (std::fclose(f) || !wrote || std::rename(tmp.c_str(), path.c_str())) {
+    std::remove(tmp.c_str());
+    THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("could not write " << path);
+  }
+}
@@ -0,0 +1,215 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "skipscan.h"
+
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LBT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+  bool haveSsse3() {
+    #ifdef LBT_X86_SIMD
+    return __builtin_cpu_supports("ssse3");
+    #else
+    return false;
+    #endif
+  }
+
+  bool haveAvx2() {
+    #ifdef LBT_X86_SIMD
+    return __builtin_cpu_supports("avx2");
+    #else
+    return false;
+    #endif
+  }
+}
+
+SkipScanner::SkipScanner(): Which(NONE), Single(0) {
+  std::memset(Lookup, 0, sizeof(Lookup));
+  std::memset(HighClear, 0, sizeof(HighClear));
+  std::memset(HighSet, 0, sizeof(HighSet));
+}
+
+SkipScanner::SkipScanner(const ByteSet& set, bool allowSimd) {
+  init(set, allowSimd);
+}
+
+void SkipScanner::init(const ByteSet& set, bool allowSimd) {
+  std::memset(Lookup, 0, sizeof(Lookup));
+  std::memset(HighClear, 0, sizeof(HighClear));
+  std::memset(HighSet, 0, sizeof(HighSet));
+  Single = 0;
+
+  for (uint32_t b = 0; b < 256; ++b) {
+    if (set.test(b)) {
+      Lookup[b] = 1;
+      Single = b;
+
+      if (b < 0x80) {
+        HighClear[b & 0x0F] |= 1 << (b >> 4);
+      }
+      else {
+        HighSet[b & 0x0F] |= 1 << ((b >> 4) & 0x07);
+      }
+    }
+  }
+
+  const size_t num = set.count();
+  if (num == 0) {
+    Which = NONE;
+  }
+  else if (num == 256) {
+    Which = ALL;
+  }
+  else if (num == 1) {
+    Which = MEMCHR;
+  }
+  else if (allowSimd && haveAvx2()) {
+    Which = AVX2;
+  }
+  else if (allowSimd && haveSsse3()) {
+    Which = SSSE3;
+  }
+  else {
+    Which = SCALAR;
+  }
+}
+
+const byte* SkipScanner::next(const byte* beg, const byte* end) const {
+  switch (Which) {
+  case NONE:
+    return end;
+  case ALL:
+    return beg;
+  case MEMCHR:
+    {
+      const void* hit = std::memchr(beg, Single, end - beg);
+      return hit ? static_cast<const byte*>(hit) : end;
+    }
+  case SSSE3:
+    return ssse3(beg, end);
+  case AVX2:
+    return avx2(beg, end);
+  default:
+    return scalar(beg, end);
+  }
+}
+
+const byte* SkipScanner::scalar(const byte* beg, const byte* end) const {
+  for ( ; beg < end && !Lookup[*beg]; ++beg) ;
+  return beg;
+}
+
+#ifdef LBT_X86_SIMD
+
+//
+// The classification trick (known as "truffle" in Hyperscan) splits each
+// byte into nibbles. PSHUFB looks up the low nibble in a table holding the
+// membership bits for the eight possible high nibbles, zeroing lanes whose
+// top bit is set; XORing the input with 0x80 gives the other half of the
+// set. A second PSHUFB turns the high nibble into a one-hot bit to test.
+//
+
+__attribute__((target("ssse3")))
+const byte* SkipScanner::ssse3(const byte* beg, const byte* end) const {
+  const __m128i clear = _mm_loadu_si128(reinterpret_cast<const __m128i*>(HighClear)),
+                hiset = _mm_loadu_si128(reinterpret_cast<const __m128i*>(HighSet)),
+                bits  = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                      1, 2, 4, 8, 16, 32, 64, -128),
+                top   = _mm_set1_epi8(-128),
+                lo    = _mm_set1_epi8(0x0F),
+                zero  = _mm_setzero_si128();
+
+  for ( ; end - beg >= 16; beg += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(beg));
+
+    const __m128i members = _mm_or_si128(
+      _mm_shuffle_epi8(clear, v),
+      _mm_shuffle_epi8(hiset, _mm_xor_si128(v, top))
+    );
+
+    const __m128i hi = _mm_shuffle_epi8(
+      bits, _mm_and_si128(_mm_srli_epi16(v, 4), lo)
+    );
+
+    const uint32_t mask = ~_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_and_si128(members, hi), zero)
+    ) & 0xFFFF;
+
+    if (mask) {
+      return beg + __builtin_ctz(mask);
+    }
+  }
+
+  return scalar(beg, end);
+}
+
+__attribute__((target("avx2")))
+const byte* SkipScanner::avx2(const byte* beg, const byte* end) const {
+  // VPSHUFB shuffles within each 128-bit lane, so both lanes get the tables
+  const __m256i clear = _mm256_broadcastsi128_si256(
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(HighClear))),
+                hiset = _mm256_broadcastsi128_si256(
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(HighSet))),
+                bits  = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                         1, 2, 4, 8, 16, 32, 64, -128,
+                                         1, 2, 4, 8, 16, 32, 64, -128,
+                                         1, 2, 4, 8, 16, 32, 64, -128),
+                top   = _mm256_set1_epi8(-128),
+                lo    = _mm256_set1_epi8(0x0F),
+                zero  = _mm256_setzero_si256();
+
+  for ( ; end - beg >= 32; beg += 32) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(beg));
+
+    const __m256i members = _mm256_or_si256(
+      _mm256_shuffle_epi8(clear, v),
+      _mm256_shuffle_epi8(hiset, _mm256_xor_si256(v, top))
+    );
+
+    const __m256i hi = _mm256_shuffle_epi8(
+      bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), lo)
+    );
+
+    const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_and_si256(members, hi), zero)
+    ));
+
+    if (mask) {
+      return beg + __builtin_ctz(mask);
+    }
+  }
+
+  return ssse3(beg, end);
+}
+
+#else
+
+const byte* SkipScanner::ssse3(const byte* beg, const byte* end) const {
+  return scalar(beg, end);
+}
+
+const byte* SkipScanner::avx2(const byte* beg, const byte* end) const {
+  return scalar(beg, end);
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tablevm.h"
+#include "program.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+  const uint32_t NOLABEL = std::numeric_limits<uint32_t>::max();
+  const uint32_t UNCHECKED = std::numeric_limits<uint32_t>::max();
+  const uint64_t NONE = std::numeric_limits<uint64_t>::max();
+  const uint32_t ROOT = 0;
+}
+
+const uint32_t TableVm::FINISHED = DfaTable::DEAD - 1;
+const uint32_t TableVm::HALTED = DfaTable::DEAD - 2;
+
+TableVm::TableVm():
+  Table(0),
+  SkipScan(true),
+  UsePrefilter(true),
+  Compact(false),
+  SeenNoLabel(false),
+  LiveNoLabel(false),
+  MatchEndsMax(0),
+  CurHitFn(0),
+  UserData(0) {}
+
+TableVm::TableVm(ProgramPtr prog):
+  TableVm()
+{
+  init(prog);
+}
+
+void TableVm::init(ProgramPtr prog) {
+  Prog = prog;
+  const Program& p(*Prog);
+  Table = &p.Table;
+
+  uint32_t numPatterns = 0,
+           numCheckedStates = 0;
+  for (uint32_t i = 0; i < p.size(); ++i) {
+    switch (p[i].OpCode) {
+    case LABEL_OP:
+      numPatterns = std::max(numPatterns, p[i].Op.Offset);
+      break;
+    case CHECK_HALT_OP:
+      numCheckedStates = std::max(numCheckedStates, p[i].Op.Offset);
+      break;
+    }
+  }
+  ++numPatterns;
+  ++numCheckedStates;
+
+  const bool hashed = hashLabels(numPatterns, Compact);
+  MatchEnds.resize(numPatterns, hashed);
+  Seen.resize(numPatterns, hashed);
+  Live.resize(numPatterns, hashed);
+  CheckLabels.resize(numCheckedStates, hashLabels(numCheckedStates, Compact));
+
+  Skipper.init(p.First);
+  Filter.init(UsePrefilter ? p.Literals : RequiredLiterals());
+
+  reset();
+}
+
+std::shared_ptr<VmInterface> TableVm::clone() const {
+  std::shared_ptr<TableVm> c(new TableVm(*this));
+  c->reset();
+  return c;
+}
+
+size_t TableVm::memoryUsage() const {
+  return sizeof(*this) + Filter.memoryUsage() +
+    vectorBytes(Active) + vectorBytes(Next) +
+    Seen.memoryUsage() + Live.memoryUsage() +
+    MatchEnds.memoryUsage() + CheckLabels.memoryUsage();
+}
+
+void TableVm::snapshot(std::ostream& out) const {
+  writeSnapshotValue(out, TABLE_SNAPSHOT);
+  writeSnapshotValue(out, MatchEndsMax);
+  MatchEnds.snapshot(out);
+
+  writeSnapshotValue(out, uint64_t(Active.size()));
+  for (const Thread& t : Active) {
+    writeSnapshotValue(out, t.State);
+    writeSnapshotValue(out, t.Label);
+    writeSnapshotValue(out, t.Start);
+    writeSnapshotValue(out, t.End);
+  }
+}
+
+void TableVm::restore(std::istream& in) {
+  reset();
+
+  readSnapshotTag(in, TABLE_SNAPSHOT);
+  MatchEndsMax = readSnapshotValue<uint64_t>(in);
+  MatchEnds.restore(in);
+
+  const uint64_t n = readSnapshotValue<uint64_t>(in);
+  for (uint64_t i = 0; i < n; ++i) {
+    Thread t;
+    t.State = readSnapshotValue<uint32_t>(in);
+    t.Label = readSnapshotValue<uint32_t>(in);
+    t.Start = readSnapshotValue<uint64_t>(in);
+    t.End = readSnapshotValue<uint64_t>(in);
+
+    if ((t.State >= Table->States.size() && t.State != FINISHED && t.State != HALTED) ||
+        (t.Label >= MatchEnds.size() && t.Label != NOLABEL))
+    {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot has a bad thread");
+    }
+
+    Active.push_back(t);
+  }
+}
+
+void TableVm::reset() {
+  Active.clear();
+  Next.clear();
+
+  CheckLabels.clear();
+
+  SeenNoLabel = false;
+  Seen.clear();
+
+  LiveNoLabel = false;
+  Live.clear();
+
+  MatchEnds.clear();
+  MatchEndsMax = 0;
+
+  CurHitFn = 0;
+}
+
+void TableVm::retire(uint32_t label) {
+  // threads with the label then die as though overlapping a match
+  if (label < MatchEnds.size()) {
+    MatchEnds.set(label, NONE);
+  }
+}
+
+inline void TableVm::_markLive(const uint32_t label) {
+  if (label == NOLABEL) {
+    LiveNoLabel = true;
+  }
+  else if (!Live.find(label)) {
+    Live.insert(label);
+  }
+}
+
+inline void TableVm::_markSeen(const uint32_t label) {
+  if (label == NOLABEL) {
+    SeenNoLabel = true;
+  }
+  else if (!Seen.find(label)) {
+    Seen.insert(label);
+  }
+}
+
+inline bool TableVm::_liveCheck(const uint64_t start, const uint32_t label) {
+  if (label == NOLABEL) {
+    return !Next.empty() || start < MatchEndsMax;
+  }
+  else {
+    return LiveNoLabel || Live.find(label);
+  }
+}
+
+// as FINISH_OP in Vm::_executeEpsilon()
+inline void TableVm::_finish(Thread& t, const size_t i, const uint64_t offset) {
+  if (t.End == offset) {
+    // kill all same-labeled, same-start threads
+    for (size_t j = i + 1; j < Active.size() && Active[j].Start == t.Start; ++j) {
+      if (Active[j].Label == t.Label) {
+        Active[j].State = HALTED;
+      }
+    }
+  }
+
+  if (!SeenNoLabel && !Seen.find(t.Label)) {
+    if (t.Start >= MatchEnds[t.Label]) {
+      MatchEnds.set(t.Label, t.End + 1);
+
+      if (t.End + 1 > MatchEndsMax) {
+        MatchEndsMax = t.End + 1;
+      }
+
+      if (CurHitFn) {
+        SearchHit hit(t.Start, t.End + 1, t.Label);
+        (*CurHitFn)(UserData, &hit);
+      }
+    }
+    return;
+  }
+
+  // something with priority might still match, so hold on to this
+  t.State = FINISHED;
+  _markLive(t.Label);
+  Next.push_back(t);
+}
+
+// as the code of the target state, entered after taking an edge to it;
+// returns whether the thread finished there
+inline bool TableVm::_arrive(Thread& t, uint32_t target, const size_t i, const uint64_t offset) {
+  const bool check = !(target & DfaTable::NOCHECK);
+  target &= ~DfaTable::NOCHECK;
+
+  const DfaTable::StateInfo& info(Table->States[target]);
+
+  if (info.Label != NOLABEL) {
+    if (t.Start < MatchEnds[info.Label]) {
+      return false;
+    }
+    t.Label = info.Label;
+  }
+
+  if (check && info.Check != UNCHECKED) {
+    if (CheckLabels.find(info.Check)) {
+      // another thread has the lock, we die
+      return false;
+    }
+    else if (!_liveCheck(t.Start, t.Label)) {
+      CheckLabels.insert(info.Check);
+    }
+  }
+
+  t.State = target;
+
+  if (info.Match) {
+    t.End = offset;
+
+    if (!info.Terminal) {
+      // the code forks, the child continuing and the parent finishing
+      _markSeen(t.Label);
+      _markLive(t.Label);
+      Next.push_back(t);
+    }
+
+    _finish(t, i, offset);
+    return true;
+  }
+  else {
+    _markSeen(t.Label);
+    _markLive(t.Label);
+    Next.push_back(t);
+    return false;
+  }
+}
+
+inline void TableVm::_take(const Thread& t, const uint32_t entry, const size_t i, const uint64_t offset) {
+  if (entry == DfaTable::DEAD) {
+    return;
+  }
+
+  if (!(entry & DfaTable::LIST)) {
+    Thread c(t);
+    _arrive(c, entry, i, offset);
+    return;
+  }
+
+  const uint32_t* l = &Table->Lists[entry & ~DfaTable::LIST];
+  const uint32_t* const lend = l + 1 + *l;
+  const bool fork = Table->States[t.State].Fork;
+
+  for (++l; l != lend; ++l) {
+    Thread c(t);
+    if (_arrive(c, *l, i, offset) && fork && c.Label == t.Label) {
+      // the code has a thread per edge, and this one's FINISH kills
+      // the rest, as they have its label and start
+      break;
+    }
+  }
+}
+
+inline void TableVm::_executeThread(Thread t, const size_t i, const uint32_t cls, const uint64_t offset) {
+  if (t.State == HALTED) {
+    return;
+  }
+
+  // kill threads overlapping an emitted match
+  if (t.Label != NOLABEL && t.Start < MatchEnds[t.Label]) {
+    return;
+  }
+
+  if (t.State == FINISHED) {
+    _finish(t, i, offset);
+    return;
+  }
+
+  _take(t, Table->next(t.State, cls), i, offset);
+}
+
+inline void TableVm::_executeFrame(const bool spawn, const byte b, const uint64_t offset) {
+  const uint32_t cls = Table->Classes[b];
+
+  for (size_t i = 0; i < Active.size(); ++i) {
+    _executeThread(Active[i], i, cls, offset);
+  }
+
+  // create new threads at this offset
+  if (spawn) {
+    _take(Thread{ROOT, NOLABEL, offset, NONE}, Table->next(ROOT, cls), Active.size(), offset);
+  }
+}
+
+inline void TableVm::_cleanup() {
+  Active.swap(Next);
+  Next.clear();
+  CheckLabels.clear();
+
+  SeenNoLabel = false;
+  Seen.clear();
+
+  LiveNoLabel = false;
+  Live.clear();
+}
+
+uint64_t TableVm::_firstLive() const {
+  for (const Thread& t : Active) {
+    if (t.State != FINISHED && t.State != HALTED) {
+      return t.Start;
+    }
+  }
+  return NONE;
+}
+
+void TableVm::startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+  uint64_t offset = startOffset;
+
+  if (Prog->First[*beg]) {
+    Active.push_back(Thread{ROOT, NOLABEL, offset, NONE});
+
+    for (const byte* cur = beg; cur < end; ++cur, ++offset) {
+      _executeFrame(false, *cur, offset);
+      _cleanup();
+
+      if (Active.empty()) {
+        // early exit if threads die out
+        break;
+      }
+    }
+  }
+
+  closeOut(hitFn, userData);
+  reset();
+}
+
+uint64_t TableVm::search(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+  const ByteSet& first = Prog->First;
+  uint64_t offset = startOffset;
+
+  // skipping and prefiltering are exactly as in Vm::search()
+  const bool skip = SkipScan && Skipper.worthwhile(),
+             filter = UsePrefilter && !Filter.empty();
+
+  const uint64_t lead = Filter.maxLead(),
+                 longest = Filter.maxLength();
+  const byte* const tail = !filter ? end :
+    uint64_t(end - beg) >= longest ? end - longest + 1 : beg;
+  const byte* lit = nullptr;
+
+  const auto window = [&](const byte* cur) {
+    if (!lit || lit < cur) {
+      lit = Filter.next(cur, end);
+    }
+
+    const byte* const n = std::min(lit, tail);
+    return n > cur && uint64_t(n - cur) > lead ? n - lead : cur;
+  };
+
+  for (const byte* cur = beg; cur < end; ++cur, ++offset) {
+    if (Active.empty()) {
+      const byte* const from = cur;
+      if (skip || filter) {
+        for (const byte* prev = nullptr; cur != prev && cur < end; ) {
+          prev = cur;
+          if (skip) {
+            cur = Skipper.next(cur, end);
+          }
+
+          if (filter && cur < end) {
+            cur = window(cur);
+          }
+        }
+      }
+      else {
+        // nothing is live, so only the table's first row matters
+        while (cur < end && Table->next(ROOT, Table->Classes[*cur]) == DfaTable::DEAD) {
+          ++cur;
+        }
+      }
+
+      offset += cur - from;
+
+      if (cur == end) {
+        break;
+      }
+    }
+
+    _executeFrame(first[*cur] && !(filter && window(cur) != cur), *cur, offset);
+    _cleanup();
+  }
+
+  return _firstLive();
+}
+
+uint64_t TableVm::searchResolve(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+  uint64_t offset = startOffset;
+
+  for (const byte* cur = beg; cur < end && !Active.empty(); ++cur, ++offset) {
+    _executeFrame(false, *cur, offset);
+    _cleanup();
+  }
+
+  return _firstLive();
+}
+
+void TableVm::closeOut(HitCallback hitFn, void* userData) {
+  CurHitFn = hitFn;
+  UserData = userData;
+
+  if (!CurHitFn) {
+    return;
+  }
+
+  for (const Thread& t : Active) {
+    if (t.State == FINISHED && t.Start >= MatchEnds[t.Label]) {
+      MatchEnds.set(t.Label, t.End + 1);
+
+      SearchHit hit(t.Start, t.End + 1, t.Label);
+      (*CurHitFn)(UserData, &hit);
+    }
+  }
+}
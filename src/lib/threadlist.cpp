@@ -0,0 +1,51 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "threadlist.h"
+
+const uint32_t ThreadList::NOPC = 0x80000000;
+
+void ThreadList::swap(ThreadList& other) {
+  std::swap(Base, other.Base);
+  std::swap(Size, other.Size);
+  PC.swap(other.PC);
+  Infos.swap(other.Infos);
+}
+
+void ThreadList::_reserve(size_t n) {
+  PC.resize(n);
+  Infos.resize(n);
+}
+
+void ThreadList::push_back(const Thread& t) {
+  #ifdef LBT_TRACE_ENABLED
+  push_back(t.PC ? uint32_t(t.PC - Base) : NOPC, t.Label, t.Id, t.Start, t.End);
+  #else
+  push_back(t.PC ? uint32_t(t.PC - Base) : NOPC, t.Label, t.Start, t.End);
+  #endif
+}
+
+Thread ThreadList::operator[](size_t i) const {
+  const Instruction* const pc = PC[i] == NOPC ? 0 : Base + int32_t(PC[i]);
+  const Info& info(Infos[i]);
+  #ifdef LBT_TRACE_ENABLED
+  return Thread(pc, info.Label, info.Id, info.Start, info.End);
+  #else
+  return Thread(pc, info.Label, info.Start, info.End);
+  #endif
+}
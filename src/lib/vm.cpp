@@ -18,7 +18,11 @@
 
 #include "container_out.h"
 #include "vm.h"
+#include "bitvm.h"
+#include "lazydfa.h"
+#include "tablevm.h"
 #include "program.h"
+#include "snapshot.h"
 
 #include <algorithm>
 #include <cctype>
@@ -113,7 +117,25 @@ void Thread::output_json(std::ostream& out, const Instruction* const base, byte
 }
 #endif
 
-std::shared_ptr<VmInterface> VmInterface::create() {
+std::shared_ptr<VmInterface> VmInterface::create(bool lazyDfa, bool table, bool bits) {
+  if (lazyDfa) {
+    return std::shared_ptr<VmInterface>(new LazyDfa);
+  }
+
+  #ifndef LBT_TRACE_ENABLED
+  if (bits) {
+    return std::shared_ptr<VmInterface>(new BitVm);
+  }
+
+  if (table) {
+    return std::shared_ptr<VmInterface>(new TableVm);
+  }
+  #else
+  // the other engines don't trace, so tracing always gets the Vm
+  (void) table;
+  (void) bits;
+  #endif
+
   return std::shared_ptr<VmInterface>(new Vm);
 }
 
@@ -121,12 +143,24 @@ Vm::Vm() :
   #ifdef LBT_TRACE_ENABLED
   BeginDebug(Thread::NONE), EndDebug(Thread::NONE), NextId(0),
   #endif
+  SkipScan(true),
+  UsePrefilter(true),
+  Compact(false),
+  HashedPCs(false),
+  Dedup(false),
+  Dropped(0),
   CurHitFn(0) {}
 
 Vm::Vm(ProgramPtr prog):
   #ifdef LBT_TRACE_ENABLED
   BeginDebug(Thread::NONE), EndDebug(Thread::NONE), NextId(0),
   #endif
+  SkipScan(true),
+  UsePrefilter(true),
+  Compact(false),
+  HashedPCs(false),
+  Dedup(false),
+  Dropped(0),
   CurHitFn(0)
 {
   init(prog);
@@ -135,7 +169,16 @@ Vm::Vm(ProgramPtr prog):
 void Vm::init(ProgramPtr prog) {
   Prog = prog;
   Program& p(*Prog);
-  ProgEnd = &p.back() - 1;
+  ProgEnd = p.size() - 2;
+
+  #ifdef LBT_VM_DIRECT_THREADED
+  StepTargets.clear();
+  CloseTargets.clear();
+  #endif
+
+  First.setBase(&p[0]);
+  Active.setBase(&p[0]);
+  Next.setBase(&p[0]);
 
   uint32_t numPatterns = 0,
          numCheckedStates = 0;
@@ -156,19 +199,33 @@ void Vm::init(ProgramPtr prog) {
   ++numPatterns;
   ++numCheckedStates;
 
-  MatchEnds.resize(numPatterns);
+  const bool hashed = hashLabels(numPatterns, Compact);
+
+  MatchEnds.resize(numPatterns, hashed);
   MatchEndsMax = 0;
 
-  Seen.resize(numPatterns);
+  Seen.resize(numPatterns, hashed);
   SeenNoLabel = false;
 
-  Live.resize(numPatterns);
+  Live.resize(numPatterns, hashed);
   LiveNoLabel = false;
 
-  CheckLabels.resize(numCheckedStates);
+  CheckLabels.resize(numCheckedStates, hashLabels(numCheckedStates, Compact));
+
+  // the threads in Next are few, however big the program
+  HashedPCs = hashLabels(p.size(), Compact);
+  NextPCs.resize(HashedPCs ? 0 : p.size());
+  NextPCLabel.resize(HashedPCs ? 0 : p.size());
+  NextPCStart.resize(HashedPCs ? 0 : p.size());
+  NextPCMap = LabelMap<NextPC>();
+  ActiveFinishes = NextFinishes = 0;
+  Dedup = false;
+  Dropped = 0;
 
-  Active.emplace_back(&(*Prog)[0]);
-  ThreadList::iterator t(Active.begin());
+  Skipper.init(p.First);
+  Filter.init(UsePrefilter ? p.Literals : RequiredLiterals());
+
+  Active.push_back(Thread(&(*Prog)[0]));
 
   #ifdef LBT_TRACE_ENABLED
   open_init_epsilon_json(std::clog);
@@ -176,8 +233,8 @@ void Vm::init(ProgramPtr prog) {
   pre_run_thread_json(std::clog, 0, Active.front(), &(*Prog)[0]);
   #endif
 
-  if (_executeEpSequence<0>(&(*Prog)[0], t, 0)) {
-    Next.push_back(*t);
+  if (_executeEpSequence<0>(&(*Prog)[0], 0, 0)) {
+    Next.push_back(Active, 0);
   }
 
   #ifdef LBT_TRACE_ENABLED
@@ -187,7 +244,146 @@ void Vm::init(ProgramPtr prog) {
 
   First.swap(Next);
 
+  #ifndef LBT_TRACE_ENABLED
+  _initStarts(&p[0]);
+  #endif
+
+  reset();
+}
+
+void Vm::_initStarts(const Instruction* const base) {
+  // ~4MB at most; past that, most start threads must be surviving most
+  // bytes, and there's little to save by precomputing them
+  static const size_t MAX_STARTS = 1 << 20;
+
+  std::shared_ptr<StartTable> t(new StartTable);
+  std::vector<uint32_t>& starts(t->PCs);
+
+  std::vector<uint32_t> forks;
+
+  const size_t n = First.size(),
+               size = Prog->size();
+  for (uint32_t b = 0; b < 256 && starts.size() <= MAX_STARTS; ++b) {
+    // run the start threads on b as _executeFrame() would
+    const byte cur = b;
+    Active.clear();
+    for (size_t j = 0; j < n; ++j) {
+      Active.push_back(First, j);
+    }
+
+    _step(base, 0, n, &cur);
+
+    // A new thread has no label or match yet, so the forks and jumps it
+    // meets first depend on nothing and can be followed here. Each branch
+    // becomes a start of its own, in the order the forks would run them.
+    for (size_t j = 0; j < n && starts.size() <= MAX_STARTS; ++j) {
+      forks.assign(1, Active.PC[j]);
+
+      while (!forks.empty() && starts.size() <= MAX_STARTS) {
+        uint32_t pc = forks.back();
+        forks.pop_back();
+
+        // an epsilon loop would hang the Vm anyway, but not here
+        for (size_t hops = 0; pc < size && hops < size; ++hops) {
+          const Instruction& instr = base[pc];
+          if (instr.OpCode == FORK_OP) {
+            forks.push_back(*reinterpret_cast<const uint32_t*>(&instr + 1));
+            pc += InstructionSize<FORK_OP>::VAL;
+          }
+          else if (instr.OpCode == JUMP_OP) {
+            pc = *reinterpret_cast<const uint32_t*>(&instr + 1);
+          }
+          else {
+            break;
+          }
+        }
+
+        // the penultimate instruction is always a halt; halting threads
+        // die without a trace
+        if (pc != ProgEnd && (pc >= size || base[pc].OpCode != HALT_OP)) {
+          starts.push_back(pc);
+        }
+      }
+    }
+
+    t->End.push_back(starts.size());
+  }
+
+  if (starts.size() > MAX_STARTS) {
+    t.reset();
+  }
+
+  Starts = t;
+  Active.clear();
+}
+
+std::shared_ptr<VmInterface> Vm::clone() const {
+  std::shared_ptr<Vm> c(new Vm(*this));
+  c->reset();
+  return c;
+}
+
+size_t Vm::memoryUsage() const {
+  return sizeof(*this) +
+    vectorBytes(ThreadCountHist) +
+    #ifdef LBT_VM_DIRECT_THREADED
+    vectorBytes(StepTargets) + vectorBytes(CloseTargets) + vectorBytes(Forks) +
+    #endif
+    Filter.memoryUsage() +
+    First.memoryUsage() + Active.memoryUsage() + Next.memoryUsage() +
+    Seen.memoryUsage() + Live.memoryUsage() +
+    MatchEnds.memoryUsage() + CheckLabels.memoryUsage() +
+    NextPCs.memoryUsage() + vectorBytes(NextPCLabel) + vectorBytes(NextPCStart) +
+    NextPCMap.memoryUsage();
+}
+
+void Vm::snapshot(std::ostream& out) const {
+  writeSnapshotValue(out, VM_SNAPSHOT);
+  writeSnapshotValue(out, MatchEndsMax);
+  writeSnapshotValue(out, ActiveFinishes);
+  MatchEnds.snapshot(out);
+
+  writeSnapshotValue(out, uint64_t(Active.size()));
+  for (size_t i = 0; i < Active.size(); ++i) {
+    writeSnapshotValue(out, Active.PC[i]);
+    writeSnapshotValue(out, Active.Infos[i].Label);
+    writeSnapshotValue(out, Active.Infos[i].Start);
+    writeSnapshotValue(out, Active.Infos[i].End);
+  }
+}
+
+void Vm::restore(std::istream& in) {
   reset();
+
+  readSnapshotTag(in, VM_SNAPSHOT);
+  MatchEndsMax = readSnapshotValue<uint64_t>(in);
+  ActiveFinishes = readSnapshotValue<uint32_t>(in);
+  MatchEnds.restore(in);
+
+  // a thread's pc must be where an instruction starts, not on an operand
+  const Program& p(*Prog);
+  std::vector<bool> starts(p.size(), false);
+  for (uint32_t pc = 0; pc < p.size(); pc += p[pc].length()) {
+    starts[pc] = true;
+  }
+
+  const Instruction* const base = &p[0];
+  const uint64_t n = readSnapshotValue<uint64_t>(in);
+  for (uint64_t i = 0; i < n; ++i) {
+    const uint32_t pc = readSnapshotValue<uint32_t>(in),
+                   label = readSnapshotValue<uint32_t>(in);
+    const uint64_t start = readSnapshotValue<uint64_t>(in),
+                   end = readSnapshotValue<uint64_t>(in);
+
+    if ((pc != ThreadList::NOPC && (pc >= p.size() || !starts[pc])) ||
+        (label >= MatchEnds.size() && label != Thread::NOLABEL) ||
+        start > end)
+    {
+      THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("snapshot has a bad thread");
+    }
+
+    Active.push_back(Thread(pc == ThreadList::NOPC ? nullptr : base + pc, label, start, end));
+  }
 }
 
 void Vm::reset() {
@@ -198,13 +394,19 @@ void Vm::reset() {
 
   CheckLabels.clear();
 
+  NextPCs.clear();
+  NextPCMap.clear();
+  ActiveFinishes = NextFinishes = 0;
+  Dedup = false;
+  Dropped = 0;
+
   SeenNoLabel = false;
   Seen.clear();
 
   LiveNoLabel = false;
   Live.clear();
 
-  MatchEnds.assign(MatchEnds.size(), 0);
+  MatchEnds.clear();
   MatchEndsMax = 0;
 
   CurHitFn = 0;
@@ -232,40 +434,41 @@ inline void Vm::_markSeen(const uint32_t label) {
   }
 }
 
-inline bool Vm::_execute(const Instruction* const base, ThreadList::iterator t, const byte* const cur) {
-  const Instruction& instr = *t->PC;
+inline bool Vm::_execute(const Instruction* const base, const size_t i, const byte* const cur) {
+  uint32_t& pc(Active.PC[i]);
+  const Instruction& instr = base[pc];
 
   switch (instr.OpCode) {
   case BYTE_OP:
     if ((*cur == instr.Op.T1.Byte) ^ (instr.Op.T1.Flags & Instruction::NEGATE)) {
-      t->advance(InstructionSize<BYTE_OP>::VAL);
+      pc += InstructionSize<BYTE_OP>::VAL;
       return true;
     }
     break;
 
   case EITHER_OP:
     if ((*cur == instr.Op.T2.First || *cur == instr.Op.T2.Last) ^ (instr.Op.T2.Flags & Instruction::NEGATE)) {
-      t->advance(InstructionSize<EITHER_OP>::VAL);
+      pc += InstructionSize<EITHER_OP>::VAL;
       return true;
     }
     break;
 
   case RANGE_OP:
     if ((instr.Op.T2.First <= *cur && *cur <= instr.Op.T2.Last) ^ (instr.Op.T2.Flags & Instruction::NEGATE)) {
-      t->advance(InstructionSize<RANGE_OP>::VAL);
+      pc += InstructionSize<RANGE_OP>::VAL;
       return true;
     }
     break;
 
   case ANY_OP:
-    t->advance(InstructionSize<ANY_OP>::VAL);
+    pc += InstructionSize<ANY_OP>::VAL;
     return true;
 
   case BIT_VECTOR_OP:
     {
-      const ByteSet* setPtr = reinterpret_cast<const ByteSet*>(t->PC + 1);
+      const ByteSet* setPtr = reinterpret_cast<const ByteSet*>(&instr + 1);
       if ((*setPtr)[*cur]) {
-        t->advance(InstructionSize<BIT_VECTOR_OP>::VAL);
+        pc += InstructionSize<BIT_VECTOR_OP>::VAL;
         return true;
       }
     }
@@ -273,9 +476,9 @@ inline bool Vm::_execute(const Instruction* const base, ThreadList::iterator t,
 
   case JUMP_TABLE_RANGE_OP:
     if (instr.Op.T2.First <= *cur && *cur <= instr.Op.T2.Last) {
-      const uint32_t addr = *reinterpret_cast<const uint32_t*>(t->PC + 1 + (*cur - instr.Op.T2.First));
+      const uint32_t addr = *reinterpret_cast<const uint32_t*>(&instr + 1 + (*cur - instr.Op.T2.First));
       if (addr != 0xffffffff) {
-        t->jump(base, addr);
+        pc = addr;
         return true;
       }
     }
@@ -286,7 +489,7 @@ inline bool Vm::_execute(const Instruction* const base, ThreadList::iterator t,
   }
 
   // DIE, penultimate instruction is always a halt.
-  t->PC = ProgEnd;
+  pc = ProgEnd;
   return false;
 }
 
@@ -303,32 +506,99 @@ inline bool Vm::_liveCheck(const uint64_t start, const uint32_t label) {
   }
 }
 
+// A thread reaching the same PC with the same label as one already in Next
+// can only ever do what that one does, and after it, so it can be dropped
+// so long as whatever would kill the first thread would kill it as well:
+//
+// * With the same start, it would. Both die on the same matches, and once
+//   the first reports a match the second is overlapped by it.
+//
+// * With a later start, it would unless some match can yet end between
+//   the two starts. No match already found can, if the earlier start is
+//   past all of them; and none still to be found can, unless a thread is
+//   holding one back at a finish. Threads at a finish are never merged
+//   this way, since each might be holding back a different match.
+//
+// Looking for the first thread costs more than running a few duplicates
+// does, so it's only done once a frame begins with more than
+// MIN_DEDUP_THREADS threads, and then for as long as it finds any.
+inline bool Vm::_duplicate(const Instruction* const base, const uint32_t pc, const uint32_t label, const uint64_t start) {
+  if (Dedup) {
+    bool seen;
+    uint32_t firstLabel;
+    uint64_t first;
+    if (HashedPCs) {
+      const size_t n = NextPCMap.size();
+      NextPC& p(NextPCMap.insert(pc));
+      seen = NextPCMap.size() == n;
+      if (seen) {
+        firstLabel = p.Label;
+        first = p.Start;
+      }
+      else {
+        p.Label = label;
+        p.Start = start;
+      }
+    }
+    else {
+      seen = NextPCs.find(pc);
+      if (seen) {
+        firstLabel = NextPCLabel[pc];
+        first = NextPCStart[pc];
+      }
+      else {
+        NextPCs.insert(pc);
+        NextPCLabel[pc] = label;
+        NextPCStart[pc] = start;
+      }
+    }
+
+    if (seen && firstLabel == label) {
+      if (first == start || (
+        first >= MatchEndsMax &&
+        ActiveFinishes + NextFinishes == 0 &&
+        base[pc].OpCode != FINISH_OP
+      )) {
+        ++Dropped;
+        return true;
+      }
+    }
+  }
+
+  if (base[pc].OpCode == FINISH_OP) {
+    ++NextFinishes;
+  }
+
+  return false;
+}
+
 // while base is always == &Program[0], we pass it in because it then should get inlined away
 template <uint32_t X>
-inline bool Vm::_executeEpsilon(const Instruction* const base, ThreadList::iterator t, const uint64_t offset) {
-  const Instruction& instr = *t->PC;
+inline bool Vm::_executeEpsilon(const Instruction* const base, const size_t i, const uint64_t offset) {
+  uint32_t& pc(Active.PC[i]);
+  const Instruction& instr = base[pc];
 
   switch (instr.OpCode) {
   case FINISH_OP:
     {
-      const uint32_t tLabel = t->Label;
-      const uint64_t tStart = t->Start;
-      const uint64_t tEnd = t->End;
+      const uint32_t tLabel = Active.Infos[i].Label;
+      const uint64_t tStart = Active.Infos[i].Start;
+      const uint64_t tEnd = Active.Infos[i].End;
 
       if (tEnd == offset) {
         // kill all same-labeled, same-start threads
-        const ThreadList::const_iterator e(Active.end());
-        for (ThreadList::iterator i(t+1); i != e && i->Start == tStart; ++i) {
-          if (i->Label == tLabel) {
+        const size_t e = Active.size();
+        for (size_t j = i + 1; j != e && Active.Infos[j].Start == tStart; ++j) {
+          if (Active.Infos[j].Label == tLabel) {
             // DIE. Penultimate instruction is always a halt
-            i->PC = ProgEnd;
+            Active.PC[j] = ProgEnd;
           }
         }
       }
 
       if (!SeenNoLabel && !Seen.find(tLabel)) {
         if (tStart >= MatchEnds[tLabel]) {
-          MatchEnds[tLabel] = tEnd + 1;
+          MatchEnds.set(tLabel, tEnd + 1);
 
           if (tEnd + 1 > MatchEndsMax) {
             MatchEndsMax = tEnd + 1;
@@ -340,7 +610,7 @@ inline bool Vm::_executeEpsilon(const Instruction* const base, ThreadList::itera
           }
         }
 
-        t->PC = 0;
+        pc = ThreadList::NOPC;
       }
 
       return false;
@@ -348,177 +618,479 @@ inline bool Vm::_executeEpsilon(const Instruction* const base, ThreadList::itera
 
   case FORK_OP:
     {
-      Thread f = *t;
-      t->advance(InstructionSize<FORK_OP>::VAL);
+      const uint32_t fLabel = Active.Infos[i].Label;
+      const uint64_t fEnd = Active.Infos[i].End;
+      pc += InstructionSize<FORK_OP>::VAL;
 
       // recurse to keep going in sequence
-      if (_executeEpSequence<X == 0 ? 0 : X-1>(base, t, offset)) {
-        if (t->PC->OpCode != FINISH_OP) {
-          _markSeen(t->Label);
+      if (_executeEpSequence<X == 0 ? 0 : X-1>(base, i, offset)) {
+        if (base[pc].OpCode != FINISH_OP) {
+          _markSeen(Active.Infos[i].Label);
         }
 
-        _markLive(t->Label);
-        Next.push_back(*t);
+        _markLive(Active.Infos[i].Label);
+
+        if (!_duplicate(base, pc, Active.Infos[i].Label, Active.Infos[i].Start)) {
+          Next.push_back(Active, i);
+        }
       }
 
       // Now back up to the fork, fall through to handle it as a longjump.
       // Note that the forked child is taking the parent's place in Active.
       // This is ESSENTIAL for maintaining correct thread priority order.
-      *t = f;
+      // (Nothing in the sequence changes the start.)
+      pc = &instr - base;
+      Active.Infos[i].Label = fLabel;
+      Active.Infos[i].End = fEnd;
 
       #ifdef LBT_TRACE_ENABLED
-      new_thread_json.insert(t->Id = NextId++);
+      new_thread_json.insert(Active.Infos[i].Id = NextId++);
       #endif
     }
 
   case JUMP_OP:
-    t->jump(base, *reinterpret_cast<const uint32_t*>(t->PC+1));
+    pc = *reinterpret_cast<const uint32_t*>(&instr + 1);
     return true;
 
   case CHECK_HALT_OP:
     {
       if (CheckLabels.find(instr.Op.Offset)) {
         // another thread has the lock, we die
-        t->PC = 0;
+        pc = ThreadList::NOPC;
         return false;
       }
-      else if (!_liveCheck(t->Start, t->Label)) {
+      else if (!_liveCheck(Active.Infos[i].Start, Active.Infos[i].Label)) {
         // nothing blocks us, we take the lock
         CheckLabels.insert(instr.Op.Offset);
       }
 
-      t->advance(InstructionSize<CHECK_HALT_OP>::VAL);
+      pc += InstructionSize<CHECK_HALT_OP>::VAL;
       return true;
     }
 
   case LABEL_OP:
     {
       const uint32_t label = instr.Op.Offset;
-      if (t->Start >= MatchEnds[label]) {
-        t->Label = label;
-        t->advance(InstructionSize<LABEL_OP>::VAL);
+      if (Active.Infos[i].Start >= MatchEnds[label]) {
+        Active.Infos[i].Label = label;
+        pc += InstructionSize<LABEL_OP>::VAL;
         return true;
       }
       else {
-        t->PC = 0;
+        pc = ThreadList::NOPC;
         return false;
       }
     }
 
   case MATCH_OP:
-    t->End = offset;
-    t->advance(InstructionSize<MATCH_OP>::VAL);
+    Active.Infos[i].End = offset;
+    pc += InstructionSize<MATCH_OP>::VAL;
     return true;
 
   case HALT_OP:
     // die, motherfucker, die
-    t->PC = 0;
+    pc = ThreadList::NOPC;
     return false;
   }
 
   return false;
 }
 
-inline void Vm::_executeThread(const Instruction* const base, ThreadList::iterator t, const byte* const cur, const uint64_t offset) {
-  #ifdef LBT_TRACE_ENABLED
-  pre_run_thread_json(std::clog, offset, *t, base);
-  #endif
+inline void Vm::_continueThread(const Instruction* const base, const size_t i, const uint64_t offset) {
+  if (_executeEpSequence<10>(base, i, offset)) {
+    if (base[Active.PC[i]].OpCode != FINISH_OP) {
+      _markSeen(Active.Infos[i].Label);
+    }
 
-  _execute(base, t, cur);
+    _markLive(Active.Infos[i].Label);
 
-  #ifdef LBT_TRACE_ENABLED
-  post_run_thread_json(std::clog, offset, *t, base);
-  #endif
-
-  if (_executeEpSequence<10>(base, t, offset)) {
-    if (t->PC->OpCode != FINISH_OP) {
-      _markSeen(t->Label);
+    if (!_duplicate(base, Active.PC[i], Active.Infos[i].Label, Active.Infos[i].Start)) {
+      Next.push_back(Active, i);
     }
-
-    _markLive(t->Label);
-    Next.push_back(*t);
   }
 }
 
 template <uint32_t X>
-inline bool Vm::_executeEpSequence(const Instruction* const base, ThreadList::iterator t, const uint64_t offset) {
+inline bool Vm::_executeEpSequence(const Instruction* const base, const size_t i, const uint64_t offset) {
 
   // kill threads overlapping an emitted match
-  if (t->Label != Thread::NOLABEL && t->Start < MatchEnds[t->Label]) {
+  const uint32_t label = Active.Infos[i].Label;
+  if (label != Thread::NOLABEL && Active.Infos[i].Start < MatchEnds[label]) {
     return false;
   }
 
   #ifdef LBT_TRACE_ENABLED
   bool ex;
   do {
-    const uint64_t id = t->Id; // t can change on a fork, we want the original
-    pre_run_thread_json(std::clog, offset, *t, base);
-    ex = _executeEpsilon<X>(base, t, offset);
+    const uint64_t id = Active.Infos[i].Id; // i can change on a fork, we want the original
+    pre_run_thread_json(std::clog, offset, Active[i], base);
+    ex = _executeEpsilon<X>(base, i, offset);
 //std::cerr << "\nNext.size() == " << Next.size() << std::endl;
 
-    if (t->Id == id) {
-      post_run_thread_json(std::clog, offset, *t, base);
+    if (Active.Infos[i].Id == id) {
+      post_run_thread_json(std::clog, offset, Active[i], base);
     }
     else if (!Next.empty() && Next.back().Id == id) {
       post_run_thread_json(std::clog, offset, Next.back(), base);
     }
-/*
-    const Thread& x = t->Id == id ? *t : Next.back();
-    post_run_thread_json(std::cerr, offset, x, base);
-*/
   } while (ex);
   #else
-  while (_executeEpsilon<X>(base, t, offset)) ;
+  while (_executeEpsilon<X>(base, i, offset)) ;
   #endif
 
-  return t->PC;
+  return Active.PC[i] != ThreadList::NOPC;
 }
 
-inline void Vm::_executeFrame(const ByteSet& first, ThreadList::iterator t, const Instruction* const base, const byte* const cur, const uint64_t offset) {
-  // run old threads at this offset
-  // uint32_t count = 0;
+#ifndef LBT_VM_DIRECT_THREADED
+
+inline void Vm::_step(const Instruction* const base, size_t i, const size_t n, const byte* const cur) {
+  for ( ; i < n; ++i) {
+    _execute(base, i, cur);
+  }
+}
+
+inline void Vm::_close(const Instruction* const base, size_t i, const size_t n, const uint64_t offset) {
+  for ( ; i < n; ++i) {
+    _continueThread(base, i, offset);
+  }
+}
+
+#else
+
+//
+// Direct-threaded versions of _step() and _close(). Each instruction's
+// handler ends with its own indirect jump to the next handler, so the
+// branch predictor sees every opcode pair separately instead of funneling
+// everything through the one jump at the top of a switch. The semantics
+// are exactly those of _execute() and _executeEpSequence().
+//
+// Label addresses are valid only within the copy of the function which
+// took them, so these must be neither inlined nor cloned.
+//
+#ifdef __clang__
+#define LBT_VM_DISPATCH_FN __attribute__((noinline))
+#else
+#define LBT_VM_DISPATCH_FN __attribute__((noinline, noclone))
+#endif
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+LBT_VM_DISPATCH_FN void Vm::_step(const Instruction* const base, size_t i, const size_t n, const byte* const cur) {
+  static const void* const handlers[] = {
+    &&die,                 // UNINITIALIZED
+    &&byte_op,
+    &&either_op,
+    &&range_op,
+    &&any_op,
+    &&bit_vector_op,
+    &&jump_table_range_op,
+    &&finish_op,
+    &&die,                 // FORK_OP
+    &&die,                 // JUMP_OP
+    &&die,                 // CHECK_HALT_OP
+    &&die,                 // LABEL_OP
+    &&die,                 // MATCH_OP
+    &&die,                 // ADJUST_START_OP
+    &&die,                 // HALT_OP
+    &&die                  // ILLEGAL
+  };
+
+  if (StepTargets.empty()) {
+    const Program& p(*Prog);
+    StepTargets.resize(p.size());
+    for (size_t j = 0; j < p.size(); ++j) {
+      StepTargets[j] = p[j].OpCode < ILLEGAL ? handlers[p[j].OpCode] : &&die;
+    }
+  }
+
+  if (i == n) {
+    return;
+  }
+
+  const void* const* const targets = &StepTargets[0];
+  uint32_t* const pcs = &Active.PC[0];
+  const byte b = *cur;
+
+  uint32_t pc;
+  const Instruction* instr;
+
+  #define LBT_NEXT_THREAD \
+    if (++i == n) return; \
+    pc = pcs[i]; \
+    instr = base + pc; \
+    goto *targets[pc]
+
+  --i;
+  LBT_NEXT_THREAD;
+
+byte_op:
+  pcs[i] = ((b == instr->Op.T1.Byte) ^ (instr->Op.T1.Flags & Instruction::NEGATE)) ?
+    pc + InstructionSize<BYTE_OP>::VAL : ProgEnd;
+  LBT_NEXT_THREAD;
+
+either_op:
+  pcs[i] = ((b == instr->Op.T2.First || b == instr->Op.T2.Last) ^ (instr->Op.T2.Flags & Instruction::NEGATE)) ?
+    pc + InstructionSize<EITHER_OP>::VAL : ProgEnd;
+  LBT_NEXT_THREAD;
+
+range_op:
+  pcs[i] = ((instr->Op.T2.First <= b && b <= instr->Op.T2.Last) ^ (instr->Op.T2.Flags & Instruction::NEGATE)) ?
+    pc + InstructionSize<RANGE_OP>::VAL : ProgEnd;
+  LBT_NEXT_THREAD;
+
+any_op:
+  pcs[i] = pc + InstructionSize<ANY_OP>::VAL;
+  LBT_NEXT_THREAD;
+
+bit_vector_op:
+  pcs[i] = (*reinterpret_cast<const ByteSet*>(instr + 1))[b] ?
+    pc + InstructionSize<BIT_VECTOR_OP>::VAL : ProgEnd;
+  LBT_NEXT_THREAD;
+
+jump_table_range_op:
+  if (instr->Op.T2.First <= b && b <= instr->Op.T2.Last) {
+    const uint32_t addr = *reinterpret_cast<const uint32_t*>(instr + 1 + (b - instr->Op.T2.First));
+    pcs[i] = addr != 0xffffffff ? addr : ProgEnd;
+  }
+  else {
+    pcs[i] = ProgEnd;
+  }
+  LBT_NEXT_THREAD;
+
+finish_op:
+  LBT_NEXT_THREAD;
+
+die:
+  // penultimate instruction is always a halt
+  pcs[i] = ProgEnd;
+  LBT_NEXT_THREAD;
+
+  #undef LBT_NEXT_THREAD
+}
+
+LBT_VM_DISPATCH_FN void Vm::_close(const Instruction* const base, size_t i, const size_t n, const uint64_t offset) {
+  static const void* const handlers[] = {
+    &&done,                // UNINITIALIZED
+    &&done,                // BYTE_OP
+    &&done,                // EITHER_OP
+    &&done,                // RANGE_OP
+    &&done,                // ANY_OP
+    &&done,                // BIT_VECTOR_OP
+    &&done,                // JUMP_TABLE_RANGE_OP
+    &&finish_op,
+    &&fork_op,
+    &&jump_op,
+    &&check_halt_op,
+    &&label_op,
+    &&match_op,
+    &&done,                // ADJUST_START_OP
+    &&halt_op,
+    &&done                 // ILLEGAL
+  };
+
+  if (CloseTargets.empty()) {
+    const Program& p(*Prog);
+    CloseTargets.resize(p.size());
+    for (size_t j = 0; j < p.size(); ++j) {
+      CloseTargets[j] = p[j].OpCode < ILLEGAL ? handlers[p[j].OpCode] : &&done;
+    }
+  }
+
+  const void* const* const targets = &CloseTargets[0];
+
+  // the thread being run; Start never changes along the way
+  uint32_t pc, label;
+  uint64_t start, end;
+  const Instruction* instr;
+
+  #define LBT_DISPATCH \
+    instr = base + pc; \
+    goto *targets[pc]
+
+  for ( ; i < n; ++i) {
+    pc = Active.PC[i];
+    label = Active.Infos[i].Label;
+    start = Active.Infos[i].Start;
+    end = Active.Infos[i].End;
+
+    // kill threads overlapping an emitted match
+    if (label != Thread::NOLABEL && start < MatchEnds[label]) {
+      continue;
+    }
+
+    LBT_DISPATCH;
+
+finish_op:
+    if (end == offset) {
+      // kill all same-labeled, same-start threads
+      const size_t e = Active.size();
+      for (size_t j = i + 1; j != e && Active.Infos[j].Start == start; ++j) {
+        if (Active.Infos[j].Label == label) {
+          // DIE. Penultimate instruction is always a halt
+          Active.PC[j] = ProgEnd;
+        }
+      }
+    }
+
+    if (!SeenNoLabel && !Seen.find(label)) {
+      if (start >= MatchEnds[label]) {
+        MatchEnds.set(label, end + 1);
+
+        if (end + 1 > MatchEndsMax) {
+          MatchEndsMax = end + 1;
+        }
+
+        if (CurHitFn) {
+          SearchHit hit(start, end + 1, label);
+          (*CurHitFn)(UserData, &hit);
+        }
+      }
+
+      goto dead;
+    }
+    goto done;
+
+fork_op:
+    {
+      // the child runs to the end of its sequence first, taking the
+      // parent's place in priority order; the parent then resumes as
+      // though the fork were a jump
+      const Fork f = { pc, label, end };
+      Forks.push_back(f);
+    }
+
+    pc += InstructionSize<FORK_OP>::VAL;
+
+    if (label != Thread::NOLABEL && start < MatchEnds[label]) {
+      goto resume;
+    }
+    LBT_DISPATCH;
+
+jump_op:
+    pc = *reinterpret_cast<const uint32_t*>(instr + 1);
+    LBT_DISPATCH;
+
+check_halt_op:
+    if (CheckLabels.find(instr->Op.Offset)) {
+      // another thread has the lock, we die
+      goto dead;
+    }
+    else if (!_liveCheck(start, label)) {
+      // nothing blocks us, we take the lock
+      CheckLabels.insert(instr->Op.Offset);
+    }
+
+    pc += InstructionSize<CHECK_HALT_OP>::VAL;
+    LBT_DISPATCH;
+
+label_op:
+    if (start >= MatchEnds[instr->Op.Offset]) {
+      label = instr->Op.Offset;
+      pc += InstructionSize<LABEL_OP>::VAL;
+      LBT_DISPATCH;
+    }
+    goto dead;
+
+match_op:
+    end = offset;
+    pc += InstructionSize<MATCH_OP>::VAL;
+    LBT_DISPATCH;
+
+halt_op:
+    goto dead;
+
+done:
+    // the sequence ends with the thread alive
+    if (instr->OpCode != FINISH_OP) {
+      _markSeen(label);
+    }
+
+    _markLive(label);
+
+    if (!_duplicate(base, pc, label, start)) {
+      Next.push_back(pc, label, start, end);
+    }
+    goto resume;
+
+dead:
+    pc = ThreadList::NOPC;
+
+resume:
+    if (!Forks.empty()) {
+      const Fork& f(Forks.back());
+      pc = *reinterpret_cast<const uint32_t*>(base + f.PC + 1);
+      label = f.Label;
+      end = f.End;
+      Forks.pop_back();
+      LBT_DISPATCH;
+    }
 
-  while (t != Active.end()) {
-    _executeThread(base, t, cur, offset);
-    ++t;
-    // ++count;
+    // leave the thread as the switch would have
+    Active.PC[i] = pc;
+    Active.Infos[i].Label = label;
+    Active.Infos[i].End = end;
   }
 
+  #undef LBT_DISPATCH
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+inline void Vm::_executeThreads(const Instruction* const base, const size_t i, const size_t n, const byte* const cur, const uint64_t offset) {
+  if (i == n) {
+    return;
+  }
+
+  #ifdef LBT_TRACE_ENABLED
+  for (size_t j = i; j < n; ++j) {
+    pre_run_thread_json(std::clog, offset, Active[j], base);
+    _execute(base, j, cur);
+    post_run_thread_json(std::clog, offset, Active[j], base);
+  }
+  #else
+  _step(base, i, n, cur);
+  #endif
+
+  _close(base, i, n, offset);
+}
+
+inline void Vm::_executeFrame(const ByteSet& first, size_t i, const Instruction* const base, const byte* const cur, const uint64_t offset) {
+  // run old threads at this offset
+  _executeThreads(base, i, Active.size(), cur, offset);
+
   // create new threads at this offset
   if (first[*cur]) {
     const size_t oldsize = Active.size();
 
-    for (t = First.begin(); t != First.end(); ++t) {
-      #ifdef LBT_TRACE_ENABLED
-      Active.emplace_back(
-        #ifdef _MSC_VER
-        Thread(t->PC, Thread::NOLABEL, NextId++, offset, Thread::NONE)
-        #else
-        t->PC, Thread::NOLABEL, NextId++, offset, Thread::NONE
-        #endif
-      );
-      #else
-      Active.emplace_back(
-        #ifdef _MSC_VER
-        Thread(t->PC, Thread::NOLABEL, offset, Thread::NONE)
-        #else
-        t->PC, Thread::NOLABEL, offset, Thread::NONE
-        #endif
-      );
-      #endif
+    #ifndef LBT_TRACE_ENABLED
+    if (Starts) {
+      // only the threads which survive this byte, already past it
+      const uint32_t beg = *cur ? Starts->End[*cur - 1] : 0,
+                     end = Starts->End[*cur];
+
+      for (uint32_t j = beg; j < end; ++j) {
+        Active.push_back(Starts->PCs[j], Thread::NOLABEL, offset, Thread::NONE);
+      }
+
+      _close(base, oldsize, Active.size(), offset);
+      return;
+    }
+    #endif
 
+    for (size_t j = 0; j < First.size(); ++j) {
       #ifdef LBT_TRACE_ENABLED
+      Active.push_back(First.PC[j], Thread::NOLABEL, NextId++, offset, Thread::NONE);
       new_thread_json.insert(Active.back().Id);
+      #else
+      Active.push_back(First.PC[j], Thread::NOLABEL, offset, Thread::NONE);
       #endif
     }
 
-    for (t = Active.begin() + oldsize; t != Active.end(); ++t) {
-      _executeThread(base, t, cur, offset);
-      // ++count;
-    }
+    _executeThreads(base, oldsize, Active.size(), cur, offset);
   }
-  // ThreadCountHist.resize(count + 1, 0);
-  // ++ThreadCountHist[count];
 }
 
 inline void Vm::_cleanup() {
@@ -526,6 +1098,13 @@ inline void Vm::_cleanup() {
   Next.clear();
   CheckLabels.clear();
 
+  NextPCs.clear();
+  NextPCMap.clear();
+  ActiveFinishes = NextFinishes;
+  NextFinishes = 0;
+  Dedup = Active.size() > MIN_DEDUP_THREADS || (Dedup && Dropped);
+  Dropped = 0;
+
   SeenNoLabel = false;
   Seen.clear();
 
@@ -537,27 +1116,30 @@ void Vm::cleanup() { _cleanup(); }
 
 bool Vm::execute(Thread* t, const byte* const cur) {
   Active.push_back(*t);
-  return execute(Active.end()-1, cur);
+  return execute(Active.size() - 1, cur);
 }
 
-bool Vm::execute(ThreadList::iterator t, const byte* const cur) {
-  return _execute(&(*Prog)[0], t, cur);
+bool Vm::execute(size_t i, const byte* const cur) {
+  return _execute(&(*Prog)[0], i, cur);
 }
 
 bool Vm::executeEpsilon(Thread* t, uint64_t offset) {
   Active.push_back(*t);
-  return executeEpsilon(Active.end()-1, offset);
+  return executeEpsilon(Active.size() - 1, offset);
 }
 
-bool Vm::executeEpsilon(ThreadList::iterator t, uint64_t offset) {
-  return _executeEpsilon<0>(&(*Prog)[0], t, offset);
+bool Vm::executeEpsilon(size_t i, uint64_t offset) {
+  return _executeEpsilon<0>(&(*Prog)[0], i, offset);
 }
 
 void Vm::executeFrame(const byte* const cur, uint64_t offset, HitCallback hitFn, void* userData) {
+  executeFrame(Prog->First, cur, offset, hitFn, userData);
+}
+
+void Vm::executeFrame(const ByteSet& first, const byte* const cur, uint64_t offset, HitCallback hitFn, void* userData) {
   CurHitFn = hitFn;
   UserData = userData;
-  ThreadList::iterator t = Active.begin();
-  _executeFrame(Prog->First, t, &(*Prog)[0], cur, offset);
+  _executeFrame(first, 0, &(*Prog)[0], cur, offset);
 }
 
 void Vm::startsWith(const byte* const beg, const byte* const end, const uint64_t startOffset, HitCallback hitFn, void* userData) {
@@ -567,20 +1149,16 @@ void Vm::startsWith(const byte* const beg, const byte* const end, const uint64_t
   uint64_t offset = startOffset;
 
   if (Prog->First[*beg]) {
-    for (ThreadList::const_iterator t(First.begin()); t != First.end(); ++t) {
-      Active.emplace_back(
-      #ifdef _MSC_VER
-        Thread(t->PC, Thread::NOLABEL, offset, Thread::NONE)
+    for (size_t j = 0; j < First.size(); ++j) {
+      #ifdef LBT_TRACE_ENABLED
+      Active.push_back(First.PC[j], Thread::NOLABEL, NextId++, offset, Thread::NONE);
       #else
-        t->PC, Thread::NOLABEL, offset, Thread::NONE
+      Active.push_back(First.PC[j], Thread::NOLABEL, offset, Thread::NONE);
       #endif
-      );
     }
 
     for (const byte* cur = beg; cur < end; ++cur, ++offset) {
-      for (ThreadList::iterator t(Active.begin()); t != Active.end(); ++t) {
-        _executeThread(base, t, cur, offset);
-      }
+      _executeThreads(base, 0, Active.size(), cur, offset);
 
       _cleanup();
 
@@ -602,12 +1180,65 @@ uint64_t Vm::search(const byte* const beg, const byte* const end, const uint64_t
   const ByteSet& first = Prog->First;
   uint64_t offset = startOffset;
 
+  #ifdef LBT_TRACE_ENABLED
+  // every frame must show up in the trace
+  const bool skip = false, filter = false;
+  #else
+  const bool skip = SkipScan && Skipper.worthwhile(),
+             filter = UsePrefilter && !Filter.empty();
+  #endif
+
+  // Every match contains a required literal beginning at most lead bytes
+  // into it, so threads need only be started that close to one. Literals
+  // running off the end of the buffer can't be seen, so starts from lead
+  // bytes before the last place one could begin are all kept.
+  const uint64_t lead = Filter.maxLead(),
+                 longest = Filter.maxLength();
+  const byte* const tail = !filter ? end :
+    uint64_t(end - beg) >= longest ? end - longest + 1 : beg;
+  const byte* lit = nullptr;
+
+  // the first place at or after cur where a match could begin
+  const auto window = [&](const byte* cur) {
+    if (!lit || lit < cur) {
+      lit = Filter.next(cur, end);
+    }
+
+    const byte* const n = std::min(lit, tail);
+    return n > cur && uint64_t(n - cur) > lead ? n - lead : cur;
+  };
+
+  const ByteSet none;
+
   for (const byte* cur = beg; cur < end; ++cur, ++offset) {
+    if (Active.empty() && (skip || filter)) {
+      // Nothing is live, so jump to the next byte which could begin a
+      // match. The skip scan is cheaper, so it goes first and the
+      // prefilter only has to look from wherever that stopped.
+      const byte* const from = cur;
+      for (const byte* prev = nullptr; cur != prev && cur < end; ) {
+        prev = cur;
+        if (skip) {
+          cur = Skipper.next(cur, end);
+        }
+
+        if (filter && cur < end) {
+          cur = window(cur);
+        }
+      }
+
+      offset += cur - from;
+
+      if (cur == end) {
+        break;
+      }
+    }
+
     #ifdef LBT_TRACE_ENABLED
     open_frame_json(std::clog, offset, cur);
     #endif
 
-    _executeFrame(first, Active.begin(), base, cur, offset);
+    _executeFrame(filter && window(cur) != cur ? none : first, 0, base, cur, offset);
 
     #ifdef LBT_TRACE_ENABLED
     close_frame_json(std::clog, offset);
@@ -618,14 +1249,13 @@ uint64_t Vm::search(const byte* const beg, const byte* const end, const uint64_t
   // std::cerr << "Max number of active threads was " << maxActive << ", average was " << total/(end - beg) << std::endl;
 
   // check for remaining live threads
-  const ThreadList::const_iterator e(Active.end());
-  for (ThreadList::iterator t(Active.begin()); t != e; ++t) {
-    const unsigned char op = t->PC->OpCode;
+  for (size_t i = 0; i < Active.size(); ++i) {
+    const unsigned char op = base[Active.PC[i]].OpCode;
     if (op == HALT_OP || op == FINISH_OP) {
       continue;
     }
     // this is a live thread
-    return t->Start;
+    return Active.Infos[i].Start;
   }
 
   return Thread::NONE;
@@ -645,11 +1275,13 @@ uint64_t Vm::searchResolve(const byte* const beg, const byte* const end, const u
     #endif
 
     hadRealOps = false;
-    for (ThreadList::iterator t(Active.begin()); t != Active.end(); ++t) {
-      hadRealOps = hadRealOps || !(t->PC->OpCode == HALT_OP && t->PC->OpCode == FINISH_OP);
-      _executeThread(base, t, cur, offset);
+    for (size_t i = 0; i < Active.size(); ++i) {
+      const unsigned char op = base[Active.PC[i]].OpCode;
+      hadRealOps = hadRealOps || !(op == HALT_OP && op == FINISH_OP);
     }
 
+    _executeThreads(base, 0, Active.size(), cur, offset);
+
     #ifdef LBT_TRACE_ENABLED
     close_frame_json(std::clog, offset);
     #endif
@@ -660,15 +1292,14 @@ uint64_t Vm::searchResolve(const byte* const beg, const byte* const end, const u
   // std::cerr << "Max number of active threads was " << maxActive << ", average was " << total/(end - beg) << std::endl;
 
   // check for remaining live threads
-  const ThreadList::const_iterator e(Active.end());
-  for (ThreadList::iterator t(Active.begin()); t != e; ++t) {
-    const unsigned char op = t->PC->OpCode;
+  for (size_t i = 0; i < Active.size(); ++i) {
+    const unsigned char op = base[Active.PC[i]].OpCode;
     if (op == HALT_OP || op == FINISH_OP) {
       continue;
     }
 
     // this is a live thread
-    return t->Start;
+    return Active.Infos[i].Start;
   }
   return Thread::NONE;
 }
@@ -682,16 +1313,18 @@ void Vm::closeOut(HitCallback hitFn, void* userData) {
   }
 
   SearchHit hit;
+  const Instruction* const base = &(*Prog)[0];
 
-  for (ThreadList::iterator t(Active.begin()); t != Active.end(); ++t) {
-    if (t->PC->OpCode == FINISH_OP) {
+  for (size_t i = 0; i < Active.size(); ++i) {
+    if (base[Active.PC[i]].OpCode == FINISH_OP) {
       // has match
-      if (t->Start >= MatchEnds[t->Label]) {
-        MatchEnds[t->Label] = t->End + 1;
+      const uint32_t label = Active.Infos[i].Label;
+      if (Active.Infos[i].Start >= MatchEnds[label]) {
+        MatchEnds.set(label, Active.Infos[i].End + 1);
 
-        hit.Start = t->Start;
-        hit.End = t->End + 1;
-        hit.KeywordIndex = t->Label;
+        hit.Start = Active.Infos[i].Start;
+        hit.End = Active.Infos[i].End + 1;
+        hit.KeywordIndex = label;
         (*CurHitFn)(UserData, &hit);
       }
     }
@@ -16,21 +16,58 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <scope/test.h>
+
 #include "stest.h"
 
 namespace {
+  struct Collector {
+    const STest* Test;
+    std::vector<SearchHit>* Hits;
+  };
+
+  void collect(std::vector<SearchHit>& hits, PatternMapHandle* pmap, const LG_SearchHit* const hit) {
+    hits.push_back(*static_cast<const SearchHit* const>(hit));
+
+    const LG_PatternInfo* info = lg_pattern_info(pmap, hit->KeywordIndex);
+
+    // adjust the hit to reflect the user pattern index
+    hits.back().KeywordIndex = reinterpret_cast<uint64_t>(info->UserData);
+  }
+
   void collector(void* userData, const LG_SearchHit* const hit) {
     STest* stest = static_cast<STest*>(userData);
+    collect(stest->Hits, stest->PMap.get(), hit);
+  }
 
-    stest->Hits.push_back(*static_cast<const SearchHit* const>(hit));
+  void otherCollector(void* userData, const LG_SearchHit* const hit) {
+    Collector* c = static_cast<Collector*>(userData);
+    collect(*c->Hits, c->Test->PMap.get(), hit);
+  }
 
-    const LG_PatternInfo* info = lg_pattern_info(
-      stest->PMap.get(), hit->KeywordIndex
-    );
+  // a tiny array, so that searches have to stop and resume often
+  void searchBatched(LG_HCONTEXT ctx, const byte* begin, const byte* end, uint64_t offset, Collector& c) {
+    LG_SearchHit hits[2];
+    size_t num;
 
-    // adjust the hit to reflect the user pattern index
-    stest->Hits.back().KeywordIndex =
-      reinterpret_cast<uint64_t>(info->UserData);
+    const char* cur = reinterpret_cast<const char*>(begin);
+    const char* const stop = reinterpret_cast<const char*>(end);
+    do {
+      const uint64_t next = lg_search_hits(ctx, cur, stop, offset, hits, 2, &num);
+      cur += next - offset;
+      offset = next;
+
+      for (size_t i = 0; i < num; ++i) {
+        otherCollector(&c, &hits[i]);
+      }
+    } while (cur < stop || num == 2);
+
+    do {
+      num = lg_closeout_search_hits(ctx, hits, 2);
+      for (size_t i = 0; i < num; ++i) {
+        otherCollector(&c, &hits[i]);
+      }
+    } while (num == 2);
   }
 }
 
@@ -89,12 +126,55 @@ void STest::init(const std::vector<Pattern>& pats) {
   );
 
   if (Prog) {
-    LG_ContextOptions ctxOpts;
+    LG_ContextOptions ctxOpts{};
 
     Ctx = std::unique_ptr<ContextHandle,void(*)(ContextHandle*)>(
       lg_create_context(Prog.get(), &ctxOpts),
       lg_destroy_context
     );
+
+    // the lazy DFA, the transition table where there is one,
+    LG_ContextOptions lazyOpts{};
+    lazyOpts.LazyDfa = 1;
+
+    LG_ContextOptions tableOpts{};
+    tableOpts.NoBitParallel = 1;
+
+    // the Vm alone,
+    LG_ContextOptions vmOpts{};
+    vmOpts.NoTable = 1;
+    vmOpts.NoBitParallel = 1;
+
+    // and the Vm and the table again, with per-pattern state hashed
+    LG_ContextOptions compactOpts{};
+    compactOpts.NoTable = 1;
+    compactOpts.NoBitParallel = 1;
+    compactOpts.Compact = 1;
+
+    LG_ContextOptions compactTableOpts{};
+    compactTableOpts.NoBitParallel = 1;
+    compactTableOpts.Compact = 1;
+
+    for (const LG_ContextOptions& o : {lazyOpts, tableOpts, vmOpts, compactOpts, compactTableOpts}) {
+      Others.push_back(Other{
+        std::unique_ptr<ContextHandle,void(*)(ContextHandle*)>(
+          lg_create_context(Prog.get(), &o),
+          lg_destroy_context
+        ),
+        std::vector<SearchHit>(),
+        false
+      });
+    }
+
+    // and the default engine again, taking hits in batches
+    Others.push_back(Other{
+      std::unique_ptr<ContextHandle,void(*)(ContextHandle*)>(
+        lg_create_context(Prog.get(), &ctxOpts),
+        lg_destroy_context
+      ),
+      std::vector<SearchHit>(),
+      true
+    });
   }
 }
 
@@ -109,6 +189,28 @@ void STest::search(const byte* begin, const byte* end, uint64_t offset) {
     collector
   );
   lg_closeout_search(Ctx.get(), this, collector);
+
+  for (Other& o : Others) {
+    Collector c{this, &o.Hits};
+
+    if (o.Batched) {
+      searchBatched(o.Ctx.get(), begin, end, offset, c);
+      SCOPE_ASSERT_EQUAL(Hits, o.Hits);
+      continue;
+    }
+
+    lg_search(
+      o.Ctx.get(),
+      reinterpret_cast<const char*>(begin),
+      reinterpret_cast<const char*>(end),
+      offset,
+      &c,
+      otherCollector
+    );
+    lg_closeout_search(o.Ctx.get(), &c, otherCollector);
+
+    SCOPE_ASSERT_EQUAL(Hits, o.Hits);
+  }
 }
 
 void STest::startsWith(const byte* begin, const byte* end, uint64_t offset) {
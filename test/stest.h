@@ -82,4 +82,13 @@ private:
 
   std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> Prog;
   std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> Ctx;
+
+  // every search is repeated with the other engines, which must agree
+  struct Other {
+    std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> Ctx;
+    std::vector<SearchHit> Hits;
+    bool Batched; // searched with lg_search_hits()
+  };
+
+  std::vector<Other> Others;
 };
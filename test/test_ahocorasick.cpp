@@ -0,0 +1,275 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "ahocorasick.h"
+#include "fsmthingy.h"
+#include "handles.h"
+#include "keywordvm.h"
+#include "parser.h"
+#include "parsetree.h"
+#include "program.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+  typedef std::vector<std::pair<std::string, uint32_t>> Keywords;
+
+  uint32_t walk(const AhoCorasick& ac, const std::string& s) {
+    uint32_t state = 0;
+    for (const char c : s) {
+      state = ac.next(state, c);
+    }
+    return state;
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> outputs(const AhoCorasick& ac, uint32_t state) {
+    std::vector<std::pair<uint32_t, uint32_t>> outs;
+    for (uint32_t o = ac.Out[state]; o != AhoCorasick::NONE; o = ac.Outputs[o].Next) {
+      outs.emplace_back(ac.Outputs[o].Label, ac.Outputs[o].Length);
+    }
+    return outs;
+  }
+
+  std::vector<SearchHit> sortedHits(LG_HPROGRAM prog, const std::string& text, size_t block) {
+    const LG_ContextOptions ctxOpts{};
+    std::vector<SearchHit> hits(search(prog, &ctxOpts, text, block));
+    std::sort(hits.begin(), hits.end());
+    return hits;
+  }
+}
+
+SCOPE_TEST(ahoCorasickOutputs) {
+  AhoCorasick ac;
+  ac.build(Keywords{{"he", 0}, {"she", 1}, {"his", 2}, {"hers", 3}, {"she", 4}});
+
+  SCOPE_ASSERT(!ac.empty());
+  SCOPE_ASSERT_EQUAL(5u, ac.NumLabels);
+
+  // longest first, then the suffixes
+  const std::vector<std::pair<uint32_t, uint32_t>> she{{1, 3}, {4, 3}, {0, 2}};
+  SCOPE_ASSERT(she == outputs(ac, walk(ac, "ushe")));
+
+  const std::vector<std::pair<uint32_t, uint32_t>> hers{{3, 4}};
+  SCOPE_ASSERT(hers == outputs(ac, walk(ac, "shers")));
+
+  SCOPE_ASSERT(outputs(ac, walk(ac, "hi")).empty());
+  SCOPE_ASSERT_EQUAL(0u, walk(ac, "xyz"));
+}
+
+SCOPE_TEST(ahoCorasickDoubleArray) {
+  // shared prefixes, suffixes of each other, and bytes at both ends
+  const Keywords kws{
+    {"abc", 0}, {"abd", 1}, {"bc", 2}, {"c", 3}, {"abcd", 4},
+    {std::string("\0\0", 2), 5}, {std::string("a\0b", 3), 6},
+    {"\x80\xff", 7}, {"\xff", 8}, {"\xff\xfe\xfd", 9}
+  };
+
+  AhoCorasick ac;
+  ac.build(kws);
+
+  // every keyword is spelled out from the root without failing
+  for (const auto& k : kws) {
+    uint32_t s = 0;
+    for (const char c : k.first) {
+      s = ac.child(s, c);
+      SCOPE_ASSERT(s != AhoCorasick::NONE);
+    }
+    SCOPE_ASSERT_EQUAL(k.first.size(), ac.Depth[s]);
+
+    const auto outs(outputs(ac, s));
+    SCOPE_ASSERT(std::find(outs.begin(), outs.end(), std::make_pair(k.second, uint32_t(k.first.size()))) != outs.end());
+  }
+
+  // "abcd" ends with nothing else, "abc" with "bc" and "c"
+  const std::vector<std::pair<uint32_t, uint32_t>> abcd{{4, 4}};
+  SCOPE_ASSERT(abcd == outputs(ac, walk(ac, "abcd")));
+  const std::vector<std::pair<uint32_t, uint32_t>> abc{{0, 3}, {2, 2}, {3, 1}};
+  SCOPE_ASSERT(abc == outputs(ac, walk(ac, "abc")));
+
+  // the dense table agrees with following failure links
+  SCOPE_ASSERT(!ac.Dense.empty());
+  for (uint32_t s = 0; s < ac.Check.size(); ++s) {
+    if (s == 0 || ac.Check[s] != AhoCorasick::NONE) {
+      for (uint32_t b = 0; b < 256; ++b) {
+        SCOPE_ASSERT_EQUAL(ac.next(s, b), ac.step(s, b));
+      }
+    }
+  }
+}
+
+SCOPE_TEST(keywordVmLeftmostNonOverlapping) {
+  const auto prog(compile({"aa", "aba", "ab", "b"}, {true, true, true, true}));
+  SCOPE_ASSERT(prog);
+  SCOPE_ASSERT(prog->Impl->empty());
+  SCOPE_ASSERT(!prog->Impl->Keywords.empty());
+  SCOPE_ASSERT(!prog->Impl->Keywords.Dense.empty());
+
+  // each keyword's occurrences may overlap others', but not its own
+  const std::vector<SearchHit> expected{
+    {0, 2, 0}, {2, 4, 2}, {2, 5, 1}, {3, 4, 3}, {4, 6, 2},
+    {5, 6, 3}, {8, 9, 3}, {9, 11, 2}, {10, 11, 3}
+  };
+
+  for (size_t block : {1u, 4u, 11u}) {
+    SCOPE_ASSERT_EQUAL(expected, sortedHits(prog.get(), "aaababa bab", block));
+  }
+}
+
+SCOPE_TEST(keywordVmWithoutDenseTable) {
+  ProgramPtr prog(new Program);
+  prog->Keywords.build(Keywords{{"aa", 0}, {"aba", 1}, {"ab", 2}, {"b", 3}});
+  prog->Keywords.densify(0);
+  SCOPE_ASSERT(prog->Keywords.Dense.empty());
+
+  KeywordVm vm(nullptr);
+  vm.init(prog);
+
+  std::vector<SearchHit> actual(search(vm, "aaababa bab", 4));
+  std::sort(actual.begin(), actual.end());
+
+  const std::vector<SearchHit> expected{
+    {0, 2, 0}, {2, 4, 2}, {2, 5, 1}, {3, 4, 3}, {4, 6, 2},
+    {5, 6, 3}, {8, 9, 3}, {9, 11, 2}, {10, 11, 3}
+  };
+  SCOPE_ASSERT_EQUAL(expected, actual);
+}
+
+SCOPE_TEST(keywordVmMixedList) {
+  const auto prog(compile({"ab", "a+c", "AB", "b.d"}, {true, false, true, false}));
+  SCOPE_ASSERT(prog);
+  SCOPE_ASSERT(!prog->Impl->empty());
+  SCOPE_ASSERT(!prog->Impl->Keywords.empty());
+
+  const std::vector<SearchHit> expected{
+    {0, 2, 0}, {2, 5, 1}, {6, 8, 2}, {8, 11, 3}
+  };
+  SCOPE_ASSERT_EQUAL(expected, sortedHits(prog.get(), "abaac ABbcd", 3));
+}
+
+SCOPE_TEST(keywordProgramSerialization) {
+  const auto prog(compile({"ab", "a+c"}, {true, false}));
+  const ProgramPtr p2(Program::unmarshall(prog->Impl->marshall()));
+  SCOPE_ASSERT(*prog->Impl == *p2);
+  SCOPE_ASSERT_EQUAL(prog->Impl->bufSize(), int(prog->Impl->marshall().size()));
+
+  // with the keywords folded
+  const auto folded(compile({"abcdefgh", "a+c"}, {true, false}, {true, false}));
+  SCOPE_ASSERT(folded->Impl->Keywords.folds());
+  const ProgramPtr p3(Program::unmarshall(folded->Impl->marshall()));
+  SCOPE_ASSERT(*folded->Impl == *p3);
+  SCOPE_ASSERT(p3->Keywords.folds());
+}
+
+SCOPE_TEST(ahoCorasickFoldCase) {
+  AhoCorasick ac;
+  ac.build(Keywords{{"He", 0}, {"hers", 1}, {"HE", 2}}, true);
+  SCOPE_ASSERT(ac.folds());
+  SCOPE_ASSERT(!ac.Dense.empty());
+
+  // "He" and "HE" are the same string, folded
+  const std::vector<std::pair<uint32_t, uint32_t>> he{{0, 2}, {2, 2}};
+  SCOPE_ASSERT(he == outputs(ac, walk(ac, "sHe")));
+  SCOPE_ASSERT(he == outputs(ac, walk(ac, "she")));
+
+  const std::vector<std::pair<uint32_t, uint32_t>> hers{{1, 4}};
+  SCOPE_ASSERT(hers == outputs(ac, walk(ac, "sHErS")));
+
+  for (uint32_t s = 0; s < ac.Check.size(); ++s) {
+    if (s == 0 || ac.Check[s] != AhoCorasick::NONE) {
+      for (uint32_t b = 0; b < 256; ++b) {
+        SCOPE_ASSERT_EQUAL(ac.next(s, AhoCorasick::lower(b)), ac.step(s, b));
+      }
+    }
+  }
+}
+
+SCOPE_TEST(keywordVmFoldsLongCaselessKeywords) {
+  // too many ways to write these to list them all
+  const auto prog(compile({"abcdefghij", "Mixed0123", "0-9"}, {true, true, true}, {true, true, true}));
+  SCOPE_ASSERT(prog);
+  SCOPE_ASSERT(prog->Impl->empty());
+  SCOPE_ASSERT(prog->Impl->Keywords.folds());
+
+  // case folds on letters only, and a hit may run into the next one
+  const std::string text("AbCdEfGhIj mIXED0123 0-9 abcdefghiJ0-9");
+  const std::vector<SearchHit> expected{
+    {0, 10, 0}, {11, 20, 1}, {21, 24, 2}, {25, 35, 0}, {35, 38, 2}
+  };
+
+  for (size_t block : {1u, 7u, 38u}) {
+    SCOPE_ASSERT_EQUAL(expected, sortedHits(prog.get(), text, block));
+  }
+}
+
+SCOPE_TEST(keywordVmFoldCaseMixed) {
+  // once the automaton folds case, a case-sensitive keyword can't join it
+  const auto prog(compile({"abcdefghij", "Cd", "xy"}, {true, true, true}, {true, false, true}));
+  SCOPE_ASSERT(prog);
+  SCOPE_ASSERT(!prog->Impl->empty());
+  SCOPE_ASSERT(prog->Impl->Keywords.folds());
+
+  const std::vector<SearchHit> expected{
+    {0, 10, 0}, {11, 13, 1}, {17, 19, 2}
+  };
+  SCOPE_ASSERT_EQUAL(expected, sortedHits(prog.get(), "ABCDEFGHIJ Cd cd XY", 4));
+
+  // the other way around, a short caseless keyword is listed in each case
+  const auto exact(compile({"Cd", "xy"}, {true, true}, {false, true}));
+  SCOPE_ASSERT(exact->Impl->empty());
+  SCOPE_ASSERT(!exact->Impl->Keywords.folds());
+  SCOPE_ASSERT_EQUAL(
+    std::vector<SearchHit>({{0, 2, 0}, {6, 8, 1}, {9, 11, 1}}),
+    sortedHits(exact.get(), "Cd cd xY XY", 4)
+  );
+}
+
+SCOPE_TEST(keywordsSkipTheGraph) {
+  // keywords are read off the parse tree and encoded, with no graph built
+  // for them; only the regex goes into the graph
+  FSMThingy fsm(16);
+  ParseTree tree;
+
+  const std::vector<Pattern> pats{
+    {"ab", true, false, "UTF-16LE"},
+    {"Cd", true, true, "US-ASCII"},
+    {"x+", false, false, "US-ASCII"}
+  };
+
+  for (uint32_t i = 0; i < pats.size(); ++i) {
+    SCOPE_ASSERT(parse(pats[i], tree));
+    fsm.addPattern(tree, pats[i].Encoding.c_str(), i, pats[i].FixedString);
+    SCOPE_ASSERT_EQUAL(i < 2, fsm.Fsm->verticesSize() == 1);
+  }
+
+  const std::vector<std::pair<std::string, uint32_t>> expected{
+    {std::string("a\0b\0", 4), 0}, {"cd", 1}, {"cD", 1}, {"Cd", 1}, {"CD", 1}
+  };
+  std::vector<std::pair<std::string, uint32_t>> actual(fsm.Keywords);
+  std::sort(actual.begin(), actual.end());
+  std::vector<std::pair<std::string, uint32_t>> sorted(expected);
+  std::sort(sorted.begin(), sorted.end());
+  SCOPE_ASSERT(sorted == actual);
+}
@@ -0,0 +1,115 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "bitvm.h"
+#include "handles.h"
+#include "program.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+  // 64 letters, which with the initial state makes 65 states
+  const std::string LONGEST("abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijkl");
+}
+
+SCOPE_TEST(bitVmFits) {
+  SCOPE_ASSERT(BitVm::fits(*compile({"mary", "lamb"})->Impl));
+
+  // the initial state doesn't need a bit, so 64 more fit, and 65 don't
+  SCOPE_ASSERT(BitVm::fits(*compile({LONGEST})->Impl));
+  SCOPE_ASSERT(!BitVm::fits(*compile({LONGEST + "m"})->Impl));
+
+  // 26 letters, 3 times over
+  SCOPE_ASSERT(!BitVm::fits(*compile({"abcdefghijklmnopqrstuvwxyz", "bcdefghijklmnopqrstuvwxyza", "cdefghijklmnopqrstuvwxyzab"})->Impl));
+}
+
+SCOPE_TEST(bitVmLastBit) {
+  // the match state is the 64th bit
+  const auto prog(compile({LONGEST}));
+  BitVm bvm;
+  bvm.init(prog->Impl);
+
+  const std::string text("x" + LONGEST + "y");
+  const std::vector<SearchHit> expected{{1, 65, 0}};
+  for (size_t block : {1u, 7u, 66u}) {
+    SCOPE_ASSERT_EQUAL(expected, search(bvm, text, block));
+  }
+}
+
+SCOPE_TEST(bitVmCarriesOver) {
+  const auto prog(compile({"abc"}));
+  BitVm bvm;
+  bvm.init(prog->Impl);
+
+  std::vector<SearchHit> hits;
+  const byte text[] = "xxab";
+  bvm.search(text, text + 4, 0, collectHit, &hits);
+  SCOPE_ASSERT(bvm.inVm());
+
+  const byte more[] = "cab";
+  bvm.search(more, more + 3, 4, collectHit, &hits);
+  SCOPE_ASSERT(bvm.inVm());
+
+  bvm.closeOut(collectHit, &hits);
+  SCOPE_ASSERT_EQUAL(1u, hits.size());
+  SCOPE_ASSERT_EQUAL(SearchHit(2, 5, 0), hits[0]);
+}
+
+SCOPE_TEST(bitVmHits) {
+  const auto prog(compile({"a+b", "b.?c", "(ab|ba)+"}));
+
+  const std::string text("aab bxc abac");
+  const std::vector<SearchHit> expected{
+    {0, 3, 0}, {1, 3, 2}, {4, 7, 1}, {8, 10, 0}, {8, 10, 2}, {9, 12, 1}
+  };
+
+  for (bool prefilter : {true, false}) {
+    BitVm bvm;
+    bvm.setPrefilter(prefilter);
+    bvm.init(prog->Impl);
+
+    for (size_t block : {1u, 5u, 12u}) {
+      SCOPE_ASSERT_EQUAL(expected, search(bvm, text, block));
+    }
+  }
+}
+
+SCOPE_TEST(bitVmRetire) {
+  const auto prog(compile({"a+b", "b.?c"}));
+  BitVm bvm;
+  bvm.init(prog->Impl);
+
+  std::vector<SearchHit> hits;
+  const byte text[] = "aab bxc ab";
+  bvm.retire(1);
+  bvm.search(text, text + 10, 0, collectHit, &hits);
+  bvm.closeOut(collectHit, &hits);
+
+  const std::vector<SearchHit> expected{{0, 3, 0}, {8, 10, 0}};
+  SCOPE_ASSERT_EQUAL(expected, hits);
+
+  // the label is back after a reset
+  SCOPE_ASSERT_EQUAL(3u, search(bvm, "aab bxc ab", 10).size());
+}
@@ -20,9 +20,18 @@
 
 #include "lightgrep/api.h"
 
+#include "handles.h"
+#include "limitvm.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <initializer_list>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <iostream>
 
@@ -141,3 +150,511 @@ SCOPE_TEST(testLgAddPatternListBadEncoding) {
 
 */
 }
+
+SCOPE_TEST(testLgProgramInfo) {
+  auto prog = compile({"[0-9]{4}", "ab+", "x|yz"});
+  SCOPE_ASSERT(prog);
+
+  // the lengths survive a round trip through serialization
+  std::vector<char> buf(lg_program_size(prog.get()));
+  lg_write_program(prog.get(), buf.data());
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> read(
+    lg_read_program(buf.data(), buf.size()),
+    lg_destroy_program
+  );
+  SCOPE_ASSERT(read);
+
+  for (LG_HPROGRAM p : {prog.get(), read.get()}) {
+    LG_ProgramInfo info;
+    lg_program_info(p, &info);
+    SCOPE_ASSERT_EQUAL(3u, info.NumPatterns);
+    SCOPE_ASSERT_EQUAL(1u, info.MinLength);
+    SCOPE_ASSERT_EQUAL(LG_UNBOUNDED, info.MaxLength);
+
+    uint64_t min, max;
+    lg_pattern_lengths(p, 0, &min, &max);
+    SCOPE_ASSERT_EQUAL(4u, min);
+    SCOPE_ASSERT_EQUAL(4u, max);
+
+    lg_pattern_lengths(p, 1, &min, &max);
+    SCOPE_ASSERT_EQUAL(2u, min);
+    SCOPE_ASSERT_EQUAL(LG_UNBOUNDED, max);
+
+    lg_pattern_lengths(p, 2, &min, &max);
+    SCOPE_ASSERT_EQUAL(1u, min);
+    SCOPE_ASSERT_EQUAL(2u, max);
+
+    lg_pattern_lengths(p, 3, &min, &max);
+    SCOPE_ASSERT(min > max);
+  }
+}
+
+SCOPE_TEST(testLgProgramInfoKeywords) {
+  // fixed strings, kept out of the code
+  auto prog = compile({"needle", "pin"}, {true, true});
+  SCOPE_ASSERT(prog);
+
+  LG_ProgramInfo info;
+  lg_program_info(prog.get(), &info);
+  SCOPE_ASSERT_EQUAL(2u, info.NumPatterns);
+  SCOPE_ASSERT_EQUAL(3u, info.MinLength);
+  SCOPE_ASSERT_EQUAL(6u, info.MaxLength);
+}
+
+SCOPE_TEST(testLgSearchHitsResumes) {
+  auto prog = compile({"[0-9]{4}", "ab+"});
+  SCOPE_ASSERT(prog);
+
+  // long enough to span several slices, with hits all the way through
+  std::string text;
+  for (uint32_t i = 0; text.size() < 20000; ++i) {
+    text += std::to_string(i * 7919) + (i % 3 ? " abbb " : " x ");
+  }
+
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_context(prog.get(), nullptr),
+    lg_destroy_context
+  );
+
+  std::vector<SearchHit> expected;
+  lg_search(ctx.get(), text.data(), text.data() + text.size(), 0, &expected, collectHit);
+  lg_closeout_search(ctx.get(), &expected, collectHit);
+
+  lg_reset_context(ctx.get());
+
+  std::vector<SearchHit> actual;
+  LG_SearchHit hits[7];
+  size_t num;
+
+  uint64_t off = 0, calls = 0;
+  do {
+    const uint64_t next = lg_search_hits(
+      ctx.get(), text.data() + off, text.data() + text.size(), off,
+      hits, 7, &num
+    );
+
+    SCOPE_ASSERT(next <= text.size());
+    SCOPE_ASSERT(num <= 7);
+    off = next;
+    ++calls;
+
+    for (size_t i = 0; i < num; ++i) {
+      actual.push_back(*static_cast<const SearchHit*>(&hits[i]));
+    }
+  } while (off < text.size() || num == 7);
+
+  do {
+    num = lg_closeout_search_hits(ctx.get(), hits, 7);
+    for (size_t i = 0; i < num; ++i) {
+      actual.push_back(*static_cast<const SearchHit*>(&hits[i]));
+    }
+  } while (num == 7);
+
+  // the search stopped each time the array filled
+  SCOPE_ASSERT(calls > expected.size() / 7);
+  SCOPE_ASSERT_EQUAL(expected, actual);
+}
+
+SCOPE_TEST(testLgSearchHitsHoldsOverflow) {
+  auto prog = compile({"a", "aa"});
+  SCOPE_ASSERT(prog);
+
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_context(prog.get(), nullptr),
+    lg_destroy_context
+  );
+
+  const char text[] = "aaaa";
+  LG_SearchHit hits[1];
+  size_t num;
+
+  // the array fills on the first slice, which is the whole buffer
+  SCOPE_ASSERT_EQUAL(4u, lg_search_hits(ctx.get(), text, text + 4, 0, hits, 1, &num));
+  SCOPE_ASSERT_EQUAL(1u, num);
+
+  // the rest come out of the context, with no more input
+  size_t total = num;
+  while (lg_search_hits(ctx.get(), text + 4, text + 4, 4, hits, 1, &num), num) {
+    ++total;
+  }
+
+  while (lg_closeout_search_hits(ctx.get(), hits, 1)) {
+    ++total;
+  }
+
+  SCOPE_ASSERT_EQUAL(6u, total);
+}
+
+namespace {
+  std::vector<SearchHit> searchAll(LG_HCONTEXT ctx, const std::string& text) {
+    std::vector<SearchHit> hits;
+    lg_search(ctx, text.data(), text.data() + text.size(), 0, &hits, collectHit);
+    lg_closeout_search(ctx, &hits, collectHit);
+    return hits;
+  }
+}
+
+SCOPE_TEST(testLgSearchContextExists) {
+  auto prog = compile({"ab+", "c"});
+  SCOPE_ASSERT(prog);
+
+  const LG_SearchOptions searchOpts{1, 0, 0};
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_search_context(prog.get(), nullptr, &searchOpts),
+    lg_destroy_context
+  );
+
+  const std::string text("xxabbbxcxxab");
+  std::vector<SearchHit> hits(searchAll(ctx.get(), text));
+  SCOPE_ASSERT_EQUAL(1u, hits.size());
+  SCOPE_ASSERT_EQUAL(SearchHit(2, 6, 0), hits[0]);
+
+  // nothing more until reset
+  SCOPE_ASSERT(searchAll(ctx.get(), text).empty());
+
+  lg_reset_context(ctx.get());
+  SCOPE_ASSERT_EQUAL(1u, searchAll(ctx.get(), "c").size());
+}
+
+SCOPE_TEST(testLgSearchContextCountOnly) {
+  auto prog = compile({"ab+", "c"});
+  SCOPE_ASSERT(prog);
+
+  const LG_SearchOptions searchOpts{0, 1, 0};
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_search_context(prog.get(), nullptr, &searchOpts),
+    lg_destroy_context
+  );
+
+  SCOPE_ASSERT(searchAll(ctx.get(), "abbcabcccab").empty());
+  SCOPE_ASSERT_EQUAL(3u, lg_hit_count(ctx.get(), 0));
+  SCOPE_ASSERT_EQUAL(4u, lg_hit_count(ctx.get(), 1));
+  SCOPE_ASSERT_EQUAL(0u, lg_hit_count(ctx.get(), 2));
+
+  lg_reset_context(ctx.get());
+  SCOPE_ASSERT_EQUAL(0u, lg_hit_count(ctx.get(), 0));
+}
+
+SCOPE_TEST(testLgSearchContextMaxHitsPerPattern) {
+  auto prog = compile({"ab+", "c"});
+  SCOPE_ASSERT(prog);
+
+  const LG_SearchOptions searchOpts{0, 0, 2};
+
+  // each engine is told to stop looking
+  LG_ContextOptions vmOpts{};
+  vmOpts.NoTable = 1;
+  vmOpts.NoBitParallel = 1;
+
+  LG_ContextOptions tableOpts{};
+  tableOpts.NoBitParallel = 1;
+
+  LG_ContextOptions bitOpts{};
+  bitOpts.NoPrefilter = 1;
+
+  LG_ContextOptions lazyOpts{};
+  lazyOpts.LazyDfa = 1;
+
+  for (const LG_ContextOptions& o : {vmOpts, tableOpts, bitOpts, lazyOpts}) {
+    std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+      lg_create_search_context(prog.get(), &o, &searchOpts),
+      lg_destroy_context
+    );
+
+    const std::vector<SearchHit> exp{
+      {0, 3, 0}, {3, 4, 1}, {4, 6, 0}, {6, 7, 1}
+    };
+
+    SCOPE_ASSERT_EQUAL(exp, searchAll(ctx.get(), "abbcabcccab"));
+    SCOPE_ASSERT_EQUAL(2u, lg_hit_count(ctx.get(), 0));
+    SCOPE_ASSERT_EQUAL(2u, lg_hit_count(ctx.get(), 1));
+  }
+}
+
+SCOPE_TEST(testLgSearchContextStopsWhenAllCapped) {
+  // big enough that the code's operands include words which look like
+  // labels
+  auto prog = compile({"[a-z0-9]{20,400}q", "x[0-9a-f]{1,300}y"});
+  SCOPE_ASSERT(prog);
+
+  const LG_SearchOptions searchOpts{0, 0, 1};
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_search_context(prog.get(), nullptr, &searchOpts),
+    lg_destroy_context
+  );
+
+  const LimitVm* limits = dynamic_cast<const LimitVm*>(ctx->Impl.get());
+  SCOPE_ASSERT(limits);
+
+  // once both patterns are capped, there's nothing left to look for
+  SCOPE_ASSERT_EQUAL(1u, searchAll(ctx.get(), "x1y").size());
+  SCOPE_ASSERT(!limits->done());
+  SCOPE_ASSERT_EQUAL(1u, searchAll(ctx.get(), "aaaaaaaaaaaaaaaaaaaaq").size());
+  SCOPE_ASSERT(limits->done());
+}
+
+SCOPE_TEST(testLgCloneContext) {
+  auto prog = compile({"ab+", "c", "[0-9]{3}"});
+  SCOPE_ASSERT(prog);
+  auto keywords = compile({"abb", "cab"}, {true, true});
+  SCOPE_ASSERT(keywords);
+
+  const std::string text("abbcabccc123ab45678");
+
+  LG_ContextOptions vmOpts{};
+  vmOpts.NoTable = 1;
+  vmOpts.NoBitParallel = 1;
+
+  LG_ContextOptions tableOpts{};
+  tableOpts.NoBitParallel = 1;
+
+  LG_ContextOptions bitOpts{};
+  bitOpts.NoPrefilter = 1;
+
+  LG_ContextOptions lazyOpts{};
+  lazyOpts.LazyDfa = 1;
+
+  for (LG_HPROGRAM p : {prog.get(), keywords.get()}) {
+    for (const LG_ContextOptions& o : {vmOpts, tableOpts, bitOpts, lazyOpts}) {
+      std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+        lg_create_context(p, &o),
+        lg_destroy_context
+      );
+
+      const std::vector<SearchHit> exp(searchAll(ctx.get(), text));
+      lg_reset_context(ctx.get());
+
+      // cloned partway through a search, the clone starts afresh and the
+      // original carries on
+      std::vector<SearchHit> hits;
+      lg_search(ctx.get(), text.data(), text.data() + 5, 0, &hits, collectHit);
+
+      std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> clone(
+        lg_clone_context(ctx.get()),
+        lg_destroy_context
+      );
+      SCOPE_ASSERT(clone);
+
+      lg_search(ctx.get(), text.data() + 5, text.data() + text.size(), 5, &hits, collectHit);
+      lg_closeout_search(ctx.get(), &hits, collectHit);
+      SCOPE_ASSERT_EQUAL(exp, hits);
+
+      SCOPE_ASSERT_EQUAL(exp, searchAll(clone.get(), text));
+    }
+  }
+}
+
+SCOPE_TEST(testLgContextPool) {
+  auto prog = compile({"ab+", "c"});
+  SCOPE_ASSERT(prog);
+
+  const LG_SearchOptions searchOpts{0, 1, 0};
+  std::unique_ptr<ContextPoolHandle,void(*)(ContextPoolHandle*)> pool(
+    lg_create_context_pool(prog.get(), nullptr, &searchOpts),
+    lg_destroy_context_pool
+  );
+  SCOPE_ASSERT(pool);
+
+  LG_HCONTEXT a = lg_acquire_context(pool.get());
+  LG_HCONTEXT b = lg_acquire_context(pool.get());
+  SCOPE_ASSERT(a);
+  SCOPE_ASSERT(b);
+  SCOPE_ASSERT(a != b);
+
+  // the search options carry over to every context
+  SCOPE_ASSERT(searchAll(a, "abbcab").empty());
+  SCOPE_ASSERT_EQUAL(2u, lg_hit_count(a, 0));
+  SCOPE_ASSERT_EQUAL(1u, lg_hit_count(a, 1));
+
+  // given back, a context comes out again reset
+  lg_release_context(pool.get(), a);
+  LG_HCONTEXT c = lg_acquire_context(pool.get());
+  SCOPE_ASSERT(a == c);
+  SCOPE_ASSERT_EQUAL(0u, lg_hit_count(c, 0));
+
+  SCOPE_ASSERT(searchAll(c, "cc").empty());
+  SCOPE_ASSERT_EQUAL(2u, lg_hit_count(c, 1));
+
+  lg_release_context(pool.get(), b);
+  lg_release_context(pool.get(), c);
+}
+
+SCOPE_TEST(testLgContextMemoryUsage) {
+  std::vector<std::string> pats;
+  for (uint32_t i = 0; i < 5000; ++i) {
+    pats.push_back("k" + std::to_string(i) + "x+");
+  }
+  auto prog = compile(pats);
+  SCOPE_ASSERT(prog);
+
+  const std::string text("k12xx k4999x k5000x k12x k77 k3x");
+
+  LG_ContextOptions denseOpts{};
+  denseOpts.NoTable = 1;
+
+  LG_ContextOptions compactOpts(denseOpts);
+  compactOpts.Compact = 1;
+
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> dense(
+    lg_create_context(prog.get(), &denseOpts),
+    lg_destroy_context
+  );
+
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> compact(
+    lg_create_context(prog.get(), &compactOpts),
+    lg_destroy_context
+  );
+
+  // arrays by pattern take at least 8 bytes each
+  const uint64_t denseBytes = lg_context_memory_usage(dense.get());
+  SCOPE_ASSERT(lg_context_memory_usage(compact.get()) + 8 * pats.size() < denseBytes);
+
+  const std::vector<SearchHit> exp{
+    {0, 5, 12}, {6, 12, 4999}, {20, 24, 12}, {29, 32, 3}
+  };
+  SCOPE_ASSERT_EQUAL(exp, searchAll(dense.get(), text));
+  SCOPE_ASSERT_EQUAL(exp, searchAll(compact.get(), text));
+  SCOPE_ASSERT(lg_context_memory_usage(compact.get()) < lg_context_memory_usage(dense.get()));
+}
+
+SCOPE_TEST(testLgReadProgramMapped) {
+  // the strings go to the keyword automaton, the rest to the code
+  auto prog = compile({"abc", "a[bc]+d", "bcd", "x+y"});
+  SCOPE_ASSERT(prog);
+
+  std::vector<char> buf(lg_program_size(prog.get()));
+  lg_write_program(prog.get(), buf.data());
+
+  const char path[] = "test_c_api_program.tmp";
+  std::FILE* f = std::fopen(path, "wb");
+  SCOPE_ASSERT(f);
+  SCOPE_ASSERT_EQUAL(buf.size(), std::fwrite(buf.data(), 1, buf.size(), f));
+  std::fclose(f);
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> mapped(
+    lg_read_program_mapped(path),
+    lg_destroy_program
+  );
+  std::remove(path);
+  SCOPE_ASSERT(mapped);
+
+  const std::string text("abcd abbcd xxy bcdabc");
+  const std::vector<SearchHit> exp(search(prog.get(), nullptr, text, text.size()));
+  SCOPE_ASSERT_EQUAL(8u, exp.size());
+  SCOPE_ASSERT_EQUAL(exp, search(mapped.get(), nullptr, text, text.size()));
+
+  SCOPE_ASSERT(!lg_read_program_mapped(path));
+}
+
+SCOPE_TEST(testLgProgramFromBufferNocopy) {
+  auto prog = compile({"abc", "a[bc]+d", "bcd", "x+y"});
+  SCOPE_ASSERT(prog);
+
+  std::vector<char> buf(lg_program_size(prog.get()));
+  lg_write_program(prog.get(), buf.data());
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> inPlace(
+    lg_program_from_buffer_nocopy(buf.data(), buf.size()),
+    lg_destroy_program
+  );
+  SCOPE_ASSERT(inPlace);
+
+  const std::string text("abcd abbcd xxy bcdabc");
+  SCOPE_ASSERT_EQUAL(
+    search(prog.get(), nullptr, text, text.size()),
+    search(inPlace.get(), nullptr, text, text.size())
+  );
+
+  // a program cut short is refused rather than read past its end
+  for (int size : {0, 40, int(buf.size()) - 1}) {
+    SCOPE_ASSERT(!lg_program_from_buffer_nocopy(buf.data(), size));
+    SCOPE_ASSERT(!lg_read_program(buf.data(), size));
+  }
+}
+
+SCOPE_TEST(testLgWriteProgramWithPatternMap) {
+  std::unique_ptr<PatternMapHandle,void(*)(PatternMapHandle*)> pmap(
+    lg_create_pattern_map(2),
+    lg_destroy_pattern_map
+  );
+
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+    lg_create_fsm(0),
+    lg_destroy_fsm
+  );
+
+  std::unique_ptr<PatternHandle,void(*)(PatternHandle*)> pat(
+    lg_create_pattern(),
+    lg_destroy_pattern
+  );
+
+  const LG_KeyOptions keyOpts{0, 0};
+  for (const char* p : {"a+b", "xyz"}) {
+    LG_Error* err = nullptr;
+    lg_parse_pattern(pat.get(), p, &keyOpts, &err);
+    SCOPE_ASSERT(!err);
+    lg_add_pattern(fsm.get(), pmap.get(), pat.get(), "ASCII", &err);
+    SCOPE_ASSERT(!err);
+  }
+
+  const LG_ProgramOptions progOpts{1};
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_create_program(fsm.get(), &progOpts),
+    lg_destroy_program
+  );
+  SCOPE_ASSERT(prog);
+
+  std::vector<char> buf(lg_program_size_with_pattern_map(prog.get(), pmap.get()));
+  SCOPE_ASSERT(buf.size() > size_t(lg_program_size(prog.get())));
+  lg_write_program_with_pattern_map(prog.get(), pmap.get(), buf.data());
+
+  std::unique_ptr<PatternMapHandle,void(*)(PatternMapHandle*)> readMap(
+    lg_read_pattern_map(buf.data(), buf.size()),
+    lg_destroy_pattern_map
+  );
+  SCOPE_ASSERT(readMap);
+  SCOPE_ASSERT_EQUAL(2, lg_pattern_map_size(readMap.get()));
+  SCOPE_ASSERT_EQUAL(std::string("a+b"), lg_pattern_info(readMap.get(), 0)->Pattern);
+  SCOPE_ASSERT_EQUAL(std::string("xyz"), lg_pattern_info(readMap.get(), 1)->Pattern);
+  SCOPE_ASSERT_EQUAL(std::string("ASCII"), lg_pattern_info(readMap.get(), 1)->EncodingChain);
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> readProg(
+    lg_read_program(buf.data(), buf.size()),
+    lg_destroy_program
+  );
+  SCOPE_ASSERT(readProg);
+
+  const std::string text("aab xyz");
+  SCOPE_ASSERT_EQUAL(
+    search(prog.get(), nullptr, text, text.size()),
+    search(readProg.get(), nullptr, text, text.size())
+  );
+
+  // and from a mapped file, where the patterns are used in place
+  const char path[] = "test_c_api_pattern_map.tmp";
+  std::FILE* f = std::fopen(path, "wb");
+  SCOPE_ASSERT(f);
+  SCOPE_ASSERT_EQUAL(buf.size(), std::fwrite(buf.data(), 1, buf.size(), f));
+  std::fclose(f);
+
+  std::unique_ptr<PatternMapHandle,void(*)(PatternMapHandle*)> mappedMap(
+    lg_read_pattern_map_mapped(path),
+    lg_destroy_pattern_map
+  );
+  std::remove(path);
+  SCOPE_ASSERT(mappedMap);
+  SCOPE_ASSERT_EQUAL(2, lg_pattern_map_size(mappedMap.get()));
+  SCOPE_ASSERT_EQUAL(std::string("xyz"), lg_pattern_info(mappedMap.get(), 1)->Pattern);
+  SCOPE_ASSERT_EQUAL(std::string("ASCII"), lg_pattern_info(mappedMap.get(), 0)->EncodingChain);
+
+  // a program written alone has no pattern map
+  std::vector<char> alone(lg_program_size(prog.get()));
+  lg_write_program(prog.get(), alone.data());
+  SCOPE_ASSERT(!lg_read_pattern_map(alone.data(), alone.size()));
+
+  // nor does a corrupt one
+  buf[buf.size() - 1] ^= 1;
+  SCOPE_ASSERT(!lg_read_pattern_map(buf.data(), buf.size()));
+  SCOPE_ASSERT(!lg_read_program(buf.data(), buf.size()));
+}
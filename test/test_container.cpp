@@ -0,0 +1,135 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <scope/test.h>
+
+#include "container.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+  std::string write(const ContainerWriter& out) {
+    std::string buf(out.size(), '\0');
+    out.write(&buf[0]);
+    return buf;
+  }
+
+  std::string sample() {
+    ContainerWriter out;
+    out.add(INFO_SECTION, std::string("info"));
+    out.add(CODE_SECTION, std::string(100, 'c'));
+    out.add(LITERALS_SECTION, std::string(), 0);
+    return write(out);
+  }
+
+  std::string section(const ContainerReader& in, ContainerSection id) {
+    const std::pair<const byte*, size_t> sec(in.find(id));
+    return std::string(reinterpret_cast<const char*>(sec.first), sec.second);
+  }
+}
+
+SCOPE_TEST(testChecksum) {
+  // the XXH64 reference values
+  SCOPE_ASSERT_EQUAL(0xEF46DB3751D8E999ull, checksum("", 0));
+  SCOPE_ASSERT_EQUAL(0x44BC2CF5AD770999ull, checksum("abc", 3));
+
+  // every byte counts, on both sides of the 32-byte stripes
+  const std::string s(71, 'x');
+  const uint64_t h = checksum(s.data(), s.size());
+  for (size_t i = 0; i < s.size(); ++i) {
+    std::string t(s);
+    t[i] = 'y';
+    SCOPE_ASSERT(h != checksum(t.data(), t.size()));
+  }
+}
+
+SCOPE_TEST(testContainerRoundTrip) {
+  const std::string buf(sample());
+  SCOPE_ASSERT_EQUAL(0u, buf.size() % SECTION_ALIGNMENT);
+
+  const ContainerReader in(buf.data(), buf.size());
+  SCOPE_ASSERT_EQUAL("info", section(in, INFO_SECTION));
+  SCOPE_ASSERT_EQUAL(std::string(100, 'c'), section(in, CODE_SECTION));
+
+  // there, but empty
+  SCOPE_ASSERT(in.find(LITERALS_SECTION).first);
+  SCOPE_ASSERT_EQUAL(0u, in.find(LITERALS_SECTION).second);
+
+  SCOPE_ASSERT(!in.find(TABLE_NEXT_SECTION).first);
+
+  for (ContainerSection id : {INFO_SECTION, CODE_SECTION}) {
+    SCOPE_ASSERT_EQUAL(0u, (in.find(id).first - reinterpret_cast<const byte*>(buf.data())) % SECTION_ALIGNMENT);
+  }
+}
+
+SCOPE_TEST(testContainerRejectsBadHeaders) {
+  const std::string good(sample());
+
+  // magic
+  std::string buf(good);
+  buf[0] = 'X';
+  SCOPE_EXPECT(ContainerReader(buf.data(), buf.size()), std::runtime_error);
+
+  // version
+  buf = good;
+  const uint16_t version = CONTAINER_VERSION + 1;
+  std::memcpy(&buf[4], &version, sizeof(version));
+  SCOPE_EXPECT(ContainerReader(buf.data(), buf.size()), std::runtime_error);
+
+  // byte order
+  buf = good;
+  std::swap(buf[6], buf[7]);
+  SCOPE_EXPECT(ContainerReader(buf.data(), buf.size()), std::runtime_error);
+
+  // features
+  buf = good;
+  buf[8] |= 0x80;
+  SCOPE_EXPECT(ContainerReader(buf.data(), buf.size()), std::runtime_error);
+
+  // truncation
+  SCOPE_EXPECT(ContainerReader(good.data(), good.size() - 1), std::runtime_error);
+  SCOPE_EXPECT(ContainerReader(good.data(), 16), std::runtime_error);
+
+  // a size too small to hold even the header
+  buf = good;
+  const uint64_t size = 8;
+  std::memcpy(&buf[16], &size, sizeof(size));
+  SCOPE_EXPECT(ContainerReader(buf.data(), buf.size()), std::runtime_error);
+
+  // corruption
+  buf = good;
+  buf[buf.size() - 1] ^= 1;
+  SCOPE_EXPECT(ContainerReader(buf.data(), buf.size()), std::runtime_error);
+}
+
+SCOPE_TEST(testContainerUnknownSections) {
+  const ContainerSection unknown = static_cast<ContainerSection>(1000);
+
+  ContainerWriter optional;
+  optional.add(INFO_SECTION, std::string("info"));
+  optional.add(unknown, std::string("later"), 0);
+  const std::string buf(write(optional));
+  const ContainerReader in(buf.data(), buf.size());
+  SCOPE_ASSERT_EQUAL("info", section(in, INFO_SECTION));
+
+  ContainerWriter required;
+  required.add(unknown, std::string("later"));
+  const std::string bad(write(required));
+  SCOPE_EXPECT(ContainerReader(bad.data(), bad.size()), std::runtime_error);
+}
@@ -18,6 +18,7 @@
 
 #include <scope/test.h>
 
+#include <algorithm>
 #include <memory>
 
 #include "nfabuilder.h"
@@ -112,3 +113,70 @@ NFAPtr createGraph(const std::vector<Pattern>& pats, bool determinize) {
 
   return g;
 }
+
+void collectHit(void* userData, const LG_SearchHit* const hit) {
+  static_cast<std::vector<SearchHit>*>(userData)->push_back(
+    *static_cast<const SearchHit*>(hit)
+  );
+}
+
+ProgramHandlePtr compile(const std::vector<std::string>& pats, const std::vector<bool>& fixed, const std::vector<bool>& caseless, bool determinize) {
+  std::unique_ptr<PatternMapHandle,void(*)(PatternMapHandle*)> pmap(
+    lg_create_pattern_map(pats.size()),
+    lg_destroy_pattern_map
+  );
+
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+    lg_create_fsm(0),
+    lg_destroy_fsm
+  );
+
+  std::unique_ptr<PatternHandle,void(*)(PatternHandle*)> pat(
+    lg_create_pattern(),
+    lg_destroy_pattern
+  );
+
+  for (size_t i = 0; i < pats.size(); ++i) {
+    const LG_KeyOptions keyOpts{
+      !fixed.empty() && fixed[i], !caseless.empty() && caseless[i]
+    };
+    LG_Error* err = nullptr;
+    lg_parse_pattern(pat.get(), pats[i].c_str(), &keyOpts, &err);
+    SCOPE_ASSERT(!err);
+    lg_add_pattern(fsm.get(), pmap.get(), pat.get(), "ASCII", &err);
+    SCOPE_ASSERT(!err);
+  }
+
+  const LG_ProgramOptions progOpts{determinize};
+  return ProgramHandlePtr(
+    lg_create_program(fsm.get(), &progOpts),
+    lg_destroy_program
+  );
+}
+
+std::vector<SearchHit> search(LG_HPROGRAM prog, const LG_ContextOptions* opts, const std::string& text, size_t block) {
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_context(prog, opts),
+    lg_destroy_context
+  );
+
+  std::vector<SearchHit> hits;
+  for (size_t off = 0; off < text.size(); off += block) {
+    const size_t len = std::min(block, text.size() - off);
+    lg_search(ctx.get(), text.data() + off, text.data() + off + len, off, &hits, collectHit);
+  }
+  lg_closeout_search(ctx.get(), &hits, collectHit);
+  return hits;
+}
+
+std::vector<SearchHit> search(VmInterface& vm, const std::string& text, size_t block) {
+  std::vector<SearchHit> hits;
+  vm.reset();
+  for (size_t off = 0; off < text.size(); off += block) {
+    const size_t len = std::min(block, text.size() - off);
+    const byte* const beg = reinterpret_cast<const byte*>(text.data()) + off;
+    vm.search(beg, beg + len, off, collectHit, &hits);
+  }
+  vm.closeOut(collectHit, &hits);
+  return hits;
+}
@@ -21,10 +21,18 @@
 #include "automata.h"
 #include "fwd_pointers.h"
 #include "pattern.h"
+#include "searchhit.h"
+#include "vm_interface.h"
+
+#include "lightgrep/api.h"
 
 #include <initializer_list>
+#include <memory>
+#include <string>
 #include <vector>
 
+typedef std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> ProgramHandlePtr;
+
 void edge(NFA::VertexDescriptor source, NFA::VertexDescriptor target, NFA& fsm, Transition* trans);
 
 bool edgeExists(const NFA& g, const NFA::VertexDescriptor source, const NFA::VertexDescriptor target);
@@ -39,6 +47,20 @@ void ASSERT_EQUAL_MATCHES(const NFA& a, const NFA& b);
 
 NFAPtr createGraph(const std::vector<Pattern>& pats, bool determinize);
 
+// hit callback which appends to the std::vector<SearchHit> in userData
+void collectHit(void* userData, const LG_SearchHit* const hit);
+
+// compiles ASCII patterns through the C API; fixed[i] marks pattern i as
+// a fixed string and caseless[i] as case-insensitive, and an empty list
+// means none are; the graph is determinized unless determinize is unset
+ProgramHandlePtr compile(const std::vector<std::string>& pats, const std::vector<bool>& fixed = std::vector<bool>(), const std::vector<bool>& caseless = std::vector<bool>(), bool determinize = true);
+
+// searches text in blocks of the given size with a fresh context
+std::vector<SearchHit> search(LG_HPROGRAM prog, const LG_ContextOptions* opts, const std::string& text, size_t block);
+
+// resets vm, then searches text in blocks of the given size
+std::vector<SearchHit> search(VmInterface& vm, const std::string& text, size_t block);
+
 template<class T>
 std::vector<Pattern> makePatterns(const std::initializer_list<T>& list) {
   std::vector<Pattern> ret;
@@ -0,0 +1,101 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "labelvalues.h"
+
+SCOPE_TEST(labelValuesSetAndClear) {
+  LabelValues<uint64_t> v;
+  v.resize(5);
+  SCOPE_ASSERT_EQUAL(5u, v.size());
+
+  v.set(1, 7);
+  v.set(3, 2);
+  v.set(3, 9);
+  SCOPE_ASSERT_EQUAL(0u, v[0]);
+  SCOPE_ASSERT_EQUAL(7u, v[1]);
+  SCOPE_ASSERT_EQUAL(9u, v[3]);
+
+  v.clear();
+  SCOPE_ASSERT_EQUAL(5u, v.size());
+  for (uint32_t i = 0; i < 5; ++i) {
+    SCOPE_ASSERT_EQUAL(0u, v[i]);
+  }
+
+  v.set(4, 1);
+  SCOPE_ASSERT_EQUAL(1u, v[4]);
+  v.clear();
+  SCOPE_ASSERT_EQUAL(0u, v[4]);
+}
+
+SCOPE_TEST(labelValuesResize) {
+  LabelValues<uint64_t> v;
+  v.resize(3);
+  v.set(2, 5);
+  v.resize(4);
+  SCOPE_ASSERT_EQUAL(4u, v.size());
+  SCOPE_ASSERT_EQUAL(0u, v[2]);
+  v.clear();
+  SCOPE_ASSERT_EQUAL(0u, v[2]);
+}
+
+SCOPE_TEST(labelValuesHashed) {
+  LabelValues<uint64_t> v;
+  v.resize(1u << 30, true);
+  SCOPE_ASSERT_EQUAL(1u << 30, v.size());
+
+  // far more than the table starts with, spread over all the labels
+  for (uint32_t i = 0; i < 1000; ++i) {
+    v.set(i * 1000003u % (1u << 30), i + 1);
+  }
+  for (uint32_t i = 0; i < 1000; ++i) {
+    SCOPE_ASSERT_EQUAL(i + 1, v[i * 1000003u % (1u << 30)]);
+  }
+  SCOPE_ASSERT_EQUAL(0u, v[1]);
+  SCOPE_ASSERT(v.memoryUsage() < (1u << 20));
+
+  v.clear();
+  for (uint32_t i = 0; i < 1000; ++i) {
+    SCOPE_ASSERT_EQUAL(0u, v[i * 1000003u % (1u << 30)]);
+  }
+
+  v.set(7, 3);
+  SCOPE_ASSERT_EQUAL(3u, v[7]);
+}
+
+SCOPE_TEST(labelSetHashed) {
+  for (bool hashed : {false, true}) {
+    LabelSet s;
+    s.resize(100, hashed);
+    SCOPE_ASSERT_EQUAL(0u, s.size());
+
+    for (uint32_t i = 0; i < 100; i += 3) {
+      s.insert(i);
+    }
+    SCOPE_ASSERT_EQUAL(34u, s.size());
+    for (uint32_t i = 0; i < 100; ++i) {
+      SCOPE_ASSERT_EQUAL(i % 3 == 0, s.find(i));
+    }
+
+    s.clear();
+    SCOPE_ASSERT_EQUAL(0u, s.size());
+    SCOPE_ASSERT(!s.find(0));
+    SCOPE_ASSERT(!s.find(99));
+  }
+}
@@ -0,0 +1,121 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "handles.h"
+#include "lazydfa.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <string>
+#include <vector>
+
+SCOPE_TEST(lazyDfaHits) {
+  const auto prog(compile({"x?(cat|dog)s", "a[^q]*q", "bad"}));
+  SCOPE_ASSERT(prog);
+
+  const std::string text("cats xdogs bad aq");
+  const std::vector<SearchHit> expected{
+    {0, 4, 0}, {5, 10, 0}, {11, 14, 2}, {1, 17, 1}
+  };
+
+  for (bool prefilter : {false, true}) {
+    LazyDfa dfa;
+    dfa.setPrefilter(prefilter);
+    dfa.init(prog->Impl);
+
+    for (size_t block : {1u, 3u, 17u}) {
+      SCOPE_ASSERT_EQUAL(expected, search(dfa, text, block));
+    }
+
+    // the states are reused, rather than rebuilt
+    const uint32_t states = dfa.numStates();
+    SCOPE_ASSERT_EQUAL(expected, search(dfa, text, 17));
+    SCOPE_ASSERT_EQUAL(states, dfa.numStates());
+    SCOPE_ASSERT_EQUAL(0u, dfa.numFlushes());
+    SCOPE_ASSERT(!dfa.gaveUp());
+  }
+}
+
+SCOPE_TEST(lazyDfaFlushes) {
+  const auto prog(compile({"a[^q]*q", "b[^q]*q"}));
+  SCOPE_ASSERT(prog);
+
+  // room for two states; the third, for both threads, arrives only after
+  // the first two have been used for a hundred bytes
+  LazyDfa dfa(5000);
+  dfa.init(prog->Impl);
+
+  const std::string cs(100, 'c'),
+                    text("a" + cs + "b" + cs + "q");
+
+  const std::vector<SearchHit> expected{{0, 203, 0}, {101, 203, 1}};
+  SCOPE_ASSERT_EQUAL(expected, search(dfa, text, text.size()));
+  SCOPE_ASSERT_EQUAL(1u, dfa.numFlushes());
+  SCOPE_ASSERT(!dfa.gaveUp());
+}
+
+SCOPE_TEST(lazyDfaGivesUp) {
+  const auto prog(compile({"a[^q]*q", "b[^q]*q"}));
+  SCOPE_ASSERT(prog);
+
+  // room for no states at all, so the cache can never pay for itself
+  LazyDfa dfa(1);
+  dfa.init(prog->Impl);
+
+  const std::string cs(100, 'c'),
+                    text("a" + cs + "b" + cs + "q");
+
+  const std::vector<SearchHit> expected{{0, 203, 0}, {101, 203, 1}};
+  SCOPE_ASSERT_EQUAL(expected, search(dfa, text, text.size()));
+  SCOPE_ASSERT_EQUAL(1u, dfa.numFlushes());
+  SCOPE_ASSERT(dfa.gaveUp());
+
+  // a new stream gets another chance
+  dfa.reset();
+  SCOPE_ASSERT(!dfa.gaveUp());
+}
+
+SCOPE_TEST(lazyDfaRetire) {
+  const auto prog(compile({"a[^q]*q", "b[^q]*q"}));
+  SCOPE_ASSERT(prog);
+
+  LazyDfa dfa;
+  dfa.init(prog->Impl);
+
+  // the states built before the label was retired have its threads, and
+  // must not be used after
+  const std::string text("acq bcq acq bcq");
+  SCOPE_ASSERT_EQUAL(4u, search(dfa, text, text.size()).size());
+
+  std::vector<SearchHit> hits;
+  const byte* const beg = reinterpret_cast<const byte*>(text.data());
+  dfa.reset();
+  dfa.retire(0);
+  dfa.search(beg, beg + text.size(), 0, collectHit, &hits);
+  dfa.closeOut(collectHit, &hits);
+
+  const std::vector<SearchHit> expected{{4, 7, 1}, {12, 15, 1}};
+  SCOPE_ASSERT_EQUAL(expected, hits);
+
+  // the label is back after a reset
+  SCOPE_ASSERT_EQUAL(4u, search(dfa, text, text.size()).size());
+}
@@ -0,0 +1,110 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "literals.h"
+#include "parser.h"
+#include "parsetree.h"
+#include "encoders/concrete_encoders.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+  bool extract(const Pattern& pat, const Encoder& enc, RequiredLiterals& lits) {
+    ParseTree tree;
+    parseAndReduce(pat, tree);
+    return requiredLiterals(tree, enc, lits);
+  }
+
+  bool extract(const char* pat, RequiredLiterals& lits) {
+    return extract(Pattern(pat), ASCII(), lits);
+  }
+}
+
+SCOPE_TEST(requiredLiteralsFixed) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(extract("PK\\x03\\x04", lits));
+  SCOPE_ASSERT_EQUAL(std::vector<std::string>{std::string("PK\x03\x04")}, lits.Strings);
+  SCOPE_ASSERT_EQUAL(0u, lits.MaxLead);
+}
+
+SCOPE_TEST(requiredLiteralsEmail) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(!extract("[a-z0-9._]+@[a-z0-9.]+\\.(com|org|net)", lits));
+  SCOPE_ASSERT(extract("[a-z0-9._]{1,64}@[a-z0-9.]+\\.(com|org|net)", lits));
+  SCOPE_ASSERT_EQUAL(std::vector<std::string>{"@"}, lits.Strings);
+  SCOPE_ASSERT_EQUAL(64u, lits.MaxLead);
+}
+
+SCOPE_TEST(requiredLiteralsPrefersBoundedLead) {
+  // "xyz" is better but may be arbitrarily far from the start
+  RequiredLiterals lits;
+  SCOPE_ASSERT(extract("ab.*xyz", lits));
+  SCOPE_ASSERT_EQUAL(std::vector<std::string>{"ab"}, lits.Strings);
+  SCOPE_ASSERT_EQUAL(0u, lits.MaxLead);
+}
+
+SCOPE_TEST(requiredLiteralsAlternation) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(extract("x?(cat|dog)s", lits));
+  const std::vector<std::string> exp{"cats", "dogs"};
+  SCOPE_ASSERT_EQUAL(exp, lits.Strings);
+  SCOPE_ASSERT_EQUAL(1u, lits.MaxLead);
+}
+
+SCOPE_TEST(requiredLiteralsAcrossBoundary) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(extract("[0-9]{2,4}ab(cd)+", lits));
+  SCOPE_ASSERT_EQUAL(std::vector<std::string>{"abcd"}, lits.Strings);
+  SCOPE_ASSERT_EQUAL(4u, lits.MaxLead);
+}
+
+SCOPE_TEST(requiredLiteralsNone) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(!extract("[a-z]+", lits));
+  SCOPE_ASSERT(!extract("a|[0-9]", lits));
+  SCOPE_ASSERT(!extract("(abc)?d*", lits));
+}
+
+SCOPE_TEST(requiredLiteralsCaseInsensitive) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(extract(Pattern("ab", false, true), ASCII(), lits));
+  const std::vector<std::string> exp{"AB", "Ab", "aB", "ab"};
+  SCOPE_ASSERT_EQUAL(exp, lits.Strings);
+}
+
+SCOPE_TEST(requiredLiteralsEncoded) {
+  RequiredLiterals lits;
+  SCOPE_ASSERT(extract(Pattern("x.yz"), UTF16LE(), lits));
+  SCOPE_ASSERT_EQUAL(std::vector<std::string>{std::string("y\0z\0", 4)}, lits.Strings);
+  SCOPE_ASSERT_EQUAL(6u, lits.MaxLead);
+}
+
+SCOPE_TEST(requiredLiteralsMerge) {
+  RequiredLiterals a, b;
+  a.Strings = {"foo"};
+  a.MaxLead = 3;
+  b.Strings = {"bar"};
+  b.MaxLead = 7;
+  a.merge(b);
+  const std::vector<std::string> exp{"foo", "bar"};
+  SCOPE_ASSERT_EQUAL(exp, a.Strings);
+  SCOPE_ASSERT_EQUAL(7u, a.MaxLead);
+}
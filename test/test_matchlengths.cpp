@@ -0,0 +1,95 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "fsmthingy.h"
+#include "matchlengths.h"
+#include "parser.h"
+#include "parsetree.h"
+#include "pattern.h"
+
+#include <initializer_list>
+#include <vector>
+
+namespace {
+  std::vector<MatchLengths> lengths(std::initializer_list<const char*> pats, bool determinize) {
+    FSMThingy fsm(0);
+    ParseTree tree;
+
+    uint32_t label = 0;
+    for (const char* p : pats) {
+      parseAndReduce(Pattern(p), tree);
+      fsm.addPattern(tree, "ASCII", label++);
+    }
+
+    fsm.finalizeGraph(determinize);
+    return fsm.Lengths;
+  }
+}
+
+SCOPE_TEST(matchLengthsFixed) {
+  for (bool det : {false, true}) {
+    const std::vector<MatchLengths> lens(
+      lengths({"abc", "a|bcd", "x[0-9]{2,4}y"}, det)
+    );
+    SCOPE_ASSERT_EQUAL(3u, lens.size());
+    SCOPE_ASSERT(MatchLengths(3, 3) == lens[0]);
+    SCOPE_ASSERT(MatchLengths(1, 3) == lens[1]);
+    SCOPE_ASSERT(MatchLengths(4, 6) == lens[2]);
+  }
+}
+
+SCOPE_TEST(matchLengthsUnbounded) {
+  for (bool det : {false, true}) {
+    const std::vector<MatchLengths> lens(
+      lengths({"ab+c", "a*b", "(xy)+z{3}|q"}, det)
+    );
+    SCOPE_ASSERT_EQUAL(3u, lens.size());
+    SCOPE_ASSERT(MatchLengths(3, MatchLengths::UNBOUNDED) == lens[0]);
+    SCOPE_ASSERT(MatchLengths(1, MatchLengths::UNBOUNDED) == lens[1]);
+    SCOPE_ASSERT(MatchLengths(1, MatchLengths::UNBOUNDED) == lens[2]);
+  }
+}
+
+SCOPE_TEST(matchLengthsKeywords) {
+  FSMThingy fsm(0);
+  ParseTree tree;
+
+  parseAndReduce(Pattern("pin"), tree);
+  fsm.addPattern(tree, "ASCII", 1, true);
+  parseAndReduce(Pattern("needle"), tree);
+  fsm.addPattern(tree, "ASCII", 1, true);
+
+  fsm.finalizeGraph(false);
+
+  SCOPE_ASSERT_EQUAL(2u, fsm.Lengths.size());
+  SCOPE_ASSERT(fsm.Lengths[0].empty());
+  SCOPE_ASSERT(MatchLengths(3, 6) == fsm.Lengths[1]);
+}
+
+SCOPE_TEST(matchLengthsMerge) {
+  std::vector<MatchLengths> lens;
+  mergeLengths(lens, 2, MatchLengths(4, 4));
+  mergeLengths(lens, 2, MatchLengths(2, 3));
+
+  SCOPE_ASSERT_EQUAL(3u, lens.size());
+  SCOPE_ASSERT(lens[0].empty());
+  SCOPE_ASSERT(lens[1].empty());
+  SCOPE_ASSERT(MatchLengths(2, 4) == lens[2]);
+}
@@ -0,0 +1,175 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "handles.h"
+#include "parallelsearch.h"
+#include "program.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+  std::vector<SearchHit> serialHits(LG_HPROGRAM prog, const std::string& text, uint64_t startOffset) {
+    std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+      lg_create_context(prog, nullptr),
+      lg_destroy_context
+    );
+
+    std::vector<SearchHit> hits;
+    lg_search(ctx.get(), text.data(), text.data() + text.size(), startOffset, &hits, collectHit);
+    lg_closeout_search(ctx.get(), &hits, collectHit);
+    std::sort(hits.begin(), hits.end());
+    return hits;
+  }
+
+  void checkChunked(LG_HPROGRAM prog, const std::string& text, const std::vector<SearchHit>& expected) {
+    SCOPE_ASSERT_EQUAL(expected, serialHits(prog, text, 5));
+
+    const VmMaker makeVm = [prog]() {
+      std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+        lg_create_context(prog, nullptr),
+        lg_destroy_context
+      );
+      return ctx->Impl;
+    };
+
+    const byte* beg = reinterpret_cast<const byte*>(text.data());
+
+    for (uint64_t chunk : {1, 2, 3, 5, 8, 13, 64, 1000}) {
+      for (uint32_t threads : {1, 3}) {
+        std::vector<SearchHit> actual;
+        const uint64_t num = searchParallel(
+          makeVm, beg, beg + text.size(), 5, threads, chunk, collectHit, &actual
+        );
+        SCOPE_ASSERT_EQUAL(expected.size(), num);
+        SCOPE_ASSERT(expected == actual);
+      }
+    }
+  }
+
+  // big enough to be split
+  std::string bigText() {
+    std::string text;
+    for (uint32_t i = 0; text.size() < (3u << 20); ++i) {
+      text += std::to_string(i * 7919) + (i % 3 ? " abbb " : " x ");
+    }
+    return text;
+  }
+}
+
+SCOPE_TEST(searchParallelMatchesSerialOnStraddlers) {
+  // long runs straddle chunks, and chains of hits move when an earlier
+  // chunk's hit runs into them
+  auto prog = compile({"a+", "[0-9]{4}", "aba", "(ab)+a", "b?a{2,3}"});
+  SCOPE_ASSERT(prog);
+  checkChunked(prog.get(), "aaaaaaab 0123456 abababa baaab a 12 ababa", {
+    {5, 8, 4}, {5, 12, 0}, {8, 11, 4}, {14, 18, 1}, {22, 23, 0},
+    {22, 25, 2}, {22, 29, 3}, {24, 25, 0}, {26, 27, 0}, {26, 29, 2},
+    {28, 29, 0}, {30, 34, 4}, {31, 34, 0}, {36, 37, 0}, {41, 42, 0},
+    {41, 44, 2}, {41, 46, 3}, {43, 44, 0}, {45, 46, 0}
+  });
+}
+
+SCOPE_TEST(searchParallelMatchesSerialOnLongMatches) {
+  // hits many chunks long, some not found until well past their chunk
+  auto prog = compile({"a[^z]*b", "c[abc]+z", "zz"});
+  SCOPE_ASSERT(prog);
+  checkChunked(prog.get(), "acbcab zz caaaaabbbbcz azzb cabz aaaa", {
+    {5, 11, 0}, {12, 14, 2}, {15, 27, 1}, {16, 25, 0}, {29, 31, 2},
+    {33, 37, 1}, {34, 36, 0}
+  });
+}
+
+SCOPE_TEST(searchParallelMatchesSerialAcrossLabels) {
+  // the labels share the a+ loop and its CHECK_HALT, so one label's thread
+  // can hold the lock against another's, with the seam anywhere in the run;
+  // a+ba's chain at the end has to be searched again
+  auto prog = compile({"a+b", "a+c", "[ab]+c", "b", "a+ba"});
+  SCOPE_ASSERT(prog);
+  SCOPE_ASSERT(prog->Impl->NumChecked > 0);
+  checkChunked(prog.get(), "aaaab aaac abaac baaaaac bb aaaaaaaab aabababa", {
+    {5, 10, 0}, {9, 10, 3}, {11, 15, 1}, {11, 15, 2}, {16, 18, 0},
+    {16, 19, 4}, {16, 21, 2}, {17, 18, 3}, {18, 21, 1}, {22, 23, 3},
+    {22, 29, 2}, {23, 29, 1}, {30, 31, 3}, {31, 32, 3}, {33, 42, 0},
+    {41, 42, 3}, {43, 46, 0}, {43, 47, 4}, {45, 46, 3}, {46, 48, 0},
+    {47, 48, 3}, {48, 50, 0}, {48, 51, 4}, {49, 50, 3}
+  });
+}
+
+SCOPE_TEST(searchParallelNoChunks) {
+  auto prog = compile({"a"});
+  SCOPE_ASSERT(prog);
+
+  std::vector<SearchHit> actual;
+  SCOPE_ASSERT_EQUAL(0u, lg_search_parallel(prog.get(), nullptr, "", "", 0, 4, &actual, collectHit));
+  SCOPE_ASSERT(actual.empty());
+}
+
+SCOPE_TEST(testLgSearchParallel) {
+  auto prog = compile({"[0-9]{4}", "ab+", "b+ 1"});
+  SCOPE_ASSERT(prog);
+
+  const std::string text(bigText());
+
+  const std::vector<SearchHit> expected(serialHits(prog.get(), text, 5));
+
+  std::vector<SearchHit> actual;
+  const uint64_t num = lg_search_parallel(
+    prog.get(), nullptr, text.data(), text.data() + text.size(), 5, 4,
+    &actual, collectHit
+  );
+  SCOPE_ASSERT_EQUAL(expected.size(), num);
+  SCOPE_ASSERT(expected == actual);
+}
+
+SCOPE_TEST(testLgSearchParallelFile) {
+  auto prog = compile({"[0-9]{4}", "ab+", "b+ 1"});
+  SCOPE_ASSERT(prog);
+
+  const std::string text(bigText());
+
+  const char path[] = "test_parallelsearch.tmp";
+  std::FILE* f = std::fopen(path, "wb");
+  SCOPE_ASSERT(f);
+  SCOPE_ASSERT_EQUAL(text.size(), std::fwrite(text.data(), 1, text.size(), f));
+  std::fclose(f);
+
+  const std::vector<SearchHit> expected(serialHits(prog.get(), text, 0));
+
+  std::vector<SearchHit> actual;
+  const uint64_t num = lg_search_parallel_file(
+    prog.get(), nullptr, path, 4, &actual, collectHit
+  );
+  std::remove(path);
+  SCOPE_ASSERT_EQUAL(expected.size(), num);
+  SCOPE_ASSERT(expected == actual);
+
+  // a file which isn't there has no hits
+  actual.clear();
+  SCOPE_ASSERT_EQUAL(0u, lg_search_parallel_file(prog.get(), nullptr, path, 4, &actual, collectHit));
+  SCOPE_ASSERT(actual.empty());
+}
@@ -0,0 +1,118 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <scope/test.h>
+
+#include "patternmap.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+SCOPE_TEST(testPatternMapAdd) {
+  PatternMap pmap(1);
+  pmap.addPattern("foo", "UTF-8");
+  pmap.addPattern("foo", "UTF-16LE");
+  pmap.addPattern("bar", "UTF-8");
+
+  SCOPE_ASSERT_EQUAL(3u, pmap.size());
+  SCOPE_ASSERT_EQUAL(std::string("foo"), pmap.info(1).Pattern);
+  SCOPE_ASSERT_EQUAL(std::string("UTF-16LE"), pmap.info(1).EncodingChain);
+  SCOPE_ASSERT_EQUAL(std::string("bar"), pmap.info(2).Pattern);
+  SCOPE_ASSERT(!pmap.info(2).UserData);
+
+  // repeats are stored once
+  SCOPE_ASSERT_EQUAL(pmap.info(0).Pattern, pmap.info(1).Pattern);
+  SCOPE_ASSERT_EQUAL(pmap.info(0).EncodingChain, pmap.info(2).EncodingChain);
+}
+
+SCOPE_TEST(testPatternMapStringsStayPut) {
+  PatternMap pmap(0);
+  pmap.addPattern("first", "ASCII");
+  const char* first = pmap.info(0).Pattern;
+
+  // enough to fill several blocks, with one too big for any
+  for (uint32_t i = 0; i < 20000; ++i) {
+    pmap.addPattern(("p" + std::to_string(i)).c_str(), "ASCII");
+  }
+  pmap.addPattern(std::string(100000, 'x').c_str(), "ASCII");
+
+  SCOPE_ASSERT_EQUAL(first, pmap.info(0).Pattern);
+  SCOPE_ASSERT_EQUAL(std::string("first"), first);
+  SCOPE_ASSERT_EQUAL(std::string("p19999"), pmap.info(20000).Pattern);
+  SCOPE_ASSERT_EQUAL(100000u, std::strlen(pmap.info(20001).Pattern));
+}
+
+SCOPE_TEST(testPatternMapSerialization) {
+  PatternMap pmap(0);
+  pmap.addPattern("a+b", "ASCII");
+  pmap.addPattern("a+b", "UTF-8");
+  pmap.addPattern("", "ASCII");
+  pmap.info(2).UserData = reinterpret_cast<void*>(7);
+
+  const std::string buf = pmap.marshall();
+  std::unique_ptr<PatternMap> read(PatternMap::unmarshallInPlace(
+    reinterpret_cast<const byte*>(buf.data()), buf.size(), nullptr
+  ));
+
+  SCOPE_ASSERT_EQUAL(3u, read->size());
+  for (uint32_t i = 0; i < 3; ++i) {
+    SCOPE_ASSERT_EQUAL(std::string(pmap.pattern(i)), read->info(i).Pattern);
+    SCOPE_ASSERT_EQUAL(std::string(pmap.chain(i)), read->info(i).EncodingChain);
+    SCOPE_ASSERT_EQUAL(pmap.info(i).UserData, read->info(i).UserData);
+  }
+
+  // the strings are used where they lie, and shared ones once
+  SCOPE_ASSERT(buf.data() <= read->info(1).Pattern && read->info(1).Pattern < buf.data() + buf.size());
+  SCOPE_ASSERT_EQUAL(read->info(0).Pattern, read->info(1).Pattern);
+
+  // and more can be added
+  read->addPattern("c", "ASCII");
+  SCOPE_ASSERT_EQUAL(4u, read->size());
+  SCOPE_ASSERT_EQUAL(std::string("c"), read->info(3).Pattern);
+  SCOPE_ASSERT_EQUAL(std::string("a+b"), read->info(1).Pattern);
+}
+
+SCOPE_TEST(testPatternMapMalformed) {
+  PatternMap pmap(0);
+  pmap.addPattern("abc", "ASCII");
+  const std::string good = pmap.marshall();
+
+  const auto read = [](const std::string& buf) {
+    return PatternMap::unmarshallInPlace(
+      reinterpret_cast<const byte*>(buf.data()), buf.size(), nullptr
+    );
+  };
+
+  // cut short
+  SCOPE_EXPECT(read(good.substr(0, good.size() - 1)), std::runtime_error);
+  SCOPE_EXPECT(read(good.substr(0, 8)), std::runtime_error);
+
+  // strings not ending in a NUL
+  std::string buf(good);
+  buf[buf.size() - 1] = 'x';
+  SCOPE_EXPECT(read(buf), std::runtime_error);
+
+  // an offset past the strings, for the pattern or the chain, is caught
+  // on reading, not when the pattern's info is asked for
+  const uint64_t off = 1000;
+  for (size_t pos : {16, 24}) {
+    buf = good;
+    std::memcpy(&buf[pos], &off, sizeof(off));
+    SCOPE_EXPECT(read(buf), std::runtime_error);
+  }
+}
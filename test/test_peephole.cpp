@@ -0,0 +1,173 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "test_helper.h"
+#include "compiler.h"
+#include "fsmthingy.h"
+#include "parser.h"
+#include "parsetree.h"
+#include "peephole.h"
+#include "program.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+  uint32_t target(const Program& prog, uint32_t pc) {
+    return *reinterpret_cast<const uint32_t*>(&prog[pc + 1]);
+  }
+}
+
+SCOPE_TEST(peepholeRemovesCodeJumpTablesSkip) {
+  NFA fsm(9);
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(0, 2, fsm, fsm.TransFac->getByte('b'));
+  edge(0, 3, fsm, fsm.TransFac->getByte('c'));
+  edge(0, 4, fsm, fsm.TransFac->getByte('d'));
+  edge(1, 5, fsm, fsm.TransFac->getByte('w'));
+  edge(2, 6, fsm, fsm.TransFac->getByte('x'));
+  edge(3, 7, fsm, fsm.TransFac->getByte('y'));
+  edge(4, 8, fsm, fsm.TransFac->getByte('z'));
+
+  for (uint32_t i = 5; i < 9; ++i) {
+    fsm[i].Label = i - 5;
+    fsm[i].IsMatch = true;
+  }
+
+  ProgramPtr p = Compiler::createProgram(fsm);
+  Program& prog(*p);
+
+  // the table lands past 'a' through 'd', so nothing runs them
+  SCOPE_ASSERT_EQUAL(27u, prog.size());
+  optimizeCode(prog);
+  SCOPE_ASSERT_EQUAL(23u, prog.size());
+
+  SCOPE_ASSERT_EQUAL(Instruction::makeJumpTableRange('a', 'd'), prog[0]);
+  SCOPE_ASSERT_EQUAL(5u, target(prog, 0));
+  SCOPE_ASSERT_EQUAL(9u, target(prog, 1));
+  SCOPE_ASSERT_EQUAL(13u, target(prog, 2));
+  SCOPE_ASSERT_EQUAL(17u, target(prog, 3));
+
+  for (uint32_t i = 0; i < 4; ++i) {
+    SCOPE_ASSERT_EQUAL(Instruction::makeByte('w' + i), prog[5 + 4*i]);
+    SCOPE_ASSERT_EQUAL(Instruction::makeLabel(i), prog[6 + 4*i]);
+    SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[7 + 4*i]);
+    SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[8 + 4*i]);
+  }
+
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[21]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[22]);
+}
+
+SCOPE_TEST(peepholeThreadsJumps) {
+  Program prog(13, Instruction());
+  prog[0] = Instruction::makeFork(&prog[0], 5);
+  prog[2] = Instruction::makeByte('a');
+  prog[3] = Instruction::makeJump(&prog[3], 5);
+  prog[5] = Instruction::makeJump(&prog[5], 8);
+  prog[7] = Instruction::makeByte('x');
+  prog[8] = Instruction::makeByte('b');
+  prog[9] = Instruction::makeMatch();
+  prog[10] = Instruction::makeFinish();
+  prog[11] = Instruction::makeHalt();
+  prog[12] = Instruction::makeFinish();
+
+  optimizeCode(prog);
+
+  // the fork goes straight to 'b', the jumps are left with nowhere to
+  // go but the next instruction, and 'x' is unreachable
+  SCOPE_ASSERT_EQUAL(8u, prog.size());
+  SCOPE_ASSERT_EQUAL(FORK_OP, prog[0].OpCode);
+  SCOPE_ASSERT_EQUAL(3u, target(prog, 0));
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('a'), prog[2]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[3]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[4]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[5]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[6]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[7]);
+}
+
+SCOPE_TEST(peepholeLeavesTightCodeAlone) {
+  NFA fsm(4);
+  edge(0, 1, fsm, fsm.TransFac->getByte('a')); // ac|bc
+  edge(0, 2, fsm, fsm.TransFac->getByte('b'));
+  edge(1, 3, fsm, fsm.TransFac->getByte('c'));
+  edge(2, 3, fsm, fsm.TransFac->getByte('c'));
+
+  ProgramPtr p = Compiler::createProgram(fsm);
+  const Program expected(*p);
+
+  optimizeCode(*p);
+  SCOPE_ASSERT(expected == *p);
+}
+
+SCOPE_TEST(peepholeEmptyProgram) {
+  // a program of nothing but keywords has no code at all
+  Program prog;
+  optimizeCode(prog);
+  SCOPE_ASSERT(prog.empty());
+}
+
+SCOPE_TEST(peepholeKeepsHits) {
+  // the code the pass leaves must find what the compiler's did, on every
+  // engine which runs it
+  const std::string text("the cat sat on 12 mats; ab1 abb22 cattle, scattered acat 900");
+  bool shrunk = false;
+
+  for (const auto& pats : {
+    makePatterns({"cat", "ca.", "[a-z]+t", "ab+[0-9]{1,2}"}),
+    makePatterns({"(the|on) ", "s?cat(tle|tered)?", "[0-9]+", "a[a-z]*t"})
+  }) {
+    for (bool determinize : {false, true}) {
+      FSMThingy fsm(16);
+      ParseTree tree;
+      for (uint32_t i = 0; i < pats.size(); ++i) {
+        SCOPE_ASSERT(parse(pats[i], tree));
+        fsm.addPattern(tree, pats[i].Encoding.c_str(), i);
+      }
+      fsm.finalizeGraph(determinize);
+
+      ProgramPtr p = Compiler::createProgram(*fsm.Fsm, determinize);
+      ProgramPtr opt(new Program(*p));
+      optimizeCode(*opt);
+      shrunk |= opt->size() < p->size();
+
+      for (bool lazy : {false, true}) {
+        for (bool filter : {false, true}) {
+          std::shared_ptr<VmInterface> expected(VmInterface::create(lazy)),
+                                       actual(VmInterface::create(lazy));
+          expected->setSkipScan(filter);
+          expected->setPrefilter(filter);
+          actual->setSkipScan(filter);
+          actual->setPrefilter(filter);
+          expected->init(p);
+          actual->init(opt);
+
+          const std::vector<SearchHit> hits(search(*expected, text, 7));
+          SCOPE_ASSERT(!hits.empty());
+          SCOPE_ASSERT(hits == search(*actual, text, 7));
+        }
+      }
+    }
+  }
+
+  SCOPE_ASSERT(shrunk);
+}
@@ -0,0 +1,129 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "prefilter.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+  const byte* naiveNext(const std::vector<std::string>& lits, const byte* beg, const byte* end) {
+    for ( ; beg < end; ++beg) {
+      for (const std::string& s : lits) {
+        if (s.size() <= size_t(end - beg) && !std::memcmp(beg, s.data(), s.size())) {
+          return beg;
+        }
+      }
+    }
+    return end;
+  }
+
+  void checkAllOffsets(const RequiredLiterals& lits, const std::string& text) {
+    const Prefilter simd(lits), scalar(lits, false);
+    const byte* const beg = reinterpret_cast<const byte*>(text.data());
+    const byte* const end = beg + text.size();
+    for (const byte* cur = beg; cur <= end; ++cur) {
+      const byte* const exp = naiveNext(lits.Strings, cur, end);
+      SCOPE_ASSERT_EQUAL(exp - beg, simd.next(cur, end) - beg);
+      SCOPE_ASSERT_EQUAL(exp - beg, scalar.next(cur, end) - beg);
+    }
+  }
+}
+
+SCOPE_TEST(prefilterEmpty) {
+  const Prefilter f(RequiredLiterals{});
+  const byte buf[] = "abc";
+  SCOPE_ASSERT(f.empty());
+  SCOPE_ASSERT_EQUAL(buf + 3, f.next(buf, buf + 3));
+}
+
+SCOPE_TEST(prefilterOnlyWholeLiterals) {
+  RequiredLiterals lits;
+  lits.Strings = {"abcdef", "xy"};
+  const Prefilter f(lits);
+
+  const std::string text("..abcde..xy..abc");
+  const byte* const beg = reinterpret_cast<const byte*>(text.data());
+  SCOPE_ASSERT_EQUAL(9, f.next(beg, beg + text.size()) - beg);
+  SCOPE_ASSERT_EQUAL(16, f.next(beg + 10, beg + text.size()) - beg);
+  SCOPE_ASSERT_EQUAL(6u, f.maxLength());
+}
+
+SCOPE_TEST(prefilterTeddy) {
+  RequiredLiterals lits;
+  lits.Strings = {"cat", "dog", "\x80\xff"};
+  SCOPE_ASSERT(Prefilter::PAIRS != Prefilter(lits).kernel());
+
+  // across the 16- and 32-byte boundaries, and a partial one at the end
+  const std::string text(std::string(14, '.') + "cat" + std::string(14, '.') + "\x80\xff...dogdo");
+  const byte* const beg = reinterpret_cast<const byte*>(text.data());
+  const byte* const end = beg + text.size();
+
+  const Prefilter f(lits);
+  SCOPE_ASSERT_EQUAL(14, f.next(beg, end) - beg);
+  SCOPE_ASSERT_EQUAL(31, f.next(beg + 15, end) - beg);
+  SCOPE_ASSERT_EQUAL(36, f.next(beg + 32, end) - beg);
+  SCOPE_ASSERT_EQUAL(41, f.next(beg + 37, end) - beg);
+
+  checkAllOffsets(lits, text);
+}
+
+SCOPE_TEST(prefilterPairs) {
+  // too many for Teddy's buckets
+  RequiredLiterals lits;
+  for (uint32_t i = 0; i < 200; ++i) {
+    lits.Strings.push_back(std::string("n") + char('0' + i / 100) + char('0' + i / 10 % 10) + char('0' + i % 10));
+  }
+  SCOPE_ASSERT_EQUAL(Prefilter::PAIRS, Prefilter(lits).kernel());
+
+  const std::string text("n04 n042 xn19 n1999 n200");
+  const byte* const beg = reinterpret_cast<const byte*>(text.data());
+  const byte* const end = beg + text.size();
+
+  const Prefilter f(lits);
+  SCOPE_ASSERT_EQUAL(4, f.next(beg, end) - beg);
+  SCOPE_ASSERT_EQUAL(14, f.next(beg + 5, end) - beg);
+  SCOPE_ASSERT_EQUAL(24, f.next(beg + 15, end) - beg);
+
+  checkAllOffsets(lits, text);
+}
+
+SCOPE_TEST(prefilterSearchHits) {
+  const auto prog(compile({"x?(cat|dog)s", "[0-9]{2,4}q(cd)+", "z.{0,5}zz", "bad"}));
+  SCOPE_ASSERT(prog);
+
+  const std::string text("9912qcdcd.cats..zxyzzz.bad xdogs ba");
+  const std::vector<SearchHit> expected{
+    {0, 9, 1}, {10, 14, 0}, {16, 22, 2}, {23, 26, 3}, {27, 32, 0}
+  };
+
+  LG_ContextOptions noPrefilter{}, prefilter{};
+  noPrefilter.NoPrefilter = 1;
+
+  for (size_t block : {1u, 7u, 35u}) {
+    SCOPE_ASSERT_EQUAL(expected, search(prog.get(), &noPrefilter, text, block));
+    SCOPE_ASSERT_EQUAL(expected, search(prog.get(), &prefilter, text, block));
+  }
+}
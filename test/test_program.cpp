@@ -18,26 +18,219 @@
 
 #include <scope/test.h>
 
+#include "codegen.h"
+#include "container.h"
 #include "program.h"
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
 ProgramPtr makeProgram() {
   ProgramPtr p1(new Program());
   p1->push_back(Instruction::makeByte('a'));
   p1->push_back(Instruction::makeLabel(0));
   p1->push_back(Instruction::makeMatch());
+  p1->push_back(Instruction::makeHalt());
+  p1->push_back(Instruction::makeFinish());
   p1->First.set('a');
   return p1;
 }
 
+ProgramPtr makeTableProgram() {
+  ProgramPtr p1(makeProgram());
+
+  DfaTable& tbl(p1->Table);
+  std::fill(tbl.Classes, tbl.Classes + 256, 0);
+  tbl.Classes['a'] = 1;
+  tbl.NumClasses = 2;
+  tbl.Next = std::vector<uint32_t>{DfaTable::DEAD, DfaTable::LIST, DfaTable::DEAD, DfaTable::DEAD};
+  tbl.States.push_back({NONE, NONE, false, false, false});
+  tbl.States.push_back({0, NONE, true, true, false});
+  tbl.Lists = std::vector<uint32_t>{2, 1, 1 | DfaTable::NOCHECK};
+  return p1;
+}
+
+// changes the bytes of a section and fixes up the checksum, as someone
+// crafting a file would
+void tamper(std::string& buf, ContainerSection id, size_t off, const void* val, size_t len) {
+  const ContainerReader in(buf.data(), buf.size());
+  const size_t pos = reinterpret_cast<const char*>(in.find(id).first) - buf.data();
+  std::memcpy(&buf[pos + off], val, len);
+
+  const uint64_t sum = checksum(buf.data() + 32, buf.size() - 32);
+  std::memcpy(&buf[24], &sum, sizeof(sum));
+}
+
 SCOPE_TEST(testProgramBufSize) {
   ProgramPtr p1(makeProgram());
-  SCOPE_ASSERT_EQUAL(48, p1->bufSize());
+  // the header and directory of nine sections, padded to 256 bytes; the
+  // info and the instructions, padded to 64 each; and the empty keyword
+  // automaton and match lengths, taking no room
+  SCOPE_ASSERT_EQUAL(384, p1->bufSize());
+  SCOPE_ASSERT_EQUAL(384u, p1->marshall().size());
 }
 
 SCOPE_TEST(testProgramSerialization) {
   ProgramPtr  p1(makeProgram());
+  p1->Lengths.emplace_back(1, 1);
   std::string buf = p1->marshall();
   ProgramPtr p2 = Program::unmarshall(buf);
   SCOPE_ASSERT(p2);
   SCOPE_ASSERT(*p1 == *p2);
 }
+
+SCOPE_TEST(testProgramUnmarshallInPlace) {
+  ProgramPtr p1(makeProgram());
+  p1->Lengths.emplace_back(1, 1);
+  const std::string buf = p1->marshall();
+
+  ProgramPtr p2 = Program::unmarshallInPlace(buf.data(), buf.size(), nullptr);
+  SCOPE_ASSERT(*p1 == *p2);
+  SCOPE_ASSERT(p2->borrowed());
+  SCOPE_ASSERT_EQUAL(buf.data() + 320, reinterpret_cast<const char*>(p2->data()));
+
+  // changing it takes a copy first
+  p2->push_back(Instruction::makeMatch());
+  SCOPE_ASSERT(!p2->borrowed());
+  SCOPE_ASSERT_EQUAL(6u, p2->size());
+  SCOPE_ASSERT(*p1 == *Program::unmarshall(buf));
+}
+
+SCOPE_TEST(testProgramSerializesTableAndLiterals) {
+  ProgramPtr p1(makeProgram());
+
+  DfaTable& tbl(p1->Table);
+  std::fill(tbl.Classes, tbl.Classes + 256, 0);
+  tbl.Classes['a'] = 1;
+  tbl.NumClasses = 2;
+  tbl.Next = std::vector<uint32_t>{DfaTable::DEAD, 1, DfaTable::DEAD, DfaTable::DEAD};
+  tbl.States.push_back({NONE, NONE, false, false, false});
+  tbl.States.push_back({0, NONE, true, true, false});
+
+  p1->Literals.Strings = {"a", "bc"};
+  p1->Literals.MaxLead = 3;
+
+  const std::string buf = p1->marshall();
+  SCOPE_ASSERT_EQUAL(size_t(p1->bufSize()), buf.size());
+
+  ProgramPtr p2 = Program::unmarshall(buf);
+  SCOPE_ASSERT(*p1 == *p2);
+  SCOPE_ASSERT(p1->Literals == p2->Literals);
+  SCOPE_ASSERT_EQUAL(0, std::memcmp(tbl.Classes, p2->Table.Classes, 256));
+  SCOPE_ASSERT_EQUAL(2u, p2->Table.NumClasses);
+  SCOPE_ASSERT(tbl.Next == p2->Table.Next);
+  SCOPE_ASSERT_EQUAL(2u, p2->Table.States.size());
+  SCOPE_ASSERT_EQUAL(0u, p2->Table.States[1].Label);
+  SCOPE_ASSERT(p2->Table.States[1].Match && p2->Table.States[1].Terminal);
+  SCOPE_ASSERT(!p2->Table.States[0].Match);
+  SCOPE_ASSERT(p2->Table.Lists.empty());
+}
+
+SCOPE_TEST(testProgramUnmarshallRejectsCorruption) {
+  std::string buf = makeProgram()->marshall();
+  buf[330] ^= 1;
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+}
+
+SCOPE_TEST(testProgramUnmarshallRejectsBadTable) {
+  const std::string good = makeTableProgram()->marshall();
+  SCOPE_ASSERT(Program::unmarshall(good));
+
+  // a byte in a class past the last
+  std::string buf(good);
+  const byte cls = 2;
+  tamper(buf, TABLE_INFO_SECTION, 'b', &cls, sizeof(cls));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+
+  // a transition to a state past the last
+  buf = good;
+  const uint32_t state = 2;
+  tamper(buf, TABLE_NEXT_SECTION, 0, &state, sizeof(state));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+
+  // a list running past the end
+  buf = good;
+  const uint32_t len = 3;
+  tamper(buf, TABLE_LISTS_SECTION, 0, &len, sizeof(len));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+
+  // a list with a state past the last
+  buf = good;
+  tamper(buf, TABLE_LISTS_SECTION, 2 * sizeof(uint32_t), &state, sizeof(state));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+
+  // a list past the end of the lists
+  buf = good;
+  const uint32_t list = DfaTable::LIST | 3;
+  tamper(buf, TABLE_NEXT_SECTION, sizeof(uint32_t), &list, sizeof(list));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+}
+
+SCOPE_TEST(testProgramUnmarshallRejectsBadCode) {
+  // a jump over a byte, then the usual tail
+  ProgramPtr p1(new Program());
+  p1->resize(2);
+  (*p1)[0] = Instruction::makeJump(&(*p1)[0], 3);
+  p1->push_back(Instruction::makeByte('a'));
+  p1->push_back(Instruction::makeMatch());
+  p1->push_back(Instruction::makeHalt());
+  p1->push_back(Instruction::makeFinish());
+
+  const std::string good = p1->marshall();
+  SCOPE_ASSERT(*p1 == *Program::unmarshall(good));
+
+  // a jump past the end
+  std::string buf(good);
+  uint32_t addr = 6;
+  tamper(buf, CODE_SECTION, sizeof(Instruction), &addr, sizeof(addr));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+
+  // a jump into the middle of itself
+  buf = good;
+  addr = 1;
+  tamper(buf, CODE_SECTION, sizeof(Instruction), &addr, sizeof(addr));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+
+  // no halt before the finish
+  buf = good;
+  const Instruction byte = Instruction::makeByte('a');
+  tamper(buf, CODE_SECTION, 4 * sizeof(Instruction), &byte, sizeof(byte));
+  SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+}
+
+SCOPE_TEST(testProgramUnmarshallRejectsBadKeywords) {
+  ProgramPtr p1(makeProgram());
+  AhoCorasick& ac(p1->Keywords);
+  ac.build({{"ab", 0}, {"b", 1}});
+
+  const std::string good = p1->marshall();
+  SCOPE_ASSERT(*p1 == *Program::unmarshall(good));
+
+  const uint32_t a = ac.child(0, 'a'),
+                 ab = ac.child(a, 'b'),
+                 n = ac.Base.size();
+
+  const auto expectBad = [&](ContainerSection id, size_t off, uint32_t val) {
+    std::string buf(good);
+    tamper(buf, id, off, &val, sizeof(val));
+    SCOPE_EXPECT(Program::unmarshall(buf), std::runtime_error);
+  };
+
+  // a child of a state past the end
+  expectBad(KEYWORD_CHECK_SECTION, a * sizeof(uint32_t), n);
+  // a child at the wrong depth
+  expectBad(KEYWORD_DEPTH_SECTION, ab * sizeof(uint32_t), 1);
+  // a base with no room for every byte after it
+  expectBad(KEYWORD_BASE_SECTION, 0, n - 255);
+  // a failure link to a deeper state
+  expectBad(KEYWORD_FAIL_SECTION, a * sizeof(uint32_t), ab);
+  // a failure link past the end
+  expectBad(KEYWORD_FAIL_SECTION, ab * sizeof(uint32_t), n);
+  // outputs past the last
+  expectBad(KEYWORD_OUT_SECTION, ab * sizeof(uint32_t), ac.Outputs.size());
+  // an output with a label past the last
+  expectBad(KEYWORD_OUTPUTS_SECTION, 0, 2);
+  // outputs in a loop
+  expectBad(KEYWORD_OUTPUTS_SECTION, 2 * sizeof(uint32_t), 0);
+}
@@ -0,0 +1,152 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <scope/test.h>
+
+#include "programcache.h"
+
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+  const char* ENCS[] = {"ASCII", "UTF-8"};
+  const LG_KeyOptions KEY_OPTS{0, 0};
+  const LG_ProgramOptions PROG_OPTS{1};
+
+  struct Cached {
+    int Result;
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> Prog;
+    std::unique_ptr<PatternMapHandle,void(*)(PatternMapHandle*)> PMap;
+    LG_Error* Err;
+
+    Cached(const char* patterns):
+      Result(0),
+      Prog(nullptr, lg_destroy_program),
+      PMap(nullptr, lg_destroy_pattern_map),
+      Err(nullptr)
+    {
+      LG_HPROGRAM prog;
+      LG_HPATTERNMAP pmap;
+      Result = lg_cached_program(
+        ".", patterns, ENCS, 2, &KEY_OPTS, &PROG_OPTS, &prog, &pmap, &Err
+      );
+      Prog.reset(prog);
+      PMap.reset(pmap);
+    }
+
+    ~Cached() {
+      lg_free_error(Err);
+    }
+  };
+
+  std::string cachePath(const char* patterns) {
+    char name[37];
+    lg_program_cache_file(patterns, ENCS, 2, &KEY_OPTS, &PROG_OPTS, name);
+    SCOPE_ASSERT_EQUAL(programCacheKey(patterns, ENCS, 2, KEY_OPTS, PROG_OPTS) + ".lgp", name);
+    return std::string("./") + name;
+  }
+}
+
+SCOPE_TEST(testProgramCacheKey) {
+  const std::string key(programCacheKey("a+b\n", ENCS, 2, KEY_OPTS, PROG_OPTS));
+  SCOPE_ASSERT_EQUAL(32u, key.size());
+  SCOPE_ASSERT_EQUAL(key, programCacheKey("a+b\n", ENCS, 2, KEY_OPTS, PROG_OPTS));
+
+  // everything counts
+  SCOPE_ASSERT(key != programCacheKey("a+c\n", ENCS, 2, KEY_OPTS, PROG_OPTS));
+  SCOPE_ASSERT(key != programCacheKey("a+b\n", ENCS, 1, KEY_OPTS, PROG_OPTS));
+
+  const LG_KeyOptions ci{0, 1};
+  SCOPE_ASSERT(key != programCacheKey("a+b\n", ENCS, 2, ci, PROG_OPTS));
+
+  const LG_ProgramOptions nfa{0};
+  SCOPE_ASSERT(key != programCacheKey("a+b\n", ENCS, 2, KEY_OPTS, nfa));
+
+  // and the fields don't run together
+  const char* joined[] = {"ASCIIUTF-8"};
+  SCOPE_ASSERT(key != programCacheKey("a+b\n", joined, 1, KEY_OPTS, PROG_OPTS));
+}
+
+SCOPE_TEST(testProgramCacheStoresAndReuses) {
+  const char pats[] = "a+b\nxyz\tASCII\n";
+  const std::string path(cachePath(pats));
+  std::remove(path.c_str());
+
+  const std::string text("aab xyz");
+
+  Cached first(pats);
+  SCOPE_ASSERT_EQUAL(0, first.Result);
+  SCOPE_ASSERT(!first.Err);
+
+  Cached second(pats);
+  std::remove(path.c_str());
+  SCOPE_ASSERT_EQUAL(1, second.Result);
+  SCOPE_ASSERT(!second.Err);
+
+  const std::vector<SearchHit> hits(search(second.Prog.get(), nullptr, text, text.size()));
+  SCOPE_ASSERT_EQUAL(search(first.Prog.get(), nullptr, text, text.size()), hits);
+  SCOPE_ASSERT_EQUAL(3u, hits.size());
+
+  SCOPE_ASSERT_EQUAL(3, lg_pattern_map_size(second.PMap.get()));
+  for (int i = 0; i < 3; ++i) {
+    const LG_PatternInfo* exp = lg_pattern_info(first.PMap.get(), i);
+    const LG_PatternInfo* act = lg_pattern_info(second.PMap.get(), i);
+    SCOPE_ASSERT_EQUAL(std::string(exp->Pattern), act->Pattern);
+    SCOPE_ASSERT_EQUAL(std::string(exp->EncodingChain), act->EncodingChain);
+    // the line numbers
+    SCOPE_ASSERT_EQUAL(exp->UserData, act->UserData);
+  }
+}
+
+SCOPE_TEST(testProgramCacheReplacesBadFiles) {
+  const char pats[] = "q+r\n";
+  const std::string path(cachePath(pats));
+
+  std::FILE* f = std::fopen(path.c_str(), "wb");
+  SCOPE_ASSERT(f);
+  std::fputs("not a program", f);
+  std::fclose(f);
+
+  Cached first(pats);
+  SCOPE_ASSERT_EQUAL(0, first.Result);
+  SCOPE_ASSERT(first.Prog);
+
+  Cached second(pats);
+  std::remove(path.c_str());
+  SCOPE_ASSERT_EQUAL(1, second.Result);
+}
+
+SCOPE_TEST(testProgramCacheSkipsErrors) {
+  const char pats[] = "a+b\nfoo\tBOGUS\n";
+  const std::string path(cachePath(pats));
+  std::remove(path.c_str());
+
+  for (int i = 0; i < 2; ++i) {
+    Cached c(pats);
+    SCOPE_ASSERT_EQUAL(0, c.Result);
+    SCOPE_ASSERT(c.Prog);
+    SCOPE_ASSERT(c.Err);
+    SCOPE_ASSERT_EQUAL(1, c.Err->Index);
+  }
+
+  SCOPE_ASSERT(!std::fopen(path.c_str(), "rb"));
+}
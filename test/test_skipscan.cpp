@@ -0,0 +1,140 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "skipscan.h"
+#include "stest.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+  const byte* naiveNext(const ByteSet& set, const byte* beg, const byte* end) {
+    for ( ; beg < end && !set[*beg]; ++beg) ;
+    return beg;
+  }
+
+  void checkAllOffsets(const ByteSet& set, const std::vector<byte>& buf) {
+    const SkipScanner simd(set), scalar(set, false);
+    const byte* const end = &buf[0] + buf.size();
+    for (const byte* cur = &buf[0]; cur <= end; ++cur) {
+      const byte* const exp = naiveNext(set, cur, end);
+      SCOPE_ASSERT_EQUAL(exp - &buf[0], simd.next(cur, end) - &buf[0]);
+      SCOPE_ASSERT_EQUAL(exp - &buf[0], scalar.next(cur, end) - &buf[0]);
+    }
+  }
+}
+
+SCOPE_TEST(skipScanEmptySet) {
+  const ByteSet set;
+  const SkipScanner s(set);
+  const byte buf[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  SCOPE_ASSERT_EQUAL(SkipScanner::NONE, s.kernel());
+  SCOPE_ASSERT_EQUAL(buf + 36, s.next(buf, buf + 36));
+}
+
+SCOPE_TEST(skipScanFullSet) {
+  ByteSet set;
+  set.set();
+  const SkipScanner s(set);
+  const byte buf[] = "abc";
+  SCOPE_ASSERT_EQUAL(SkipScanner::ALL, s.kernel());
+  SCOPE_ASSERT(!s.worthwhile());
+  SCOPE_ASSERT_EQUAL(buf + 1, s.next(buf + 1, buf + 3));
+}
+
+SCOPE_TEST(skipScanSingleByte) {
+  const ByteSet set('q');
+  const SkipScanner s(set);
+  const byte buf[] = "abcdefghijklmnopqrstuvwxyz";
+  SCOPE_ASSERT_EQUAL(SkipScanner::MEMCHR, s.kernel());
+  SCOPE_ASSERT_EQUAL(buf + 16, s.next(buf, buf + 26));
+  SCOPE_ASSERT_EQUAL(buf + 26, s.next(buf + 17, buf + 26));
+}
+
+SCOPE_TEST(skipScanNibbleEdges) {
+  // every high nibble and the bytes on either side of the sign bit
+  const ByteSet set{0x00, 0x1F, 0x7F, 0x80, 0x9A, 0xFF};
+
+  std::vector<byte> buf(100, 'a');
+  buf[3] = 0x7F;
+  buf[17] = 0x80;
+  buf[31] = 0x00;
+  buf[32] = 0xFF;
+  buf[70] = 0x9A;
+  buf[98] = 0x1F;
+
+  checkAllOffsets(set, buf);
+}
+
+SCOPE_TEST(skipScanManyNibbles) {
+  // letters and digits share high nibbles with non-members
+  ByteSet set;
+  for (const char* c = "abcdefghijklmnopqrstuvwxyz0123456789"; *c; ++c) {
+    set.set(byte(*c));
+  }
+
+  // members on either side of the 16- and 32-byte boundaries, then a run
+  std::vector<byte> buf(150, '.');
+  buf[15] = 'q';
+  buf[16] = 'Q';
+  buf[31] = '@';
+  buf[32] = '0';
+  buf[63] = '9';
+  buf[64] = 0xE1;
+  for (uint32_t i = 100; i < 110; ++i) {
+    buf[i] = 'a' + (i - 100);
+  }
+  buf[149] = 'z';
+
+  checkAllOffsets(set, buf);
+}
+
+SCOPE_TEST(skipScanAllButOne) {
+  ByteSet set;
+  set.set();
+  set.reset('x');
+
+  std::vector<byte> buf(80, 'x');
+  buf[0] = 'y';
+  buf[33] = 0x00;
+  buf[79] = 0xFF;
+
+  checkAllOffsets(set, buf);
+}
+
+SCOPE_TEST(skipScanSearchSameHits) {
+  // skipping must not change hits, including ones at the very end
+  std::string text(160, 'x');
+  text.replace(45, 3, "abc");
+  text.replace(114, 2, "ab");
+  text[159] = 'a';
+
+  STest fixture({"abc", "b+", "a"});
+
+  const byte* beg = reinterpret_cast<const byte*>(text.data());
+  fixture.search(beg, beg + text.size(), 0);
+  SCOPE_ASSERT_EQUAL(6u, fixture.Hits.size());
+  SCOPE_ASSERT_EQUAL(SearchHit(45, 46, 2), fixture.Hits[0]);
+  SCOPE_ASSERT_EQUAL(SearchHit(45, 48, 0), fixture.Hits[1]);
+  SCOPE_ASSERT_EQUAL(SearchHit(46, 47, 1), fixture.Hits[2]);
+  SCOPE_ASSERT_EQUAL(SearchHit(114, 115, 2), fixture.Hits[3]);
+  SCOPE_ASSERT_EQUAL(SearchHit(115, 116, 1), fixture.Hits[4]);
+  SCOPE_ASSERT_EQUAL(SearchHit(159, 160, 2), fixture.Hits[5]);
+}
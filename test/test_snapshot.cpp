@@ -0,0 +1,251 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "handles.h"
+#include "program.h"
+#include "searchhit.h"
+#include "test_helper.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+  typedef std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ContextPtr;
+
+  ContextPtr createContext(LG_HPROGRAM prog, const LG_ContextOptions& opts, const LG_SearchOptions* searchOpts) {
+    return ContextPtr(
+      searchOpts ?
+        lg_create_search_context(prog, &opts, searchOpts) :
+        lg_create_context(prog, &opts),
+      lg_destroy_context
+    );
+  }
+
+  std::vector<char> snapshot(LG_HCONTEXT ctx) {
+    const int size = lg_context_snapshot_size(ctx);
+    SCOPE_ASSERT(size > 0);
+    std::vector<char> buf(size);
+    lg_write_context_snapshot(ctx, buf.data());
+    return buf;
+  }
+
+  // Searches text in blocks, snapshotting after each and carrying on in a
+  // new context restored from it, and checks that the hits are those of
+  // searching it all in one go.
+  void checkResumes(LG_HPROGRAM prog, const LG_ContextOptions& opts, const LG_SearchOptions* searchOpts, const std::string& text, size_t block) {
+    std::vector<SearchHit> exp;
+    {
+      ContextPtr ctx(createContext(prog, opts, searchOpts));
+      lg_search(ctx.get(), text.data(), text.data() + text.size(), 0, &exp, collectHit);
+      lg_closeout_search(ctx.get(), &exp, collectHit);
+    }
+
+    std::vector<SearchHit> hits;
+    ContextPtr ctx(createContext(prog, opts, searchOpts));
+    for (size_t off = 0; off < text.size(); off += block) {
+      const size_t end = std::min(text.size(), off + block);
+      lg_search(ctx.get(), text.data() + off, text.data() + end, off, &hits, collectHit);
+
+      const std::vector<char> buf(snapshot(ctx.get()));
+      ctx = createContext(prog, opts, searchOpts);
+
+      LG_Error* err = nullptr;
+      SCOPE_ASSERT_EQUAL(1, lg_read_context_snapshot(ctx.get(), buf.data(), buf.size(), &err));
+      SCOPE_ASSERT(!err);
+    }
+    lg_closeout_search(ctx.get(), &hits, collectHit);
+
+    SCOPE_ASSERT_EQUAL(exp, hits);
+  }
+}
+
+SCOPE_TEST(snapshotResumesEachEngine) {
+  auto prog = compile({"a+b", "c", "[0-9]{3}", "x[^x]*x", "b(a|c)+b"});
+  SCOPE_ASSERT(prog);
+  auto keywords = compile({"abb", "cab", "bc", "0123"}, {true, true, true, true});
+  SCOPE_ASSERT(keywords);
+
+  LG_ContextOptions vmOpts;
+  std::memset(&vmOpts, 0, sizeof(vmOpts));
+  vmOpts.NoTable = vmOpts.NoBitParallel = 1;
+
+  LG_ContextOptions tableOpts;
+  std::memset(&tableOpts, 0, sizeof(tableOpts));
+  tableOpts.NoBitParallel = 1;
+
+  LG_ContextOptions bitOpts;
+  std::memset(&bitOpts, 0, sizeof(bitOpts));
+  bitOpts.NoPrefilter = 1;
+
+  LG_ContextOptions lazyOpts;
+  std::memset(&lazyOpts, 0, sizeof(lazyOpts));
+  lazyOpts.LazyDfa = 1;
+
+  LG_ContextOptions compactOpts(vmOpts);
+  compactOpts.Compact = 1;
+
+  const LG_SearchOptions capped{0, 0, 2};
+
+  // hits straddling the blocks, and threads alive across them
+  const std::string text("aaab 0123 xabcx bacab abbcab x12 ccabb0123x");
+
+  const std::vector<SearchHit> regexHits{
+    {0, 4, 0}, {5, 8, 2}, {11, 13, 0}, {13, 14, 1}, {10, 15, 3},
+    {18, 19, 1}, {16, 21, 4}, {19, 21, 0}, {22, 24, 0}, {25, 26, 1},
+    {24, 28, 4}, {26, 28, 0}, {33, 34, 1}, {34, 35, 1}, {35, 37, 0},
+    {38, 41, 2}, {29, 43, 3}
+  };
+
+  const std::vector<SearchHit> keywordHits{
+    {5, 9, 3}, {12, 14, 2}, {18, 21, 1}, {22, 25, 0}, {24, 26, 2},
+    {25, 28, 1}, {34, 37, 1}, {35, 38, 0}, {38, 42, 3}
+  };
+
+  for (const LG_ContextOptions& o : {vmOpts, tableOpts, bitOpts, lazyOpts, compactOpts}) {
+    SCOPE_ASSERT_EQUAL(regexHits, search(prog.get(), &o, text, text.size()));
+    SCOPE_ASSERT_EQUAL(keywordHits, search(keywords.get(), &o, text, text.size()));
+
+    for (LG_HPROGRAM p : {prog.get(), keywords.get()}) {
+      for (const LG_SearchOptions* s : {(const LG_SearchOptions*) nullptr, &capped}) {
+        for (size_t block : {1u, 7u, 64u}) {
+          checkResumes(p, o, s, text, block);
+        }
+      }
+    }
+  }
+}
+
+SCOPE_TEST(snapshotSizeGoesWithState) {
+  auto prog = compile({"a+b", "c"});
+  SCOPE_ASSERT(prog);
+
+  LG_ContextOptions opts;
+  std::memset(&opts, 0, sizeof(opts));
+  opts.NoTable = opts.NoBitParallel = 1;
+
+  ContextPtr ctx(createContext(prog.get(), opts, nullptr));
+  const size_t empty = snapshot(ctx.get()).size();
+
+  // a live thread, and a label which has matched
+  std::vector<SearchHit> hits;
+  const std::string text("c aaa");
+  lg_search(ctx.get(), text.data(), text.data() + text.size(), 0, &hits, collectHit);
+  SCOPE_ASSERT(snapshot(ctx.get()).size() > empty);
+
+  // and none once reset
+  lg_reset_context(ctx.get());
+  SCOPE_ASSERT_EQUAL(empty, snapshot(ctx.get()).size());
+}
+
+SCOPE_TEST(snapshotRejectsMismatches) {
+  auto prog = compile({"a+b", "c"});
+  SCOPE_ASSERT(prog);
+  auto other = compile({"a+b", "d"});
+  SCOPE_ASSERT(other);
+
+  LG_ContextOptions vmOpts;
+  std::memset(&vmOpts, 0, sizeof(vmOpts));
+  vmOpts.NoTable = vmOpts.NoBitParallel = 1;
+
+  LG_ContextOptions lazyOpts(vmOpts);
+  lazyOpts.LazyDfa = 1;
+
+  ContextPtr ctx(createContext(prog.get(), vmOpts, nullptr));
+  std::vector<SearchHit> hits;
+  const std::string text("c aaa");
+  lg_search(ctx.get(), text.data(), text.data() + text.size(), 0, &hits, collectHit);
+  const std::vector<char> buf(snapshot(ctx.get()));
+
+  const auto fails = [&](LG_HCONTEXT c, const char* data, int size) {
+    LG_Error* err = nullptr;
+    const int ret = lg_read_context_snapshot(c, data, size, &err);
+    const bool failed = !ret && err;
+    lg_free_error(err);
+    return failed;
+  };
+
+  // another program
+  ContextPtr o(createContext(other.get(), vmOpts, nullptr));
+  SCOPE_ASSERT(fails(o.get(), buf.data(), buf.size()));
+
+  // other options
+  ContextPtr l(createContext(prog.get(), lazyOpts, nullptr));
+  SCOPE_ASSERT(fails(l.get(), buf.data(), buf.size()));
+
+  const LG_SearchOptions capped{0, 0, 2};
+  ContextPtr c(createContext(prog.get(), vmOpts, &capped));
+  SCOPE_ASSERT(fails(c.get(), buf.data(), buf.size()));
+
+  // cut short, or with junk after
+  ContextPtr v(createContext(prog.get(), vmOpts, nullptr));
+  SCOPE_ASSERT(fails(v.get(), buf.data(), buf.size() - 1));
+
+  std::vector<char> longer(buf);
+  longer.push_back(0);
+  SCOPE_ASSERT(fails(v.get(), longer.data(), longer.size()));
+
+  // a thread on an operand rather than an instruction, or ending before
+  // it starts; the Vm's last thread is the last thing in the snapshot
+  const Program& code(*prog->Impl);
+  const size_t thread = buf.size() - 24;
+  uint32_t pc;
+  std::memcpy(&pc, &buf[thread], sizeof(pc));
+  SCOPE_ASSERT(pc < code.size());
+
+  uint32_t operand = 0;
+  for (uint32_t i = 0; i < code.size() && !operand; i += code[i].length()) {
+    if (code[i].length() > 1) {
+      operand = i + 1;
+    }
+  }
+  SCOPE_ASSERT(operand);
+
+  std::vector<char> bad(buf);
+  std::memcpy(&bad[thread], &operand, sizeof(operand));
+  SCOPE_ASSERT(fails(v.get(), bad.data(), bad.size()));
+
+  bad = buf;
+  const uint64_t start = 4, end = 3;
+  std::memcpy(&bad[thread + 8], &start, sizeof(start));
+  std::memcpy(&bad[thread + 16], &end, sizeof(end));
+  SCOPE_ASSERT(fails(v.get(), bad.data(), bad.size()));
+
+  // a failed restore leaves the context reset, so it finds just "c"
+  hits.clear();
+  lg_search(v.get(), text.data(), text.data() + text.size(), 0, &hits, collectHit);
+  lg_closeout_search(v.get(), &hits, collectHit);
+  SCOPE_ASSERT_EQUAL(1u, hits.size());
+
+  // the program read back is the same program
+  std::vector<char> progBuf(lg_program_size(prog.get()));
+  lg_write_program(prog.get(), progBuf.data());
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> copy(
+    lg_read_program(progBuf.data(), progBuf.size()),
+    lg_destroy_program
+  );
+  ContextPtr r(createContext(copy.get(), vmOpts, nullptr));
+  LG_Error* err = nullptr;
+  SCOPE_ASSERT_EQUAL(1, lg_read_context_snapshot(r.get(), buf.data(), buf.size(), &err));
+  SCOPE_ASSERT(!err);
+}
@@ -47,3 +47,26 @@ SCOPE_TEST(sparseClear) {
     SCOPE_ASSERT(!s.find(i));
   }
 }
+
+SCOPE_TEST(sparseCopy) {
+  SparseSet s(5);
+  s.insert(4);
+  s.insert(1);
+
+  SparseSet t(s);
+  SCOPE_ASSERT_EQUAL(2u, t.size());
+  SCOPE_ASSERT(t.find(4));
+  SCOPE_ASSERT(t.find(1));
+  SCOPE_ASSERT(!t.find(0));
+
+  // the copies are independent
+  t.insert(2);
+  SCOPE_ASSERT(!s.find(2));
+
+  SparseSet u(2);
+  u = t;
+  SCOPE_ASSERT_EQUAL(3u, u.size());
+  SCOPE_ASSERT(u.find(2));
+  u.clear();
+  SCOPE_ASSERT(t.find(2));
+}
@@ -0,0 +1,146 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "lightgrep/api.h"
+
+#include "codegen.h"
+#include "handles.h"
+#include "program.h"
+#include "searchhit.h"
+#include "tablevm.h"
+#include "test_helper.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+  std::vector<SearchHit> startsWith(VmInterface& vm, const std::string& text) {
+    std::vector<SearchHit> hits;
+    const byte* const beg = reinterpret_cast<const byte*>(text.data());
+    vm.startsWith(beg, beg + text.size(), 0, collectHit, &hits);
+    return hits;
+  }
+}
+
+SCOPE_TEST(dfaTableKeywords) {
+  const auto prog(compile({"mary", "lamb", "mar"}));
+  const DfaTable& tbl(prog->Impl->Table);
+  SCOPE_ASSERT(!tbl.empty());
+
+  // m, a, r, y, l, b, and everything else
+  SCOPE_ASSERT_EQUAL(7u, tbl.NumClasses);
+  SCOPE_ASSERT_EQUAL(tbl.Classes['z'], tbl.Classes['\0']);
+  SCOPE_ASSERT(tbl.Classes['m'] != tbl.Classes['a']);
+  SCOPE_ASSERT(tbl.next(0, tbl.Classes['z']) == DfaTable::DEAD);
+  SCOPE_ASSERT(tbl.next(0, tbl.Classes['m']) != DfaTable::DEAD);
+}
+
+SCOPE_TEST(dfaTableLists) {
+  // "mar" and "mary" end in different states after the 'r'
+  const auto prog(compile({"mary", "mar"}));
+  const DfaTable& tbl(prog->Impl->Table);
+  SCOPE_ASSERT(!tbl.empty());
+
+  uint32_t s = 0;
+  for (const char* c = "ma"; *c; ++c) {
+    s = tbl.next(s, tbl.Classes[byte(*c)]);
+    SCOPE_ASSERT(s != DfaTable::DEAD);
+    SCOPE_ASSERT(!(s & DfaTable::LIST));
+    s &= ~DfaTable::NOCHECK;
+  }
+
+  const uint32_t e = tbl.next(s, tbl.Classes['r']);
+  SCOPE_ASSERT(e != DfaTable::DEAD);
+  SCOPE_ASSERT(e & DfaTable::LIST);
+
+  const uint32_t* l = &tbl.Lists[e & ~DfaTable::LIST];
+  SCOPE_ASSERT_EQUAL(2u, l[0]);
+  SCOPE_ASSERT(tbl.States[l[1] & ~DfaTable::NOCHECK].Match != tbl.States[l[2] & ~DfaTable::NOCHECK].Match);
+}
+
+SCOPE_TEST(dfaTableNoCheck) {
+  // the jump table after 'a' or "qq" goes straight past the CHECK_HALTs
+  // of the states it leads to, as the code does
+  const auto prog(compile({"(a|qq)(bx|cy|dz|ew)"}));
+  const DfaTable& tbl(prog->Impl->Table);
+  SCOPE_ASSERT(!tbl.empty());
+
+  const uint32_t s = tbl.next(0, tbl.Classes['a']);
+  SCOPE_ASSERT(s != DfaTable::DEAD);
+  SCOPE_ASSERT(!(s & (DfaTable::LIST | DfaTable::NOCHECK)));
+  SCOPE_ASSERT(!tbl.States[s].Fork);
+
+  for (const char* c = "bcde"; *c; ++c) {
+    const uint32_t e = tbl.next(s, tbl.Classes[byte(*c)]);
+    SCOPE_ASSERT(e != DfaTable::DEAD);
+    SCOPE_ASSERT(!(e & DfaTable::LIST));
+    SCOPE_ASSERT(e & DfaTable::NOCHECK);
+    SCOPE_ASSERT(tbl.States[e & ~DfaTable::NOCHECK].Check != NONE);
+  }
+}
+
+SCOPE_TEST(dfaTableOnlyWhereUsed) {
+  // more states than BitVm takes
+  std::vector<std::string> pats;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    pats.push_back(std::string(3, c) + 'x');
+  }
+
+  // no forks once determinized, so there's a table for TableVm
+  SCOPE_ASSERT(!compile(pats)->Impl->Table.empty());
+
+  // but not without determinizing
+  SCOPE_ASSERT(compile(pats, {}, {}, false)->Impl->Table.empty());
+
+  // nor with a fork, as after the 'r' of "mar" and "mary"
+  pats.push_back("mary");
+  pats.push_back("mar");
+  SCOPE_ASSERT(compile(pats)->Impl->Table.empty());
+}
+
+SCOPE_TEST(tableVmListHits) {
+  const auto prog(compile({"mary", "mar"}));
+  TableVm tvm(prog->Impl);
+
+  const std::string text("mary mar marx");
+  const std::vector<SearchHit> expected{
+    {0, 3, 1}, {0, 4, 0}, {5, 8, 1}, {9, 12, 1}
+  };
+
+  for (size_t block : {1u, 3u, 13u}) {
+    SCOPE_ASSERT_EQUAL(expected, search(tvm, text, block));
+  }
+
+  tvm.reset();
+  const std::vector<SearchHit> starting{{0, 3, 1}, {0, 4, 0}};
+  SCOPE_ASSERT_EQUAL(starting, startsWith(tvm, text));
+}
+
+SCOPE_TEST(tableVmNoCheckHits) {
+  const auto prog(compile({"(a|qq)(bx|cy|dz|ew)"}));
+  TableVm tvm(prog->Impl);
+
+  const std::string text("abx qqcy qaez qqew");
+  const std::vector<SearchHit> expected{{0, 3, 0}, {4, 8, 0}, {14, 18, 0}};
+
+  for (size_t block : {1u, 3u, 18u}) {
+    SCOPE_ASSERT_EQUAL(expected, search(tvm, text, block));
+  }
+}
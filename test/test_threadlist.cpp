@@ -0,0 +1,81 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <scope/test.h>
+
+#include "threadlist.h"
+
+SCOPE_TEST(threadListPushBackReadBack) {
+  Instruction prog[4];
+
+  ThreadList l;
+  l.setBase(prog);
+  SCOPE_ASSERT(l.empty());
+
+  l.push_back(Thread(prog + 2, 7, 13, Thread::NONE));
+  l.push_back(Thread(0, 3, 1, 5));
+
+  SCOPE_ASSERT_EQUAL(2u, l.size());
+  SCOPE_ASSERT_EQUAL(2u, l.PC[0]);
+  SCOPE_ASSERT_EQUAL(ThreadList::NOPC, l.PC[1]);
+
+  SCOPE_ASSERT_EQUAL(Thread(prog + 2, 7, 13, Thread::NONE), l.front());
+  SCOPE_ASSERT_EQUAL(Thread(0, 3, 1, 5), l.back());
+}
+
+SCOPE_TEST(threadListPCBeforeBase) {
+  Instruction prog[4];
+
+  ThreadList l;
+  l.setBase(prog + 1);
+  l.push_back(Thread(prog, 0, 0, 0));
+  SCOPE_ASSERT_EQUAL(prog, l[0].PC);
+}
+
+SCOPE_TEST(threadListGrowCopySwap) {
+  Instruction prog[4];
+
+  ThreadList a, b;
+  a.setBase(prog);
+  b.setBase(prog);
+
+  for (uint32_t i = 0; i < 100; ++i) {
+    a.push_back(Thread(prog + (i % 4), i, i, i + 1));
+  }
+  SCOPE_ASSERT_EQUAL(100u, a.size());
+
+  for (size_t i = 1; i < a.size(); i += 2) {
+    b.push_back(a, i);
+  }
+  SCOPE_ASSERT_EQUAL(50u, b.size());
+  SCOPE_ASSERT_EQUAL(Thread(prog + 3, 99, 99, 100), b.back());
+
+  a.swap(b);
+  SCOPE_ASSERT_EQUAL(50u, a.size());
+  SCOPE_ASSERT_EQUAL(100u, b.size());
+  SCOPE_ASSERT_EQUAL(Thread(prog + 1, 1, 1, 2), a.front());
+
+  size_t n = 0;
+  for (ThreadList::const_iterator it(b.begin()); it != b.end(); ++it, ++n) {
+    SCOPE_ASSERT_EQUAL(Thread(prog + (n % 4), n, n, n + 1), *it);
+  }
+  SCOPE_ASSERT_EQUAL(100u, n);
+
+  b.clear();
+  SCOPE_ASSERT(b.empty());
+}
@@ -349,12 +349,118 @@ SCOPE_TEST(runFrame) {
   byte b = 'a';
   Vm s(p);
   s.executeFrame(&b, 0, 0, 0);
-  SCOPE_ASSERT_EQUAL(1u, s.numActive());
+  // the new thread starts out already split at the fork
+  SCOPE_ASSERT_EQUAL(2u, s.numActive());
   SCOPE_ASSERT_EQUAL(2u, s.numNext());
   SCOPE_ASSERT_EQUAL(Thread(&prog[7], 1, 0, 0), s.next()[0]);
   SCOPE_ASSERT_EQUAL(Thread(&prog[8], Thread::NOLABEL, 0, Thread::NONE), s.next()[1]);
 }
 
+SCOPE_TEST(runFrameSpawnsOnlySurvivors) {
+  ProgramPtr p(new Program(11, Instruction::makeRaw32(0)));
+  Program&   prog(*p);
+  prog[0]  = Instruction::makeFork(&prog[0], 5);
+  prog[2]  = Instruction::makeByte('a');
+  prog[3]  = Instruction::makeJump(&prog[3], 6);
+  prog[5]  = Instruction::makeByte('b');
+  prog[6]  = Instruction::makeLabel(0);
+  prog[7]  = Instruction::makeMatch();
+  prog[8]  = Instruction::makeFinish();
+  prog[9]  = Instruction::makeHalt();
+  prog[10] = Instruction::makeFinish();
+  prog.First.set('a');
+  prog.First.set('b');
+
+  byte b = 'a';
+  Vm s(p);
+  SCOPE_ASSERT_EQUAL(2u, s.first().size());
+
+  s.executeFrame(&b, 0, 0, 0);
+  // the thread for 'b' is never started, and the one for 'a' starts past
+  // the byte and the jump, then matches
+  SCOPE_ASSERT_EQUAL(1u, s.numActive());
+  SCOPE_ASSERT_EQUAL(Thread(0, 0, 0, 0), s.active()[0]);
+  SCOPE_ASSERT_EQUAL(0u, s.numNext());
+}
+
+namespace {
+  // Runs a frame leaving enough threads at prog[4] that the next frame
+  // looks for duplicates; they die on the next 'a'.
+  void busyFrame(Vm& s, Program& prog) {
+    const byte b = 'a';
+    for (uint32_t i = 0; i <= Vm::MIN_DEDUP_THREADS; ++i) {
+      s.add(Thread(&prog[0], Thread::NOLABEL, 0, Thread::NONE));
+    }
+    s.executeFrame(&b, 0, 0, 0);
+    SCOPE_ASSERT_EQUAL(Vm::MIN_DEDUP_THREADS + 1, s.numNext());
+    s.cleanup();
+  }
+}
+
+SCOPE_TEST(runFrameDropsDuplicateSameStart) {
+  ProgramPtr p(new Program(7, Instruction::makeRaw32(0)));
+  Program&   prog(*p);
+  // two ways of reaching the same byte
+  prog[0] = Instruction::makeByte('a');
+  prog[1] = Instruction::makeJump(&prog[1], 4);
+  prog[3] = Instruction::makeByte('a');
+  prog[4] = Instruction::makeByte('b');
+  prog[5] = Instruction::makeHalt();
+  prog[6] = Instruction::makeFinish();
+
+  byte b = 'a';
+  Vm s(p);
+  busyFrame(s, prog);
+  s.add(Thread(&prog[0], Thread::NOLABEL, 0, Thread::NONE));
+  s.add(Thread(&prog[3], Thread::NOLABEL, 0, Thread::NONE));
+  s.executeFrame(&b, 1, 0, 0);
+
+  SCOPE_ASSERT_EQUAL(1u, s.numNext());
+  SCOPE_ASSERT_EQUAL(Thread(&prog[4], Thread::NOLABEL, 0, Thread::NONE), s.next()[0]);
+}
+
+SCOPE_TEST(runFrameDropsDuplicateLaterStart) {
+  ProgramPtr p(new Program(7, Instruction::makeRaw32(0)));
+  Program&   prog(*p);
+  prog[0] = Instruction::makeByte('a');
+  prog[1] = Instruction::makeJump(&prog[1], 4);
+  prog[3] = Instruction::makeByte('a');
+  prog[4] = Instruction::makeByte('b');
+  prog[5] = Instruction::makeHalt();
+  prog[6] = Instruction::makeFinish();
+
+  byte b = 'a';
+  Vm s(p);
+  busyFrame(s, prog);
+  s.add(Thread(&prog[0], Thread::NOLABEL, 0, Thread::NONE));
+  s.add(Thread(&prog[3], Thread::NOLABEL, 1, Thread::NONE));
+  s.executeFrame(&b, 1, 0, 0);
+
+  // nothing can end between the starts, so the leftmost thread will do
+  SCOPE_ASSERT_EQUAL(1u, s.numNext());
+  SCOPE_ASSERT_EQUAL(Thread(&prog[4], Thread::NOLABEL, 0, Thread::NONE), s.next()[0]);
+}
+
+SCOPE_TEST(runFrameKeepsDuplicatesInQuietFrame) {
+  ProgramPtr p(new Program(7, Instruction::makeRaw32(0)));
+  Program&   prog(*p);
+  prog[0] = Instruction::makeByte('a');
+  prog[1] = Instruction::makeJump(&prog[1], 4);
+  prog[3] = Instruction::makeByte('a');
+  prog[4] = Instruction::makeByte('b');
+  prog[5] = Instruction::makeHalt();
+  prog[6] = Instruction::makeFinish();
+
+  byte b = 'a';
+  Vm s(p);
+  s.add(Thread(&prog[0], Thread::NOLABEL, 0, Thread::NONE));
+  s.add(Thread(&prog[3], Thread::NOLABEL, 0, Thread::NONE));
+  s.executeFrame(&b, 0, 0, 0);
+
+  // too few threads to be worth looking for duplicates
+  SCOPE_ASSERT_EQUAL(2u, s.numNext());
+}
+
 SCOPE_TEST(testInit) {
   ProgramPtr p(new Program(14, Instruction::makeRaw32(0)));
   Program& prog(*p);